@@ -28,6 +28,7 @@
 
 #include <oauth2/http.h>
 #include <oauth2/log.h>
+#include <oauth2/mem.h>
 #include <oauth2/util.h>
 #include <oauth2/version.h>
 
@@ -142,6 +143,21 @@ int oauth2_apache_post_config(apr_pool_t *pool, apr_pool_t *p1, apr_pool_t *p2,
 		    foo##_child_cleanup);                                      \
 	}
 
+/*
+ * child init
+ */
+
+void oauth2_apache_child_init(apr_pool_t *p, server_rec *s, module *m);
+
+#define OAUTH2_APACHE_CHILD_INIT(foo) foo##_child_init
+
+#define OAUTH2_APACHE_CHILD_INIT_IMPL(foo)                                     \
+	static void OAUTH2_APACHE_CHILD_INIT(foo)(apr_pool_t * p,              \
+						  server_rec * s)              \
+	{                                                                      \
+		oauth2_apache_child_init(p, s, &foo##_module);                 \
+	}
+
 /*
  * directory config
  */
@@ -277,6 +293,11 @@ typedef struct oauth2_apache_request_ctx_t {
 	oauth2_log_t *log;
 	oauth2_http_request_t *request;
 	request_rec *r;
+	// request-scoped allocations, carved out of the request pool; the
+	// pool may be destroyed on another thread under the event MPM so it
+	// is entered only around work for the request, see
+	// oauth2_apache_token_verify
+	oauth2_mem_arena_t *arena;
 } oauth2_apache_request_ctx_t;
 
 oauth2_apache_request_ctx_t *
@@ -288,6 +309,10 @@ oauth2_apache_request_context(request_rec *r,
  * misc
  */
 
+// oauth2_token_verify with the request's arena entered
+bool oauth2_apache_token_verify(oauth2_apache_request_ctx_t *ctx,
+				oauth2_cfg_token_verify_t *verify,
+				const char *token, json_t **json_payload);
 bool oauth2_apache_http_request_set(oauth2_log_t *log,
 				    oauth2_http_request_t *request,
 				    request_rec *r);
@@ -117,6 +117,7 @@ oauth2_flag_t
 oauth2_cfg_endpoint_get_ssl_verify(const oauth2_cfg_endpoint_t *cfg);
 oauth2_uint_t
 oauth2_cfg_endpoint_get_http_timeout(const oauth2_cfg_endpoint_t *cfg);
+oauth2_flag_t oauth2_cfg_endpoint_get_http2(const oauth2_cfg_endpoint_t *cfg);
 
 /*
  * token verify
@@ -143,6 +143,9 @@ char *oauth2_http_request_url_get(oauth2_log_t *log,
  */
 
 OAUTH2_MEMBER_LIST_DECLARE_SET_UNSET_ADD_GET(http, request, header)
+bool oauth2_http_request_header_add_ref(oauth2_log_t *log,
+					oauth2_http_request_t *request,
+					const char *name, const char *value);
 
 void oauth2_http_request_headers_loop(oauth2_log_t *log,
 				      oauth2_http_request_t *request,
@@ -202,6 +205,8 @@ OAUTH2_TYPE_DECLARE_MEMBER_SET(http, call_ctx, ssl_cert, char *)
 OAUTH2_TYPE_DECLARE_MEMBER_SET(http, call_ctx, ssl_key, char *)
 OAUTH2_TYPE_DECLARE_MEMBER_SET(http, call_ctx, timeout, int)
 OAUTH2_TYPE_DECLARE_MEMBER_SET(http, call_ctx, ssl_verify, bool)
+OAUTH2_TYPE_DECLARE_MEMBER_SET(http, call_ctx, http2, bool)
+OAUTH2_TYPE_DECLARE_MEMBER_SET(http, call_ctx, hedge, bool)
 OAUTH2_MEMBER_LIST_DECLARE_SET_UNSET_ADD_GET(http, call_ctx, cookie)
 OAUTH2_MEMBER_LIST_DECLARE_SET_UNSET_ADD_GET(http, call_ctx, hdr)
 bool oauth2_http_call_ctx_basic_auth_set(oauth2_log_t *log,
@@ -220,6 +225,10 @@ bool oauth2_http_get(oauth2_log_t *log, const char *url,
 		     const oauth2_nv_list_t *params,
 		     oauth2_http_call_ctx_t *ctx, char **response,
 		     oauth2_http_status_code_t *status_code);
+bool oauth2_http_get_json(oauth2_log_t *log, const char *url,
+			  const oauth2_nv_list_t *params,
+			  oauth2_http_call_ctx_t *ctx, json_t **json,
+			  oauth2_http_status_code_t *status_code);
 bool oauth2_http_post_form(oauth2_log_t *log, const char *url,
 			   const oauth2_nv_list_t *params,
 			   oauth2_http_call_ctx_t *ctx, char **response,
@@ -229,6 +238,42 @@ bool oauth2_http_post_json(oauth2_log_t *log, const char *url,
 			   char **response,
 			   oauth2_http_status_code_t *status_code);
 
+/*
+ * asynchronous http call functions, driven by an external event loop
+ */
+
+#define OAUTH2_HTTP_ASYNC_POLL_IN 1
+#define OAUTH2_HTTP_ASYNC_POLL_OUT 2
+#define OAUTH2_HTTP_ASYNC_POLL_REMOVE 4
+
+// fd to pass to oauth2_http_async_action when the timer has expired
+#define OAUTH2_HTTP_ASYNC_TIMEOUT -1
+
+typedef struct oauth2_http_async_t oauth2_http_async_t;
+
+// (de)register interest in OAUTH2_HTTP_ASYNC_POLL_* events on fd
+typedef bool(oauth2_http_async_socket_cb_t)(oauth2_log_t *log, int fd,
+					    int events, void *arg);
+// (re)arm the single engine timer; a negative timeout disarms it
+typedef bool(oauth2_http_async_timer_cb_t)(oauth2_log_t *log, long timeout_ms,
+					   void *arg);
+// called exactly once per call; the callee owns the response
+typedef void(oauth2_http_async_done_cb_t)(
+    oauth2_log_t *log, bool rc, char *response,
+    oauth2_http_status_code_t status_code, void *arg);
+
+oauth2_http_async_t *
+oauth2_http_async_init(oauth2_log_t *log,
+		       oauth2_http_async_socket_cb_t *socket_cb,
+		       oauth2_http_async_timer_cb_t *timer_cb, void *arg);
+void oauth2_http_async_free(oauth2_log_t *log, oauth2_http_async_t *async);
+bool oauth2_http_call_async(oauth2_log_t *log, oauth2_http_async_t *async,
+			    const char *url, const char *data,
+			    oauth2_http_call_ctx_t *ctx,
+			    oauth2_http_async_done_cb_t *callback, void *arg);
+bool oauth2_http_async_action(oauth2_log_t *log, oauth2_http_async_t *async,
+			      int fd, int events);
+
 /*
  * http cookie functions
  */
@@ -54,6 +54,17 @@ bool oauth2_jose_hash_bytes(oauth2_log_t *log, const char *digest,
 bool oauth2_jose_hash2s(oauth2_log_t *log, const char *digest, const char *src,
 			char **dst);
 
+/*
+ * start a thread that refreshes the documents of uri's configured with
+ * <prefix>.refresh=true ahead of their expiry; call it once per worker
+ * process after configuration, e.g. from a child_init hook; uri's that are
+ * registered later, like a jwks_uri discovered from metadata, are picked up
+ * too; the thread logs to the sinks of the log, which must remain valid
+ * until oauth2_shutdown stops the thread
+ */
+bool oauth2_jose_uri_refresh_start(oauth2_log_t *log);
+void oauth2_jose_uri_refresh_stop(oauth2_log_t *log);
+
 bool oauth2_jose_jwk_create_symmetric(oauth2_log_t *log,
 				      const char *client_secret,
 				      const char *hash_algo,
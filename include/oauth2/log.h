@@ -22,6 +22,9 @@
  *
  **************************************************************************/
 
+#include <stdbool.h>
+#include <stddef.h>
+
 // don't change this without checking consequences in log.c...
 typedef enum oauth2_log_level_t {
 	OAUTH2_LOG_ERROR,
@@ -58,6 +61,28 @@ typedef enum oauth2_log_level_t {
 		   ##__VA_ARGS__)
 #endif
 
+// verbose levels are checked before the arguments are evaluated, so that
+// disabled statements cost neither argument evaluation nor formatting
+#define _oauth2_log_gated(log, level, fmt, ...)                                \
+	do {                                                                   \
+		if (oauth2_log_level_enabled(log, level))                      \
+			_oauth2_log(log, level, fmt, ##__VA_ARGS__);           \
+	} while (0)
+
+// build with -DOAUTH2_LOG_TRACE_DISABLE (configure --disable-trace-log) to
+// compile the trace levels out altogether; the dead call keeps the
+// arguments referenced
+#ifdef OAUTH2_LOG_TRACE_DISABLE
+#define _oauth2_log_trace(log, level, fmt, ...)                                \
+	do {                                                                   \
+		if (0)                                                         \
+			_oauth2_log(log, level, fmt, ##__VA_ARGS__);           \
+	} while (0)
+#else
+#define _oauth2_log_trace(log, level, fmt, ...)                                \
+	_oauth2_log_gated(log, level, fmt, ##__VA_ARGS__)
+#endif
+
 #define oauth2_error(log, fmt, ...)                                            \
 	_oauth2_log(log, OAUTH2_LOG_ERROR, fmt, ##__VA_ARGS__)
 #define oauth2_warn(log, fmt, ...)                                             \
@@ -67,11 +92,11 @@ typedef enum oauth2_log_level_t {
 #define oauth2_info(log, fmt, ...)                                             \
 	_oauth2_log(log, OAUTH2_LOG_INFO, fmt, ##__VA_ARGS__)
 #define oauth2_debug(log, fmt, ...)                                            \
-	_oauth2_log(log, OAUTH2_LOG_DEBUG, fmt, ##__VA_ARGS__)
+	_oauth2_log_gated(log, OAUTH2_LOG_DEBUG, fmt, ##__VA_ARGS__)
 #define oauth2_trace1(log, fmt, ...)                                           \
-	_oauth2_log(log, OAUTH2_LOG_TRACE1, fmt, ##__VA_ARGS__)
+	_oauth2_log_trace(log, OAUTH2_LOG_TRACE1, fmt, ##__VA_ARGS__)
 #define oauth2_trace2(log, fmt, ...)                                           \
-	_oauth2_log(log, OAUTH2_LOG_TRACE2, fmt, ##__VA_ARGS__)
+	_oauth2_log_trace(log, OAUTH2_LOG_TRACE2, fmt, ##__VA_ARGS__)
 
 /*
  * log context definitions
@@ -101,6 +126,7 @@ extern oauth2_log_sink_t oauth2_log_sink_stdout;
 void oauth2_log(oauth2_log_t *log, const char *filename, unsigned long line,
 		const char *function, oauth2_log_level_t level, const char *fmt,
 		...);
+bool oauth2_log_level_enabled(oauth2_log_t *log, oauth2_log_level_t level);
 
 oauth2_log_sink_t *oauth2_log_sink_create(oauth2_log_level_t level,
 					  oauth2_log_function_t callback,
@@ -111,11 +137,33 @@ void oauth2_log_sink_add(oauth2_log_t *log, oauth2_log_sink_t *add);
 void oauth2_log_sink_level_set(oauth2_log_sink_t *sink,
 			       oauth2_log_level_t level);
 
+/*
+ * asynchronous sink: records are queued in a lock-free ring buffer and
+ * written to the target sink by a dedicated thread; the target is owned by
+ * the async sink and must be safe to call from that thread, so it must not
+ * be bound to a request
+ */
+
+typedef enum oauth2_log_async_overflow_t {
+	// drop the record and count it
+	OAUTH2_LOG_ASYNC_OVERFLOW_DROP,
+	// wait for the writer to make room
+	OAUTH2_LOG_ASYNC_OVERFLOW_BLOCK
+} oauth2_log_async_overflow_t;
+
+oauth2_log_sink_t *
+oauth2_log_sink_async_create(oauth2_log_sink_t *target, size_t capacity,
+			     oauth2_log_async_overflow_t overflow);
+unsigned long oauth2_log_sink_async_dropped_get(oauth2_log_sink_t *sink);
+
 /*
  * internals
  */
 oauth2_log_t *oauth2_log_init(oauth2_log_level_t level,
 			      oauth2_log_sink_t *sink);
+// a log of its own for another thread, writing to the sinks of the given log
+// which must outlive it
+oauth2_log_t *oauth2_log_clone(oauth2_log_t *log);
 void oauth2_log_free(oauth2_log_t *);
 
 #endif /* _OAUTH2_LOG_H_ */
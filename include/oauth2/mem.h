@@ -22,6 +22,7 @@
  *
  **************************************************************************/
 
+#include <stdbool.h>
 #include <stddef.h>
 
 typedef void *(*oauth2_mem_alloc_fn_t)(size_t);
@@ -48,7 +49,39 @@ void oauth2_mem_set_alloc_ex_funcs(oauth2_mem_alloc3_fn_t alloc3,
 				   oauth2_mem_realloc3_fn_t realloc3,
 				   oauth2_mem_dealloc3_fn_t dealloc3);
 
+// returns zeroed memory
 void *oauth2_mem_alloc(size_t);
+// for buffers that the caller fully overwrites
+void *oauth2_mem_alloc_uninit(size_t);
 void oauth2_mem_free(void *);
 
+/*
+ * request-scoped arena: while an arena is entered on a thread,
+ * oauth2_mem_alloc draws from it and everything is released at once by
+ * oauth2_mem_arena_free, which may run on another thread; oauth2_mem_free of
+ * memory that the arena handed out is a no-op but only recognized as such
+ * while the arena is entered on the calling thread, so enter it around any
+ * code that frees request data; leaving restores the arena that was entered
+ * before; data that must outlive the request has to be allocated between
+ * oauth2_mem_arena_suspend and oauth2_mem_arena_resume
+ */
+
+typedef struct oauth2_mem_arena_t oauth2_mem_arena_t;
+
+typedef void *(*oauth2_mem_arena_chunk_alloc_fn_t)(void *ctx, size_t size);
+typedef void (*oauth2_mem_arena_chunk_free_fn_t)(void *ctx, void *ptr);
+
+oauth2_mem_arena_t *oauth2_mem_arena_create(size_t chunk_size);
+oauth2_mem_arena_t *
+oauth2_mem_arena_create_ex(size_t chunk_size,
+			   oauth2_mem_arena_chunk_alloc_fn_t alloc,
+			   oauth2_mem_arena_chunk_free_fn_t dealloc, void *ctx);
+void oauth2_mem_arena_free(oauth2_mem_arena_t *arena);
+size_t oauth2_mem_arena_used(oauth2_mem_arena_t *arena);
+
+void oauth2_mem_arena_enter(oauth2_mem_arena_t *arena);
+void oauth2_mem_arena_leave(oauth2_mem_arena_t *arena);
+bool oauth2_mem_arena_suspend();
+void oauth2_mem_arena_resume(bool suspended);
+
 #endif /* _OAUTH2_MEM_H_ */
@@ -32,6 +32,7 @@
 
 #include <oauth2/http.h>
 #include <oauth2/log.h>
+#include <oauth2/mem.h>
 #include <oauth2/util.h>
 
 // module
@@ -125,12 +126,21 @@ typedef struct oauth2_nginx_request_context_t {
 	oauth2_log_t *log;
 	ngx_http_request_t *r;
 	oauth2_http_request_t *request;
+	// request-scoped allocations, released by the context free; requests
+	// are interleaved on the event loop so it is entered only around work
+	// for the request, see oauth2_nginx_token_verify
+	oauth2_mem_arena_t *arena;
 } oauth2_nginx_request_context_t;
 
 oauth2_nginx_request_context_t *
 oauth2_nginx_request_context_init(ngx_http_request_t *r);
 void oauth2_nginx_request_context_free(void *rec);
 
+// oauth2_token_verify with the request's arena entered
+bool oauth2_nginx_token_verify(oauth2_nginx_request_context_t *ctx,
+			       oauth2_cfg_token_verify_t *verify,
+			       const char *token, json_t **json_payload);
+
 ngx_int_t oauth2_nginx_http_response_set(oauth2_log_t *log,
 					 oauth2_http_response_t *response,
 					 ngx_http_request_t *r);
@@ -117,6 +117,8 @@ typedef uint64_t oauth2_time_t;
 OAUTH2_TYPE_DECLARE(nv, list)
 OAUTH2_TYPE_DECLARE_MEMBER_SET_GET(nv, list, case_sensitive, bool)
 OAUTH2_LIST_DECLARE_SET_UNSET_ADD_GET(nv, list)
+bool oauth2_nv_list_add_ref(oauth2_log_t *log, oauth2_nv_list_t *list,
+			    const char *name, const char *value);
 
 typedef bool(oauth2_nv_list_loop_cb_t)(oauth2_log_t *log, void *rec,
 				       const char *key, const char *value);
@@ -134,6 +136,28 @@ char *oauth2_stradd(char *src, const char *add1, const char *add2,
 		    const char *add3);
 char *oauth2_getword(const char **line, char stop);
 
+/*
+ * string builder with amortized growth; a caller-owned struct that is
+ * initialized with oauth2_strbuf_init and either handed over with
+ * oauth2_strbuf_take or released with oauth2_strbuf_free
+ */
+
+typedef struct oauth2_strbuf_t {
+	char *buf;
+	size_t len;
+	size_t size;
+	// set when an allocation failed; all further appends are ignored
+	bool failed;
+} oauth2_strbuf_t;
+
+void oauth2_strbuf_init(oauth2_strbuf_t *sb, size_t hint);
+bool oauth2_strbuf_appendn(oauth2_strbuf_t *sb, const char *str, size_t len);
+bool oauth2_strbuf_append(oauth2_strbuf_t *sb, const char *str);
+bool oauth2_strbuf_appendf(oauth2_strbuf_t *sb, const char *fmt, ...);
+bool oauth2_strbuf_append_escaped(oauth2_strbuf_t *sb, const char *str);
+char *oauth2_strbuf_take(oauth2_strbuf_t *sb);
+void oauth2_strbuf_free(oauth2_strbuf_t *sb);
+
 size_t oauth2_base64url_encode(oauth2_log_t *log, const uint8_t *src,
 			       const size_t src_len, char **dst);
 bool oauth2_base64url_decode(oauth2_log_t *log, const char *src, uint8_t **dst,
@@ -143,10 +167,39 @@ size_t oauth2_base64_encode(oauth2_log_t *log, const uint8_t *src,
 bool oauth2_base64_decode(oauth2_log_t *log, const char *src, uint8_t **dst,
 			  size_t *dst_len);
 
+/*
+ * encode into or decode from caller provided buffers; the encoded length
+ * excludes the terminating \0, the decoded length is an upper bound that
+ * is exact for unpadded input; on decode *dst_len passes in the size of dst
+ * and returns the number of bytes written
+ */
+size_t oauth2_base64_encode_len(size_t src_len, bool url);
+size_t oauth2_base64_decode_len(size_t src_len);
+size_t oauth2_base64url_encode_buf(oauth2_log_t *log, const uint8_t *src,
+				   size_t src_len, char *dst, size_t dst_size);
+size_t oauth2_base64_encode_buf(oauth2_log_t *log, const uint8_t *src,
+				size_t src_len, char *dst, size_t dst_size);
+bool oauth2_base64url_decode_buf(oauth2_log_t *log, const char *src,
+				 size_t src_len, uint8_t *dst, size_t *dst_len);
+bool oauth2_base64_decode_buf(oauth2_log_t *log, const char *src,
+			      size_t src_len, uint8_t *dst, size_t *dst_len);
+
 char *oauth2_url_encode(oauth2_log_t *log, const char *str);
 char *oauth2_url_decode(oauth2_log_t *log, const char *str);
 
+/*
+ * percent-encode into or decode from caller provided buffers; decoding
+ * needs at most src_len + 1 bytes and may be done in place (dst == src)
+ */
+size_t oauth2_url_encode_len(const char *src, size_t src_len);
+size_t oauth2_url_encode_buf(oauth2_log_t *log, const char *src,
+			     size_t src_len, char *dst, size_t dst_size);
+bool oauth2_url_decode_buf(oauth2_log_t *log, const char *src,
+			   size_t src_len, char *dst, size_t *dst_len);
+
 char *oauth2_html_escape(oauth2_log_t *log, const char *src);
+const char *oauth2_html_escape_nocopy(oauth2_log_t *log, const char *src,
+				      char **alloc);
 bool oauth2_parse_form_encoded_params(oauth2_log_t *log, const char *data,
 				      oauth2_nv_list_t **params);
 
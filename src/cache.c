@@ -277,6 +277,8 @@ oauth2_cache_t *_oauth2_cache_obtain(oauth2_log_t *log, const char *name)
 {
 	oauth2_cache_t *rv = NULL;
 	oauth2_cache_list_t *ptr = NULL, *result = NULL;
+	// caches are shared across requests
+	bool suspended = oauth2_mem_arena_suspend();
 
 	oauth2_debug(log, "enter: %s", name);
 
@@ -309,6 +311,8 @@ oauth2_cache_t *_oauth2_cache_obtain(oauth2_log_t *log, const char *name)
 
 end:
 
+	oauth2_mem_arena_resume(suspended);
+
 	oauth2_debug(log, "leave: %p", rv);
 
 	return rv;
@@ -626,8 +630,9 @@ static int oauth2_cache_encrypt(oauth2_log_t *log, oauth2_cache_t *cache,
 	oauth2_debug(log, "enter: %s", plaintext);
 
 	len = strlen(plaintext);
-	buf = oauth2_mem_alloc(OAUTH2_CACHE_TAG_LEN + len +
-			       EVP_CIPHER_block_size(OAUTH2_CACHE_CIPHER));
+	buf = oauth2_mem_alloc_uninit(
+	    OAUTH2_CACHE_TAG_LEN + len +
+	    EVP_CIPHER_block_size(OAUTH2_CACHE_CIPHER));
 	if (buf == NULL)
 		goto end;
 
@@ -738,7 +743,8 @@ static int oauth2_cache_decrypt(oauth2_log_t *log, oauth2_cache_t *cache,
 		goto end;
 
 	len = buf_len - OAUTH2_CACHE_TAG_LEN;
-	rv = oauth2_mem_alloc(len + EVP_CIPHER_block_size(OAUTH2_CACHE_CIPHER));
+	rv = oauth2_mem_alloc_uninit(
+	    len + EVP_CIPHER_block_size(OAUTH2_CACHE_CIPHER));
 
 	len = _oauth2_cache_decrypt_impl(
 	    log, cache, (unsigned char *)(buf + OAUTH2_CACHE_TAG_LEN), len,
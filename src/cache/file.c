@@ -180,13 +180,14 @@ static char *_oauth2_cache_file_path(oauth2_log_t *log,
 				     oauth2_cache_impl_file_t *impl,
 				     const char *key)
 {
-	char *path = NULL;
+	oauth2_strbuf_t sb;
 
 	// TODO: WIN32 \ ?
-	path = oauth2_strdup(impl->dir);
-	path = oauth2_stradd(path, "/", OAUTH2_CACHE_FILE_PREFIX, key);
+	oauth2_strbuf_init(&sb, 0);
+	oauth2_strbuf_appendf(&sb, "%s/%s%s", impl->dir ? impl->dir : "",
+			      OAUTH2_CACHE_FILE_PREFIX, key ? key : "");
 
-	return path;
+	return oauth2_strbuf_take(&sb);
 }
 
 static bool _oauth2_cache_file_read(oauth2_log_t *log, FILE *f, void *buf,
@@ -292,11 +293,15 @@ static bool oauth2_cache_file_get(oauth2_log_t *log, oauth2_cache_t *cache,
 		goto unlock;
 	}
 
-	*value = oauth2_mem_alloc(info.len);
+	*value = oauth2_mem_alloc_uninit(info.len);
 	if (*value == NULL)
 		goto unlock;
 
 	rc = _oauth2_cache_file_read(log, f, (void *)*value, info.len);
+	if (rc == false) {
+		oauth2_mem_free(*value);
+		*value = NULL;
+	}
 
 unlock:
 
@@ -34,6 +34,104 @@
 #define OAUTH2_ENDPOINT_AUTH_CLIENT_CERT_STR "client_cert"
 #define OAUTH2_ENDPOINT_AUTH_BASIC_STR "basic"
 
+#define OAUTH2_ENDPOINT_AUTH_JWT_POOL_SIZE_DEFAULT 8
+#define OAUTH2_ENDPOINT_AUTH_JWT_POOL_SIZE_MAX 256
+#define OAUTH2_ENDPOINT_AUTH_JWT_EXPIRY_DEFAULT 60
+
+oauth2_cfg_endpoint_auth_jwt_pool_t *
+oauth2_cfg_endpoint_auth_jwt_pool_init(oauth2_log_t *log,
+				       const oauth2_nv_list_t *params)
+{
+	oauth2_cfg_endpoint_auth_jwt_pool_t *pool =
+	    (oauth2_cfg_endpoint_auth_jwt_pool_t *)oauth2_mem_alloc(
+		sizeof(oauth2_cfg_endpoint_auth_jwt_pool_t));
+
+	pool->size = oauth2_parse_uint(
+	    log, oauth2_nv_list_get(log, params, "assertion_pool_size"),
+	    OAUTH2_ENDPOINT_AUTH_JWT_POOL_SIZE_DEFAULT);
+	if (pool->size > OAUTH2_ENDPOINT_AUTH_JWT_POOL_SIZE_MAX)
+		pool->size = OAUTH2_ENDPOINT_AUTH_JWT_POOL_SIZE_MAX;
+	pool->expiry_s = oauth2_parse_time_sec(
+	    log, oauth2_nv_list_get(log, params, "assertion_expiry"),
+	    OAUTH2_ENDPOINT_AUTH_JWT_EXPIRY_DEFAULT);
+
+	if (pool->size > 0) {
+		pool->jwt = oauth2_mem_alloc(pool->size * sizeof(char *));
+		pool->exp =
+		    oauth2_mem_alloc(pool->size * sizeof(oauth2_time_t));
+	}
+	pool->next = 0;
+	pool->len = 0;
+	pool->pid = 0;
+
+	return pool;
+}
+
+oauth2_cfg_endpoint_auth_jwt_pool_t *
+oauth2_cfg_endpoint_auth_jwt_pool_clone(
+    oauth2_log_t *log, const oauth2_cfg_endpoint_auth_jwt_pool_t *src)
+{
+	oauth2_cfg_endpoint_auth_jwt_pool_t *dst = NULL;
+
+	if (src == NULL)
+		goto end;
+
+	// only the settings are copied: an assertion must be handed out once
+	dst = (oauth2_cfg_endpoint_auth_jwt_pool_t *)oauth2_mem_alloc(
+	    sizeof(oauth2_cfg_endpoint_auth_jwt_pool_t));
+	dst->size = src->size;
+	dst->expiry_s = src->expiry_s;
+	if (dst->size > 0) {
+		dst->jwt = oauth2_mem_alloc(dst->size * sizeof(char *));
+		dst->exp = oauth2_mem_alloc(dst->size * sizeof(oauth2_time_t));
+	}
+
+end:
+
+	return dst;
+}
+
+void oauth2_cfg_endpoint_auth_jwt_pool_flush(
+    oauth2_log_t *log, oauth2_cfg_endpoint_auth_jwt_pool_t *pool)
+{
+	oauth2_uint_t i = 0;
+
+	if ((pool == NULL) || (pool->jwt == NULL))
+		goto end;
+
+	for (i = pool->next; i < pool->len; i++) {
+		if (pool->jwt[i])
+			oauth2_mem_free(pool->jwt[i]);
+		pool->jwt[i] = NULL;
+	}
+	pool->next = 0;
+	pool->len = 0;
+	pool->pid = 0;
+
+end:
+
+	return;
+}
+
+void oauth2_cfg_endpoint_auth_jwt_pool_free(
+    oauth2_log_t *log, oauth2_cfg_endpoint_auth_jwt_pool_t *pool)
+{
+	if (pool == NULL)
+		goto end;
+
+	_oauth2_jwt_pool_release(log, pool);
+	oauth2_cfg_endpoint_auth_jwt_pool_flush(log, pool);
+	if (pool->jwt)
+		oauth2_mem_free(pool->jwt);
+	if (pool->exp)
+		oauth2_mem_free(pool->exp);
+	oauth2_mem_free(pool);
+
+end:
+
+	return;
+}
+
 oauth2_cfg_endpoint_auth_t *oauth2_cfg_endpoint_auth_init(oauth2_log_t *log)
 {
 	oauth2_cfg_endpoint_auth_t *auth =
@@ -72,6 +170,9 @@ void oauth2_cfg_endpoint_auth_free(oauth2_log_t *log,
 			cjose_jwk_release(auth->client_secret_jwt.jwk);
 		if (auth->client_secret_jwt.aud)
 			oauth2_mem_free(auth->client_secret_jwt.aud);
+		if (auth->client_secret_jwt.pool)
+			oauth2_cfg_endpoint_auth_jwt_pool_free(
+			    log, auth->client_secret_jwt.pool);
 		break;
 	case OAUTH2_ENDPOINT_AUTH_PRIVATE_KEY_JWT:
 		if (auth->private_key_jwt.client_id)
@@ -80,6 +181,9 @@ void oauth2_cfg_endpoint_auth_free(oauth2_log_t *log,
 			cjose_jwk_release(auth->private_key_jwt.jwk);
 		if (auth->private_key_jwt.aud)
 			oauth2_mem_free(auth->private_key_jwt.aud);
+		if (auth->private_key_jwt.pool)
+			oauth2_cfg_endpoint_auth_jwt_pool_free(
+			    log, auth->private_key_jwt.pool);
 		break;
 	case OAUTH2_ENDPOINT_AUTH_CLIENT_CERT:
 		if (auth->client_cert.certfile)
@@ -137,6 +241,8 @@ oauth2_cfg_endpoint_auth_clone(oauth2_log_t *log,
 		    oauth2_strdup(src->client_secret_jwt.client_id);
 		dst->client_secret_jwt.jwk =
 		    cjose_jwk_retain(src->client_secret_jwt.jwk, &err);
+		dst->client_secret_jwt.pool = oauth2_cfg_endpoint_auth_jwt_pool_clone(
+		    log, src->client_secret_jwt.pool);
 		break;
 	case OAUTH2_ENDPOINT_AUTH_PRIVATE_KEY_JWT:
 		dst->private_key_jwt.aud =
@@ -145,6 +251,8 @@ oauth2_cfg_endpoint_auth_clone(oauth2_log_t *log,
 		    oauth2_strdup(src->private_key_jwt.client_id);
 		dst->private_key_jwt.jwk =
 		    cjose_jwk_retain(src->private_key_jwt.jwk, &err);
+		dst->private_key_jwt.pool = oauth2_cfg_endpoint_auth_jwt_pool_clone(
+		    log, src->private_key_jwt.pool);
 		break;
 	case OAUTH2_ENDPOINT_AUTH_CLIENT_CERT:
 		dst->client_cert.certfile =
@@ -283,6 +391,9 @@ static char *oauth2_cfg_endpoint_auth_client_secret_jwt_options_set(
 		goto end;
 	}
 
+	auth->client_secret_jwt.pool =
+	    oauth2_cfg_endpoint_auth_jwt_pool_init(log, params);
+
 end:
 
 	return rv;
@@ -329,6 +440,9 @@ static char *oauth2_cfg_endpoint_auth_private_key_jwt_options_set(
 		goto end;
 	}
 
+	auth->private_key_jwt.pool =
+	    oauth2_cfg_endpoint_auth_jwt_pool_init(log, params);
+
 end:
 
 	return rv;
@@ -27,6 +27,7 @@ typedef struct oauth2_cfg_endpoint_t {
 	oauth2_cfg_endpoint_auth_t *auth;
 	oauth2_flag_t ssl_verify;
 	oauth2_uint_t http_timeout;
+	oauth2_flag_t http2;
 } oauth2_cfg_endpoint_t;
 
 oauth2_cfg_endpoint_t *oauth2_cfg_endpoint_init(oauth2_log_t *log)
@@ -42,6 +43,7 @@ oauth2_cfg_endpoint_t *oauth2_cfg_endpoint_init(oauth2_log_t *log)
 	endpoint->auth = NULL;
 	endpoint->ssl_verify = OAUTH2_CFG_FLAG_UNSET;
 	endpoint->http_timeout = OAUTH2_CFG_UINT_UNSET;
+	endpoint->http2 = OAUTH2_CFG_FLAG_UNSET;
 
 end:
 
@@ -79,6 +81,7 @@ oauth2_cfg_endpoint_t *oauth2_cfg_endpoint_clone(oauth2_log_t *log,
 	dst->auth = oauth2_cfg_endpoint_auth_clone(log, src->auth);
 	dst->ssl_verify = src->ssl_verify;
 	dst->http_timeout = src->http_timeout;
+	dst->http2 = src->http2;
 
 end:
 	return dst;
@@ -86,6 +89,7 @@ end:
 
 #define OAUTH2_CFG_ENDPOINT_SSL_VERIFY_DEFAULT 1
 #define OAUTH2_CFG_ENDPOINT_HTTP_TIMEOUT_DEFAULT 20
+#define OAUTH2_CFG_ENDPOINT_HTTP2_DEFAULT 0
 
 char *oauth2_cfg_set_endpoint_options(oauth2_log_t *log,
 				      oauth2_cfg_endpoint_t *cfg,
@@ -129,6 +133,14 @@ char *oauth2_cfg_set_endpoint_options(oauth2_log_t *log,
 			goto end;
 	}
 
+	value = oauth2_nv_list_get(log, params, "http2");
+	if (value) {
+		rv = oauth2_strdup(oauth2_cfg_set_flag_slot(
+		    cfg, offsetof(oauth2_cfg_endpoint_t, http2), value));
+		if (rv)
+			goto end;
+	}
+
 end:
 
 	oauth2_debug(log, "leave: %s", rv);
@@ -163,6 +175,13 @@ oauth2_cfg_endpoint_get_http_timeout(const oauth2_cfg_endpoint_t *cfg)
 	return cfg->http_timeout;
 }
 
+oauth2_flag_t oauth2_cfg_endpoint_get_http2(const oauth2_cfg_endpoint_t *cfg)
+{
+	if ((cfg == NULL) || (cfg->http2 == OAUTH2_CFG_FLAG_UNSET))
+		return OAUTH2_CFG_ENDPOINT_HTTP2_DEFAULT;
+	return cfg->http2;
+}
+
 #define OAUTH2_CFG_ROPC_CLIENT_ID_DEFAULT NULL
 #define OAUTH2_CFG_ROPC_USERNAME_DEFAULT NULL
 #define OAUTH2_CFG_ROPC_PASSWORD_DEFAULT NULL
@@ -66,6 +66,7 @@ oauth2_cfg_token_verify_t *oauth2_cfg_token_verify_init(oauth2_log_t *log)
 	verify->callback = NULL;
 	verify->cache = NULL;
 	verify->expiry_s = OAUTH2_CFG_UINT_UNSET;
+	verify->cache_self = false;
 	verify->next = NULL;
 	return verify;
 }
@@ -97,6 +98,7 @@ oauth2_cfg_token_verify_clone(oauth2_log_t *log, oauth2_cfg_token_verify_t *src)
 	dst = oauth2_cfg_token_verify_init(NULL);
 	dst->cache = oauth2_cache_clone(log, src->cache);
 	dst->expiry_s = src->expiry_s;
+	dst->cache_self = src->cache_self;
 	dst->callback = src->callback;
 	dst->ctx = oauth2_cfg_ctx_clone(log, src->ctx);
 	dst->next = oauth2_cfg_token_verify_clone(NULL, src->next);
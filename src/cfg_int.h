@@ -30,6 +30,8 @@
 
 #include <cjose/cjose.h>
 
+#include <sys/types.h>
+
 /*
  * auth
  */
@@ -48,16 +50,55 @@ typedef struct oauth2_cfg_endpoint_auth_client_secret_post_t {
 	char *client_secret;
 } oauth2_cfg_endpoint_auth_client_secret_post_t;
 
+typedef struct oauth2_cfg_endpoint_auth_jwt_pool_t {
+	// configured number of assertions kept ready
+	oauth2_uint_t size;
+	// validity of each assertion in seconds
+	oauth2_time_t expiry_s;
+	// pre-signed assertions and their exp claim values
+	char **jwt;
+	oauth2_time_t *exp;
+	// next assertion to hand out and number of assertions in the pool
+	oauth2_uint_t next;
+	oauth2_uint_t len;
+	// process that owns the pool; a forked child must never re-use it
+	pid_t pid;
+	// signing material retained for the background refill
+	cjose_jwk_t *jwk;
+	const char *alg;
+	char *client_id;
+	char *aud;
+	// queued for, or being topped up by, the refill thread
+	bool queued;
+	bool busy;
+	struct oauth2_cfg_endpoint_auth_jwt_pool_t *queue_next;
+} oauth2_cfg_endpoint_auth_jwt_pool_t;
+
+oauth2_cfg_endpoint_auth_jwt_pool_t *
+oauth2_cfg_endpoint_auth_jwt_pool_init(oauth2_log_t *log,
+				       const oauth2_nv_list_t *params);
+oauth2_cfg_endpoint_auth_jwt_pool_t *
+oauth2_cfg_endpoint_auth_jwt_pool_clone(
+    oauth2_log_t *log, const oauth2_cfg_endpoint_auth_jwt_pool_t *src);
+void oauth2_cfg_endpoint_auth_jwt_pool_flush(
+    oauth2_log_t *log, oauth2_cfg_endpoint_auth_jwt_pool_t *pool);
+void oauth2_cfg_endpoint_auth_jwt_pool_free(
+    oauth2_log_t *log, oauth2_cfg_endpoint_auth_jwt_pool_t *pool);
+void _oauth2_jwt_pool_release(oauth2_log_t *log,
+			      oauth2_cfg_endpoint_auth_jwt_pool_t *pool);
+
 typedef struct oauth2_cfg_endpoint_auth_client_secret_jwt_t {
 	char *client_id;
 	cjose_jwk_t *jwk;
 	char *aud;
+	oauth2_cfg_endpoint_auth_jwt_pool_t *pool;
 } oauth2_cfg_endpoint_auth_client_secret_jwt_t;
 
 typedef struct oauth2_cfg_endpoint_auth_private_key_jwt_t {
 	char *client_id;
 	cjose_jwk_t *jwk;
 	char *aud;
+	oauth2_cfg_endpoint_auth_jwt_pool_t *pool;
 } oauth2_cfg_endpoint_auth_private_key_jwt_t;
 
 typedef struct oauth2_cfg_endpoint_auth_client_cert_t {
@@ -145,6 +186,8 @@ typedef struct oauth2_cfg_token_verify_t {
 	oauth2_cfg_ctx_t *ctx;
 	oauth2_cache_t *cache;
 	oauth2_time_t expiry_s;
+	// the callback caches its results itself, with expiry_s as upper bound
+	bool cache_self;
 	struct oauth2_cfg_token_verify_t *next;
 } oauth2_cfg_token_verify_t;
 
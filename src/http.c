@@ -20,10 +20,14 @@
  **************************************************************************/
 
 #include <curl/curl.h>
+#include <openssl/sha.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "oauth2/http.h"
+#include "oauth2/ipc.h"
 #include "oauth2/mem.h"
 #include "oauth2/util.h"
 #include "oauth2/version.h"
@@ -179,6 +183,26 @@ bool oauth2_http_request_header_add(oauth2_log_t *log,
 	    log, request, name, value, oauth2_nv_list_add);
 }
 
+/*
+ * adds a header that refers to the server's own storage of name and value,
+ * which must outlive the request; values that need sanitizing are copied
+ */
+bool oauth2_http_request_header_add_ref(oauth2_log_t *log,
+					oauth2_http_request_t *request,
+					const char *name, const char *value)
+{
+	if ((request == NULL) || (name == NULL))
+		return false;
+
+	if ((value) && (strchr(value, '\n')))
+		return oauth2_http_request_header_add(log, request, name,
+						      value);
+
+	oauth2_trace1(log, "%s: %s", name, value ? value : "(null)");
+
+	return oauth2_nv_list_add_ref(log, request->header, name, value);
+}
+
 static char *oauth2_http_request_header_get_left_most_only(
     oauth2_log_t *log, const oauth2_http_request_t *request, const char *name)
 {
@@ -391,7 +415,7 @@ char *oauth2_http_request_port_get(oauth2_log_t *log,
 	}
 
 	if (port > 0) {
-		port_str = oauth2_mem_alloc(OAUTH2_PORT_STR_MAX);
+		port_str = oauth2_mem_alloc_uninit(OAUTH2_PORT_STR_MAX);
 		oauth2_snprintf(port_str, OAUTH2_PORT_STR_MAX, "%lu", port);
 	}
 
@@ -541,11 +565,15 @@ typedef struct oauth2_http_call_ctx_t {
 	char *ca_info;
 	char *ssl_cert;
 	char *ssl_key;
+	bool http2;
+	bool hedge;
 	char *to_str;
 } oauth2_http_call_ctx_t;
 
 #define OAUTH2_HTTP_CALL_TIMEOUT_DEFAULT 15
 #define OAUTH2_HTTP_CALL_SSL_VERIFY_DEFAULT true
+#define OAUTH2_HTTP_CALL_HTTP2_DEFAULT false
+#define OAUTH2_HTTP_CALL_HEDGE_DEFAULT false
 
 oauth2_http_call_ctx_t *oauth2_http_call_ctx_init(oauth2_log_t *log)
 {
@@ -564,6 +592,10 @@ oauth2_http_call_ctx_t *oauth2_http_call_ctx_init(oauth2_log_t *log)
 	oauth2_http_call_ctx_ca_info_set(log, ctx, NULL);
 	oauth2_http_call_ctx_ssl_cert_set(log, ctx, NULL);
 	oauth2_http_call_ctx_ssl_key_set(log, ctx, NULL);
+	oauth2_http_call_ctx_http2_set(log, ctx,
+				       OAUTH2_HTTP_CALL_HTTP2_DEFAULT);
+	oauth2_http_call_ctx_hedge_set(log, ctx,
+				       OAUTH2_HTTP_CALL_HEDGE_DEFAULT);
 
 	ctx->cookie = oauth2_nv_list_init(log);
 	ctx->hdr = oauth2_nv_list_init(log);
@@ -615,6 +647,8 @@ _OAUTH2_TYPE_IMPLEMENT_MEMBER_SET(http, call_ctx, outgoing_proxy, char *, str)
 _OAUTH2_TYPE_IMPLEMENT_MEMBER_SET(http, call_ctx, ca_info, char *, str)
 _OAUTH2_TYPE_IMPLEMENT_MEMBER_SET(http, call_ctx, ssl_cert, char *, str)
 _OAUTH2_TYPE_IMPLEMENT_MEMBER_SET(http, call_ctx, ssl_key, char *, str)
+_OAUTH2_TYPE_IMPLEMENT_MEMBER_SET(http, call_ctx, http2, bool, bln)
+_OAUTH2_TYPE_IMPLEMENT_MEMBER_SET(http, call_ctx, hedge, bool, bln)
 _OAUTH2_MEMBER_LIST_IMPLEMENT_SET_ADD_UNSET_GET(http, call_ctx, cookie);
 _OAUTH2_MEMBER_LIST_IMPLEMENT_SET_ADD_UNSET_GET(http, call_ctx, hdr);
 
@@ -667,6 +701,7 @@ static char *_oauth2_http_call_ctx2s(oauth2_log_t *log,
 				     oauth2_http_call_ctx_t *ctx)
 {
 	char *ptr = NULL;
+	oauth2_strbuf_t sb;
 
 	if (ctx == NULL)
 		return NULL;
@@ -674,44 +709,42 @@ static char *_oauth2_http_call_ctx2s(oauth2_log_t *log,
 	if (ctx->to_str)
 		oauth2_mem_free(ctx->to_str);
 
-	ctx->to_str = oauth2_strdup("[");
+	oauth2_strbuf_init(&sb, 0);
+	oauth2_strbuf_append(&sb, "[");
 	if (ctx->basic_auth_username)
-		ctx->to_str =
-		    oauth2_stradd(ctx->to_str, " basic_auth_username",
-				  _OAUTH2_STR_EQUAL, ctx->basic_auth_username);
+		oauth2_strbuf_appendf(&sb, " basic_auth_username=%s",
+				      ctx->basic_auth_username);
 	if (ctx->basic_auth_password)
-		ctx->to_str =
-		    oauth2_stradd(ctx->to_str, " basic_auth_password",
-				  _OAUTH2_STR_EQUAL, ctx->basic_auth_password);
+		oauth2_strbuf_appendf(&sb, " basic_auth_password=%s",
+				      ctx->basic_auth_password);
 	if (ctx->outgoing_proxy)
-		ctx->to_str =
-		    oauth2_stradd(ctx->to_str, " outgoing_proxy",
-				  _OAUTH2_STR_EQUAL, ctx->outgoing_proxy);
+		oauth2_strbuf_appendf(&sb, " outgoing_proxy=%s",
+				      ctx->outgoing_proxy);
 	if (ctx->ca_info)
-		ctx->to_str = oauth2_stradd(ctx->to_str, " ca_info",
-					    _OAUTH2_STR_EQUAL, ctx->ca_info);
+		oauth2_strbuf_appendf(&sb, " ca_info=%s", ctx->ca_info);
 	if (ctx->ssl_cert)
-		ctx->to_str = oauth2_stradd(ctx->to_str, " ssl_cert",
-					    _OAUTH2_STR_EQUAL, ctx->ssl_cert);
+		oauth2_strbuf_appendf(&sb, " ssl_cert=%s", ctx->ssl_cert);
 	if (ctx->ssl_key)
-		ctx->to_str = oauth2_stradd(ctx->to_str, " ssl_key",
-					    _OAUTH2_STR_EQUAL, ctx->ssl_key);
+		oauth2_strbuf_appendf(&sb, " ssl_key=%s", ctx->ssl_key);
+	if (ctx->http2)
+		oauth2_strbuf_append(&sb, " http2=true");
+	if (ctx->hedge)
+		oauth2_strbuf_append(&sb, " hedge=true");
 
 	ptr = oauth2_nv_list2s(log, ctx->hdr);
 	if (ptr) {
-		ctx->to_str =
-		    oauth2_stradd(ctx->to_str, " hdr", _OAUTH2_STR_EQUAL, ptr);
+		oauth2_strbuf_appendf(&sb, " hdr=%s", ptr);
 		oauth2_mem_free(ptr);
 	}
 
 	ptr = oauth2_nv_list2s(log, ctx->cookie);
 	if (ptr) {
-		ctx->to_str = oauth2_stradd(ctx->to_str, " cookie",
-					    _OAUTH2_STR_EQUAL, ptr);
+		oauth2_strbuf_appendf(&sb, " cookie=%s", ptr);
 		oauth2_mem_free(ptr);
 	}
 
-	ctx->to_str = oauth2_stradd(ctx->to_str, " ]", NULL, NULL);
+	oauth2_strbuf_append(&sb, " ]");
+	ctx->to_str = oauth2_strbuf_take(&sb);
 
 	return ctx->to_str;
 }
@@ -722,37 +755,30 @@ static char *_oauth2_http_call_ctx2s(oauth2_log_t *log,
 
 typedef struct _oauth2_http_encode_str_t {
 	const char *sep;
-	char **str;
+	oauth2_strbuf_t *sb;
 } _oauth2_http_encode_str_t;
 
 static bool _oauth2_http_url_encode_list(oauth2_log_t *log, void *rec,
 					 const char *key, const char *value)
 {
 	bool rc = false;
-	char *enc_key = NULL, *enc_val = NULL;
 	_oauth2_http_encode_str_t *state = (_oauth2_http_encode_str_t *)rec;
 
-	if ((state->str == NULL) || (key == NULL))
+	if ((state->sb == NULL) || (key == NULL))
 		goto end;
 
 	oauth2_debug(log, "processing: %s=%s", key, value);
 
-	enc_key = oauth2_url_encode(log, key);
-	enc_val = oauth2_url_encode(log, value);
-
-	*state->str =
-	    _oauth2_stradd4(*state->str, *state->str ? state->sep : "", enc_key,
-			    _OAUTH2_STR_EQUAL, enc_val);
+	if (state->sb->buf)
+		oauth2_strbuf_append(state->sb, state->sep);
+	oauth2_strbuf_append_escaped(state->sb, key);
+	oauth2_strbuf_append(state->sb, _OAUTH2_STR_EQUAL);
+	oauth2_strbuf_append_escaped(state->sb, value);
 
 	rc = true;
 
 end:
 
-	if (enc_key)
-		oauth2_mem_free(enc_key);
-	if (enc_val)
-		oauth2_mem_free(enc_val);
-
 	return rc;
 }
 
@@ -760,7 +786,8 @@ static bool _oauth2_http_url_query_encode_param(oauth2_log_t *log, void *rec,
 						const char *key,
 						const char *value)
 {
-	_oauth2_http_encode_str_t encode_str = {_OAUTH2_STR_AMP, (char **)rec};
+	_oauth2_http_encode_str_t encode_str = {_OAUTH2_STR_AMP,
+						(oauth2_strbuf_t *)rec};
 	return _oauth2_http_url_encode_list(log, &encode_str, key, value);
 }
 
@@ -768,39 +795,44 @@ static bool _oauth2_http_url_encode_cookie(oauth2_log_t *log, void *rec,
 					   const char *key, const char *value)
 {
 	_oauth2_http_encode_str_t encode_str = {_OAUTH2_STR_SEMICOL " ",
-						(char **)rec};
+						(oauth2_strbuf_t *)rec};
 	return _oauth2_http_url_encode_list(log, &encode_str, key, value);
 }
 
 static char *_oauth2_http_cookies_encode(oauth2_log_t *log,
 					 oauth2_nv_list_t *cookies)
 {
-	char *str = NULL;
-	oauth2_nv_list_loop(log, cookies, _oauth2_http_url_encode_cookie, &str);
-	return str;
+	oauth2_strbuf_t sb;
+
+	oauth2_strbuf_init(&sb, 0);
+	oauth2_nv_list_loop(log, cookies, _oauth2_http_url_encode_cookie, &sb);
+
+	return oauth2_strbuf_take(&sb);
 }
 
 char *oauth2_http_url_query_encode(oauth2_log_t *log, const char *url,
 				   const oauth2_nv_list_t *params)
 {
 	char *result = NULL;
-	const char *sep = NULL;
-	char *encode_str = NULL;
+	oauth2_strbuf_t sb, params_sb;
 
+	oauth2_strbuf_init(&params_sb, 0);
 	oauth2_nv_list_loop(log, params, _oauth2_http_url_query_encode_param,
-			    &encode_str);
-
-	if (url && encode_str)
-		sep = strrchr(url, _OAUTH2_CHAR_QUERY) != NULL
-			  ? _OAUTH2_STR_AMP
-			  : _OAUTH2_STR_QMARK;
-
-	result = oauth2_stradd(result, url, sep, encode_str);
+			    &params_sb);
+
+	oauth2_strbuf_init(&sb, 0);
+	oauth2_strbuf_append(&sb, url);
+	if ((url) && (params_sb.buf))
+		oauth2_strbuf_append(&sb, strrchr(url, _OAUTH2_CHAR_QUERY)
+					      ? _OAUTH2_STR_AMP
+					      : _OAUTH2_STR_QMARK);
+	if (params_sb.buf)
+		oauth2_strbuf_appendn(&sb, params_sb.buf, params_sb.len);
+	result = oauth2_strbuf_take(&sb);
 
 	oauth2_debug(log, "result=%s", result);
 
-	if (encode_str)
-		oauth2_mem_free(encode_str);
+	oauth2_strbuf_free(&params_sb);
 
 	return result;
 }
@@ -809,9 +841,15 @@ char *oauth2_http_url_form_encode(oauth2_log_t *log,
 				  const oauth2_nv_list_t *args)
 {
 	char *encode_str = NULL;
+	oauth2_strbuf_t sb;
+
+	oauth2_strbuf_init(&sb, 0);
 	oauth2_nv_list_loop(log, args, _oauth2_http_url_query_encode_param,
-			    &encode_str);
+			    &sb);
+	encode_str = oauth2_strbuf_take(&sb);
+
 	oauth2_debug(log, "data=%s", encode_str);
+
 	return encode_str;
 }
 
@@ -821,11 +859,91 @@ char *oauth2_http_url_form_encode(oauth2_log_t *log,
 
 typedef struct oauth2_http_curl_buf_t {
 	oauth2_log_t *log;
+	CURL *curl;
 	char *memory;
 	size_t size;
+	size_t capacity;
 } oauth2_http_curl_buf_t;
 
 #define _OAUTH2_HTTP_CURL_BUF_MAX 1024 * 1024
+#define _OAUTH2_HTTP_CURL_BUF_MIN 1024
+
+static void _oauth2_http_curl_buf_init(oauth2_log_t *log,
+				       oauth2_http_curl_buf_t *buf)
+{
+	buf->log = log;
+	buf->curl = NULL;
+	buf->memory = NULL;
+	buf->size = 0;
+	buf->capacity = 0;
+}
+
+// the announced Content-Length, if any and if acceptable
+static size_t _oauth2_http_curl_buf_size_hint(oauth2_http_curl_buf_t *mem)
+{
+	curl_off_t len = -1;
+
+	if (mem->curl == NULL)
+		goto end;
+
+#if LIBCURL_VERSION_NUM >= 0x073700
+	if (curl_easy_getinfo(mem->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+			      &len) != CURLE_OK)
+		len = -1;
+#else
+	double d = -1;
+	if (curl_easy_getinfo(mem->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD,
+			      &d) == CURLE_OK)
+		len = (curl_off_t)d;
+#endif
+
+end:
+
+	return ((len > 0) && (len <= _OAUTH2_HTTP_CURL_BUF_MAX)) ? (size_t)len
+								 : 0;
+}
+
+// make room for len bytes plus a terminating NUL, growing geometrically
+static bool _oauth2_http_curl_buf_reserve(oauth2_http_curl_buf_t *mem,
+					  size_t len)
+{
+	bool rc = false;
+	size_t capacity = mem->capacity;
+	char *ptr = NULL;
+
+	if (len + 1 <= capacity) {
+		rc = true;
+		goto end;
+	}
+
+	if (capacity == 0) {
+		capacity = _oauth2_http_curl_buf_size_hint(mem) + 1;
+		if (capacity < _OAUTH2_HTTP_CURL_BUF_MIN)
+			capacity = _OAUTH2_HTTP_CURL_BUF_MIN;
+	}
+	while (capacity < len + 1)
+		capacity *= 2;
+	if (capacity > _OAUTH2_HTTP_CURL_BUF_MAX + 1)
+		capacity = _OAUTH2_HTTP_CURL_BUF_MAX + 1;
+
+	ptr = oauth2_mem_get_realloc()(mem->memory, capacity);
+	if (ptr == NULL) {
+		oauth2_error(mem->log,
+			     "memory allocation for new buffer of %ld bytes "
+			     "failed",
+			     capacity);
+		goto end;
+	}
+
+	mem->memory = ptr;
+	mem->capacity = capacity;
+
+	rc = true;
+
+end:
+
+	return rc;
+}
 
 static size_t oauth2_http_curl_buf_write(void *contents, size_t size,
 					 size_t nmemb, void *userp)
@@ -842,19 +960,11 @@ static size_t oauth2_http_curl_buf_write(void *contents, size_t size,
 		goto end;
 	}
 
-	char *newptr = oauth2_mem_alloc(mem->size + realsize + 1);
-	if (newptr == NULL) {
-		oauth2_error(
-		    mem->log,
-		    "memory allocation for new buffer of %ld bytes failed",
-		    mem->size + realsize + 1);
+	if (_oauth2_http_curl_buf_reserve(mem, mem->size + realsize) == false)
 		goto end;
-	}
 
-	memcpy(newptr, mem->memory, mem->size);
-	memcpy(&(newptr[mem->size]), contents, realsize);
+	memcpy(&(mem->memory[mem->size]), contents, realsize);
 	mem->size += realsize;
-	mem->memory = newptr;
 	mem->memory[mem->size] = 0;
 
 	rc = realsize;
@@ -889,37 +999,244 @@ end:
 	return rc;
 }
 
-bool oauth2_http_call(oauth2_log_t *log, const char *url, const char *data,
-		      oauth2_http_call_ctx_t *ctx, char **response,
-		      oauth2_http_status_code_t *status_code)
+/*
+ * pool of idle curl easy handles, keyed by origin, that keep their live
+ * connections; DNS, TLS sessions and connections are shared between all
+ * handles of the process through a curl share object
+ */
+
+#define OAUTH2_HTTP_CURL_POOL_MAX 16
+
+typedef struct oauth2_http_curl_pool_entry_t {
+	char *origin;
+	CURL *curl;
+	oauth2_time_t idle_since;
+} oauth2_http_curl_pool_entry_t;
+
+static oauth2_http_curl_pool_entry_t
+    _oauth2_http_curl_pool[OAUTH2_HTTP_CURL_POOL_MAX];
+// handles, connections and sessions are per-process so thread mutexes do
+static pthread_mutex_t _oauth2_http_curl_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pid_t _oauth2_http_curl_pool_pid = 0;
+
+static CURLSH *_oauth2_http_curl_share = NULL;
+static pthread_mutex_t _oauth2_http_curl_share_mutex[CURL_LOCK_DATA_LAST];
+
+static void _oauth2_http_curl_share_lock(CURL *curl, curl_lock_data data,
+					 curl_lock_access access, void *u)
 {
-	bool rc = false;
-	char *str = NULL;
-	long response_code = 0;
+	if (data < CURL_LOCK_DATA_LAST)
+		pthread_mutex_lock(&_oauth2_http_curl_share_mutex[data]);
+}
 
-	char err[CURL_ERROR_SIZE];
-	CURL *curl = NULL;
-	CURLcode errornum = CURLE_OK;
-	struct curl_slist *h_list = NULL;
-	oauth2_http_curl_buf_t buf;
-	buf.log = log;
-	buf.memory = NULL;
-	buf.size = 0;
+static void _oauth2_http_curl_share_unlock(CURL *curl, curl_lock_data data,
+					   void *u)
+{
+	if (data < CURL_LOCK_DATA_LAST)
+		pthread_mutex_unlock(&_oauth2_http_curl_share_mutex[data]);
+}
 
-	oauth2_debug(log, "enter: url=%s, data=%s, ctx=%s", url,
-		     data ? data : "(null)", _oauth2_http_call_ctx2s(log, ctx));
+static CURLSH *_oauth2_http_curl_share_init(oauth2_log_t *log)
+{
+	CURLSH *share = NULL;
+	int i = 0;
+	curl_lock_data data[] = {CURL_LOCK_DATA_SHARE, CURL_LOCK_DATA_DNS,
+				 CURL_LOCK_DATA_SSL_SESSION,
+#if LIBCURL_VERSION_NUM >= 0x073900
+				 CURL_LOCK_DATA_CONNECT,
+#endif
+				 CURL_LOCK_DATA_LAST};
+
+	share = curl_share_init();
+	if (share == NULL) {
+		oauth2_error(log, "curl_share_init() error");
+		goto end;
+	}
+
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(&_oauth2_http_curl_share_mutex[i], NULL);
+
+	for (i = 0; data[i] != CURL_LOCK_DATA_LAST; i++)
+		if (data[i] != CURL_LOCK_DATA_SHARE)
+			curl_share_setopt(share, CURLSHOPT_SHARE, data[i]);
+
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC,
+			  _oauth2_http_curl_share_lock);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC,
+			  _oauth2_http_curl_share_unlock);
+
+end:
+
+	return share;
+}
+
+static void _oauth2_http_curl_share_free(oauth2_log_t *log)
+{
+	int i = 0;
+
+	if (_oauth2_http_curl_share == NULL)
+		return;
+
+	curl_share_cleanup(_oauth2_http_curl_share);
+	_oauth2_http_curl_share = NULL;
 
-	if ((url == NULL) || (response == NULL))
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_destroy(&_oauth2_http_curl_share_mutex[i]);
+}
+
+static char *_oauth2_http_url_origin(oauth2_log_t *log, const char *url)
+{
+	const char *p = NULL;
+
+	p = strstr(url, "://");
+	p = p ? p + 3 : url;
+	p += strcspn(p, "/?#");
+
+	return oauth2_strndup(url, p - url);
+}
+
+// must be called with the pool lock held
+static void _oauth2_http_curl_pool_fork_check(oauth2_log_t *log)
+{
+	int i = 0;
+
+	if (_oauth2_http_curl_pool_pid == getpid())
+		goto end;
+
+	if (_oauth2_http_curl_pool_pid != 0) {
+		oauth2_debug(log, "dropping curl handles of parent process");
+		// the connections belong to the parent: cleaning them up here
+		// would shut down TLS sessions that the parent still uses
+		for (i = 0; i < OAUTH2_HTTP_CURL_POOL_MAX; i++) {
+			_oauth2_http_curl_pool[i].curl = NULL;
+			_oauth2_http_curl_pool[i].origin = NULL;
+		}
+		// the share mutexes are initialized again with a new share
+		_oauth2_http_curl_share = NULL;
+	}
+
+	_oauth2_http_curl_pool_pid = getpid();
+
+end:
+
+	return;
+}
+
+static bool _oauth2_http_curl_pool_lock(oauth2_log_t *log)
+{
+	return (pthread_mutex_lock(&_oauth2_http_curl_pool_mutex) == 0);
+}
+
+static bool _oauth2_http_curl_pool_unlock(oauth2_log_t *log)
+{
+	return (pthread_mutex_unlock(&_oauth2_http_curl_pool_mutex) == 0);
+}
+
+static CURL *_oauth2_http_curl_acquire(oauth2_log_t *log, const char *origin)
+{
+	CURL *curl = NULL;
+	CURLSH *share = NULL;
+	oauth2_http_curl_pool_entry_t *e = NULL;
+	int i = 0;
+
+	if (_oauth2_http_curl_pool_lock(log) == false)
 		goto end;
 
-	// TODO: this is somewhat shared (at least the initialization of
-	// globals) with url-encode/url-decode??
-	curl = curl_easy_init();
+	_oauth2_http_curl_pool_fork_check(log);
+
+	if (_oauth2_http_curl_share == NULL)
+		_oauth2_http_curl_share = _oauth2_http_curl_share_init(log);
+	share = _oauth2_http_curl_share;
+
+	for (i = 0; i < OAUTH2_HTTP_CURL_POOL_MAX; i++) {
+		e = &_oauth2_http_curl_pool[i];
+		if ((e->curl == NULL) || (strcmp(e->origin, origin) != 0))
+			continue;
+		curl = e->curl;
+		oauth2_mem_free(e->origin);
+		e->origin = NULL;
+		e->curl = NULL;
+		break;
+	}
+
+	_oauth2_http_curl_pool_unlock(log);
+
+end:
+
 	if (curl == NULL) {
-		oauth2_error(log, "curl_easy_init() error");
+		curl = curl_easy_init();
+		if (curl == NULL)
+			oauth2_error(log, "curl_easy_init() error");
+	} else {
+		oauth2_debug(log, "reusing curl handle for: %s", origin);
+	}
+
+	if ((curl) && (share))
+		curl_easy_setopt(curl, CURLOPT_SHARE, share);
+
+	return curl;
+}
+
+static void _oauth2_http_curl_release(oauth2_log_t *log, const char *origin,
+				      CURL *curl)
+{
+	CURL *victim = curl;
+	oauth2_http_curl_pool_entry_t *e = NULL;
+	int i = 0;
+	bool suspended = false;
+
+	if (curl == NULL)
+		goto end;
+
+	// clear all options, including pointers into the caller's stack, but
+	// keep the live connections and caches
+	curl_easy_reset(curl);
+
+	if (_oauth2_http_curl_pool_lock(log) == false)
 		goto end;
+
+	_oauth2_http_curl_pool_fork_check(log);
+
+	for (i = 0; i < OAUTH2_HTTP_CURL_POOL_MAX; i++) {
+		if (_oauth2_http_curl_pool[i].curl == NULL) {
+			e = &_oauth2_http_curl_pool[i];
+			break;
+		}
+		if ((e == NULL) ||
+		    (_oauth2_http_curl_pool[i].idle_since < e->idle_since))
+			e = &_oauth2_http_curl_pool[i];
 	}
 
+	victim = e->curl;
+	if (e->origin)
+		oauth2_mem_free(e->origin);
+	// the pool outlives the request
+	suspended = oauth2_mem_arena_suspend();
+	e->origin = oauth2_strdup(origin);
+	oauth2_mem_arena_resume(suspended);
+	e->curl = curl;
+	e->idle_since = oauth2_time_now_sec();
+
+	_oauth2_http_curl_pool_unlock(log);
+
+end:
+
+	if (victim)
+		curl_easy_cleanup(victim);
+
+	return;
+}
+
+// sets all per-call options on a (pooled) handle; the header list that is
+// returned in h_list must be freed after the transfer has finished
+static void _oauth2_http_curl_setup(oauth2_log_t *log, CURL *curl,
+				    const char *url, const char *data,
+				    oauth2_http_call_ctx_t *ctx,
+				    oauth2_http_curl_buf_t *buf, char *err,
+				    struct curl_slist **h_list)
+{
+	char *str = NULL;
+
 	err[0] = 0;
 
 	curl_easy_setopt(curl, CURLOPT_HEADER, 0L);
@@ -932,9 +1249,10 @@ bool oauth2_http_call(oauth2_log_t *log, const char *url, const char *data,
 	if (ctx)
 		curl_easy_setopt(curl, CURLOPT_TIMEOUT, ctx->timeout);
 
+	buf->curl = curl;
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,
 			 oauth2_http_curl_buf_write);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&buf);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)buf);
 
 #ifndef LIBCURL_NO_CURLPROTO
 	curl_easy_setopt(curl, CURLOPT_REDIR_PROTOCOLS,
@@ -991,6 +1309,19 @@ bool oauth2_http_call(oauth2_log_t *log, const char *url, const char *data,
 			curl_easy_setopt(curl, CURLOPT_SSLKEY, ctx->ssl_key);
 	}
 
+	if (ctx && ctx->http2) {
+#if LIBCURL_VERSION_NUM >= 0x072F00
+		// negotiate h2 over TLS through ALPN, plain HTTP stays 1.1
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
+				 CURL_HTTP_VERSION_2TLS);
+		// wait for a connection that can be multiplexed rather than
+		// opening a new one for each concurrent (async) call
+		curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+#else
+		oauth2_warn(log, "HTTP/2 requires libcurl >= 7.47.0");
+#endif
+	}
+
 	if (data != NULL) {
 		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
 		curl_easy_setopt(curl, CURLOPT_POST, 1);
@@ -998,10 +1329,10 @@ bool oauth2_http_call(oauth2_log_t *log, const char *url, const char *data,
 
 	if (ctx)
 		oauth2_nv_list_loop(log, ctx->hdr, _oauth2_http_curl_header_add,
-				    &h_list);
+				    h_list);
 
-	if (h_list != NULL)
-		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, h_list);
+	if (*h_list != NULL)
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, *h_list);
 
 	if (ctx)
 		str = _oauth2_http_cookies_encode(log, ctx->cookie);
@@ -1015,13 +1346,21 @@ bool oauth2_http_call(oauth2_log_t *log, const char *url, const char *data,
 	}
 
 	curl_easy_setopt(curl, CURLOPT_URL, url);
+}
+
+static bool _oauth2_http_curl_result(oauth2_log_t *log, CURL *curl,
+				     const char *url, CURLcode errornum,
+				     const char *err,
+				     oauth2_http_status_code_t *status_code)
+{
+	bool rc = false;
+	long response_code = 0;
 
-	errornum = curl_easy_perform(curl);
 	if (errornum != CURLE_OK) {
 		oauth2_error(log, "curl_easy_perform() failed on: %s (%s: %s)",
 			     url, curl_easy_strerror(errornum),
 			     err[0] ? err : "");
-		if (errornum == CURLE_OPERATION_TIMEDOUT)
+		if ((errornum == CURLE_OPERATION_TIMEDOUT) && (status_code))
 			// 408 Request Timeout
 			// 504 Gateway Timeout
 			*status_code = 504;
@@ -1033,111 +1372,1035 @@ bool oauth2_http_call(oauth2_log_t *log, const char *url, const char *data,
 	if (status_code)
 		*status_code = (oauth2_uint_t)response_code;
 
-	*response = oauth2_mem_alloc(buf.size + 1);
-	strncpy(*response, buf.memory, buf.size);
-	(*response)[buf.size] = '\0';
-
 	rc = true;
 
 end:
 
-	if (buf.memory)
-		oauth2_mem_free(buf.memory);
-	if (h_list != NULL)
-		curl_slist_free_all(h_list);
-	curl_easy_cleanup(curl);
+	return rc;
+}
 
-	oauth2_debug(log, "leave [%d]: %s", rc,
-		     (response && *response) ? *response : "(null)");
+/*
+ * per-endpoint health, kept in shared memory under a global mutex so all
+ * worker processes see the same state: latency histogram and error counts
+ * over a decaying window, a circuit breaker and a p95 based hedging delay
+ */
 
-	return rc;
+// maximum number of endpoints tracked, the least recently used is evicted
+#define OAUTH2_HTTP_HEALTH_MAX 64
+// counts are halved after each window so older samples fade out
+#define OAUTH2_HTTP_HEALTH_WINDOW_S 30
+// minimum number of samples to base a circuit breaker decision on
+#define OAUTH2_HTTP_HEALTH_MIN_CALLS 10
+#define OAUTH2_HTTP_HEALTH_ERROR_PCT 50
+#define OAUTH2_HTTP_HEALTH_OPEN_S 30
+// minimum number of samples to derive a hedging delay from
+#define OAUTH2_HTTP_HEALTH_HEDGE_MIN_CALLS 20
+#define OAUTH2_HTTP_HEALTH_HEDGE_PCT 95
+#define OAUTH2_HTTP_HEALTH_BUCKETS 10
+
+// upper bounds in milliseconds of the latency histogram buckets
+static const oauth2_time_t
+    _oauth2_http_health_bucket_ms[OAUTH2_HTTP_HEALTH_BUCKETS] = {
+	10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 0};
+
+typedef enum oauth2_http_health_state_t {
+	OAUTH2_HTTP_HEALTH_CLOSED,
+	OAUTH2_HTTP_HEALTH_OPEN,
+	OAUTH2_HTTP_HEALTH_HALF_OPEN
+} oauth2_http_health_state_t;
+
+// a slot in shared memory: no pointers, the endpoint is stored as a digest
+typedef struct oauth2_http_health_t {
+	bool used;
+	unsigned char endpoint[SHA256_DIGEST_LENGTH];
+	oauth2_time_t last;
+	oauth2_http_health_state_t state;
+	// end of the open period or of the half-open probe
+	oauth2_time_t until;
+	oauth2_time_t window_start;
+	unsigned int calls;
+	unsigned int errors;
+	unsigned int latency[OAUTH2_HTTP_HEALTH_BUCKETS];
+} oauth2_http_health_t;
+
+static oauth2_ipc_shm_t *_oauth2_http_health_shm = NULL;
+static oauth2_ipc_mutex_t *_oauth2_http_health_mutex = NULL;
+// don't retry on every call when shared memory cannot be created
+static bool _oauth2_http_health_failed = false;
+// guards creation and destruction of the above within the process
+static pthread_mutex_t _oauth2_http_health_init_mutex =
+    PTHREAD_MUTEX_INITIALIZER;
+
+static void _oauth2_http_health_free(oauth2_log_t *log)
+{
+	if (_oauth2_http_health_shm) {
+		oauth2_ipc_mutex_lock(log, _oauth2_http_health_mutex);
+		oauth2_ipc_shm_free(log, _oauth2_http_health_shm);
+		oauth2_ipc_mutex_unlock(log, _oauth2_http_health_mutex);
+	}
+	if (_oauth2_http_health_mutex)
+		oauth2_ipc_mutex_free(log, _oauth2_http_health_mutex);
+	__atomic_store_n(&_oauth2_http_health_shm, NULL, __ATOMIC_RELEASE);
+	_oauth2_http_health_mutex = NULL;
 }
 
-bool oauth2_http_get(oauth2_log_t *log, const char *url,
-		     const oauth2_nv_list_t *params,
-		     oauth2_http_call_ctx_t *ctx, char **response,
-		     oauth2_http_status_code_t *status_code)
+// called from oauth2_init so a server that forks its workers after that
+// shares the table between them; otherwise created on first use
+bool _oauth2_http_health_init(oauth2_log_t *log)
 {
 	bool rc = false;
-	char *query_url = NULL;
+	oauth2_ipc_shm_t *shm = NULL;
 
-	oauth2_debug(log, "enter: %s", url);
+	pthread_mutex_lock(&_oauth2_http_health_init_mutex);
 
-	query_url = oauth2_http_url_query_encode(log, url, params);
-	rc = oauth2_http_call(log, query_url, NULL, ctx, response, status_code);
+	if (_oauth2_http_health_shm) {
+		rc = true;
+		goto end;
+	}
 
-	if (query_url)
-		oauth2_mem_free(query_url);
+	if (_oauth2_http_health_failed)
+		goto end;
 
-	oauth2_debug(log, "leave: %d", rc);
+	_oauth2_http_health_mutex = oauth2_ipc_mutex_init(log);
+	if (oauth2_ipc_mutex_post_config(log, _oauth2_http_health_mutex) ==
+	    false)
+		goto end;
 
-	return rc;
-}
+	// ftruncate'd shared memory is zero-filled: all slots are unused
+	shm = oauth2_ipc_shm_init(log, sizeof(oauth2_http_health_t) *
+					   OAUTH2_HTTP_HEALTH_MAX);
+	if (oauth2_ipc_shm_post_config(log, shm) == false)
+		goto end;
 
-bool oauth2_http_post_form(oauth2_log_t *log, const char *url,
-			   const oauth2_nv_list_t *params,
-			   oauth2_http_call_ctx_t *ctx, char **response,
-			   oauth2_http_status_code_t *status_code)
-{
-	bool rc = false;
-	char *data = NULL;
+	// publish only after the mutex and the mapping are complete
+	__atomic_store_n(&_oauth2_http_health_shm, shm, __ATOMIC_RELEASE);
 
-	data = oauth2_http_url_form_encode(log, params);
+	rc = true;
 
-	oauth2_http_call_ctx_content_type_set(log, ctx,
-					      OAUTH2_CONTENT_TYPE_FORM_ENCODED);
-	rc = oauth2_http_call(log, url, data, ctx, response, status_code);
+end:
 
-	if (data)
-		oauth2_mem_free(data);
+	if (rc == false) {
+		oauth2_error(log, "could not create the endpoint health table "
+				  "in shared memory, not tracking health");
+		if (shm)
+			oauth2_ipc_shm_free(log, shm);
+		_oauth2_http_health_free(log);
+		_oauth2_http_health_failed = true;
+	}
+
+	pthread_mutex_unlock(&_oauth2_http_health_init_mutex);
 
 	return rc;
 }
 
-bool oauth2_http_post_json(oauth2_log_t *log, const char *url,
-			   const json_t *json, oauth2_http_call_ctx_t *ctx,
-			   char **response,
-			   oauth2_http_status_code_t *status_code)
+static oauth2_http_health_t *_oauth2_http_health_lock(oauth2_log_t *log)
 {
-	bool rc = false;
-	char *json_str = NULL;
+	oauth2_http_health_t *rv = NULL;
 
-	if (json)
-		json_str = json_dumps(json, JSON_PRESERVE_ORDER | JSON_COMPACT);
+	if ((__atomic_load_n(&_oauth2_http_health_shm, __ATOMIC_ACQUIRE) ==
+	     NULL) &&
+	    (_oauth2_http_health_init(log) == false))
+		goto end;
 
-	oauth2_http_call_ctx_content_type_set(log, ctx,
-					      OAUTH2_CONTENT_TYPE_JSON);
-	rc = oauth2_http_call(log, url, json_str, ctx, response, status_code);
+	if (oauth2_ipc_mutex_lock(log, _oauth2_http_health_mutex) == false)
+		goto end;
 
-	if (json_str)
-		oauth2_mem_free(json_str);
+	rv = oauth2_ipc_shm_get(log, _oauth2_http_health_shm);
 
-	return rc;
+end:
+
+	return rv;
 }
 
-/*
- * query
- */
+static void _oauth2_http_health_unlock(oauth2_log_t *log)
+{
+	oauth2_ipc_mutex_unlock(log, _oauth2_http_health_mutex);
+}
 
-static bool _oauth2_http_request_query_parse(oauth2_log_t *log,
-					     oauth2_http_request_t *request)
+static char *_oauth2_http_health_key(oauth2_log_t *log, const char *url)
 {
-	bool rc = false;
+	char *rv = NULL, *p = NULL;
 
-	if (request == NULL)
-		goto end;
+	// the endpoint, without query parameters
+	rv = oauth2_strdup(url);
+	p = rv ? strchr(rv, _OAUTH2_CHAR_QUERY) : NULL;
+	if (p)
+		*p = '\0';
 
-	if (request->_parsed_query != NULL) {
-		rc = true;
-		goto end;
-	}
+	return rv;
+}
 
-	request->_parsed_query = oauth2_nv_list_init(log);
-	if (request->_parsed_query == NULL)
+// must be called with _oauth2_http_health_mutex held
+static oauth2_http_health_t *
+_oauth2_http_health_get(oauth2_http_health_t *table, const char *key,
+			oauth2_time_t now)
+{
+	oauth2_http_health_t *h = NULL, *victim = NULL;
+	unsigned char md[SHA256_DIGEST_LENGTH];
+	int i = 0;
+
+	if ((table == NULL) || (key == NULL))
 		goto end;
 
-	rc = _oauth2_nv_list_parse(log, request->query, request->_parsed_query,
-				   _OAUTH2_CHAR_AMP, _OAUTH2_CHAR_EQUAL, true,
+	SHA256((const unsigned char *)key, strlen(key), md);
+
+	for (i = 0; i < OAUTH2_HTTP_HEALTH_MAX; i++) {
+		h = &table[i];
+		if ((h->used) && (memcmp(h->endpoint, md, sizeof(md)) == 0))
+			goto end;
+		if ((victim == NULL) || (h->used == false) ||
+		    ((victim->used) && (h->last < victim->last)))
+			victim = h;
+	}
+
+	h = victim;
+	memset(h, 0, sizeof(*h));
+	memcpy(h->endpoint, md, sizeof(md));
+	h->used = true;
+
+end:
+
+	if (h)
+		h->last = now;
+
+	return h;
+}
+
+static oauth2_time_t
+_oauth2_http_health_hedge_delay(const oauth2_http_health_t *h)
+{
+	unsigned int i = 0, total = 0, sum = 0;
+
+	for (i = 0; i < OAUTH2_HTTP_HEALTH_BUCKETS; i++)
+		total += h->latency[i];
+
+	if (total < OAUTH2_HTTP_HEALTH_HEDGE_MIN_CALLS)
+		return 0;
+
+	for (i = 0; i < OAUTH2_HTTP_HEALTH_BUCKETS; i++) {
+		sum += h->latency[i];
+		if (sum * 100 >= total * OAUTH2_HTTP_HEALTH_HEDGE_PCT)
+			break;
+	}
+
+	// the last bucket is unbounded
+	return (i < OAUTH2_HTTP_HEALTH_BUCKETS)
+		   ? _oauth2_http_health_bucket_ms[i]
+		   : 0;
+}
+
+// returns false when the circuit breaker is open and the call must fail fast
+bool _oauth2_http_health_admit(oauth2_log_t *log, const char *key,
+			       oauth2_time_t now, oauth2_time_t timeout_s,
+			       oauth2_time_t *hedge_delay_ms)
+{
+	bool rc = true;
+	oauth2_http_health_t *table = NULL, *h = NULL;
+
+	table = _oauth2_http_health_lock(log);
+	if (table == NULL)
+		goto end;
+
+	h = _oauth2_http_health_get(table, key, now);
+	if (h == NULL)
+		goto unlock;
+
+	switch (h->state) {
+	case OAUTH2_HTTP_HEALTH_OPEN:
+	case OAUTH2_HTTP_HEALTH_HALF_OPEN:
+		if (h->until > now) {
+			rc = false;
+			break;
+		}
+		// let a single probe through, other calls keep failing fast
+		// until it completes or times out
+		oauth2_debug(log, "sending probe: %s", key);
+		h->state = OAUTH2_HTTP_HEALTH_HALF_OPEN;
+		h->until = now + timeout_s;
+		break;
+	default:
+		if (hedge_delay_ms)
+			*hedge_delay_ms = _oauth2_http_health_hedge_delay(h);
+		break;
+	}
+
+unlock:
+
+	_oauth2_http_health_unlock(log);
+
+end:
+
+	return rc;
+}
+
+void _oauth2_http_health_update(oauth2_log_t *log, const char *key,
+				oauth2_time_t now, bool ok,
+				oauth2_time_t latency_ms)
+{
+	oauth2_http_health_t *table = NULL, *h = NULL;
+	unsigned int i = 0;
+
+	table = _oauth2_http_health_lock(log);
+	if (table == NULL)
+		goto end;
+
+	h = _oauth2_http_health_get(table, key, now);
+	if (h == NULL)
+		goto unlock;
+
+	if (now >= h->window_start + OAUTH2_HTTP_HEALTH_WINDOW_S) {
+		h->calls /= 2;
+		h->errors /= 2;
+		for (i = 0; i < OAUTH2_HTTP_HEALTH_BUCKETS; i++)
+			h->latency[i] /= 2;
+		h->window_start = now;
+	}
+
+	h->calls++;
+	if (ok == false)
+		h->errors++;
+	for (i = 0; i < OAUTH2_HTTP_HEALTH_BUCKETS - 1; i++)
+		if (latency_ms <= _oauth2_http_health_bucket_ms[i])
+			break;
+	h->latency[i]++;
+
+	if (h->state == OAUTH2_HTTP_HEALTH_HALF_OPEN) {
+		if (ok) {
+			oauth2_info(log, "closing circuit breaker: %s", key);
+			h->state = OAUTH2_HTTP_HEALTH_CLOSED;
+			h->calls = 0;
+			h->errors = 0;
+		} else {
+			h->state = OAUTH2_HTTP_HEALTH_OPEN;
+			h->until = now + OAUTH2_HTTP_HEALTH_OPEN_S;
+		}
+	} else if ((h->state == OAUTH2_HTTP_HEALTH_CLOSED) &&
+		   (h->calls >= OAUTH2_HTTP_HEALTH_MIN_CALLS) &&
+		   (h->errors * 100 >=
+		    h->calls * OAUTH2_HTTP_HEALTH_ERROR_PCT)) {
+		oauth2_warn(log,
+			    "opening circuit breaker for %d seconds: %s (%u "
+			    "errors in %u calls)",
+			    OAUTH2_HTTP_HEALTH_OPEN_S, key, h->errors,
+			    h->calls);
+		h->state = OAUTH2_HTTP_HEALTH_OPEN;
+		h->until = now + OAUTH2_HTTP_HEALTH_OPEN_S;
+	}
+
+unlock:
+
+	_oauth2_http_health_unlock(log);
+
+end:
+
+	return;
+}
+
+/*
+ * hedging: when a call takes longer than the p95 latency of its endpoint, a
+ * second identical one is started and the first successful answer is used
+ */
+
+// a fast error response must not beat a slower successful one
+static bool _oauth2_http_curl_hedge_ok(CURL *curl, CURLcode result)
+{
+	long code = 0;
+
+	if (result != CURLE_OK)
+		return false;
+	if (curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code) != CURLE_OK)
+		return false;
+
+	return ((code >= 200) && (code < 300));
+}
+
+static CURLcode _oauth2_http_curl_perform_hedged(
+    oauth2_log_t *log, const char *url, const char *data,
+    oauth2_http_call_ctx_t *ctx, const char *origin, CURL **curl,
+    oauth2_http_curl_buf_t *buf, char *err, oauth2_time_t delay_ms)
+{
+	CURLcode rv = CURLE_FAILED_INIT, failed_rv = CURLE_FAILED_INIT;
+	CURLM *multi = NULL;
+	CURLMsg *msg = NULL;
+	CURL *hedge = NULL, *winner = NULL, *loser = NULL, *failed = NULL;
+	oauth2_http_curl_buf_t hbuf;
+	char herr[CURL_ERROR_SIZE];
+	struct curl_slist *h_list = NULL;
+	oauth2_time_t start = _oauth2_time_now_ms(), elapsed = 0;
+	int running = 0, left = 0, wait_ms = 0;
+	// the hedge is attempted once, even if no handle could be obtained
+	bool hedged = false;
+
+	_oauth2_http_curl_buf_init(log, &hbuf);
+
+	multi = curl_multi_init();
+	if ((multi == NULL) ||
+	    (curl_multi_add_handle(multi, *curl) != CURLM_OK)) {
+		rv = curl_easy_perform(*curl);
+		goto end;
+	}
+
+	while (winner == NULL) {
+
+		if (curl_multi_perform(multi, &running) != CURLM_OK)
+			break;
+
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			if (_oauth2_http_curl_hedge_ok(msg->easy_handle,
+						       msg->data.result)) {
+				rv = msg->data.result;
+				winner = msg->easy_handle;
+				break;
+			}
+			// a failure only counts if nothing else is in flight
+			failed = msg->easy_handle;
+			failed_rv = msg->data.result;
+			curl_multi_remove_handle(multi, msg->easy_handle);
+		}
+
+		if (winner)
+			break;
+
+		if (running == 0) {
+			rv = failed_rv;
+			winner = failed;
+			break;
+		}
+
+		elapsed = _oauth2_time_now_ms() - start;
+		if ((hedged == false) && (elapsed >= delay_ms)) {
+			oauth2_debug(log, "hedging after %llu ms: %s",
+				     (unsigned long long)elapsed, url);
+			hedged = true;
+			hedge = _oauth2_http_curl_acquire(log, origin);
+			if (hedge) {
+				_oauth2_http_curl_setup(log, hedge, url, data,
+							ctx, &hbuf, herr,
+							&h_list);
+				curl_multi_add_handle(multi, hedge);
+				continue;
+			}
+		}
+
+		wait_ms = hedged ? 1000 : (int)(delay_ms - elapsed);
+		curl_multi_wait(multi, NULL, 0, wait_ms, NULL);
+	}
+
+	loser = hedge;
+	if ((winner) && (winner == hedge)) {
+		oauth2_debug(log, "hedged call won: %s", url);
+		loser = *curl;
+		*curl = hedge;
+		if (buf->memory)
+			oauth2_mem_free(buf->memory);
+		buf->memory = hbuf.memory;
+		buf->size = hbuf.size;
+		buf->capacity = hbuf.capacity;
+		hbuf.memory = NULL;
+		memcpy(err, herr, CURL_ERROR_SIZE);
+	}
+
+	curl_multi_remove_handle(multi, *curl);
+	if (loser) {
+		curl_multi_remove_handle(multi, loser);
+		_oauth2_http_curl_release(log, origin, loser);
+	}
+
+end:
+
+	if (multi)
+		curl_multi_cleanup(multi);
+	if (h_list)
+		curl_slist_free_all(h_list);
+	if (hbuf.memory)
+		oauth2_mem_free(hbuf.memory);
+
+	return rv;
+}
+
+void _oauth2_http_shutdown(oauth2_log_t *log)
+{
+	int i = 0;
+
+	pthread_mutex_lock(&_oauth2_http_health_init_mutex);
+	_oauth2_http_health_free(log);
+	_oauth2_http_health_failed = false;
+	pthread_mutex_unlock(&_oauth2_http_health_init_mutex);
+
+	_oauth2_http_curl_pool_lock(log);
+
+	for (i = 0; i < OAUTH2_HTTP_CURL_POOL_MAX; i++) {
+		if (_oauth2_http_curl_pool[i].curl)
+			curl_easy_cleanup(_oauth2_http_curl_pool[i].curl);
+		if (_oauth2_http_curl_pool[i].origin)
+			oauth2_mem_free(_oauth2_http_curl_pool[i].origin);
+		_oauth2_http_curl_pool[i].curl = NULL;
+		_oauth2_http_curl_pool[i].origin = NULL;
+	}
+
+	_oauth2_http_curl_share_free(log);
+
+	_oauth2_http_curl_pool_pid = 0;
+
+	_oauth2_http_curl_pool_unlock(log);
+}
+
+static bool _oauth2_http_call(oauth2_log_t *log, const char *url,
+			      const char *data, oauth2_http_call_ctx_t *ctx,
+			      oauth2_http_curl_buf_t *buf,
+			      oauth2_http_status_code_t *status_code)
+{
+	bool rc = false;
+	char err[CURL_ERROR_SIZE];
+	CURL *curl = NULL;
+	CURLcode errornum = CURLE_OK;
+	struct curl_slist *h_list = NULL;
+	char *origin = NULL, *health = NULL;
+	oauth2_http_status_code_t code = 0;
+	oauth2_time_t start = 0, hedge_delay_ms = 0;
+
+	oauth2_debug(log, "enter: url=%s, data=%s, ctx=%s", url,
+		     data ? data : "(null)", _oauth2_http_call_ctx2s(log, ctx));
+
+	if (url == NULL)
+		goto end;
+
+	health = _oauth2_http_health_key(log, url);
+	if (_oauth2_http_health_admit(
+		log, health, oauth2_time_now_sec(),
+		ctx ? ctx->timeout : OAUTH2_HTTP_CALL_TIMEOUT_DEFAULT,
+		&hedge_delay_ms) == false) {
+		oauth2_error(log, "circuit breaker open, failing fast: %s",
+			     url);
+		// 503 Service Unavailable
+		if (status_code)
+			*status_code = 503;
+		goto end;
+	}
+
+	origin = _oauth2_http_url_origin(log, url);
+	if (origin == NULL)
+		goto end;
+
+	curl = _oauth2_http_curl_acquire(log, origin);
+	if (curl == NULL)
+		goto end;
+
+	_oauth2_http_curl_setup(log, curl, url, data, ctx, buf, err, &h_list);
+
+	start = _oauth2_time_now_ms();
+
+	// only hedge requests that are safe to send twice
+	if ((hedge_delay_ms > 0) && ((data == NULL) || (ctx && ctx->hedge)))
+		errornum = _oauth2_http_curl_perform_hedged(
+		    log, url, data, ctx, origin, &curl, buf, err,
+		    hedge_delay_ms);
+	else
+		errornum = curl_easy_perform(curl);
+
+	rc = _oauth2_http_curl_result(log, curl, url, errornum, err, &code);
+	if (status_code)
+		*status_code = code;
+
+	_oauth2_http_health_update(log, health, oauth2_time_now_sec(),
+				   rc && (code < 500),
+				   _oauth2_time_now_ms() - start);
+
+end:
+
+	_oauth2_http_curl_release(log, origin, curl);
+	if (h_list != NULL)
+		curl_slist_free_all(h_list);
+	if (origin)
+		oauth2_mem_free(origin);
+	if (health)
+		oauth2_mem_free(health);
+
+	oauth2_debug(log, "leave [%d]: %s", rc,
+		     buf->memory ? buf->memory : "(null)");
+
+	return rc;
+}
+
+bool oauth2_http_call(oauth2_log_t *log, const char *url, const char *data,
+		      oauth2_http_call_ctx_t *ctx, char **response,
+		      oauth2_http_status_code_t *status_code)
+{
+	bool rc = false;
+	oauth2_http_curl_buf_t buf;
+
+	_oauth2_http_curl_buf_init(log, &buf);
+
+	if (response == NULL)
+		goto end;
+
+	rc = _oauth2_http_call(log, url, data, ctx, &buf, status_code);
+	if (rc == false)
+		goto end;
+
+	// hand over the NUL terminated receive buffer itself
+	*response = buf.memory ? buf.memory : oauth2_strdup("");
+	buf.memory = NULL;
+
+end:
+
+	if (buf.memory)
+		oauth2_mem_free(buf.memory);
+
+	return rc;
+}
+
+/*
+ * asynchronous calls on a curl multi handle, driven by an external event loop
+ */
+
+typedef struct oauth2_http_async_call_t {
+	oauth2_http_async_t *async;
+	CURL *curl;
+	char *origin;
+	char *url;
+	char *data;
+	char *health;
+	oauth2_time_t start;
+	struct curl_slist *h_list;
+	oauth2_http_curl_buf_t buf;
+	char err[CURL_ERROR_SIZE];
+	oauth2_http_async_done_cb_t *callback;
+	void *arg;
+	struct oauth2_http_async_call_t *next;
+} oauth2_http_async_call_t;
+
+typedef struct oauth2_http_async_t {
+	CURLM *multi;
+	oauth2_log_t *log;
+	oauth2_http_async_socket_cb_t *socket_cb;
+	oauth2_http_async_timer_cb_t *timer_cb;
+	void *arg;
+	oauth2_http_async_call_t *calls;
+} oauth2_http_async_t;
+
+static int _oauth2_http_async_socket_cb(CURL *curl, curl_socket_t s, int what,
+					void *userp, void *socketp)
+{
+	oauth2_http_async_t *async = (oauth2_http_async_t *)userp;
+	int events = 0;
+
+	if (what == CURL_POLL_REMOVE)
+		events = OAUTH2_HTTP_ASYNC_POLL_REMOVE;
+	if ((what == CURL_POLL_IN) || (what == CURL_POLL_INOUT))
+		events |= OAUTH2_HTTP_ASYNC_POLL_IN;
+	if ((what == CURL_POLL_OUT) || (what == CURL_POLL_INOUT))
+		events |= OAUTH2_HTTP_ASYNC_POLL_OUT;
+
+	return async->socket_cb(async->log, s, events, async->arg) ? 0 : -1;
+}
+
+static int _oauth2_http_async_timer_cb(CURLM *multi, long timeout_ms,
+				       void *userp)
+{
+	oauth2_http_async_t *async = (oauth2_http_async_t *)userp;
+	return async->timer_cb(async->log, timeout_ms, async->arg) ? 0 : -1;
+}
+
+oauth2_http_async_t *
+oauth2_http_async_init(oauth2_log_t *log,
+		       oauth2_http_async_socket_cb_t *socket_cb,
+		       oauth2_http_async_timer_cb_t *timer_cb, void *arg)
+{
+	oauth2_http_async_t *async = NULL;
+
+	if ((socket_cb == NULL) || (timer_cb == NULL))
+		goto end;
+
+	async = oauth2_mem_alloc(sizeof(oauth2_http_async_t));
+	if (async == NULL)
+		goto end;
+
+	async->multi = curl_multi_init();
+	if (async->multi == NULL) {
+		oauth2_error(log, "curl_multi_init() error");
+		oauth2_mem_free(async);
+		async = NULL;
+		goto end;
+	}
+
+	async->log = log;
+	async->socket_cb = socket_cb;
+	async->timer_cb = timer_cb;
+	async->arg = arg;
+	async->calls = NULL;
+
+	curl_multi_setopt(async->multi, CURLMOPT_SOCKETFUNCTION,
+			  _oauth2_http_async_socket_cb);
+	curl_multi_setopt(async->multi, CURLMOPT_SOCKETDATA, async);
+	curl_multi_setopt(async->multi, CURLMOPT_TIMERFUNCTION,
+			  _oauth2_http_async_timer_cb);
+	curl_multi_setopt(async->multi, CURLMOPT_TIMERDATA, async);
+#if LIBCURL_VERSION_NUM >= 0x072B00
+	curl_multi_setopt(async->multi, CURLMOPT_PIPELINING,
+			  CURLPIPE_MULTIPLEX);
+#endif
+
+end:
+
+	return async;
+}
+
+// unlinks the call, returns its handle to the pool and frees it; the
+// response buffer is left alone so it can be handed over
+static void _oauth2_http_async_call_free(oauth2_log_t *log,
+					 oauth2_http_async_call_t *call)
+{
+	oauth2_http_async_call_t **ptr = NULL;
+
+	for (ptr = &call->async->calls; *ptr; ptr = &(*ptr)->next) {
+		if (*ptr == call) {
+			*ptr = call->next;
+			break;
+		}
+	}
+
+	if (call->curl) {
+		curl_multi_remove_handle(call->async->multi, call->curl);
+		_oauth2_http_curl_release(log, call->origin, call->curl);
+	}
+	if (call->h_list)
+		curl_slist_free_all(call->h_list);
+	if (call->data)
+		oauth2_mem_free(call->data);
+	if (call->url)
+		oauth2_mem_free(call->url);
+	if (call->health)
+		oauth2_mem_free(call->health);
+	if (call->origin)
+		oauth2_mem_free(call->origin);
+	oauth2_mem_free(call);
+}
+
+void oauth2_http_async_free(oauth2_log_t *log, oauth2_http_async_t *async)
+{
+	oauth2_http_async_call_t *call = NULL;
+	oauth2_http_async_done_cb_t *callback = NULL;
+	void *arg = NULL;
+
+	if (async == NULL)
+		goto end;
+
+	async->log = log;
+
+	// let pending callers release their state
+	while ((call = async->calls) != NULL) {
+		callback = call->callback;
+		arg = call->arg;
+		if (call->buf.memory)
+			oauth2_mem_free(call->buf.memory);
+		_oauth2_http_async_call_free(log, call);
+		callback(log, false, NULL, 0, arg);
+	}
+
+	if (async->multi)
+		curl_multi_cleanup(async->multi);
+	oauth2_mem_free(async);
+
+end:
+
+	return;
+}
+
+bool oauth2_http_call_async(oauth2_log_t *log, oauth2_http_async_t *async,
+			    const char *url, const char *data,
+			    oauth2_http_call_ctx_t *ctx,
+			    oauth2_http_async_done_cb_t *callback, void *arg)
+{
+	bool rc = false;
+	oauth2_http_async_call_t *call = NULL;
+	CURLMcode mc = CURLM_OK;
+
+	oauth2_debug(log, "enter: url=%s, data=%s, ctx=%s", url,
+		     data ? data : "(null)", _oauth2_http_call_ctx2s(log, ctx));
+
+	if ((async == NULL) || (url == NULL) || (callback == NULL))
+		goto end;
+
+	async->log = log;
+
+	call = oauth2_mem_alloc(sizeof(oauth2_http_async_call_t));
+	if (call == NULL)
+		goto end;
+
+	call->async = async;
+	call->callback = callback;
+	call->arg = arg;
+	_oauth2_http_curl_buf_init(log, &call->buf);
+	// curl does not copy these
+	call->url = oauth2_strdup(url);
+	call->data = data ? oauth2_strdup(data) : NULL;
+
+	call->next = async->calls;
+	async->calls = call;
+
+	call->health = _oauth2_http_health_key(log, url);
+	if (_oauth2_http_health_admit(
+		log, call->health, oauth2_time_now_sec(),
+		ctx ? ctx->timeout : OAUTH2_HTTP_CALL_TIMEOUT_DEFAULT,
+		NULL) == false) {
+		oauth2_error(log, "circuit breaker open, failing fast: %s",
+			     url);
+		goto end;
+	}
+
+	call->origin = _oauth2_http_url_origin(log, url);
+	if (call->origin == NULL)
+		goto end;
+
+	call->curl = _oauth2_http_curl_acquire(log, call->origin);
+	if (call->curl == NULL)
+		goto end;
+
+	_oauth2_http_curl_setup(log, call->curl, call->url, call->data, ctx,
+				&call->buf, call->err, &call->h_list);
+	curl_easy_setopt(call->curl, CURLOPT_PRIVATE, call);
+	call->start = _oauth2_time_now_ms();
+
+	mc = curl_multi_add_handle(async->multi, call->curl);
+	if (mc != CURLM_OK) {
+		oauth2_error(log, "curl_multi_add_handle() failed: %s",
+			     curl_multi_strerror(mc));
+		goto end;
+	}
+
+	rc = true;
+
+end:
+
+	if ((rc == false) && (call))
+		_oauth2_http_async_call_free(log, call);
+
+	oauth2_debug(log, "leave: %d", rc);
+
+	return rc;
+}
+
+static void _oauth2_http_async_done(oauth2_log_t *log,
+				    oauth2_http_async_t *async)
+{
+	CURLMsg *msg = NULL;
+	int left = 0;
+	oauth2_http_async_call_t *call = NULL;
+	oauth2_http_async_done_cb_t *callback = NULL;
+	oauth2_http_status_code_t status_code = 0;
+	char *response = NULL;
+	void *arg = NULL;
+	bool rc = false;
+
+	while ((msg = curl_multi_info_read(async->multi, &left)) != NULL) {
+
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		call = NULL;
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &call);
+		if (call == NULL)
+			continue;
+
+		status_code = 0;
+		rc = _oauth2_http_curl_result(log, call->curl, call->url,
+					      msg->data.result, call->err,
+					      &status_code);
+		_oauth2_http_health_update(log, call->health,
+					   oauth2_time_now_sec(),
+					   rc && (status_code < 500),
+					   _oauth2_time_now_ms() - call->start);
+
+		response = call->buf.memory;
+		if ((rc) && (response == NULL))
+			response = oauth2_strdup("");
+		if ((rc == false) && (response)) {
+			oauth2_mem_free(response);
+			response = NULL;
+		}
+
+		callback = call->callback;
+		arg = call->arg;
+
+		// the callback may start new calls on this engine
+		_oauth2_http_async_call_free(log, call);
+		callback(log, rc, response, status_code, arg);
+	}
+}
+
+bool oauth2_http_async_action(oauth2_log_t *log, oauth2_http_async_t *async,
+			      int fd, int events)
+{
+	bool rc = false;
+	int running = 0, ev = 0;
+	CURLMcode mc = CURLM_OK;
+
+	if (async == NULL)
+		goto end;
+
+	async->log = log;
+
+	if (events & OAUTH2_HTTP_ASYNC_POLL_IN)
+		ev |= CURL_CSELECT_IN;
+	if (events & OAUTH2_HTTP_ASYNC_POLL_OUT)
+		ev |= CURL_CSELECT_OUT;
+
+	mc = curl_multi_socket_action(async->multi,
+				      (fd == OAUTH2_HTTP_ASYNC_TIMEOUT)
+					  ? CURL_SOCKET_TIMEOUT
+					  : (curl_socket_t)fd,
+				      ev, &running);
+	if (mc != CURLM_OK) {
+		oauth2_error(log, "curl_multi_socket_action() failed: %s",
+			     curl_multi_strerror(mc));
+		goto end;
+	}
+
+	_oauth2_http_async_done(log, async);
+
+	rc = true;
+
+end:
+
+	return rc;
+}
+
+bool oauth2_http_get_json(oauth2_log_t *log, const char *url,
+			  const oauth2_nv_list_t *params,
+			  oauth2_http_call_ctx_t *ctx, json_t **json,
+			  oauth2_http_status_code_t *status_code)
+{
+	bool rc = false;
+	char *query_url = NULL;
+	json_error_t err;
+	oauth2_http_curl_buf_t buf;
+
+	_oauth2_http_curl_buf_init(log, &buf);
+
+	oauth2_debug(log, "enter: %s", url);
+
+	if (json == NULL)
+		goto end;
+
+	query_url = oauth2_http_url_query_encode(log, url, params);
+	if (_oauth2_http_call(log, query_url, NULL, ctx, &buf, status_code) ==
+	    false)
+		goto end;
+
+	if (buf.memory == NULL) {
+		oauth2_error(log, "empty HTTP response");
+		goto end;
+	}
+
+	// parse straight from the receive buffer instead of a copy of it
+	*json = json_loadb(buf.memory, buf.size, 0, &err);
+	if (*json == NULL) {
+		oauth2_error(log, "json_loadb failed: %s", err.text);
+		goto end;
+	}
+
+	rc = true;
+
+end:
+
+	if (buf.memory)
+		oauth2_mem_free(buf.memory);
+	if (query_url)
+		oauth2_mem_free(query_url);
+
+	oauth2_debug(log, "leave: %d", rc);
+
+	return rc;
+}
+
+bool oauth2_http_get(oauth2_log_t *log, const char *url,
+		     const oauth2_nv_list_t *params,
+		     oauth2_http_call_ctx_t *ctx, char **response,
+		     oauth2_http_status_code_t *status_code)
+{
+	bool rc = false;
+	char *query_url = NULL;
+
+	oauth2_debug(log, "enter: %s", url);
+
+	query_url = oauth2_http_url_query_encode(log, url, params);
+	rc = oauth2_http_call(log, query_url, NULL, ctx, response, status_code);
+
+	if (query_url)
+		oauth2_mem_free(query_url);
+
+	oauth2_debug(log, "leave: %d", rc);
+
+	return rc;
+}
+
+bool oauth2_http_post_form(oauth2_log_t *log, const char *url,
+			   const oauth2_nv_list_t *params,
+			   oauth2_http_call_ctx_t *ctx, char **response,
+			   oauth2_http_status_code_t *status_code)
+{
+	bool rc = false;
+	char *data = NULL;
+
+	data = oauth2_http_url_form_encode(log, params);
+
+	oauth2_http_call_ctx_content_type_set(log, ctx,
+					      OAUTH2_CONTENT_TYPE_FORM_ENCODED);
+	rc = oauth2_http_call(log, url, data, ctx, response, status_code);
+
+	if (data)
+		oauth2_mem_free(data);
+
+	return rc;
+}
+
+bool oauth2_http_post_json(oauth2_log_t *log, const char *url,
+			   const json_t *json, oauth2_http_call_ctx_t *ctx,
+			   char **response,
+			   oauth2_http_status_code_t *status_code)
+{
+	bool rc = false;
+	char *json_str = NULL;
+
+	if (json)
+		json_str = json_dumps(json, JSON_PRESERVE_ORDER | JSON_COMPACT);
+
+	oauth2_http_call_ctx_content_type_set(log, ctx,
+					      OAUTH2_CONTENT_TYPE_JSON);
+	rc = oauth2_http_call(log, url, json_str, ctx, response, status_code);
+
+	if (json_str)
+		oauth2_mem_free(json_str);
+
+	return rc;
+}
+
+/*
+ * query
+ */
+
+static bool _oauth2_http_request_query_parse(oauth2_log_t *log,
+					     oauth2_http_request_t *request)
+{
+	bool rc = false;
+
+	if (request == NULL)
+		goto end;
+
+	if (request->_parsed_query != NULL) {
+		rc = true;
+		goto end;
+	}
+
+	request->_parsed_query = oauth2_nv_list_init(log);
+	if (request->_parsed_query == NULL)
+		goto end;
+
+	rc = _oauth2_nv_list_parse(log, request->query, request->_parsed_query,
+				   _OAUTH2_CHAR_AMP, _OAUTH2_CHAR_EQUAL, true,
 				   false);
 
 end:
@@ -1300,20 +2563,91 @@ end:
 	return true;
 }
 
+static bool _oauth2_http_cookie_find(const char *cookies, const char *name,
+				     _oauth2_nv_slice_t *slice)
+{
+	size_t len = strlen(name);
+
+	while (_oauth2_nv_slice_next(&cookies, _OAUTH2_CHAR_SEMICOL,
+				     _OAUTH2_CHAR_EQUAL, true, slice))
+		if ((slice->name_len == len) &&
+		    (strncmp(slice->name, name, len) == 0))
+			return true;
+
+	return false;
+}
+
+// rewrites the Cookie header without the first cookie called name
+static bool _oauth2_http_request_cookie_strip(oauth2_log_t *log,
+					      oauth2_http_request_t *request,
+					      const char *cookies,
+					      const char *name)
+{
+	bool rc = false, found = false;
+	oauth2_strbuf_t sb;
+	_oauth2_nv_slice_t slice;
+	size_t len = strlen(name);
+
+	oauth2_strbuf_init(&sb, strlen(cookies) + 1);
+
+	while (_oauth2_nv_slice_next(&cookies, _OAUTH2_CHAR_SEMICOL,
+				     _OAUTH2_CHAR_EQUAL, true, &slice)) {
+		if ((found == false) && (slice.name_len == len) &&
+		    (strncmp(slice.name, name, len) == 0)) {
+			found = true;
+			continue;
+		}
+		if (sb.buf)
+			oauth2_strbuf_append(&sb, _OAUTH2_STR_SEMICOL " ");
+		oauth2_strbuf_appendn(&sb, slice.pair, slice.pair_len);
+	}
+
+	if (sb.failed)
+		goto end;
+
+	// the other cookies are passed on verbatim
+	if (sb.buf)
+		rc = _oauth2_http_request_header_cookie_set(log, request,
+							    sb.buf);
+	else
+		rc = oauth2_http_request_header_unset(log, request,
+						      OAUTH2_HTTP_HDR_COOKIE);
+
+end:
+
+	oauth2_strbuf_free(&sb);
+
+	return rc;
+}
+
 char *oauth2_http_request_cookie_get(oauth2_log_t *log,
 				     oauth2_http_request_t *request,
 				     const char *name, bool strip)
 {
 	char *rv = NULL;
-	const char *value = NULL;
+	const char *value = NULL, *cookies = NULL;
+	_oauth2_nv_slice_t slice;
 
 	oauth2_debug(log, "enter: %s", name);
 
 	if ((request == NULL) || (name == NULL))
 		goto end;
 
-	if (_oauth2_http_request_get_parsed_cookies(log, request) == false)
+	/*
+	 * until a cookie is set the Cookie header is scanned in place rather
+	 * than parsed into a list of copies
+	 */
+	if (request->_parsed_cookies == NULL) {
+		cookies = oauth2_http_request_header_cookie_get(log, request);
+		if ((cookies == NULL) ||
+		    (_oauth2_http_cookie_find(cookies, name, &slice) == false))
+			goto end;
+		rv = oauth2_strndup(slice.value, slice.value_len);
+		if (strip)
+			_oauth2_http_request_cookie_strip(log, request, cookies,
+							  name);
 		goto end;
+	}
 
 	value = oauth2_nv_list_get(log, request->_parsed_cookies, name);
 	if (value == NULL)
@@ -43,11 +43,20 @@
 // from the sema.h docs
 #define _OAUTH2_IPC_NAME_MAX 63
 
+// IPC primitives live as long as the process, never in a request arena
+static void *_oauth2_ipc_alloc(size_t size)
+{
+	bool suspended = oauth2_mem_arena_suspend();
+	void *ptr = oauth2_mem_alloc(size);
+	oauth2_mem_arena_resume(suspended);
+	return ptr;
+}
+
 static char *_oauth2_ipc_get_name(oauth2_log_t *log, const char *type,
 				  void *ptr)
 {
 	char *rv = NULL;
-	rv = oauth2_mem_alloc(_OAUTH2_IPC_NAME_MAX);
+	rv = _oauth2_ipc_alloc(_OAUTH2_IPC_NAME_MAX);
 	oauth2_snprintf(rv, _OAUTH2_IPC_NAME_MAX, "/zzo-%s-%ld.%p", type,
 			(long int)getpid(), ptr);
 	return rv;
@@ -64,7 +73,7 @@ typedef struct oauth2_ipc_sema_t {
 
 oauth2_ipc_sema_t *oauth2_ipc_sema_init(oauth2_log_t *log)
 {
-	oauth2_ipc_sema_t *s = oauth2_mem_alloc(sizeof(oauth2_ipc_sema_t));
+	oauth2_ipc_sema_t *s = _oauth2_ipc_alloc(sizeof(oauth2_ipc_sema_t));
 	if (s) {
 		s->sema = NULL;
 	}
@@ -221,7 +230,7 @@ typedef struct oauth2_ipc_mutex_t {
 
 oauth2_ipc_mutex_t *oauth2_ipc_mutex_init(oauth2_log_t *log)
 {
-	oauth2_ipc_mutex_t *m = oauth2_mem_alloc(sizeof(oauth2_ipc_mutex_t));
+	oauth2_ipc_mutex_t *m = _oauth2_ipc_alloc(sizeof(oauth2_ipc_mutex_t));
 	if (m) {
 		m->mutex = oauth2_ipc_sema_init(log);
 	}
@@ -306,7 +315,7 @@ typedef struct oauth2_ipc_shm_t {
 
 oauth2_ipc_shm_t *oauth2_ipc_shm_init(oauth2_log_t *log, size_t size)
 {
-	oauth2_ipc_shm_t *shm = oauth2_mem_alloc(sizeof(oauth2_ipc_shm_t));
+	oauth2_ipc_shm_t *shm = _oauth2_ipc_alloc(sizeof(oauth2_ipc_shm_t));
 	shm->mutex = oauth2_ipc_mutex_init(log);
 	shm->fd = -1;
 	shm->num = oauth2_ipc_sema_init(log);
@@ -337,10 +346,18 @@ void oauth2_ipc_shm_free(oauth2_log_t *log, oauth2_ipc_shm_t *shm)
 		// if we cannot lock it, it is 0
 		// TODO: isn't close enough?
 		rc = oauth2_ipc_sema_trywait(log, shm->num);
+		// the last process that detaches removes the name
+		if ((rc == true) && (oauth2_ipc_sema_trywait(log, shm->num)))
+			oauth2_ipc_sema_post(log, shm->num);
+		else
+			rc = false;
 		if (rc == false) {
 			rv = shm_unlink(shm->name);
-			oauth2_error(log, "shm_unlink() failed: %s (%d)",
-				     strerror(errno), rv);
+			// another process may have removed it already
+			if ((rv != 0) && (errno != ENOENT))
+				oauth2_error(log,
+					     "shm_unlink() failed: %s (%d)",
+					     strerror(errno), rv);
 		}
 		oauth2_ipc_sema_free(log, shm->num);
 		shm->num = NULL;
@@ -35,6 +35,11 @@
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
 #include <openssl/pem.h>
+#include <openssl/sha.h>
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 
 #define _OAUTH2_JOSE_OPENSSL_ERR_LOG(log, function)                            \
 	oauth2_error(log, "%s failed: %s", function,                           \
@@ -149,7 +154,7 @@ bool oauth2_jose_hash_bytes(oauth2_log_t *log, const char *digest,
 	if (!EVP_DigestFinal(ctx, md_value, dst_len))
 		goto end;
 
-	*dst = oauth2_mem_alloc((size_t)*dst_len);
+	*dst = oauth2_mem_alloc_uninit((size_t)*dst_len);
 	if (*dst == NULL) {
 		*dst_len = 0;
 		goto end;
@@ -411,7 +416,7 @@ bool oauth2_jose_jwt_decrypt(oauth2_log_t *log, const char *secret,
 	}
 	oauth2_trace1(log, "plaintext retrieved");
 
-	payload = oauth2_mem_alloc(payload_len + 1);
+	payload = oauth2_mem_alloc_uninit(payload_len + 1);
 	strncpy(payload, (const char *)s_payload, payload_len);
 	payload[payload_len] = '\0';
 	oauth2_trace1(log, "plaintext copied");
@@ -473,6 +478,8 @@ ctx->uri = NULL;
 ctx->ssl_verify = true;
 ctx->cache = NULL;
 ctx->expiry_s = OAUTH2_CFG_UINT_UNSET;
+ctx->refresh = false;
+ctx->refreshed = 0;
 _OAUTH2_CFG_CTX_INIT_END
 
 _OAUTH2_CFG_CTX_CLONE_START(oauth2_uri_ctx)
@@ -480,6 +487,8 @@ dst->uri = oauth2_strdup(src->uri);
 dst->ssl_verify = src->ssl_verify;
 dst->cache = oauth2_cache_clone(log, src->cache);
 dst->expiry_s = src->expiry_s;
+dst->refresh = src->refresh;
+dst->refreshed = 0;
 _OAUTH2_CFG_CTX_CLONE_END
 
 _OAUTH2_CFG_CTX_FREE_START(oauth2_uri_ctx)
@@ -697,73 +706,254 @@ end:
 }
 
 #define OAUTH2_JOSE_JWT_IAT_SLACK_DEFAULT (oauth2_uint_t)10
+#define OAUTH2_JOSE_JWT_NBF_SLACK_DEFAULT (oauth2_uint_t)10
 
 #define OAUTH2_JOSE_JWT_IAT_SLACK_BEFORE "verify.iat.slack_before"
 #define OAUTH2_JOSE_JWT_IAT_SLACK_AFTER "verify.iat.slack_after"
+#define OAUTH2_JOSE_JWT_NBF_SLACK "verify.nbf.slack"
 #define OAUTH2_JOSE_JWT_ISS_VALIDATE "verify.iss"
+#define OAUTH2_JOSE_JWT_ISS_VALUE "verify.iss.value"
+#define OAUTH2_JOSE_JWT_AUD_VALIDATE "verify.aud"
+#define OAUTH2_JOSE_JWT_AUD_VALUE "verify.aud.value"
 #define OAUTH2_JOSE_JWT_EXP_VALIDATE "verify.exp"
+#define OAUTH2_JOSE_JWT_NBF_VALIDATE "verify.nbf"
 #define OAUTH2_JOSE_JWT_IAT_VALIDATE "verify.iat"
+#define OAUTH2_JOSE_JWT_CLAIMS_REQUIRED "verify.claims.required"
+
+#define OAUTH2_JOSE_JWT_NBF "nbf"
+
+// the one-pass validator keeps track of the checks that matched in a bitmask
+#define OAUTH2_JOSE_JWT_CLAIM_CHECKS_MAX 32
+
+static void
+_oauth2_jose_jwt_claim_checks_free(oauth2_log_t *log,
+				   oauth2_jose_jwt_claim_check_t *checks,
+				   oauth2_uint_t n)
+{
+	oauth2_uint_t i = 0;
+
+	if (checks == NULL)
+		goto end;
+
+	for (i = 0; i < n; i++) {
+		if (checks[i].claim)
+			oauth2_mem_free(checks[i].claim);
+		if (checks[i].value)
+			oauth2_mem_free(checks[i].value);
+	}
+	oauth2_mem_free(checks);
+
+end:
+
+	return;
+}
+
+static oauth2_jose_jwt_claim_check_t *
+_oauth2_jose_jwt_claim_checks_clone(oauth2_log_t *log,
+				    const oauth2_jose_jwt_claim_check_t *src,
+				    oauth2_uint_t n)
+{
+	oauth2_jose_jwt_claim_check_t *dst = NULL;
+	oauth2_uint_t i = 0;
+
+	if ((src == NULL) || (n == 0))
+		goto end;
+
+	dst = oauth2_mem_alloc(n * sizeof(oauth2_jose_jwt_claim_check_t));
+	for (i = 0; i < n; i++) {
+		dst[i] = src[i];
+		dst[i].claim = oauth2_strdup(src[i].claim);
+		dst[i].value = oauth2_strdup(src[i].value);
+	}
+
+end:
+
+	return dst;
+}
+
+// distinguishes verify contexts in the negative cache across reallocation;
+// contexts are created on request threads too
+static oauth2_uint_t _oauth2_jose_jwt_verify_ctx_id = 0;
 
 _OAUTH2_CFG_CTX_INIT_START(oauth2_jose_jwt_verify_ctx)
-ctx->exp_validate = OAUTH2_CFG_UINT_UNSET;
-ctx->iat_validate = OAUTH2_CFG_UINT_UNSET;
-ctx->iss_validate = OAUTH2_CFG_UINT_UNSET;
-ctx->iat_slack_after = OAUTH2_CFG_UINT_UNSET;
-ctx->iat_slack_before = OAUTH2_CFG_UINT_UNSET;
+ctx->id =
+    __atomic_add_fetch(&_oauth2_jose_jwt_verify_ctx_id, 1, __ATOMIC_RELAXED);
+ctx->checks = NULL;
+ctx->n_checks = 0;
 ctx->jwks_provider = NULL;
 _OAUTH2_CFG_CTX_INIT_END
 
 _OAUTH2_CFG_CTX_CLONE_START(oauth2_jose_jwt_verify_ctx)
-dst->exp_validate = src->exp_validate;
-dst->iat_slack_after = src->iat_slack_after;
-dst->iat_slack_before = src->iat_slack_before;
-dst->iat_validate = src->iat_validate;
-dst->iss_validate = src->iss_validate;
+dst->id =
+    __atomic_add_fetch(&_oauth2_jose_jwt_verify_ctx_id, 1, __ATOMIC_RELAXED);
+dst->checks =
+    _oauth2_jose_jwt_claim_checks_clone(log, src->checks, src->n_checks);
+dst->n_checks = dst->checks ? src->n_checks : 0;
 dst->jwks_provider = _oauth2_jose_jwks_provider_clone(log, src->jwks_provider);
 _OAUTH2_CFG_CTX_CLONE_END
 
 _OAUTH2_CFG_CTX_FREE_START(oauth2_jose_jwt_verify_ctx)
+_oauth2_jose_jwt_claim_checks_free(log, ctx->checks, ctx->n_checks);
 if (ctx->jwks_provider)
 	_oauth2_jose_jwks_provider_free(log, ctx->jwks_provider);
 _OAUTH2_CFG_CTX_FREE_END
 
 _OAUTH2_CFG_CTX_FUNCS(oauth2_jose_jwt_verify_ctx)
 
+static oauth2_jose_jwt_claim_check_t *
+_oauth2_jose_jwt_claim_check_add(oauth2_log_t *log,
+				 oauth2_jose_jwt_verify_ctx_t *jwt_verify,
+				 const char *claim,
+				 oauth2_jose_jwt_claim_op_t op,
+				 oauth2_jose_jwt_validate_claim_t validate,
+				 const char *value)
+{
+	oauth2_jose_jwt_claim_check_t *check = NULL;
+
+	if (validate == OAUTH2_JOSE_JWT_VALIDATE_CLAIM_SKIP)
+		goto end;
+
+	if (jwt_verify->n_checks >= OAUTH2_JOSE_JWT_CLAIM_CHECKS_MAX) {
+		oauth2_error(log, "too many claim checks configured (max=%d)",
+			     OAUTH2_JOSE_JWT_CLAIM_CHECKS_MAX);
+		goto end;
+	}
+
+	check = &jwt_verify->checks[jwt_verify->n_checks];
+	check->claim = oauth2_strdup(claim);
+	check->op = op;
+	check->validate = validate;
+	check->value = oauth2_strdup(value);
+	check->slack_before = OAUTH2_CFG_UINT_UNSET;
+	check->slack_after = OAUTH2_CFG_UINT_UNSET;
+	jwt_verify->n_checks++;
+
+	oauth2_debug(log, "claim check: %s (op=%d, validate=%s)", claim, op,
+		     _oauth2_validate_claim_option2s(validate));
+
+end:
+
+	return check;
+}
+
+static oauth2_jose_jwt_validate_claim_t
+_oauth2_jose_jwt_validate_option_get(oauth2_log_t *log,
+				     const oauth2_nv_list_t *params,
+				     const char *name,
+				     oauth2_jose_jwt_validate_claim_t def)
+{
+	return _oauth2_parse_validate_claim_option(
+	    log, oauth2_nv_list_get(log, params, name), def);
+}
+
 bool oauth2_jose_jwt_verify_set_options(
     oauth2_log_t *log, oauth2_jose_jwt_verify_ctx_t *jwt_verify,
     oauth2_jose_jwks_provider_type_t type, const oauth2_nv_list_t *params)
 {
+	bool rc = false;
+	oauth2_jose_jwt_validate_claim_t validate;
+	oauth2_jose_jwt_claim_check_t *check = NULL;
+	const char *value = NULL;
+	char *list = NULL, *claim = NULL, *save = NULL;
+
 	jwt_verify->jwks_provider = _oauth2_jose_jwks_provider_init(log, type);
 
-	jwt_verify->iss_validate = _oauth2_parse_validate_claim_option(
-	    log, oauth2_nv_list_get(log, params, OAUTH2_JOSE_JWT_ISS_VALIDATE),
+	_oauth2_jose_jwt_claim_checks_free(log, jwt_verify->checks,
+					   jwt_verify->n_checks);
+	jwt_verify->checks =
+	    oauth2_mem_alloc(OAUTH2_JOSE_JWT_CLAIM_CHECKS_MAX *
+			     sizeof(oauth2_jose_jwt_claim_check_t));
+	jwt_verify->n_checks = 0;
+
+	validate = _oauth2_jose_jwt_validate_option_get(
+	    log, params, OAUTH2_JOSE_JWT_ISS_VALIDATE,
 	    OAUTH2_JOSE_JWT_VALIDATE_CLAIM_OPTIONAL);
-	jwt_verify->exp_validate = _oauth2_parse_validate_claim_option(
-	    log, oauth2_nv_list_get(log, params, OAUTH2_JOSE_JWT_EXP_VALIDATE),
+	value = oauth2_nv_list_get(log, params, OAUTH2_JOSE_JWT_ISS_VALUE);
+	_oauth2_jose_jwt_claim_check_add(log, jwt_verify, OAUTH2_JOSE_JWT_ISS,
+					 OAUTH2_JOSE_JWT_CLAIM_OP_ISS, validate,
+					 value);
+
+	// the audience can only be checked against a configured value
+	value = oauth2_nv_list_get(log, params, OAUTH2_JOSE_JWT_AUD_VALUE);
+	validate = _oauth2_jose_jwt_validate_option_get(
+	    log, params, OAUTH2_JOSE_JWT_AUD_VALIDATE,
+	    value ? OAUTH2_JOSE_JWT_VALIDATE_CLAIM_REQUIRED
+		  : OAUTH2_JOSE_JWT_VALIDATE_CLAIM_SKIP);
+	_oauth2_jose_jwt_claim_check_add(log, jwt_verify, OAUTH2_JOSE_JWT_AUD,
+					 OAUTH2_JOSE_JWT_CLAIM_OP_AUD, validate,
+					 value);
+
+	validate = _oauth2_jose_jwt_validate_option_get(
+	    log, params, OAUTH2_JOSE_JWT_EXP_VALIDATE,
 	    OAUTH2_JOSE_JWT_VALIDATE_CLAIM_OPTIONAL);
-	jwt_verify->iat_validate = _oauth2_parse_validate_claim_option(
-	    log, oauth2_nv_list_get(log, params, OAUTH2_JOSE_JWT_IAT_VALIDATE),
+	_oauth2_jose_jwt_claim_check_add(log, jwt_verify, OAUTH2_JOSE_JWT_EXP,
+					 OAUTH2_JOSE_JWT_CLAIM_OP_EXP, validate,
+					 NULL);
+
+	validate = _oauth2_jose_jwt_validate_option_get(
+	    log, params, OAUTH2_JOSE_JWT_NBF_VALIDATE,
 	    OAUTH2_JOSE_JWT_VALIDATE_CLAIM_OPTIONAL);
-	;
-	jwt_verify->iat_slack_before = oauth2_parse_uint(
-	    log,
-	    oauth2_nv_list_get(log, params, OAUTH2_JOSE_JWT_IAT_SLACK_BEFORE),
-	    OAUTH2_JOSE_JWT_IAT_SLACK_DEFAULT);
-	// TODO: this is probably different (default -1) for id_token's
-	//       would we need to pass all flags explicitly in init?
-	jwt_verify->iat_slack_after = oauth2_parse_uint(
-	    log,
-	    oauth2_nv_list_get(log, params, OAUTH2_JOSE_JWT_IAT_SLACK_AFTER),
-	    OAUTH2_CFG_UINT_UNSET);
-
-	// TODO: calculate rc based on previous calls
-	return true;
+	check = _oauth2_jose_jwt_claim_check_add(
+	    log, jwt_verify, OAUTH2_JOSE_JWT_NBF, OAUTH2_JOSE_JWT_CLAIM_OP_NBF,
+	    validate, NULL);
+	if (check)
+		check->slack_after = oauth2_parse_uint(
+		    log,
+		    oauth2_nv_list_get(log, params, OAUTH2_JOSE_JWT_NBF_SLACK),
+		    OAUTH2_JOSE_JWT_NBF_SLACK_DEFAULT);
+
+	validate = _oauth2_jose_jwt_validate_option_get(
+	    log, params, OAUTH2_JOSE_JWT_IAT_VALIDATE,
+	    OAUTH2_JOSE_JWT_VALIDATE_CLAIM_OPTIONAL);
+	check = _oauth2_jose_jwt_claim_check_add(
+	    log, jwt_verify, OAUTH2_JOSE_JWT_IAT, OAUTH2_JOSE_JWT_CLAIM_OP_IAT,
+	    validate, NULL);
+	if (check) {
+		check->slack_before = oauth2_parse_uint(
+		    log,
+		    oauth2_nv_list_get(log, params,
+				       OAUTH2_JOSE_JWT_IAT_SLACK_BEFORE),
+		    OAUTH2_JOSE_JWT_IAT_SLACK_DEFAULT);
+		// TODO: this is probably different (default -1) for id_token's
+		//       would we need to pass all flags explicitly in init?
+		check->slack_after = oauth2_parse_uint(
+		    log,
+		    oauth2_nv_list_get(log, params,
+				       OAUTH2_JOSE_JWT_IAT_SLACK_AFTER),
+		    OAUTH2_CFG_UINT_UNSET);
+	}
+
+	value =
+	    oauth2_nv_list_get(log, params, OAUTH2_JOSE_JWT_CLAIMS_REQUIRED);
+	if (value) {
+		list = oauth2_strdup(value);
+		for (claim = strtok_r(list, " ,", &save); claim;
+		     claim = strtok_r(NULL, " ,", &save)) {
+			if (_oauth2_jose_jwt_claim_check_add(
+				log, jwt_verify, claim,
+				OAUTH2_JOSE_JWT_CLAIM_OP_PRESENT,
+				OAUTH2_JOSE_JWT_VALIDATE_CLAIM_REQUIRED,
+				NULL) == NULL)
+				goto end;
+		}
+	}
+
+	rc = true;
+
+end:
+
+	if (list)
+		oauth2_mem_free(list);
+
+	return rc;
 }
 
 typedef struct oauth2_jose_jwt_verify_jwk_ctx_t {
 	cjose_jws_t *jws;
 	const char *kid;
 	bool verified;
+	// a key with the (non-NULL) kid of the JWS was found
+	bool kid_found;
 } oauth2_jose_jwt_verify_jwk_ctx_t;
 
 static bool _oauth2_jose_jwt_verify_jwk(oauth2_log_t *log, void *rec,
@@ -786,6 +976,9 @@ static bool _oauth2_jose_jwt_verify_jwk(oauth2_log_t *log, void *rec,
 	    (strcmp(ctx->kid, kid) != 0))
 		goto end;
 
+	if ((ctx->kid != NULL) && (kid != NULL) && (strcmp(ctx->kid, kid) == 0))
+		ctx->kid_found = true;
+
 	if (cjose_jws_verify(ctx->jws, jwk->jwk, &err) == true) {
 		oauth2_debug(log, "cjose_jws_verify returned true");
 		ctx->verified = true;
@@ -804,10 +997,9 @@ char *oauth2_jose_jwt_header_peek(oauth2_log_t *log,
 				  const char *compact_encoded_jwt,
 				  const char **alg)
 {
-	char *input = NULL, *result = NULL;
 	json_t *json = NULL;
 	char *p = NULL;
-	size_t result_len;
+	size_t input_len = 0, rv_len = 0;
 	char *rv = NULL;
 
 	if (compact_encoded_jwt == NULL)
@@ -817,18 +1009,20 @@ char *oauth2_jose_jwt_header_peek(oauth2_log_t *log,
 	if (p == NULL)
 		goto end;
 
-	input = oauth2_strndup(compact_encoded_jwt,
-			       strlen(compact_encoded_jwt) - strlen(p));
-
-	oauth2_debug(log, "decoding: %s (%d-%d=%d)", input,
-		     strlen(compact_encoded_jwt), strlen(p),
-		     strlen(compact_encoded_jwt) - strlen(p));
-
-	if (oauth2_base64url_decode(log, input, (uint8_t **)&result,
-				    &result_len) == false)
+	// decode the header segment in place, without copying it out first
+	input_len = p - compact_encoded_jwt;
+	rv_len = oauth2_base64_decode_len(input_len);
+	rv = oauth2_mem_alloc_uninit(rv_len + 1);
+	if (rv == NULL)
 		goto end;
 
-	rv = oauth2_strndup(result, result_len);
+	if (oauth2_base64url_decode_buf(log, compact_encoded_jwt, input_len,
+					(uint8_t *)rv, &rv_len) == false) {
+		oauth2_mem_free(rv);
+		rv = NULL;
+		goto end;
+	}
+	rv[rv_len] = '\0';
 
 	oauth2_debug(log, "decoded: %s", rv);
 
@@ -845,10 +1039,6 @@ char *oauth2_jose_jwt_header_peek(oauth2_log_t *log,
 
 end:
 
-	if (input)
-		oauth2_mem_free(input);
-	if (result)
-		oauth2_mem_free(result);
 	if (json)
 		json_decref(json);
 
@@ -878,99 +1068,278 @@ end:
 	return;
 }
 
+static bool _oauth2_jose_jwt_claim_aud_match(const json_t *value,
+					     const char *aud)
+{
+	size_t i = 0;
+	const json_t *elem = NULL;
+
+	if (json_is_string(value))
+		return (strcmp(json_string_value(value), aud) == 0);
+
+	for (i = 0; i < json_array_size(value); i++) {
+		elem = json_array_get(value, i);
+		if ((json_is_string(elem)) &&
+		    (strcmp(json_string_value(elem), aud) == 0))
+			return true;
+	}
+
+	return false;
+}
+
 static bool
-_oauth2_jose_jwt_validate_iss(oauth2_log_t *log, const json_t *json_payload,
-			      const char *iss,
-			      oauth2_jose_jwt_validate_claim_t validate)
+_oauth2_jose_jwt_claim_check_run(oauth2_log_t *log,
+				 const oauth2_jose_jwt_claim_check_t *check,
+				 const json_t *value, const char *iss,
+				 oauth2_time_t now)
 {
 	bool rc = false;
-	char *value = NULL;
+	const char *expected = NULL;
+	json_int_t t = 0;
 
-	oauth2_debug(log, "enter: iss=%s, validate=%s", iss,
-		     _oauth2_validate_claim_option2s(validate));
+	switch (check->op) {
 
-	if (validate == OAUTH2_JOSE_JWT_VALIDATE_CLAIM_SKIP) {
+	case OAUTH2_JOSE_JWT_CLAIM_OP_PRESENT:
 		rc = true;
-		goto end;
-	}
+		break;
 
-	if (iss == NULL) {
-		rc = (validate != OAUTH2_JOSE_JWT_VALIDATE_CLAIM_REQUIRED);
-		goto end;
-	}
+	case OAUTH2_JOSE_JWT_CLAIM_OP_ISS:
+		expected = check->value ? check->value : iss;
+		if (expected == NULL) {
+			rc = true;
+			break;
+		}
+		if (!json_is_string(value)) {
+			oauth2_error(log,
+				     "JWT did not contain an \"%s\" string "
+				     "(requested value: %s)",
+				     check->claim, expected);
+			rc = (check->validate !=
+			      OAUTH2_JOSE_JWT_VALIDATE_CLAIM_REQUIRED);
+			break;
+		}
+		if (strcmp(expected, json_string_value(value)) != 0) {
+			oauth2_error(log,
+				     "requested issuer (%s) does not match "
+				     "received \"%s\" value in JWT (%s)",
+				     expected, check->claim,
+				     json_string_value(value));
+			break;
+		}
+		rc = true;
+		break;
 
-	if (oauth2_json_string_get(log, json_payload, OAUTH2_JOSE_JWT_ISS,
-				   &value, NULL) == false) {
-		rc = (validate != OAUTH2_JOSE_JWT_VALIDATE_CLAIM_REQUIRED);
-		goto end;
-	}
+	case OAUTH2_JOSE_JWT_CLAIM_OP_AUD:
+		if (check->value == NULL) {
+			rc = true;
+			break;
+		}
+		if (_oauth2_jose_jwt_claim_aud_match(value, check->value) ==
+		    false) {
+			oauth2_error(log,
+				     "\"%s\" validation failure: requested "
+				     "audience (%s) not found in JWT",
+				     check->claim, check->value);
+			break;
+		}
+		rc = true;
+		break;
 
-	if (value == NULL) {
-		oauth2_error(log,
-			     "JWT did not contain an \"%s\" string (requested "
-			     "value: %s)",
-			     OAUTH2_JOSE_JWT_ISS, iss);
-		rc = (validate != OAUTH2_JOSE_JWT_VALIDATE_CLAIM_REQUIRED);
-		goto end;
-	}
+	case OAUTH2_JOSE_JWT_CLAIM_OP_EXP:
+	case OAUTH2_JOSE_JWT_CLAIM_OP_NBF:
+	case OAUTH2_JOSE_JWT_CLAIM_OP_IAT:
+		if (!json_is_number(value)) {
+			oauth2_warn(log, "JWT did not contain a \"%s\" number",
+				    check->claim);
+			rc = (check->validate !=
+			      OAUTH2_JOSE_JWT_VALIDATE_CLAIM_REQUIRED);
+			break;
+		}
+		t = json_is_integer(value) ? json_integer_value(value)
+					   : (json_int_t)json_real_value(value);
+
+		if ((check->op == OAUTH2_JOSE_JWT_CLAIM_OP_EXP) && (now > t)) {
+			oauth2_error(log,
+				     "\"%s\" validation failure (%ld): JWT "
+				     "expired %ld seconds ago",
+				     check->claim, (long)t, (long)(now - t));
+			break;
+		}
 
-	if (strcmp(iss, value) != 0) {
-		oauth2_error(log,
-			     "requested issuer (%s) does not match received "
-			     "\"%s\" value in id_token (%s)",
-			     iss, OAUTH2_JOSE_JWT_ISS, value);
-		goto end;
-	}
+		if ((check->op == OAUTH2_JOSE_JWT_CLAIM_OP_NBF) &&
+		    (check->slack_after != OAUTH2_CFG_UINT_UNSET) &&
+		    ((now + check->slack_after) < t)) {
+			oauth2_error(log,
+				     "\"%s\" validation failure (%ld): JWT is "
+				     "not valid until %ld seconds from now",
+				     check->claim, (long)t, (long)(t - now));
+			break;
+		}
 
-	rc = true;
+		if ((check->op == OAUTH2_JOSE_JWT_CLAIM_OP_IAT) &&
+		    (check->slack_before != OAUTH2_CFG_UINT_UNSET) &&
+		    ((now - check->slack_before) > t)) {
+			oauth2_error(log,
+				     "\"%s\" validation failure (%ld): JWT was "
+				     "issued more than %d seconds ago",
+				     check->claim, (long)t,
+				     check->slack_before);
+			break;
+		}
 
-end:
+		if ((check->op == OAUTH2_JOSE_JWT_CLAIM_OP_IAT) &&
+		    (check->slack_after != OAUTH2_CFG_UINT_UNSET) &&
+		    ((now + check->slack_after) < t)) {
+			oauth2_error(log,
+				     "\"%s\" validation failure (%ld): JWT was "
+				     "issued more than %d seconds in the "
+				     "future",
+				     check->claim, (long)t, check->slack_after);
+			break;
+		}
 
-	oauth2_debug(log, "leave: %d", rc);
+		rc = true;
+		break;
+	}
 
 	return rc;
 }
 
 static bool
-_oauth2_jose_jwt_validate_exp(oauth2_log_t *log, const json_t *json_payload,
-			      oauth2_jose_jwt_validate_claim_t validate)
+_oauth2_jose_jwt_payload_validate(oauth2_log_t *log,
+				  oauth2_jose_jwt_verify_ctx_t *jwt_verify_ctx,
+				  const json_t *json_payload, const char *iss,
+				  bool *transient)
 {
 	bool rc = false;
-	json_int_t exp = -1;
-	oauth2_time_t now;
+	const oauth2_jose_jwt_claim_check_t *check = NULL;
+	const char *key = NULL;
+	json_t *value = NULL;
+	uint32_t seen = 0;
+	oauth2_time_t now = 0;
+	oauth2_uint_t i = 0;
 
-	oauth2_debug(log, "enter: validate=%s",
-		     _oauth2_validate_claim_option2s(validate));
+	oauth2_debug(log, "enter: checks=" OAUTH2_UINT_FORMAT,
+		     jwt_verify_ctx->n_checks);
 
-	if (validate == OAUTH2_JOSE_JWT_VALIDATE_CLAIM_SKIP) {
+	if (jwt_verify_ctx->n_checks == 0) {
 		rc = true;
 		goto end;
 	}
 
-	if (oauth2_json_number_get(log, json_payload, OAUTH2_JOSE_JWT_EXP, &exp,
-				   -1) == false) {
-		rc = (validate != OAUTH2_JOSE_JWT_VALIDATE_CLAIM_REQUIRED);
-		goto end;
+	now = oauth2_time_now_sec();
+
+	json_object_foreach((json_t *)json_payload, key, value)
+	{
+		if (json_is_null(value))
+			continue;
+		for (i = 0; i < jwt_verify_ctx->n_checks; i++) {
+			check = &jwt_verify_ctx->checks[i];
+			if (strcmp(check->claim, key) != 0)
+				continue;
+			seen |= (1U << i);
+			if (_oauth2_jose_jwt_claim_check_run(log, check, value,
+							     iss, now))
+				continue;
+			// the token may become valid as time passes
+			if ((transient) &&
+			    ((check->op == OAUTH2_JOSE_JWT_CLAIM_OP_NBF) ||
+			     (check->op == OAUTH2_JOSE_JWT_CLAIM_OP_IAT)))
+				*transient = true;
+			goto end;
+		}
 	}
 
-	if (exp == -1) {
-		oauth2_warn(log, "JWT did not contain a \"%s\" number",
-			    OAUTH2_JOSE_JWT_EXP);
-		rc = (validate != OAUTH2_JOSE_JWT_VALIDATE_CLAIM_REQUIRED);
+	for (i = 0; i < jwt_verify_ctx->n_checks; i++) {
+		check = &jwt_verify_ctx->checks[i];
+		if (seen & (1U << i))
+			continue;
+		if (check->validate != OAUTH2_JOSE_JWT_VALIDATE_CLAIM_REQUIRED)
+			continue;
+		oauth2_error(log, "JWT did not contain a required \"%s\" claim",
+			     check->claim);
 		goto end;
 	}
 
-	now = oauth2_time_now_sec();
+	// TODO: token_binding_policy
+	//	if (oauth2_jose_jwt_validate_cnf(r, jwt->payload.value.json,
+	//			token_binding_policy) == false)
+	//		goto end;
 
-	oauth2_debug(log,
-		     "\"%s\"=%" JSON_INTEGER_FORMAT ", %ld seconds from now",
-		     OAUTH2_JOSE_JWT_EXP, exp, (long)(exp - now));
+	rc = true;
 
-	if (now > exp) {
-		oauth2_error(log,
-			     "\"%s\" validation failure (%ld): JWT expired %ld "
-			     "seconds ago",
-			     OAUTH2_JOSE_JWT_EXP, (long)exp, (long)(now - exp));
+end:
+
+	oauth2_debug(log, "leave: %d", rc);
+
+	return rc;
+}
+
+/*
+ * bounded in-process negative cache of SHA-256 digests, used to rate limit
+ * JWKS refreshes for unknown kids and to reject known invalid tokens early;
+ * the time of the last forced refresh is kept on the jwks_uri context itself
+ * so that no amount of cache entries can evict it
+ */
+
+#define OAUTH2_JOSE_NEG_CACHE_SETS 128
+#define OAUTH2_JOSE_NEG_CACHE_WAYS 4
+// minimum interval between forced refreshes of a single JWKS URI
+#define OAUTH2_JOSE_JWKS_REFRESH_MIN_INTERVAL 30
+// interval during which a kid that was not found will not cause a refresh
+#define OAUTH2_JOSE_JWKS_KID_MISS_TTL 300
+// lifetime of the digest of a token that failed verification
+#define OAUTH2_JOSE_JWT_INVALID_TTL 60
+
+typedef enum oauth2_jose_neg_cache_type_t {
+	OAUTH2_JOSE_NEG_CACHE_KID = 1,
+	OAUTH2_JOSE_NEG_CACHE_JWT
+} oauth2_jose_neg_cache_type_t;
+
+typedef struct oauth2_jose_neg_cache_entry_t {
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	oauth2_jose_neg_cache_type_t type;
+	oauth2_time_t expires;
+} oauth2_jose_neg_cache_entry_t;
+
+static oauth2_jose_neg_cache_entry_t
+    _oauth2_jose_neg_cache[OAUTH2_JOSE_NEG_CACHE_SETS]
+			  [OAUTH2_JOSE_NEG_CACHE_WAYS];
+
+// the table is per-process so it is guarded by a thread mutex only
+static pthread_mutex_t _oauth2_jose_neg_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool _oauth2_jose_neg_cache_lock(oauth2_log_t *log)
+{
+	return (pthread_mutex_lock(&_oauth2_jose_neg_cache_mutex) == 0);
+}
+
+static bool _oauth2_jose_neg_cache_unlock(oauth2_log_t *log)
+{
+	return (pthread_mutex_unlock(&_oauth2_jose_neg_cache_mutex) == 0);
+}
+
+static bool _oauth2_jose_neg_cache_digest(oauth2_log_t *log,
+					  oauth2_jose_neg_cache_type_t type,
+					  oauth2_uint_t id, const char *s1,
+					  const char *s2, unsigned char *md)
+{
+	bool rc = false;
+	EVP_MD_CTX *ctx = NULL;
+
+	ctx = EVP_MD_CTX_new();
+	if (ctx == NULL)
+		goto end;
+
+	if ((EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1) ||
+	    (EVP_DigestUpdate(ctx, &type, sizeof(type)) != 1) ||
+	    (EVP_DigestUpdate(ctx, &id, sizeof(id)) != 1) ||
+	    (EVP_DigestUpdate(ctx, s1 ? s1 : "", s1 ? strlen(s1) + 1 : 1) !=
+	     1) ||
+	    (EVP_DigestUpdate(ctx, s2 ? s2 : "", s2 ? strlen(s2) + 1 : 1) !=
+	     1) ||
+	    (EVP_DigestFinal_ex(ctx, md, NULL) != 1)) {
+		_OAUTH2_JOSE_OPENSSL_ERR_LOG(log, "EVP_Digest");
 		goto end;
 	}
 
@@ -978,106 +1347,141 @@ _oauth2_jose_jwt_validate_exp(oauth2_log_t *log, const json_t *json_payload,
 
 end:
 
-	oauth2_debug(log, "leave: %d", rc);
+	if (ctx)
+		EVP_MD_CTX_free(ctx);
 
 	return rc;
 }
 
-static bool
-_oauth2_jose_jwt_validate_iat(oauth2_log_t *log, const json_t *json_payload,
-			      oauth2_jose_jwt_validate_claim_t validate,
-			      oauth2_uint_t slack_before,
-			      oauth2_uint_t slack_after)
+static oauth2_jose_neg_cache_entry_t *
+_oauth2_jose_neg_cache_set(const unsigned char *md)
 {
-	bool rc = false;
-	json_int_t iat = -1;
-	oauth2_time_t now;
+	uint32_t idx = ((uint32_t)md[0] << 24) | ((uint32_t)md[1] << 16) |
+		       ((uint32_t)md[2] << 8) | (uint32_t)md[3];
+	return _oauth2_jose_neg_cache[idx % OAUTH2_JOSE_NEG_CACHE_SETS];
+}
 
-	oauth2_debug(log,
-		     "enter: validate=%s, slack_before=" OAUTH2_UINT_FORMAT
-		     ", slack_after=" OAUTH2_UINT_FORMAT,
-		     _oauth2_validate_claim_option2s(validate), slack_before,
-		     slack_after);
+// picks the way to store a new entry in: a free or expired one, else the
+// live entry that expires first; invalid token digests are attacker
+// controlled so they may only displace each other, never kid misses
+static oauth2_jose_neg_cache_entry_t *
+_oauth2_jose_neg_cache_victim(oauth2_jose_neg_cache_entry_t *set,
+			      oauth2_jose_neg_cache_type_t type,
+			      oauth2_time_t now)
+{
+	oauth2_jose_neg_cache_entry_t *victim = NULL, *e = NULL;
+	int i = 0;
 
-	if (validate == OAUTH2_JOSE_JWT_VALIDATE_CLAIM_SKIP) {
-		rc = true;
-		goto end;
+	for (i = 0; i < OAUTH2_JOSE_NEG_CACHE_WAYS; i++) {
+		e = &set[i];
+		if (e->expires <= now)
+			return e;
+		if ((type == OAUTH2_JOSE_NEG_CACHE_JWT) && (e->type != type))
+			continue;
+		// kid misses displace invalid token digests first
+		if ((victim == NULL) ||
+		    ((e->type == OAUTH2_JOSE_NEG_CACHE_JWT) &&
+		     (victim->type != OAUTH2_JOSE_NEG_CACHE_JWT)) ||
+		    ((e->type == victim->type) &&
+		     (e->expires < victim->expires)))
+			victim = e;
 	}
 
-	if (oauth2_json_number_get(log, json_payload, OAUTH2_JOSE_JWT_IAT, &iat,
-				   -1) == false) {
-		rc = (validate != OAUTH2_JOSE_JWT_VALIDATE_CLAIM_REQUIRED);
+	return victim;
+}
+
+// returns true if the key is present; else adds it for ttl_s when ttl_s > 0
+static bool _oauth2_jose_neg_cache_check(oauth2_log_t *log,
+					 oauth2_jose_neg_cache_type_t type,
+					 oauth2_uint_t id, const char *s1,
+					 const char *s2, oauth2_time_t ttl_s)
+{
+	bool rc = false;
+	unsigned char md[SHA256_DIGEST_LENGTH];
+	oauth2_jose_neg_cache_entry_t *set = NULL, *e = NULL;
+	oauth2_time_t now = 0;
+	int i = 0;
+
+	if (_oauth2_jose_neg_cache_digest(log, type, id, s1, s2, md) == false)
 		goto end;
-	}
 
-	if (iat == -1) {
-		oauth2_warn(log, "JWT did not contain a \"%s\" number",
-			    OAUTH2_JOSE_JWT_IAT);
-		rc = (validate != OAUTH2_JOSE_JWT_VALIDATE_CLAIM_REQUIRED);
+	if (_oauth2_jose_neg_cache_lock(log) == false)
 		goto end;
-	}
 
 	now = oauth2_time_now_sec();
-
-	if ((slack_before >= 0) && ((now - slack_before) > iat)) {
-		oauth2_error(log,
-			     "\"%s\" validation failure (%ld): JWT was issued "
-			     "more than %d seconds ago",
-			     OAUTH2_JOSE_JWT_IAT, (long)iat, slack_before);
-		goto end;
+	set = _oauth2_jose_neg_cache_set(md);
+	for (i = 0; i < OAUTH2_JOSE_NEG_CACHE_WAYS; i++) {
+		if ((set[i].expires > now) &&
+		    (memcmp(set[i].digest, md, SHA256_DIGEST_LENGTH) == 0)) {
+			rc = true;
+			break;
+		}
 	}
 
-	if ((slack_after >= 0) && ((now + slack_after) < iat)) {
-		oauth2_error(log,
-			     "\"%s\" validation failure (%ld): JWT was issued "
-			     "more than %d seconds in the future",
-			     OAUTH2_JOSE_JWT_IAT, (long)iat, slack_after);
-		goto end;
+	if ((rc == false) && (ttl_s > 0)) {
+		e = _oauth2_jose_neg_cache_victim(set, type, now);
+		if (e) {
+			memcpy(e->digest, md, SHA256_DIGEST_LENGTH);
+			e->type = type;
+			e->expires = now + ttl_s;
+		}
 	}
 
-	rc = true;
+	_oauth2_jose_neg_cache_unlock(log);
 
 end:
 
-	oauth2_debug(log, "leave: %d", rc);
-
 	return rc;
 }
 
+static void _oauth2_jose_neg_cache_flush(oauth2_log_t *log)
+{
+	_oauth2_jose_neg_cache_lock(log);
+	memset(_oauth2_jose_neg_cache, 0, sizeof(_oauth2_jose_neg_cache));
+	_oauth2_jose_neg_cache_unlock(log);
+}
+
 static bool
-_oauth2_jose_jwt_payload_validate(oauth2_log_t *log,
-				  oauth2_jose_jwt_verify_ctx_t *jwt_verify_ctx,
-				  const json_t *json_payload, const char *iss)
+_oauth2_jose_jwks_refresh_allowed(oauth2_log_t *log,
+				  oauth2_jose_jwks_provider_t *provider,
+				  const char *kid)
 {
 	bool rc = false;
+	oauth2_uri_ctx_t *uri_ctx = NULL;
+	const char *uri = NULL;
+	oauth2_time_t now = 0;
 
-	oauth2_debug(log, "enter");
-
-	if (_oauth2_jose_jwt_validate_iss(
-		log, json_payload, iss, jwt_verify_ctx->iss_validate) == false)
+	if ((provider->type == OAUTH2_JOSE_JWKS_PROVIDER_LIST) ||
+	    (provider->jwks_uri == NULL))
 		goto end;
 
-	if (_oauth2_jose_jwt_validate_exp(
-		log, json_payload, jwt_verify_ctx->exp_validate) == false)
-		goto end;
+	uri_ctx = provider->jwks_uri;
+	uri = uri_ctx->uri;
 
-	if (_oauth2_jose_jwt_validate_iat(
-		log, json_payload, jwt_verify_ctx->iat_validate,
-		jwt_verify_ctx->iat_slack_before,
-		jwt_verify_ctx->iat_slack_after) == false)
+	if (_oauth2_jose_neg_cache_check(log, OAUTH2_JOSE_NEG_CACHE_KID, 0, uri,
+					 kid, 0)) {
+		oauth2_debug(log,
+			     "not refreshing %s: kid \"%s\" was not found "
+			     "recently",
+			     uri, kid ? kid : "(null)");
 		goto end;
+	}
 
-	// TODO: token_binding_policy
-	//	if (oauth2_jose_jwt_validate_cnf(r, jwt->payload.value.json,
-	//			token_binding_policy) == false)
-	//		goto end;
+	if (_oauth2_jose_neg_cache_lock(log) == false)
+		goto end;
+	now = oauth2_time_now_sec();
+	if (now >=
+	    uri_ctx->refreshed + OAUTH2_JOSE_JWKS_REFRESH_MIN_INTERVAL) {
+		uri_ctx->refreshed = now;
+		rc = true;
+	}
+	_oauth2_jose_neg_cache_unlock(log);
 
-	rc = true;
+	if (rc == false)
+		oauth2_debug(log, "not refreshing %s: refreshed recently", uri);
 
 end:
 
-	oauth2_debug(log, "leave: %d", rc);
-
 	return rc;
 }
 
@@ -1096,10 +1500,21 @@ bool oauth2_jose_jwt_verify(oauth2_log_t *log,
 	uint8_t *plaintext = NULL;
 	size_t plaintext_len = 0;
 	bool refresh = false;
+	bool invalid = false;
+	bool transient = false;
+	oauth2_uri_ctx_t *uri = NULL;
 
 	peek = oauth2_jose_jwt_header_peek(log, token, NULL);
 	oauth2_debug(log, "enter: JWT token header=%s", peek);
 
+	if ((jwt_verify_ctx) &&
+	    (_oauth2_jose_neg_cache_check(log, OAUTH2_JOSE_NEG_CACHE_JWT,
+					  jwt_verify_ctx->id, token, NULL,
+					  0))) {
+		oauth2_error(log, "token failed verification recently");
+		goto end;
+	}
+
 	/*
 	 * TODO: resolve the shared secret(s) and the private key(s) for
 	 * decryption
@@ -1111,12 +1526,15 @@ bool oauth2_jose_jwt_verify(oauth2_log_t *log,
 	jws = cjose_jws_import(token, strlen(token), &err);
 	if (jws == NULL) {
 		oauth2_error(log, "cjose_jws_import failed: %s", err.message);
+		invalid = true;
 		goto end;
 	}
 
 	hdr = cjose_jws_get_protected(jws);
-	if (hdr == NULL)
+	if (hdr == NULL) {
+		invalid = true;
 		goto end;
+	}
 
 	if (jwt_verify_ctx) {
 
@@ -1126,24 +1544,47 @@ bool oauth2_jose_jwt_verify(oauth2_log_t *log,
 		ctx.jws = jws;
 		ctx.kid = cjose_header_get(hdr, "kid", &err);
 		ctx.verified = false;
+		ctx.kid_found = false;
 
 		_oauth2_jose_verification_keys_loop(
 		    log, keys, _oauth2_jose_jwt_verify_jwk, &ctx);
 
 		if (ctx.verified == false) {
 
-			if (refresh == false)
+			// keys were fresh: the signature is definitely bad
+			if (refresh == false) {
+				invalid = (keys != NULL);
+				goto end;
+			}
+
+			// keys may be stale but don't let floods of tokens
+			// with unknown kids hammer the JWKS endpoint
+			if (_oauth2_jose_jwks_refresh_allowed(
+				log, jwt_verify_ctx->jwks_provider,
+				ctx.kid) == false)
 				goto end;
 
 			if (keys)
 				oauth2_jose_jwk_list_free(log, keys);
 			keys = jwt_verify_ctx->jwks_provider->resolve(
 			    log, jwt_verify_ctx->jwks_provider, &refresh);
+			ctx.kid_found = false;
 			_oauth2_jose_verification_keys_loop(
 			    log, keys, _oauth2_jose_jwt_verify_jwk, &ctx);
 
-			if (ctx.verified == false)
+			if (ctx.verified == false) {
+				// only a kid that the refreshed set does not
+				// contain at all is worth remembering
+				uri = jwt_verify_ctx->jwks_provider->jwks_uri;
+				if ((keys) && (ctx.kid) &&
+				    (ctx.kid_found == false))
+					_oauth2_jose_neg_cache_check(
+					    log, OAUTH2_JOSE_NEG_CACHE_KID, 0,
+					    uri->uri, ctx.kid,
+					    OAUTH2_JOSE_JWKS_KID_MISS_TTL);
+				invalid = (keys != NULL);
 				goto end;
+			}
 		}
 	}
 
@@ -1162,19 +1603,30 @@ bool oauth2_jose_jwt_verify(oauth2_log_t *log,
 	oauth2_debug(log, "got plaintext (len=%lu): %s", plaintext_len,
 		     *s_payload);
 
-	if (oauth2_json_decode_object(log, *s_payload, json_payload) == false)
+	if (oauth2_json_decode_object(log, *s_payload, json_payload) == false) {
+		invalid = true;
 		goto end;
+	}
 
 	if (jwt_verify_ctx) {
-		if (_oauth2_jose_jwt_payload_validate(
-			log, jwt_verify_ctx, *json_payload, NULL) == false)
+		if (_oauth2_jose_jwt_payload_validate(log, jwt_verify_ctx,
+						      *json_payload, NULL,
+						      &transient) == false) {
+			invalid = (transient == false);
 			goto end;
+		}
 	}
 
 	rc = true;
 
 end:
 
+	// remember definitive failures only, never transient ones
+	if ((rc == false) && (invalid) && (jwt_verify_ctx))
+		_oauth2_jose_neg_cache_check(log, OAUTH2_JOSE_NEG_CACHE_JWT,
+					     jwt_verify_ctx->id, token, NULL,
+					     OAUTH2_JOSE_JWT_INVALID_TTL);
+
 	if (peek)
 		oauth2_mem_free(peek);
 	if (jws)
@@ -1385,7 +1837,7 @@ _OAUTH_CFG_CTX_CALLBACK(oauth2_jose_verify_options_jwk_set_hex)
 
 	key_len = strlen(value) / 2;
 	ptr = value;
-	key = oauth2_mem_alloc(key_len);
+	key = oauth2_mem_alloc_uninit(key_len);
 	for (n = 0; n < key_len / sizeof(unsigned char); n++) {
 		if (sscanf(ptr, "%2hhx", &key[n]) != 1) {
 			rv = oauth2_strdup("sscanf failed");
@@ -1457,11 +1909,11 @@ _oauth2_jose_options_jwk_set_rsa_key(oauth2_log_t *log, EVP_PKEY *pkey,
 	RSA_free(rsa);
 
 	key_spec.nlen = BN_num_bytes(rsa_n);
-	key_spec.n = oauth2_mem_alloc(key_spec.nlen);
+	key_spec.n = oauth2_mem_alloc_uninit(key_spec.nlen);
 	BN_bn2bin(rsa_n, key_spec.n);
 
 	key_spec.elen = BN_num_bytes(rsa_e);
-	key_spec.e = oauth2_mem_alloc(key_spec.elen);
+	key_spec.e = oauth2_mem_alloc_uninit(key_spec.elen);
 	BN_bn2bin(rsa_e, key_spec.e);
 
 	jwk = cjose_jwk_create_RSA_spec(&key_spec, &err);
@@ -1615,6 +2067,11 @@ char *oauth2_jose_options_uri_ctx(oauth2_log_t *log, const char *value,
 			      OAUTH2_JOSE_URI_REFRESH_DEFAULT);
 	oauth2_mem_free(key);
 
+	key = oauth2_stradd(NULL, prefix, ".", "refresh");
+	ctx->refresh =
+	    oauth2_parse_bool(log, oauth2_nv_list_get(log, params, key), false);
+	oauth2_mem_free(key);
+
 	return rv;
 }
 
@@ -1641,6 +2098,14 @@ static char *_oauth2_jose_verify_options_jwk_set_url(
 
 	rv = oauth2_jose_options_uri_ctx(log, value, params,
 					 ptr->jwks_provider->jwks_uri, prefix);
+	if (rv != NULL)
+		goto end;
+
+	oauth2_jose_uri_refresh_register(
+	    log, ptr->jwks_provider->jwks_uri,
+	    (type == OAUTH2_JOSE_JWKS_PROVIDER_JWKS_URI)
+		? OAUTH2_JOSE_URI_REFRESH_JWKS
+		: OAUTH2_JOSE_URI_REFRESH_RAW);
 
 end:
 
@@ -1741,11 +2206,11 @@ _oauth2_jose_jwks_eckey_url_resolve_response_callback(oauth2_log_t *log,
 	}
 
 	spec.xlen = BN_num_bytes(x);
-	spec.x = oauth2_mem_alloc(spec.xlen);
+	spec.x = oauth2_mem_alloc_uninit(spec.xlen);
 	BN_bn2bin(x, spec.x);
 
 	spec.ylen = BN_num_bytes(y);
-	spec.y = oauth2_mem_alloc(spec.ylen);
+	spec.y = oauth2_mem_alloc_uninit(spec.ylen);
 	BN_bn2bin(y, spec.y);
 
 	spec.dlen = 0;
@@ -1784,22 +2249,79 @@ end:
 	return keys;
 }
 
+#define OAUTH2_JOSE_JWKS_KEYS "keys"
+#define OAUTH2_JOSE_JWK_USE "use"
+#define OAUTH2_JOSE_JWK_USE_SIG "sig"
+
+// the JWK members needed to import and select a verification key; anything
+// else (x5c certificate chains, x5t, ...) is dropped before caching a JWKS
+static const char *_oauth2_jose_jwk_members[] = {
+    "kty", "kid", OAUTH2_JOSE_JWK_USE, "alg", "n", "e", "x", "y", "crv", NULL};
+
+static bool _oauth2_jose_jwk_use_sig(oauth2_log_t *log, const json_t *json_key)
+{
+	const char *use = json_string_value(
+	    json_object_get(json_key, OAUTH2_JOSE_JWK_USE));
+	if ((use != NULL) && (strcmp(use, OAUTH2_JOSE_JWK_USE_SIG) != 0)) {
+		oauth2_debug(log,
+			     "skipping key because of "
+			     "non-matching \"%s\": \"%s\"",
+			     OAUTH2_JOSE_JWK_USE, use);
+		return false;
+	}
+	return true;
+}
+
+static json_t *_oauth2_jose_jwks_reduce(oauth2_log_t *log,
+					const json_t *json_jwks)
+{
+	json_t *result = NULL, *json_keys = NULL, *keys = NULL;
+	json_t *json_key = NULL, *key = NULL, *value = NULL;
+	const char *name = NULL;
+	int i = 0, j = 0;
+
+	json_keys = json_object_get(json_jwks, OAUTH2_JOSE_JWKS_KEYS);
+	if ((json_keys == NULL) || !(json_is_array(json_keys))) {
+		oauth2_error(log, "\"%s\" array element is not a JSON array",
+			     OAUTH2_JOSE_JWKS_KEYS);
+		goto end;
+	}
+
+	keys = json_array();
+	for (i = 0; i < json_array_size(json_keys); i++) {
+		json_key = json_array_get(json_keys, i);
+		if (_oauth2_jose_jwk_use_sig(log, json_key) == false)
+			continue;
+		key = json_object();
+		for (j = 0; _oauth2_jose_jwk_members[j] != NULL; j++) {
+			name = _oauth2_jose_jwk_members[j];
+			value = json_object_get(json_key, name);
+			if (value)
+				json_object_set(key, name, value);
+		}
+		json_array_append_new(keys, key);
+	}
+
+	result = json_object();
+	json_object_set_new(result, OAUTH2_JOSE_JWKS_KEYS, keys);
+
+end:
+
+	return result;
+}
+
 static oauth2_jose_jwk_list_t *
-_oauth2_jose_jwks_uri_resolve_response_callback(oauth2_log_t *log,
-						char *response)
+_oauth2_jose_jwks_import(oauth2_log_t *log, const json_t *json_jwks)
 {
-	json_t *json_result = NULL, *json_keys = NULL, *json_key = NULL;
+	json_t *json_keys = NULL, *json_key = NULL;
 	oauth2_jose_jwk_list_t *result = NULL, *elem = NULL, *last = NULL;
 	int i = 0;
 	cjose_err err;
 
-	if (oauth2_json_decode_object(log, response, &json_result) == false)
-		goto end;
-
-	// TODO: #define
-	json_keys = json_object_get(json_result, "keys");
+	json_keys = json_object_get(json_jwks, OAUTH2_JOSE_JWKS_KEYS);
 	if ((json_keys == NULL) || !(json_is_array(json_keys))) {
-		oauth2_error(log, "\"keys\" array element is not a JSON array");
+		oauth2_error(log, "\"%s\" array element is not a JSON array",
+			     OAUTH2_JOSE_JWKS_KEYS);
 		goto end;
 	}
 
@@ -1807,16 +2329,8 @@ _oauth2_jose_jwks_uri_resolve_response_callback(oauth2_log_t *log,
 
 		json_key = json_array_get(json_keys, i);
 
-		// TODO: #define
-		const char *use =
-		    json_string_value(json_object_get(json_key, "use"));
-		if ((use != NULL) && (strcmp(use, "sig") != 0)) {
-			oauth2_debug(log,
-				     "skipping key because of "
-				     "non-matching \"%s\": \"%s\"",
-				     "use", use);
+		if (_oauth2_jose_jwk_use_sig(log, json_key) == false)
 			continue;
-		}
 
 		// TODO: search/skip based on key type (?)
 
@@ -1849,6 +2363,23 @@ _oauth2_jose_jwks_uri_resolve_response_callback(oauth2_log_t *log,
 		}
 	}
 
+end:
+
+	return result;
+}
+
+static oauth2_jose_jwk_list_t *
+_oauth2_jose_jwks_uri_resolve_response_callback(oauth2_log_t *log,
+						char *response)
+{
+	json_t *json_result = NULL;
+	oauth2_jose_jwk_list_t *result = NULL;
+
+	if (oauth2_json_decode_object(log, response, &json_result) == false)
+		goto end;
+
+	result = _oauth2_jose_jwks_import(log, json_result);
+
 end:
 
 	if (json_result)
@@ -1873,6 +2404,8 @@ char *oauth2_jose_resolve_from_uri(oauth2_log_t *log, oauth2_uri_ctx_t *uri_ctx,
 	if (*refresh == false) {
 
 		oauth2_cache_get(log, uri_ctx->cache, uri_ctx->uri, &response);
+		// a cached response may be stale, so the caller may refresh it
+		*refresh = (response != NULL);
 	}
 
 	if (response == NULL) {
@@ -1933,17 +2466,563 @@ end:
 static oauth2_jose_jwk_list_t *oauth2_jose_jwks_uri_resolve(
     oauth2_log_t *log, oauth2_jose_jwks_provider_t *provider, bool *refresh)
 {
-	return _oauth2_jose_jwks_resolve_from_uri(
-	    log, provider, refresh,
-	    _oauth2_jose_jwks_uri_resolve_response_callback);
+	oauth2_jose_jwk_list_t *keys = NULL;
+	oauth2_uri_ctx_t *uri_ctx = provider->jwks_uri;
+	oauth2_http_call_ctx_t *ctx = NULL;
+	oauth2_uint_t status_code = 0;
+	json_t *json_jwks = NULL, *json_reduced = NULL;
+	char *response = NULL;
+
+	oauth2_debug(log, "enter");
+
+	if (*refresh == false)
+		oauth2_cache_get(log, uri_ctx->cache, uri_ctx->uri, &response);
+
+	if (response) {
+		keys = _oauth2_jose_jwks_uri_resolve_response_callback(
+		    log, response);
+		*refresh = true;
+		goto end;
+	}
+
+	*refresh = false;
+
+	ctx = oauth2_http_call_ctx_init(log);
+	oauth2_http_call_ctx_ssl_verify_set(log, ctx, uri_ctx->ssl_verify);
+
+	if (oauth2_http_get_json(log, uri_ctx->uri, NULL, ctx, &json_jwks,
+				 &status_code) == false)
+		goto end;
+
+	if ((status_code < 200) || (status_code >= 300))
+		goto end;
+
+	json_reduced = _oauth2_jose_jwks_reduce(log, json_jwks);
+	if (json_reduced == NULL)
+		goto end;
+
+	keys = _oauth2_jose_jwks_import(log, json_reduced);
+
+	response = oauth2_json_encode(log, json_reduced,
+				      JSON_PRESERVE_ORDER | JSON_COMPACT);
+	oauth2_cache_set(log, uri_ctx->cache, uri_ctx->uri, response,
+			 uri_ctx->expiry_s);
+
+end:
+
+	if (response)
+		oauth2_mem_free(response);
+	if (json_reduced)
+		json_decref(json_reduced);
+	if (json_jwks)
+		json_decref(json_jwks);
+	if (ctx)
+		oauth2_http_call_ctx_free(log, ctx);
+
+	oauth2_debug(log, "leave: %p", keys);
+
+	return keys;
+}
+
+/*
+ * in-process cache of the EC keys constructed from the PEM served on an
+ * eckey_uri, so the PEM parsing and EC point conversion is done once per URL
+ */
+
+#define OAUTH2_JOSE_ECKEY_CACHE_MAX 16
+
+typedef struct oauth2_jose_eckey_cache_entry_t {
+	char *url;
+	cjose_jwk_t *jwk;
+	oauth2_time_t expires;
+	oauth2_time_t accessed;
+} oauth2_jose_eckey_cache_entry_t;
+
+static oauth2_jose_eckey_cache_entry_t
+    _oauth2_jose_eckey_cache[OAUTH2_JOSE_ECKEY_CACHE_MAX];
+
+// the table is per-process so it is guarded by a thread mutex only
+static pthread_mutex_t _oauth2_jose_eckey_cache_mutex =
+    PTHREAD_MUTEX_INITIALIZER;
+
+static bool _oauth2_jose_eckey_cache_lock(oauth2_log_t *log)
+{
+	return (pthread_mutex_lock(&_oauth2_jose_eckey_cache_mutex) == 0);
+}
+
+static bool _oauth2_jose_eckey_cache_unlock(oauth2_log_t *log)
+{
+	return (pthread_mutex_unlock(&_oauth2_jose_eckey_cache_mutex) == 0);
+}
+
+static void
+_oauth2_jose_eckey_cache_entry_clear(oauth2_jose_eckey_cache_entry_t *e)
+{
+	if (e->url)
+		oauth2_mem_free(e->url);
+	if (e->jwk)
+		cjose_jwk_release(e->jwk);
+	e->url = NULL;
+	e->jwk = NULL;
+	e->expires = 0;
+	e->accessed = 0;
+}
+
+static cjose_jwk_t *_oauth2_jose_eckey_cache_get(oauth2_log_t *log,
+						 const char *url)
+{
+	cjose_jwk_t *jwk = NULL;
+	oauth2_jose_eckey_cache_entry_t *e = NULL;
+	oauth2_time_t now = 0;
+	cjose_err err;
+	int i = 0;
+
+	if (url == NULL)
+		goto end;
+
+	if (_oauth2_jose_eckey_cache_lock(log) == false)
+		goto end;
+
+	now = oauth2_time_now_sec();
+	for (i = 0; i < OAUTH2_JOSE_ECKEY_CACHE_MAX; i++) {
+		e = &_oauth2_jose_eckey_cache[i];
+		if ((e->url == NULL) || (strcmp(e->url, url) != 0))
+			continue;
+		if (e->expires <= now) {
+			_oauth2_jose_eckey_cache_entry_clear(e);
+			break;
+		}
+		err.code = CJOSE_ERR_NONE;
+		jwk = cjose_jwk_retain(e->jwk, &err);
+		e->accessed = now;
+		break;
+	}
+
+	_oauth2_jose_eckey_cache_unlock(log);
+
+end:
+
+	oauth2_debug(log, "in-process EC key %s for: %s",
+		     jwk ? "found" : "not found", url);
+
+	return jwk;
+}
+
+static void _oauth2_jose_eckey_cache_set(oauth2_log_t *log, const char *url,
+					 cjose_jwk_t *jwk,
+					 oauth2_time_t expiry_s)
+{
+	oauth2_jose_eckey_cache_entry_t *e = NULL, *victim = NULL;
+	bool victim_free = false, suspended = false;
+	oauth2_time_t now = 0;
+	cjose_err err;
+	int i = 0;
+
+	if ((url == NULL) || (jwk == NULL) || (expiry_s == 0))
+		goto end;
+
+	if (_oauth2_jose_eckey_cache_lock(log) == false)
+		goto end;
+
+	now = oauth2_time_now_sec();
+
+	// re-use the slot for this URL, else a free or expired slot, else
+	// evict the least recently used one
+	for (i = 0; i < OAUTH2_JOSE_ECKEY_CACHE_MAX; i++) {
+		e = &_oauth2_jose_eckey_cache[i];
+		if ((e->url) && (strcmp(e->url, url) == 0)) {
+			victim = e;
+			break;
+		}
+		if (victim_free)
+			continue;
+		if ((e->url == NULL) || (e->expires <= now)) {
+			victim = e;
+			victim_free = true;
+			continue;
+		}
+		if ((victim == NULL) || (e->accessed < victim->accessed))
+			victim = e;
+	}
+
+	_oauth2_jose_eckey_cache_entry_clear(victim);
+	err.code = CJOSE_ERR_NONE;
+	victim->jwk = cjose_jwk_retain(jwk, &err);
+	if (victim->jwk) {
+		suspended = oauth2_mem_arena_suspend();
+		victim->url = oauth2_strdup(url);
+		oauth2_mem_arena_resume(suspended);
+		victim->expires = now + expiry_s;
+		victim->accessed = now;
+	}
+
+	_oauth2_jose_eckey_cache_unlock(log);
+
+end:
+
+	return;
+}
+
+static void _oauth2_jose_eckey_cache_flush(oauth2_log_t *log)
+{
+	int i = 0;
+
+	if (_oauth2_jose_eckey_cache_lock(log) == false)
+		goto end;
+
+	for (i = 0; i < OAUTH2_JOSE_ECKEY_CACHE_MAX; i++)
+		_oauth2_jose_eckey_cache_entry_clear(
+		    &_oauth2_jose_eckey_cache[i]);
+
+	_oauth2_jose_eckey_cache_unlock(log);
+
+end:
+
+	return;
+}
+
+/*
+ * background refresh of the documents behind uri contexts that have been
+ * configured with <prefix>.refresh=true, publishing them into the cache
+ * ahead of their expiry so that requests do not block on a fetch
+ */
+
+// seconds between checks for due entries
+#define OAUTH2_JOSE_URI_REFRESH_TICK_S 1
+// seconds before retrying a failed fetch
+#define OAUTH2_JOSE_URI_REFRESH_RETRY_S 30
+
+typedef struct oauth2_jose_uri_refresh_t {
+	char *uri;
+	bool ssl_verify;
+	oauth2_cache_t *cache;
+	oauth2_time_t expiry_s;
+	oauth2_jose_uri_refresh_type_t type;
+	// only accessed by the refresh thread
+	oauth2_time_t refresh_at;
+	struct oauth2_jose_uri_refresh_t *next;
+} oauth2_jose_uri_refresh_t;
+
+static oauth2_jose_uri_refresh_t *_oauth2_jose_uri_refresh_list = NULL;
+static pthread_mutex_t _oauth2_jose_uri_refresh_mutex =
+    PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _oauth2_jose_uri_refresh_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t _oauth2_jose_uri_refresh_thread;
+static bool _oauth2_jose_uri_refresh_running = false;
+static bool _oauth2_jose_uri_refresh_stopping = false;
+static pid_t _oauth2_jose_uri_refresh_pid = 0;
+// the thread's own log, set when started in this process
+static oauth2_log_t *_oauth2_jose_uri_refresh_log = NULL;
+
+static void *_oauth2_jose_uri_refresh_run(void *arg);
+
+// must be called with _oauth2_jose_uri_refresh_mutex held
+static bool _oauth2_jose_uri_refresh_spawn(oauth2_log_t *log)
+{
+	if ((_oauth2_jose_uri_refresh_running) ||
+	    (_oauth2_jose_uri_refresh_log == NULL) ||
+	    (_oauth2_jose_uri_refresh_list == NULL))
+		return true;
+
+	_oauth2_jose_uri_refresh_stopping = false;
+	if (pthread_create(&_oauth2_jose_uri_refresh_thread, NULL,
+			   _oauth2_jose_uri_refresh_run,
+			   _oauth2_jose_uri_refresh_log) != 0) {
+		oauth2_error(log, "pthread_create failed");
+		return false;
+	}
+
+	_oauth2_jose_uri_refresh_running = true;
+
+	return true;
+}
+
+bool oauth2_jose_uri_refresh_register(oauth2_log_t *log,
+				      oauth2_uri_ctx_t *ctx,
+				      oauth2_jose_uri_refresh_type_t type)
+{
+	oauth2_jose_uri_refresh_t *ptr = NULL;
+	bool suspended = false;
+
+	if ((ctx == NULL) || (ctx->refresh == false) || (ctx->uri == NULL) ||
+	    (ctx->cache == NULL))
+		return false;
+
+	pthread_mutex_lock(&_oauth2_jose_uri_refresh_mutex);
+
+	for (ptr = _oauth2_jose_uri_refresh_list; ptr; ptr = ptr->next)
+		if ((ptr->cache == ctx->cache) && (ptr->type == type) &&
+		    (strcmp(ptr->uri, ctx->uri) == 0))
+			break;
+
+	if (ptr == NULL) {
+		suspended = oauth2_mem_arena_suspend();
+		ptr = oauth2_mem_alloc(sizeof(oauth2_jose_uri_refresh_t));
+		ptr->uri = oauth2_strdup(ctx->uri);
+		oauth2_mem_arena_resume(suspended);
+		ptr->ssl_verify = ctx->ssl_verify;
+		ptr->cache = oauth2_cache_clone(log, ctx->cache);
+		ptr->expiry_s = ctx->expiry_s;
+		ptr->type = type;
+		// fetch right after start so the cache is warm
+		ptr->refresh_at = 0;
+		ptr->next = _oauth2_jose_uri_refresh_list;
+		_oauth2_jose_uri_refresh_list = ptr;
+		oauth2_debug(log, "registered: %s", ctx->uri);
+		// e.g. a jwks_uri learned from a metadata document after start
+		if (_oauth2_jose_uri_refresh_pid == getpid())
+			_oauth2_jose_uri_refresh_spawn(log);
+	}
+
+	pthread_mutex_unlock(&_oauth2_jose_uri_refresh_mutex);
+
+	return true;
+}
+
+static bool _oauth2_jose_uri_refresh_fetch(oauth2_log_t *log,
+					   oauth2_jose_uri_refresh_t *ptr)
+{
+	bool rc = false;
+	oauth2_http_call_ctx_t *ctx = NULL;
+	oauth2_uint_t status_code = 0;
+	json_t *json_jwks = NULL, *json_reduced = NULL;
+	char *response = NULL;
+
+	ctx = oauth2_http_call_ctx_init(log);
+	if (ctx == NULL)
+		goto end;
+
+	oauth2_http_call_ctx_ssl_verify_set(log, ctx, ptr->ssl_verify);
+
+	if (ptr->type == OAUTH2_JOSE_URI_REFRESH_JWKS) {
+		// store the same reduced form that the jwks_uri resolver does
+		if (oauth2_http_get_json(log, ptr->uri, NULL, ctx, &json_jwks,
+					 &status_code) == false)
+			goto end;
+		if ((status_code < 200) || (status_code >= 300))
+			goto end;
+		json_reduced = _oauth2_jose_jwks_reduce(log, json_jwks);
+		if (json_reduced == NULL)
+			goto end;
+		response = oauth2_json_encode(
+		    log, json_reduced, JSON_PRESERVE_ORDER | JSON_COMPACT);
+	} else {
+		if (oauth2_http_get(log, ptr->uri, NULL, ctx, &response,
+				    &status_code) == false)
+			goto end;
+		if ((status_code < 200) || (status_code >= 300))
+			goto end;
+	}
+
+	if (response == NULL)
+		goto end;
+
+	rc = oauth2_cache_set(log, ptr->cache, ptr->uri, response,
+			      ptr->expiry_s);
+
+end:
+
+	if (response)
+		oauth2_mem_free(response);
+	if (json_reduced)
+		json_decref(json_reduced);
+	if (json_jwks)
+		json_decref(json_jwks);
+	if (ctx)
+		oauth2_http_call_ctx_free(log, ctx);
+
+	return rc;
+}
+
+// refresh at 3/4 of the expiry minus a random jitter of up to 1/10 of it,
+// so that workers started at the same time do not fetch in lock step
+static oauth2_time_t _oauth2_jose_uri_refresh_delay(oauth2_log_t *log,
+						    oauth2_time_t expiry_s)
+{
+	oauth2_time_t delay = expiry_s * 3 / 4, jitter = expiry_s / 10;
+	uint32_t r = 0;
+
+	if ((jitter > 0) &&
+	    (_oauth2_rand_bytes(log, (uint8_t *)&r, sizeof(r)) == true))
+		delay -= r % (jitter + 1);
+
+	return (delay > 0) ? delay : 1;
+}
+
+static void *_oauth2_jose_uri_refresh_run(void *arg)
+{
+	oauth2_log_t *log = (oauth2_log_t *)arg;
+	oauth2_jose_uri_refresh_t *ptr = NULL;
+	oauth2_time_t now = 0;
+	struct timespec ts;
+
+	pthread_mutex_lock(&_oauth2_jose_uri_refresh_mutex);
+
+	while (_oauth2_jose_uri_refresh_stopping == false) {
+
+		// entries are prepended and only freed after the thread stops
+		ptr = _oauth2_jose_uri_refresh_list;
+		pthread_mutex_unlock(&_oauth2_jose_uri_refresh_mutex);
+
+		for (; ptr; ptr = ptr->next) {
+			now = oauth2_time_now_sec();
+			if (ptr->refresh_at > now)
+				continue;
+			if (_oauth2_jose_uri_refresh_fetch(log, ptr)) {
+				ptr->refresh_at =
+				    now + _oauth2_jose_uri_refresh_delay(
+					      log, ptr->expiry_s);
+			} else {
+				oauth2_warn(log, "refresh failed for: %s",
+					    ptr->uri);
+				ptr->refresh_at =
+				    now + OAUTH2_JOSE_URI_REFRESH_RETRY_S;
+			}
+		}
+
+		pthread_mutex_lock(&_oauth2_jose_uri_refresh_mutex);
+		if (_oauth2_jose_uri_refresh_stopping)
+			break;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += OAUTH2_JOSE_URI_REFRESH_TICK_S;
+		pthread_cond_timedwait(&_oauth2_jose_uri_refresh_cond,
+				       &_oauth2_jose_uri_refresh_mutex, &ts);
+	}
+
+	pthread_mutex_unlock(&_oauth2_jose_uri_refresh_mutex);
+
+	return NULL;
+}
+
+bool oauth2_jose_uri_refresh_start(oauth2_log_t *log)
+{
+	bool rc = false;
+	bool suspended = false;
+
+	oauth2_debug(log, "enter");
+
+	pthread_mutex_lock(&_oauth2_jose_uri_refresh_mutex);
+
+	// a thread does not survive a fork
+	if (_oauth2_jose_uri_refresh_pid != getpid()) {
+		_oauth2_jose_uri_refresh_running = false;
+		if (_oauth2_jose_uri_refresh_log)
+			oauth2_log_free(_oauth2_jose_uri_refresh_log);
+		_oauth2_jose_uri_refresh_log = NULL;
+	}
+
+	// the thread gets a log of its own, so it does not race on the
+	// cached level of the caller's log
+	if (_oauth2_jose_uri_refresh_log == NULL) {
+		suspended = oauth2_mem_arena_suspend();
+		_oauth2_jose_uri_refresh_log = oauth2_log_clone(log);
+		oauth2_mem_arena_resume(suspended);
+		if (_oauth2_jose_uri_refresh_log == NULL)
+			goto end;
+	}
+	_oauth2_jose_uri_refresh_pid = getpid();
+
+	// with no entries yet, the first registration starts the thread
+	rc = _oauth2_jose_uri_refresh_spawn(log);
+
+end:
+
+	pthread_mutex_unlock(&_oauth2_jose_uri_refresh_mutex);
+
+	oauth2_debug(log, "leave: %d", rc);
+
+	return rc;
+}
+
+void oauth2_jose_uri_refresh_stop(oauth2_log_t *log)
+{
+	oauth2_log_t *thread_log = NULL;
+
+	pthread_mutex_lock(&_oauth2_jose_uri_refresh_mutex);
+
+	if (_oauth2_jose_uri_refresh_pid != getpid()) {
+		_oauth2_jose_uri_refresh_running = false;
+		pthread_mutex_unlock(&_oauth2_jose_uri_refresh_mutex);
+		return;
+	}
+
+	thread_log = _oauth2_jose_uri_refresh_log;
+	_oauth2_jose_uri_refresh_log = NULL;
+	_oauth2_jose_uri_refresh_pid = 0;
+
+	if (_oauth2_jose_uri_refresh_running == false) {
+		pthread_mutex_unlock(&_oauth2_jose_uri_refresh_mutex);
+		goto end;
+	}
+
+	_oauth2_jose_uri_refresh_stopping = true;
+	pthread_cond_signal(&_oauth2_jose_uri_refresh_cond);
+	pthread_mutex_unlock(&_oauth2_jose_uri_refresh_mutex);
+
+	pthread_join(_oauth2_jose_uri_refresh_thread, NULL);
+	_oauth2_jose_uri_refresh_running = false;
+
+	oauth2_debug(log, "stopped");
+
+end:
+
+	if (thread_log)
+		oauth2_log_free(thread_log);
+}
+
+static void _oauth2_jose_uri_refresh_flush(oauth2_log_t *log)
+{
+	oauth2_jose_uri_refresh_t *ptr = NULL;
+
+	oauth2_jose_uri_refresh_stop(log);
+
+	pthread_mutex_lock(&_oauth2_jose_uri_refresh_mutex);
+	while ((ptr = _oauth2_jose_uri_refresh_list)) {
+		_oauth2_jose_uri_refresh_list = ptr->next;
+		oauth2_cache_release(log, ptr->cache);
+		oauth2_mem_free(ptr->uri);
+		oauth2_mem_free(ptr);
+	}
+	pthread_mutex_unlock(&_oauth2_jose_uri_refresh_mutex);
+}
+
+void _oauth2_jose_shutdown(oauth2_log_t *log)
+{
+	_oauth2_jose_uri_refresh_flush(log);
+	_oauth2_jose_eckey_cache_flush(log);
+	_oauth2_jose_neg_cache_flush(log);
 }
 
 static oauth2_jose_jwk_list_t *oauth2_jose_jwks_eckey_url_resolve(
     oauth2_log_t *log, oauth2_jose_jwks_provider_t *provider, bool *refresh)
 {
-	return _oauth2_jose_jwks_resolve_from_uri(
+	oauth2_jose_jwk_list_t *keys = NULL;
+	cjose_jwk_t *jwk = NULL;
+
+	if (*refresh == false)
+		jwk = _oauth2_jose_eckey_cache_get(log,
+						   provider->jwks_uri->uri);
+
+	if (jwk) {
+		keys = oauth2_jose_jwk_list_init(log);
+		keys->jwk->jwk = jwk;
+		*refresh = true;
+		goto end;
+	}
+
+	keys = _oauth2_jose_jwks_resolve_from_uri(
 	    log, provider, refresh,
 	    _oauth2_jose_jwks_eckey_url_resolve_response_callback);
+
+	if (keys)
+		_oauth2_jose_eckey_cache_set(log, provider->jwks_uri->uri,
+					     keys->jwk->jwk,
+					     provider->jwks_uri->expiry_s);
+
+end:
+
+	return keys;
 }
 
 /*
@@ -43,8 +43,16 @@ typedef struct oauth2_uri_ctx_t {
 	bool ssl_verify;
 	oauth2_cache_t *cache;
 	oauth2_time_t expiry_s;
+	bool refresh;
+	// last forced JWKS refresh, under the jose negative cache mutex
+	oauth2_time_t refreshed;
 } oauth2_uri_ctx_t;
 
+typedef enum oauth2_jose_uri_refresh_type_t {
+	OAUTH2_JOSE_URI_REFRESH_RAW,
+	OAUTH2_JOSE_URI_REFRESH_JWKS
+} oauth2_jose_uri_refresh_type_t;
+
 typedef enum oauth2_jose_jwks_provider_type_t {
 	OAUTH2_JOSE_JWKS_PROVIDER_LIST,
 	OAUTH2_JOSE_JWKS_PROVIDER_JWKS_URI,
@@ -72,13 +80,34 @@ typedef enum oauth2_jose_jwt_validate_claim_t {
 	OAUTH2_JOSE_JWT_VALIDATE_CLAIM_SKIP
 } oauth2_jose_jwt_validate_claim_t;
 
+typedef enum oauth2_jose_jwt_claim_op_t {
+	OAUTH2_JOSE_JWT_CLAIM_OP_PRESENT,
+	OAUTH2_JOSE_JWT_CLAIM_OP_ISS,
+	OAUTH2_JOSE_JWT_CLAIM_OP_AUD,
+	OAUTH2_JOSE_JWT_CLAIM_OP_EXP,
+	OAUTH2_JOSE_JWT_CLAIM_OP_NBF,
+	OAUTH2_JOSE_JWT_CLAIM_OP_IAT
+} oauth2_jose_jwt_claim_op_t;
+
+/*
+ * a single claim check; the checks configured for a verify context are
+ * compiled into a flat array once at configuration time and evaluated in
+ * a single pass over the JWT payload
+ */
+typedef struct oauth2_jose_jwt_claim_check_t {
+	char *claim;
+	oauth2_jose_jwt_claim_op_t op;
+	oauth2_jose_jwt_validate_claim_t validate;
+	char *value;
+	oauth2_uint_t slack_before;
+	oauth2_uint_t slack_after;
+} oauth2_jose_jwt_claim_check_t;
+
 _OAUTH2_CFG_CTX_TYPE_START(oauth2_jose_jwt_verify_ctx)
+oauth2_uint_t id;
 oauth2_jose_jwks_provider_t *jwks_provider;
-oauth2_jose_jwt_validate_claim_t iss_validate;
-oauth2_jose_jwt_validate_claim_t exp_validate;
-oauth2_jose_jwt_validate_claim_t iat_validate;
-oauth2_uint_t iat_slack_before;
-oauth2_uint_t iat_slack_after;
+oauth2_jose_jwt_claim_check_t *checks;
+oauth2_uint_t n_checks;
 _OAUTH2_CFG_CTX_TYPE_END(oauth2_jose_jwt_verify_ctx)
 
 void *oauth2_uri_ctx_init(oauth2_log_t *log);
@@ -101,6 +130,9 @@ char *oauth2_jose_resolve_from_uri(oauth2_log_t *log, oauth2_uri_ctx_t *uri_ctx,
 char *oauth2_jose_options_uri_ctx(oauth2_log_t *log, const char *value,
 				  const oauth2_nv_list_t *params,
 				  oauth2_uri_ctx_t *ctx, const char *prefix);
+bool oauth2_jose_uri_refresh_register(oauth2_log_t *log,
+				      oauth2_uri_ctx_t *ctx,
+				      oauth2_jose_uri_refresh_type_t type);
 
 void *oauth2_jose_jwt_verify_ctx_init(oauth2_log_t *log);
 void *oauth2_jose_jwt_verify_ctx_clone(oauth2_log_t *log, void *s);
@@ -110,6 +142,8 @@ bool oauth2_jose_jwt_verify_set_options(
     oauth2_log_t *log, oauth2_jose_jwt_verify_ctx_t *jwt_verify,
     oauth2_jose_jwks_provider_type_t type, const oauth2_nv_list_t *params);
 
+void _oauth2_jose_shutdown(oauth2_log_t *log);
+
 char *oauth2_jose_jwt_header_peek(oauth2_log_t *log,
 				  const char *compact_encoded_jwt,
 				  const char **alg);
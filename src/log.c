@@ -23,13 +23,18 @@
 #include "oauth2/log.h"
 #include "oauth2/mem.h"
 #include "util_int.h"
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
 
 typedef struct oauth2_log_sink_t {
 	oauth2_log_level_t level;
 	oauth2_log_function_t callback;
 	void *ctx;
+	// releases ctx for sinks that own resources
+	void (*free)(struct oauth2_log_sink_t *sink);
 } oauth2_log_sink_t;
 
 // note this is fastest, but must maintain the order of the enum...
@@ -48,8 +53,17 @@ typedef struct oauth2_log_sink_list_t {
 
 typedef struct oauth2_log_t {
 	oauth2_log_sink_list_t sinks;
+	// the most verbose level that any of the sinks accepts in the low 32
+	// bits and the sink level generation it was computed for in the high
+	// 32 bits, so that both are read and published in a single atomic
+	// access when threads share the log
+	uint64_t level_cache;
 } oauth2_log_t;
 
+// sinks may be shared between logs and their level can be changed without
+// a reference to the log, so a level change invalidates all cached maxima
+static unsigned int _oauth2_log_level_generation = 1;
+
 oauth2_log_sink_t *oauth2_log_sink_create(oauth2_log_level_t level,
 					  oauth2_log_function_t callback,
 					  void *ctx)
@@ -58,6 +72,7 @@ oauth2_log_sink_t *oauth2_log_sink_create(oauth2_log_level_t level,
 	sink->callback = callback;
 	sink->level = level;
 	sink->ctx = ctx;
+	sink->free = NULL;
 	return sink;
 }
 
@@ -85,13 +100,60 @@ void oauth2_log_sink_add(oauth2_log_t *log, oauth2_log_sink_t *add)
 		log->sinks.last = ptr;
 	} else {
 		log->sinks.last->next = ptr;
+		log->sinks.last = ptr;
 	}
+
+	__atomic_store_n(&log->level_cache, 0, __ATOMIC_RELAXED);
 }
 
 void oauth2_log_sink_level_set(oauth2_log_sink_t *sink,
 			       oauth2_log_level_t level)
 {
-	sink->level = level;
+	__atomic_store_n(&sink->level, level, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&_oauth2_log_level_generation, 1, __ATOMIC_RELEASE);
+}
+
+// forwards to a sink owned by another log, see oauth2_log_clone
+static void _oauth2_log_sink_forward(oauth2_log_sink_t *sink,
+				     const char *filename, unsigned long line,
+				     const char *function,
+				     oauth2_log_level_t level, const char *msg)
+{
+	oauth2_log_sink_t *target = (oauth2_log_sink_t *)sink->ctx;
+	target->callback(target, filename, line, function, level, msg);
+}
+
+// a forwarding sink follows the level of its target
+static oauth2_log_level_t _oauth2_log_sink_level(oauth2_log_sink_t *sink)
+{
+	if (sink->callback == _oauth2_log_sink_forward)
+		sink = (oauth2_log_sink_t *)sink->ctx;
+	return __atomic_load_n(&sink->level, __ATOMIC_RELAXED);
+}
+
+bool oauth2_log_level_enabled(oauth2_log_t *log, oauth2_log_level_t level)
+{
+	oauth2_log_sink_list_elem_t *ptr = NULL;
+	oauth2_log_level_t level_max = OAUTH2_LOG_ERROR;
+	uint64_t cache = 0;
+	unsigned int generation =
+	    __atomic_load_n(&_oauth2_log_level_generation, __ATOMIC_ACQUIRE);
+
+	if ((log == NULL) || (log->sinks.first == NULL))
+		return false;
+
+	cache = __atomic_load_n(&log->level_cache, __ATOMIC_RELAXED);
+	if ((unsigned int)(cache >> 32) == generation)
+		return (level <= (oauth2_log_level_t)(cache & 0xffffffff));
+
+	for (ptr = log->sinks.first; ptr != NULL; ptr = ptr->next)
+		if (_oauth2_log_sink_level(ptr->sink) > level_max)
+			level_max = _oauth2_log_sink_level(ptr->sink);
+	__atomic_store_n(&log->level_cache,
+			 ((uint64_t)generation << 32) | (uint32_t)level_max,
+			 __ATOMIC_RELAXED);
+
+	return (level <= level_max);
 }
 
 static void oauth2_log_std(FILE *std, oauth2_log_sink_t *sink,
@@ -124,6 +186,313 @@ oauth2_log_sink_t oauth2_log_sink_stderr = {OAUTH2_LOG_INFO, oauth2_log_std_err,
 oauth2_log_sink_t oauth2_log_sink_stdout = {OAUTH2_LOG_INFO, oauth2_log_std_out,
 					    NULL};
 
+static void _oauth2_log_sink_free(oauth2_log_sink_t *sink)
+{
+	if ((sink == &oauth2_log_sink_stderr) ||
+	    (sink == &oauth2_log_sink_stdout))
+		return;
+	if (sink->free)
+		sink->free(sink);
+	oauth2_mem_free(sink);
+}
+
+/*
+ * asynchronous sink: a bounded multi-producer single-consumer ring buffer
+ * where each cell carries a sequence number that tells producers and the
+ * consumer whose turn it is, so that neither side takes a lock
+ */
+
+#define OAUTH2_LOG_ASYNC_CAPACITY_DEFAULT 4096
+// how long the writer sleeps when it finds the ring empty
+#define OAUTH2_LOG_ASYNC_IDLE_MS 50
+
+typedef struct oauth2_log_async_record_t {
+	const char *filename;
+	unsigned long line;
+	const char *function;
+	oauth2_log_level_t level;
+	char *msg;
+} oauth2_log_async_record_t;
+
+typedef struct oauth2_log_async_cell_t {
+	size_t seq;
+	oauth2_log_async_record_t rec;
+} oauth2_log_async_cell_t;
+
+typedef struct oauth2_log_async_t {
+	oauth2_log_sink_t *target;
+	oauth2_log_async_overflow_t overflow;
+	oauth2_log_async_cell_t *cells;
+	size_t mask;
+	size_t enqueue_pos;
+	size_t dequeue_pos;
+	unsigned long dropped;
+	bool stopping;
+	bool sleeping;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} oauth2_log_async_t;
+
+static bool _oauth2_log_async_push(oauth2_log_async_t *q,
+				   oauth2_log_async_record_t *rec)
+{
+	oauth2_log_async_cell_t *cell = NULL;
+	size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+	size_t seq = 0;
+	long diff = 0;
+
+	for (;;) {
+		cell = &q->cells[pos & q->mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		diff = (long)seq - (long)pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(
+				&q->enqueue_pos, &pos, pos + 1, true,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = __atomic_load_n(&q->enqueue_pos,
+					      __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->rec = *rec;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static bool _oauth2_log_async_pop(oauth2_log_async_t *q,
+				  oauth2_log_async_record_t *rec)
+{
+	oauth2_log_async_cell_t *cell = &q->cells[q->dequeue_pos & q->mask];
+	size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+
+	if (seq != q->dequeue_pos + 1)
+		return false;
+
+	*rec = cell->rec;
+	__atomic_store_n(&cell->seq, q->dequeue_pos + q->mask + 1,
+			 __ATOMIC_RELEASE);
+	q->dequeue_pos++;
+
+	return true;
+}
+
+static void _oauth2_log_async_wakeup(oauth2_log_async_t *q)
+{
+	// only take the lock when the writer is (about to go) asleep; the
+	// fence pairs with the one in the writer so one of us sees the other
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->sleeping, __ATOMIC_RELAXED) == false)
+		return;
+	pthread_mutex_lock(&q->mutex);
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+static bool _oauth2_log_async_empty(oauth2_log_async_t *q)
+{
+	oauth2_log_async_cell_t *cell = &q->cells[q->dequeue_pos & q->mask];
+	return (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) !=
+		q->dequeue_pos + 1);
+}
+
+static void *_oauth2_log_async_run(void *arg)
+{
+	oauth2_log_async_t *q = (oauth2_log_async_t *)arg;
+	oauth2_log_sink_t *target = q->target;
+	oauth2_log_async_record_t rec;
+	struct timespec ts;
+
+	for (;;) {
+
+		while (_oauth2_log_async_pop(q, &rec)) {
+			if (rec.level <= _oauth2_log_sink_level(target))
+				target->callback(target, rec.filename,
+						 rec.line, rec.function,
+						 rec.level, rec.msg);
+			oauth2_mem_free(rec.msg);
+		}
+
+		pthread_mutex_lock(&q->mutex);
+		__atomic_store_n(&q->sleeping, true, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&q->stopping, __ATOMIC_SEQ_CST)) {
+			pthread_mutex_unlock(&q->mutex);
+			// a final pass for records pushed before the stop
+			if (_oauth2_log_async_pop(q, &rec) == false)
+				break;
+			if (rec.level <= _oauth2_log_sink_level(target))
+				target->callback(target, rec.filename,
+						 rec.line, rec.function,
+						 rec.level, rec.msg);
+			oauth2_mem_free(rec.msg);
+			continue;
+		}
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += OAUTH2_LOG_ASYNC_IDLE_MS * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (_oauth2_log_async_empty(q))
+			pthread_cond_timedwait(&q->cond, &q->mutex, &ts);
+		__atomic_store_n(&q->sleeping, false, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&q->mutex);
+	}
+
+	return NULL;
+}
+
+static void _oauth2_log_async_callback(oauth2_log_sink_t *sink,
+				       const char *filename,
+				       unsigned long line,
+				       const char *function,
+				       oauth2_log_level_t level,
+				       const char *msg)
+{
+	oauth2_log_async_t *q = (oauth2_log_async_t *)sink->ctx;
+	oauth2_log_async_record_t rec;
+	struct timespec ts = {0, 100000L};
+	bool suspended = false;
+
+	// filename and function are string literals from the call site
+	rec.filename = filename;
+	rec.line = line;
+	rec.function = function;
+	rec.level = level;
+	// the writer thread frees the copy, possibly after the request ended
+	suspended = oauth2_mem_arena_suspend();
+	rec.msg = oauth2_strdup(msg);
+	oauth2_mem_arena_resume(suspended);
+	if (rec.msg == NULL)
+		goto dropped;
+
+	while (_oauth2_log_async_push(q, &rec) == false) {
+		if (q->overflow == OAUTH2_LOG_ASYNC_OVERFLOW_DROP) {
+			oauth2_mem_free(rec.msg);
+			goto dropped;
+		}
+		_oauth2_log_async_wakeup(q);
+		nanosleep(&ts, NULL);
+	}
+
+	_oauth2_log_async_wakeup(q);
+
+	return;
+
+dropped:
+
+	__atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+}
+
+static void _oauth2_log_async_stop(oauth2_log_async_t *q)
+{
+	pthread_mutex_lock(&q->mutex);
+	__atomic_store_n(&q->stopping, true, __ATOMIC_SEQ_CST);
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+	pthread_join(q->thread, NULL);
+
+	pthread_cond_destroy(&q->cond);
+	pthread_mutex_destroy(&q->mutex);
+}
+
+static void _oauth2_log_async_free(oauth2_log_sink_t *sink)
+{
+	oauth2_log_async_t *q = (oauth2_log_async_t *)sink->ctx;
+
+	if (q == NULL)
+		return;
+
+	_oauth2_log_async_stop(q);
+	_oauth2_log_sink_free(q->target);
+	oauth2_mem_free(q->cells);
+	oauth2_mem_free(q);
+	sink->ctx = NULL;
+}
+
+oauth2_log_sink_t *
+oauth2_log_sink_async_create(oauth2_log_sink_t *target, size_t capacity,
+			     oauth2_log_async_overflow_t overflow)
+{
+	oauth2_log_sink_t *sink = NULL;
+	oauth2_log_async_t *q = NULL;
+	size_t size = 2, i = 0;
+
+	if (target == NULL)
+		goto end;
+
+	if (capacity == 0)
+		capacity = OAUTH2_LOG_ASYNC_CAPACITY_DEFAULT;
+	// the sequence arithmetic requires a power of 2
+	while (size < capacity)
+		size <<= 1;
+
+	q = oauth2_mem_alloc(sizeof(oauth2_log_async_t));
+	if (q == NULL)
+		goto end;
+
+	q->cells = oauth2_mem_alloc(size * sizeof(oauth2_log_async_cell_t));
+	if (q->cells == NULL)
+		goto end;
+	for (i = 0; i < size; i++)
+		q->cells[i].seq = i;
+
+	q->target = target;
+	q->overflow = overflow;
+	q->mask = size - 1;
+	q->enqueue_pos = 0;
+	q->dequeue_pos = 0;
+	q->dropped = 0;
+	q->stopping = false;
+	q->sleeping = false;
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->cond, NULL);
+
+	if (pthread_create(&q->thread, NULL, _oauth2_log_async_run, q) != 0) {
+		pthread_cond_destroy(&q->cond);
+		pthread_mutex_destroy(&q->mutex);
+		goto end;
+	}
+
+	sink = oauth2_log_sink_create(_oauth2_log_sink_level(target),
+				      _oauth2_log_async_callback, q);
+	if (sink == NULL) {
+		// stops the thread but leaves the target to the caller
+		q->target = NULL;
+		_oauth2_log_async_stop(q);
+		goto end;
+	}
+	sink->free = _oauth2_log_async_free;
+	q = NULL;
+
+end:
+
+	if (q) {
+		if (q->cells)
+			oauth2_mem_free(q->cells);
+		oauth2_mem_free(q);
+	}
+
+	return sink;
+}
+
+unsigned long oauth2_log_sink_async_dropped_get(oauth2_log_sink_t *sink)
+{
+	oauth2_log_async_t *q = NULL;
+
+	if ((sink == NULL) || (sink->callback != _oauth2_log_async_callback))
+		return 0;
+
+	q = (oauth2_log_async_t *)sink->ctx;
+	return __atomic_load_n(&q->dropped, __ATOMIC_RELAXED);
+}
+
 // API
 
 #ifdef _MSC_VER
@@ -162,7 +531,7 @@ void oauth2_log(oauth2_log_t *log, const char *filename, unsigned long line,
 	char *msg = NULL;
 	int rc = 0;
 
-	if ((log == NULL) || (log->sinks.first == NULL) || (fmt == NULL))
+	if ((fmt == NULL) || (oauth2_log_level_enabled(log, level) == false))
 		goto end;
 
 	va_start(ap, fmt);
@@ -174,7 +543,7 @@ void oauth2_log(oauth2_log_t *log, const char *filename, unsigned long line,
 
 	if (msg) {
 		for (ptr = log->sinks.first; ptr != NULL; ptr = ptr->next) {
-			if (level > ptr->sink->level)
+			if (level > _oauth2_log_sink_level(ptr->sink))
 				continue;
 			ptr->sink->callback(ptr->sink, filename, line, function,
 					    level, msg);
@@ -198,15 +567,45 @@ oauth2_log_t *oauth2_log_init(oauth2_log_level_t level, oauth2_log_sink_t *sink)
 
 	log->sinks.first = NULL;
 	log->sinks.last = NULL;
+	log->level_cache = 0;
 	oauth2_log_sink_add(log,
 			    (sink != NULL) ? sink : &oauth2_log_sink_stderr);
-	log->sinks.first->sink->level = level;
+	// bumps the generation, so logs sharing the sink pick up the level
+	oauth2_log_sink_level_set(log->sinks.first->sink, level);
 
 end:
 
 	return log;
 }
 
+oauth2_log_t *oauth2_log_clone(oauth2_log_t *log)
+{
+	oauth2_log_t *dst = NULL;
+	oauth2_log_sink_list_elem_t *ptr = NULL;
+	oauth2_log_sink_t *sink = NULL;
+
+	if (log == NULL)
+		goto end;
+
+	dst = (oauth2_log_t *)oauth2_mem_alloc(sizeof(oauth2_log_t));
+	if (dst == NULL)
+		goto end;
+
+	dst->sinks.first = NULL;
+	dst->sinks.last = NULL;
+	dst->level_cache = 0;
+	for (ptr = log->sinks.first; ptr != NULL; ptr = ptr->next) {
+		sink = oauth2_log_sink_create(
+		    _oauth2_log_sink_level(ptr->sink), _oauth2_log_sink_forward,
+		    ptr->sink);
+		oauth2_log_sink_add(dst, sink);
+	}
+
+end:
+
+	return dst;
+}
+
 void oauth2_log_free(oauth2_log_t *log)
 {
 	oauth2_log_sink_list_elem_t *ptr = NULL;
@@ -216,9 +615,7 @@ void oauth2_log_free(oauth2_log_t *log)
 
 	while ((ptr = log->sinks.first)) {
 		log->sinks.first = log->sinks.first->next;
-		if ((ptr->sink != &oauth2_log_sink_stderr) &&
-		    (ptr->sink != &oauth2_log_sink_stdout))
-			oauth2_mem_free(ptr->sink);
+		_oauth2_log_sink_free(ptr->sink);
 		oauth2_mem_free(ptr);
 	}
 	log->sinks.last = NULL;
@@ -28,9 +28,23 @@
 
 #include "curl/curl.h"
 
+// cURL frees with the dealloc function so it must bypass any arena
+
 static void *oauth2_mem_calloc_callback(size_t nmemb, size_t size)
 {
-	return oauth2_mem_alloc(nmemb * size);
+	void *ptr = oauth2_mem_get_alloc()(nmemb * size);
+	if (ptr)
+		memset(ptr, 0, nmemb * size);
+	return ptr;
+}
+
+static char *oauth2_mem_strdup_callback(const char *src)
+{
+	size_t len = strlen(src) + 1;
+	char *dst = oauth2_mem_get_alloc()(len);
+	if (dst)
+		memcpy(dst, src, len);
+	return dst;
 }
 
 void oauth2_mem_set_alloc_funcs(oauth2_mem_alloc_fn_t alloc,
@@ -39,7 +53,8 @@ void oauth2_mem_set_alloc_funcs(oauth2_mem_alloc_fn_t alloc,
 {
 	cjose_set_alloc_funcs(alloc, realloc, dealloc);
 	curl_global_init_mem(CURL_GLOBAL_ALL, alloc, dealloc, realloc,
-			     oauth2_strdup, oauth2_mem_calloc_callback);
+			     oauth2_mem_strdup_callback,
+			     oauth2_mem_calloc_callback);
 }
 
 void oauth2_mem_set_alloc_ex_funcs(oauth2_mem_alloc3_fn_t alloc3,
@@ -49,7 +64,8 @@ void oauth2_mem_set_alloc_ex_funcs(oauth2_mem_alloc3_fn_t alloc3,
 	cjose_set_alloc_ex_funcs(alloc3, realloc3, dealloc3);
 	curl_global_init_mem(CURL_GLOBAL_ALL, cjose_get_alloc(),
 			     cjose_get_dealloc(), cjose_get_realloc(),
-			     oauth2_strdup, oauth2_mem_calloc_callback);
+			     oauth2_mem_strdup_callback,
+			     oauth2_mem_calloc_callback);
 }
 
 oauth2_mem_alloc_fn_t oauth2_mem_get_alloc()
@@ -82,9 +98,217 @@ oauth2_mem_dealloc3_fn_t oauth2_mem_get_dealloc3()
 	return cjose_get_dealloc3();
 }
 
+#define OAUTH2_MEM_ARENA_CHUNK_SIZE_DEFAULT 8192
+#define OAUTH2_MEM_ARENA_ALIGN 16
+#define OAUTH2_MEM_ARENA_ROUND(n)                                              \
+	(((n) + OAUTH2_MEM_ARENA_ALIGN - 1) & ~(OAUTH2_MEM_ARENA_ALIGN - 1))
+
+typedef struct oauth2_mem_arena_chunk_t {
+	struct oauth2_mem_arena_chunk_t *next;
+	char *data;
+	size_t size;
+	size_t used;
+} oauth2_mem_arena_chunk_t;
+
+struct oauth2_mem_arena_t {
+	// the arena that was entered on the thread before this one
+	struct oauth2_mem_arena_t *prev;
+	unsigned int depth;
+	oauth2_mem_arena_chunk_t *chunks;
+	size_t chunk_size;
+	size_t used;
+	oauth2_mem_arena_chunk_alloc_fn_t alloc;
+	oauth2_mem_arena_chunk_free_fn_t dealloc;
+	void *ctx;
+};
+
+// the arena that the calling thread is serving a request from
+static __thread oauth2_mem_arena_t *_oauth2_mem_arena = NULL;
+static __thread bool _oauth2_mem_arena_suspended = false;
+
+// whether ptr was handed out by one of the arenas entered on this thread;
+// only thread-local state is consulted so that a free does not contend
+static bool _oauth2_mem_arena_owns(void *ptr)
+{
+	oauth2_mem_arena_t *arena = NULL;
+	oauth2_mem_arena_chunk_t *chunk = NULL;
+
+	for (arena = _oauth2_mem_arena; arena; arena = arena->prev) {
+		for (chunk = arena->chunks; chunk; chunk = chunk->next) {
+			if (((char *)ptr >= chunk->data) &&
+			    ((char *)ptr < chunk->data + chunk->size))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+static void *_oauth2_mem_arena_chunk_alloc_default(void *ctx, size_t size)
+{
+	return oauth2_mem_get_alloc()(size);
+}
+
+static void _oauth2_mem_arena_chunk_free_default(void *ctx, void *ptr)
+{
+	oauth2_mem_get_dealloc()(ptr);
+}
+
+oauth2_mem_arena_t *
+oauth2_mem_arena_create_ex(size_t chunk_size,
+			   oauth2_mem_arena_chunk_alloc_fn_t alloc,
+			   oauth2_mem_arena_chunk_free_fn_t dealloc, void *ctx)
+{
+	oauth2_mem_arena_t *arena = NULL;
+
+	if (alloc == NULL)
+		goto end;
+
+	arena = oauth2_mem_get_alloc()(sizeof(oauth2_mem_arena_t));
+	if (arena == NULL)
+		goto end;
+
+	arena->prev = NULL;
+	arena->depth = 0;
+	arena->chunks = NULL;
+	arena->chunk_size = chunk_size ? OAUTH2_MEM_ARENA_ROUND(chunk_size)
+				       : OAUTH2_MEM_ARENA_CHUNK_SIZE_DEFAULT;
+	arena->used = 0;
+	arena->alloc = alloc;
+	arena->dealloc = dealloc;
+	arena->ctx = ctx;
+
+end:
+
+	return arena;
+}
+
+oauth2_mem_arena_t *oauth2_mem_arena_create(size_t chunk_size)
+{
+	return oauth2_mem_arena_create_ex(
+	    chunk_size, _oauth2_mem_arena_chunk_alloc_default,
+	    _oauth2_mem_arena_chunk_free_default, NULL);
+}
+
+void oauth2_mem_arena_free(oauth2_mem_arena_t *arena)
+{
+	oauth2_mem_arena_chunk_t *chunk = NULL;
+
+	if (arena == NULL)
+		return;
+
+	// normally left already, but do not leave a dangling pointer behind
+	if (_oauth2_mem_arena == arena) {
+		_oauth2_mem_arena = arena->prev;
+		_oauth2_mem_arena_suspended = false;
+	}
+
+	while ((chunk = arena->chunks)) {
+		arena->chunks = chunk->next;
+		if (arena->dealloc)
+			arena->dealloc(arena->ctx, chunk);
+	}
+
+	oauth2_mem_get_dealloc()(arena);
+}
+
+size_t oauth2_mem_arena_used(oauth2_mem_arena_t *arena)
+{
+	return arena ? arena->used : 0;
+}
+
+void oauth2_mem_arena_enter(oauth2_mem_arena_t *arena)
+{
+	if (arena == NULL)
+		return;
+
+	if (_oauth2_mem_arena == arena) {
+		arena->depth++;
+		return;
+	}
+
+	arena->prev = _oauth2_mem_arena;
+	arena->depth = 1;
+	_oauth2_mem_arena = arena;
+	_oauth2_mem_arena_suspended = false;
+}
+
+void oauth2_mem_arena_leave(oauth2_mem_arena_t *arena)
+{
+	if ((arena == NULL) || (_oauth2_mem_arena != arena))
+		return;
+
+	if (--arena->depth > 0)
+		return;
+
+	// e.g. back to the main request after a sub-request
+	_oauth2_mem_arena = arena->prev;
+	_oauth2_mem_arena_suspended = false;
+	arena->prev = NULL;
+}
+
+bool oauth2_mem_arena_suspend()
+{
+	bool suspended = _oauth2_mem_arena_suspended;
+	_oauth2_mem_arena_suspended = true;
+	return suspended;
+}
+
+void oauth2_mem_arena_resume(bool suspended)
+{
+	_oauth2_mem_arena_suspended = suspended;
+}
+
+static void *_oauth2_mem_arena_alloc(oauth2_mem_arena_t *arena, size_t size)
+{
+	oauth2_mem_arena_chunk_t *chunk = arena->chunks;
+	size_t hdr = OAUTH2_MEM_ARENA_ROUND(sizeof(oauth2_mem_arena_chunk_t));
+	size_t n = 0;
+	void *ptr = NULL;
+
+	size = OAUTH2_MEM_ARENA_ROUND(size ? size : 1);
+
+	if ((chunk) && (chunk->size - chunk->used >= size))
+		goto end;
+
+	// large allocations get a chunk of their own that is put behind the
+	// current one so that it does not waste the remainder of the latter
+	n = (size > arena->chunk_size / 4) ? size : arena->chunk_size;
+	chunk = arena->alloc(arena->ctx, hdr + n);
+	if (chunk == NULL)
+		goto end;
+	chunk->data = (char *)chunk + hdr;
+	chunk->size = n;
+	chunk->used = 0;
+	if ((n == size) && (arena->chunks)) {
+		chunk->next = arena->chunks->next;
+		arena->chunks->next = chunk;
+	} else {
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+
+end:
+
+	if (chunk) {
+		ptr = chunk->data + chunk->used;
+		chunk->used += size;
+		arena->used += size;
+	}
+
+	return ptr;
+}
+
+void *oauth2_mem_alloc_uninit(size_t size)
+{
+	if ((_oauth2_mem_arena) && (_oauth2_mem_arena_suspended == false))
+		return _oauth2_mem_arena_alloc(_oauth2_mem_arena, size);
+	return oauth2_mem_get_alloc()(size);
+}
+
 void *oauth2_mem_alloc(size_t size)
 {
-	void *ptr = oauth2_mem_get_alloc()(size);
+	void *ptr = oauth2_mem_alloc_uninit(size);
 	if (ptr)
 		memset(ptr, 0, size);
 	return ptr;
@@ -92,5 +316,8 @@ void *oauth2_mem_alloc(size_t size)
 
 void oauth2_mem_free(void *ptr)
 {
+	// arena memory is released in bulk
+	if ((ptr) && (_oauth2_mem_arena) && (_oauth2_mem_arena_owns(ptr)))
+		return;
 	oauth2_mem_get_dealloc()(ptr);
 }
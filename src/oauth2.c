@@ -31,6 +31,10 @@
 #include "util_int.h"
 
 #include <cjose/cjose.h>
+#include <openssl/sha.h>
+
+#include <pthread.h>
+#include <unistd.h>
 
 /*
  * auth
@@ -48,12 +52,12 @@
 #define OAUTH2_CLIENT_ASSERTION_TYPE_JWT_BEARER                                \
 	"urn:ietf:params:oauth:client-assertion-type:jwt-bearer"
 
-static bool _oauth2_add_signed_jwt(oauth2_log_t *log, cjose_jwk_t *jwk,
-				   const char *alg, const char *client_id,
-				   const char *aud, oauth2_nv_list_t *params)
+static char *_oauth2_create_signed_jwt(oauth2_log_t *log, cjose_jwk_t *jwk,
+				       const char *alg, const char *client_id,
+				       const char *aud, oauth2_time_t exp)
 {
 
-	bool rc = false;
+	char *rv = NULL;
 	char *payload = NULL;
 	json_t *assertion = NULL;
 	cjose_header_t *hdr = NULL;
@@ -73,7 +77,7 @@ static bool _oauth2_add_signed_jwt(oauth2_log_t *log, cjose_jwk_t *jwk,
 			    json_string(client_id));
 	json_object_set_new(assertion, OAUTH2_CLAIM_AUD, json_string(aud));
 	json_object_set_new(assertion, OAUTH2_CLAIM_EXP,
-			    json_integer(oauth2_time_now_sec() + 60));
+			    json_integer(oauth2_time_now_sec() + exp));
 	json_object_set_new(assertion, OAUTH2_CLAIM_IAT,
 			    json_integer(oauth2_time_now_sec()));
 	payload = json_dumps(assertion, JSON_PRESERVE_ORDER | JSON_COMPACT);
@@ -108,11 +112,7 @@ static bool _oauth2_add_signed_jwt(oauth2_log_t *log, cjose_jwk_t *jwk,
 		goto end;
 	}
 
-	oauth2_nv_list_set(log, params, OAUTH2_CLIENT_ASSERTION_TYPE,
-			   OAUTH2_CLIENT_ASSERTION_TYPE_JWT_BEARER);
-	oauth2_nv_list_set(log, params, OAUTH2_CLIENT_ASSERTION, jwt);
-
-	rc = true;
+	rv = oauth2_strdup(jwt);
 
 end:
 
@@ -129,6 +129,327 @@ end:
 	if (jws)
 		cjose_jws_release(jws);
 
+	return rv;
+}
+
+#define OAUTH2_JWT_EXPIRY_DEFAULT 60
+// an assertion must be valid for at least this number of seconds when sent
+#define OAUTH2_JWT_POOL_MIN_TTL_S 10
+
+/*
+ * assertion pools are topped up by a per-process background thread so that
+ * signing happens off the request path; an empty pool falls back to signing
+ * a single assertion inline, just like a configuration without a pool
+ */
+
+static pthread_mutex_t _oauth2_jwt_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+// signals queued pools and stop requests to the refill thread
+static pthread_cond_t _oauth2_jwt_pool_cond = PTHREAD_COND_INITIALIZER;
+// signals the completion of a refill
+static pthread_cond_t _oauth2_jwt_pool_done = PTHREAD_COND_INITIALIZER;
+static pthread_t _oauth2_jwt_pool_thread;
+static bool _oauth2_jwt_pool_running = false;
+static bool _oauth2_jwt_pool_stopping = false;
+static pid_t _oauth2_jwt_pool_pid = 0;
+static oauth2_cfg_endpoint_auth_jwt_pool_t *_oauth2_jwt_pool_queue = NULL;
+
+// must be called with _oauth2_jwt_pool_mutex held
+static void _oauth2_jwt_pool_append(oauth2_cfg_endpoint_auth_jwt_pool_t *pool,
+				    char **jwt, oauth2_uint_t n,
+				    oauth2_time_t exp)
+{
+	oauth2_uint_t i = 0, len = pool->len - pool->next;
+
+	// move the remaining assertions to the front, then add the new ones
+	memmove(pool->jwt, pool->jwt + pool->next, len * sizeof(char *));
+	memmove(pool->exp, pool->exp + pool->next,
+		len * sizeof(oauth2_time_t));
+	pool->next = 0;
+
+	for (i = 0; i < n; i++) {
+		if (len < pool->size) {
+			pool->jwt[len] = jwt[i];
+			pool->exp[len] = exp;
+			len++;
+		} else {
+			oauth2_mem_free(jwt[i]);
+		}
+	}
+
+	pool->len = len;
+}
+
+static void *_oauth2_jwt_pool_run(void *arg)
+{
+	oauth2_cfg_endpoint_auth_jwt_pool_t *pool = NULL;
+	char **jwt = NULL;
+	oauth2_uint_t i = 0, n = 0;
+	oauth2_time_t exp = 0;
+
+	pthread_mutex_lock(&_oauth2_jwt_pool_mutex);
+
+	while (_oauth2_jwt_pool_stopping == false) {
+
+		pool = _oauth2_jwt_pool_queue;
+		if (pool == NULL) {
+			pthread_cond_wait(&_oauth2_jwt_pool_cond,
+					  &_oauth2_jwt_pool_mutex);
+			continue;
+		}
+
+		_oauth2_jwt_pool_queue = pool->queue_next;
+		pool->queue_next = NULL;
+		pool->queued = false;
+		// the pool and its signing material stay put while busy
+		pool->busy = true;
+		n = pool->size - (pool->len - pool->next);
+		pthread_mutex_unlock(&_oauth2_jwt_pool_mutex);
+
+		// the exp claim of the assertions is at least this
+		exp = oauth2_time_now_sec() + pool->expiry_s;
+		jwt = oauth2_mem_alloc(n * sizeof(char *));
+		for (i = 0; (jwt) && (i < n); i++) {
+			jwt[i] = _oauth2_create_signed_jwt(
+			    NULL, pool->jwk, pool->alg, pool->client_id,
+			    pool->aud, pool->expiry_s);
+			if (jwt[i] == NULL)
+				break;
+		}
+
+		pthread_mutex_lock(&_oauth2_jwt_pool_mutex);
+
+		if (jwt) {
+			_oauth2_jwt_pool_append(pool, jwt, i, exp);
+			oauth2_mem_free(jwt);
+		}
+		pool->busy = false;
+		pthread_cond_broadcast(&_oauth2_jwt_pool_done);
+	}
+
+	pthread_mutex_unlock(&_oauth2_jwt_pool_mutex);
+
+	return NULL;
+}
+
+// must be called with _oauth2_jwt_pool_mutex held
+static void _oauth2_jwt_pool_fork_check(void)
+{
+	// a thread does not survive a fork
+	if (_oauth2_jwt_pool_pid == getpid())
+		return;
+
+	_oauth2_jwt_pool_running = false;
+	_oauth2_jwt_pool_queue = NULL;
+	_oauth2_jwt_pool_pid = getpid();
+}
+
+// must be called with _oauth2_jwt_pool_mutex held
+static void _oauth2_jwt_pool_schedule(oauth2_log_t *log,
+				      oauth2_cfg_endpoint_auth_jwt_pool_t *pool)
+{
+	if ((pool->queued) || (pool->busy))
+		return;
+
+	if (_oauth2_jwt_pool_running == false) {
+		_oauth2_jwt_pool_stopping = false;
+		if (pthread_create(&_oauth2_jwt_pool_thread, NULL,
+				   _oauth2_jwt_pool_run, NULL) != 0) {
+			oauth2_error(log, "pthread_create failed");
+			return;
+		}
+		_oauth2_jwt_pool_running = true;
+	}
+
+	pool->queue_next = _oauth2_jwt_pool_queue;
+	_oauth2_jwt_pool_queue = pool;
+	pool->queued = true;
+	pthread_cond_signal(&_oauth2_jwt_pool_cond);
+}
+
+// must be called with _oauth2_jwt_pool_mutex held
+static bool _oauth2_jwt_pool_bind(oauth2_log_t *log,
+				  oauth2_cfg_endpoint_auth_jwt_pool_t *pool,
+				  cjose_jwk_t *jwk, const char *alg,
+				  const char *client_id, const char *aud)
+{
+	cjose_err err;
+	bool suspended = false;
+
+	if (pool->jwk)
+		return true;
+
+	// the refill thread signs with its own references, since the pool
+	// may be freed after the configuration that it is part of
+	err.code = CJOSE_ERR_NONE;
+	pool->jwk = cjose_jwk_retain(jwk, &err);
+	if (pool->jwk == NULL)
+		return false;
+	pool->alg = alg;
+	suspended = oauth2_mem_arena_suspend();
+	pool->client_id = oauth2_strdup(client_id);
+	pool->aud = oauth2_strdup(aud);
+	oauth2_mem_arena_resume(suspended);
+
+	return true;
+}
+
+static char *_oauth2_jwt_pool_pop(oauth2_log_t *log,
+				  oauth2_cfg_endpoint_auth_jwt_pool_t *pool,
+				  cjose_jwk_t *jwk, const char *alg,
+				  const char *client_id, const char *aud)
+{
+	char *rv = NULL;
+	oauth2_time_t now = 0;
+
+	pthread_mutex_lock(&_oauth2_jwt_pool_mutex);
+
+	_oauth2_jwt_pool_fork_check();
+
+	// a forked child must never hand out the assertions of its parent
+	if (pool->pid != getpid()) {
+		oauth2_cfg_endpoint_auth_jwt_pool_flush(log, pool);
+		pool->queue_next = NULL;
+		pool->queued = false;
+		pool->busy = false;
+		pool->pid = getpid();
+	}
+
+	now = oauth2_time_now_sec();
+
+	while ((rv == NULL) && (pool->next < pool->len)) {
+		rv = pool->jwt[pool->next];
+		pool->jwt[pool->next] = NULL;
+		if (pool->exp[pool->next] < now + OAUTH2_JWT_POOL_MIN_TTL_S) {
+			oauth2_mem_free(rv);
+			rv = NULL;
+		}
+		pool->next++;
+	}
+
+	// top up once half of the pool has been used
+	if (((pool->len - pool->next) * 2 <= pool->size) &&
+	    (_oauth2_jwt_pool_bind(log, pool, jwk, alg, client_id, aud)))
+		_oauth2_jwt_pool_schedule(log, pool);
+
+	pthread_mutex_unlock(&_oauth2_jwt_pool_mutex);
+
+	if (rv == NULL) {
+		oauth2_debug(log, "assertion pool empty, signing inline");
+		rv = _oauth2_create_signed_jwt(log, jwk, alg, client_id, aud,
+					       pool->expiry_s);
+	}
+
+	return rv;
+}
+
+void _oauth2_jwt_pool_release(oauth2_log_t *log,
+			      oauth2_cfg_endpoint_auth_jwt_pool_t *pool)
+{
+	oauth2_cfg_endpoint_auth_jwt_pool_t **ptr = NULL;
+
+	pthread_mutex_lock(&_oauth2_jwt_pool_mutex);
+
+	_oauth2_jwt_pool_fork_check();
+
+	if (pool->pid == getpid()) {
+		for (ptr = &_oauth2_jwt_pool_queue; *ptr;
+		     ptr = &(*ptr)->queue_next) {
+			if (*ptr == pool) {
+				*ptr = pool->queue_next;
+				break;
+			}
+		}
+		while ((pool->busy) && (_oauth2_jwt_pool_running))
+			pthread_cond_wait(&_oauth2_jwt_pool_done,
+					  &_oauth2_jwt_pool_mutex);
+	}
+	pool->queue_next = NULL;
+	pool->queued = false;
+	pool->busy = false;
+
+	pthread_mutex_unlock(&_oauth2_jwt_pool_mutex);
+
+	if (pool->jwk)
+		cjose_jwk_release(pool->jwk);
+	if (pool->client_id)
+		oauth2_mem_free(pool->client_id);
+	if (pool->aud)
+		oauth2_mem_free(pool->aud);
+	pool->jwk = NULL;
+	pool->alg = NULL;
+	pool->client_id = NULL;
+	pool->aud = NULL;
+}
+
+void _oauth2_jwt_pool_shutdown(oauth2_log_t *log)
+{
+	pthread_mutex_lock(&_oauth2_jwt_pool_mutex);
+
+	if ((_oauth2_jwt_pool_running == false) ||
+	    (_oauth2_jwt_pool_pid != getpid())) {
+		_oauth2_jwt_pool_running = false;
+		pthread_mutex_unlock(&_oauth2_jwt_pool_mutex);
+		return;
+	}
+
+	_oauth2_jwt_pool_stopping = true;
+	pthread_cond_signal(&_oauth2_jwt_pool_cond);
+	pthread_mutex_unlock(&_oauth2_jwt_pool_mutex);
+
+	pthread_join(_oauth2_jwt_pool_thread, NULL);
+
+	pthread_mutex_lock(&_oauth2_jwt_pool_mutex);
+	_oauth2_jwt_pool_running = false;
+	// queued pools are left with stale flags: reset them
+	while (_oauth2_jwt_pool_queue) {
+		_oauth2_jwt_pool_queue->queued = false;
+		_oauth2_jwt_pool_queue = _oauth2_jwt_pool_queue->queue_next;
+	}
+	pthread_cond_broadcast(&_oauth2_jwt_pool_done);
+	pthread_mutex_unlock(&_oauth2_jwt_pool_mutex);
+}
+
+static bool _oauth2_add_signed_jwt(oauth2_log_t *log,
+				   oauth2_http_call_ctx_t *ctx,
+				   cjose_jwk_t *jwk, const char *alg,
+				   const char *client_id, const char *aud,
+				   oauth2_cfg_endpoint_auth_jwt_pool_t *pool,
+				   oauth2_nv_list_t *params)
+{
+
+	bool rc = false;
+	char *jwt = NULL;
+
+	oauth2_debug(log, "enter");
+
+	if ((pool != NULL) && (pool->size > 0) &&
+	    (pool->expiry_s > OAUTH2_JWT_POOL_MIN_TTL_S))
+		jwt = _oauth2_jwt_pool_pop(log, pool, jwk, alg, client_id, aud);
+	else
+		jwt = _oauth2_create_signed_jwt(
+		    log, jwk, alg, client_id, aud,
+		    pool ? pool->expiry_s : OAUTH2_JWT_EXPIRY_DEFAULT);
+
+	if (jwt == NULL)
+		goto end;
+
+	oauth2_nv_list_set(log, params, OAUTH2_CLIENT_ASSERTION_TYPE,
+			   OAUTH2_CLIENT_ASSERTION_TYPE_JWT_BEARER);
+	oauth2_nv_list_set(log, params, OAUTH2_CLIENT_ASSERTION, jwt);
+
+	// the jti of the assertion is single use: never send it twice
+	if (ctx)
+		oauth2_http_call_ctx_hedge_set(log, ctx, false);
+
+	rc = true;
+
+end:
+
+	if (jwt)
+		oauth2_mem_free(jwt);
+
+	oauth2_debug(log, "leave");
+
 	return rc;
 }
 
@@ -146,10 +467,11 @@ oauth2_auth_client_secret_jwt(oauth2_log_t *log, oauth2_http_call_ctx_t *ctx,
 	    (auth->client_secret_jwt.aud == NULL))
 		goto end;
 
-	rc = _oauth2_add_signed_jwt(log, auth->client_secret_jwt.jwk,
+	rc = _oauth2_add_signed_jwt(log, ctx, auth->client_secret_jwt.jwk,
 				    CJOSE_HDR_ALG_HS256,
 				    auth->client_secret_jwt.client_id,
-				    auth->client_secret_jwt.aud, params);
+				    auth->client_secret_jwt.aud,
+				    auth->client_secret_jwt.pool, params);
 
 end:
 
@@ -187,8 +509,9 @@ static bool oauth2_auth_private_key_jwt(oauth2_log_t *log,
 	}
 
 	rc = _oauth2_add_signed_jwt(
-	    log, auth->private_key_jwt.jwk, CJOSE_HDR_ALG_RS256,
-	    auth->private_key_jwt.client_id, auth->private_key_jwt.aud, params);
+	    log, ctx, auth->private_key_jwt.jwk, CJOSE_HDR_ALG_RS256,
+	    auth->private_key_jwt.client_id, auth->private_key_jwt.aud,
+	    auth->private_key_jwt.pool, params);
 
 end:
 
@@ -331,18 +654,24 @@ end:
 _OAUTH2_CFG_CTX_TYPE_START(oauth2_introspect_ctx)
 char *url;
 bool ssl_verify;
+bool http2;
+oauth2_time_t negative_expiry_s;
 oauth2_cfg_endpoint_auth_t *auth;
 _OAUTH2_CFG_CTX_TYPE_END(oauth2_introspect_ctx)
 
 _OAUTH2_CFG_CTX_INIT_START(oauth2_introspect_ctx)
 ctx->url = NULL;
 ctx->ssl_verify = true;
+ctx->http2 = false;
+ctx->negative_expiry_s = OAUTH2_CFG_UINT_UNSET;
 ctx->auth = oauth2_cfg_endpoint_auth_init(log);
 _OAUTH2_CFG_CTX_INIT_END
 
 _OAUTH2_CFG_CTX_CLONE_START(oauth2_introspect_ctx)
 dst->url = oauth2_strdup(src->url);
 dst->ssl_verify = src->ssl_verify;
+dst->http2 = src->http2;
+dst->negative_expiry_s = src->negative_expiry_s;
 dst->auth = oauth2_cfg_endpoint_auth_clone(log, src->auth);
 _OAUTH2_CFG_CTX_CLONE_END
 
@@ -361,11 +690,16 @@ _OAUTH2_CFG_CTX_FUNCS(oauth2_introspect_ctx)
 #define OAUTH2_INTROSPECT_TOKEN_TYPE_HINT_ACCESS_TOKEN "access_token"
 
 #define OAUTH2_INTROSPECT_CLAIM_ACTIVE "active"
+#define OAUTH2_INTROSPECT_CLAIM_EXP "exp"
+
+#define OAUTH2_INTROSPECT_CACHE_KEY_PREFIX "introspect:"
+#define OAUTH2_INTROSPECT_CACHE_INACTIVE "inactive"
+#define OAUTH2_INTROSPECT_NEGATIVE_EXPIRY_DEFAULT 10
 
 static bool _oauth2_introspect_verify(oauth2_log_t *log,
 				      oauth2_introspect_ctx_t *ctx,
 				      const char *token, json_t **json_payload,
-				      char **s_payload)
+				      char **s_payload, bool *inactive)
 {
 	bool rc = false;
 	oauth2_nv_list_t *params = NULL;
@@ -383,6 +717,13 @@ static bool _oauth2_introspect_verify(oauth2_log_t *log,
 						ctx->ssl_verify) == false)
 		goto end;
 
+	if (oauth2_http_call_ctx_http2_set(log, http_ctx, ctx->http2) == false)
+		goto end;
+
+	// introspection has no side effects so it may be sent twice
+	if (oauth2_http_call_ctx_hedge_set(log, http_ctx, true) == false)
+		goto end;
+
 	params = oauth2_nv_list_init(log);
 	if (params == NULL)
 		goto end;
@@ -422,6 +763,7 @@ static bool _oauth2_introspect_verify(oauth2_log_t *log,
 		    "\"%s\" boolean object with value \"false\" found in "
 		    "response JSON object",
 		    OAUTH2_INTROSPECT_CLAIM_ACTIVE);
+		*inactive = true;
 		goto end;
 	}
 
@@ -453,12 +795,65 @@ end:
 	return rc;
 }
 
+// a digest of endpoint and token, bounding the key size and keeping the
+// token itself out of the cache
+static char *_oauth2_introspect_cache_key(oauth2_log_t *log,
+					  oauth2_introspect_ctx_t *ctx,
+					  const char *token)
+{
+	char *key = NULL, *str = NULL, *digest = NULL;
+
+	str = oauth2_stradd(NULL, ctx->url, " ", token);
+	if (str == NULL)
+		goto end;
+
+	if (oauth2_jose_hash2s(log, OAUTH2_JOSE_OPENSSL_ALG_SHA256, str,
+			       &digest) == false)
+		goto end;
+
+	key = oauth2_stradd(NULL, OAUTH2_INTROSPECT_CACHE_KEY_PREFIX, digest,
+			    NULL);
+
+end:
+
+	if (str)
+		oauth2_mem_free(str);
+	if (digest)
+		oauth2_mem_free(digest);
+
+	return key;
+}
+
+// cache an active token until it expires, but no longer than max_s
+static oauth2_time_t _oauth2_introspect_cache_ttl(oauth2_log_t *log,
+						  json_t *json_payload,
+						  oauth2_time_t max_s)
+{
+	json_int_t exp = 0;
+	oauth2_time_t now = oauth2_time_now_sec();
+
+	if ((oauth2_json_number_get(log, json_payload,
+				    OAUTH2_INTROSPECT_CLAIM_EXP, &exp,
+				    0) == false) ||
+	    (exp <= 0))
+		return max_s;
+
+	if ((oauth2_time_t)exp <= now)
+		return 0;
+
+	return ((oauth2_time_t)exp - now < max_s) ? (oauth2_time_t)exp - now
+						  : max_s;
+}
+
 static bool _oauth2_introspect_verify_callback(
     oauth2_log_t *log, oauth2_cfg_token_verify_t *verify, const char *token,
     json_t **json_payload, char **s_payload)
 {
 	bool rc = false;
 	oauth2_introspect_ctx_t *ctx = NULL;
+	char *key = NULL, *value = NULL;
+	bool inactive = false;
+	oauth2_time_t ttl_s = 0;
 
 	ctx = (oauth2_introspect_ctx_t *)verify->ctx->ptr;
 
@@ -466,11 +861,49 @@ static bool _oauth2_introspect_verify_callback(
 	    (verify->ctx->ptr == NULL))
 		goto end;
 
-	rc =
-	    _oauth2_introspect_verify(log, ctx, token, json_payload, s_payload);
+	key = _oauth2_introspect_cache_key(log, ctx, token);
+	if (key)
+		oauth2_cache_get(log, verify->cache, key, &value);
+
+	if (value) {
+		if (strcmp(value, OAUTH2_INTROSPECT_CACHE_INACTIVE) == 0) {
+			oauth2_debug(log, "token is cached as inactive");
+			goto end;
+		}
+		if (oauth2_json_decode_object(log, value, json_payload)) {
+			*s_payload = value;
+			value = NULL;
+			rc = true;
+			goto end;
+		}
+	}
+
+	rc = _oauth2_introspect_verify(log, ctx, token, json_payload, s_payload,
+				       &inactive);
+
+	if (key == NULL)
+		goto end;
+
+	if (rc) {
+		ttl_s = _oauth2_introspect_cache_ttl(log, *json_payload,
+						     verify->expiry_s);
+		if (ttl_s > 0)
+			oauth2_cache_set(log, verify->cache, key, *s_payload,
+					 ttl_s);
+	} else if (inactive) {
+		// absorb repeated use of revoked or expired tokens
+		oauth2_cache_set(log, verify->cache, key,
+				 OAUTH2_INTROSPECT_CACHE_INACTIVE,
+				 ctx->negative_expiry_s);
+	}
 
 end:
 
+	if (key)
+		oauth2_mem_free(key);
+	if (value)
+		oauth2_mem_free(value);
+
 	return rc;
 }
 
@@ -486,6 +919,11 @@ static char *_oauth2_verify_options_set_introspect_url_ctx(
 	ctx->ssl_verify = oauth2_parse_bool(
 	    log, oauth2_nv_list_get(log, params, "introspect.ssl_verify"),
 	    true);
+	ctx->http2 = oauth2_parse_bool(
+	    log, oauth2_nv_list_get(log, params, "introspect.http2"), false);
+	ctx->negative_expiry_s = oauth2_parse_uint(
+	    log, oauth2_nv_list_get(log, params, "introspect.negative_expiry"),
+	    OAUTH2_INTROSPECT_NEGATIVE_EXPIRY_DEFAULT);
 
 	rv = oauth2_cfg_endpoint_auth_add_options(
 	    log, ctx->auth, oauth2_nv_list_get(log, params, "introspect.auth"),
@@ -504,6 +942,7 @@ _OAUTH_CFG_CTX_CALLBACK(oauth2_verify_options_set_introspect_url)
 	oauth2_debug(log, "enter");
 
 	verify->callback = _oauth2_introspect_verify_callback;
+	verify->cache_self = true;
 	verify->ctx->callbacks = &oauth2_introspect_ctx_funcs;
 	verify->ctx->ptr = verify->ctx->callbacks->init(log);
 
@@ -515,17 +954,158 @@ _OAUTH_CFG_CTX_CALLBACK(oauth2_verify_options_set_introspect_url)
 	return rv;
 }
 
+/*
+ * a discovery document resolved into verifiers for the endpoints it lists;
+ * it is immutable once published and freed when the last reference goes
+ */
+typedef struct oauth2_metadata_t {
+	oauth2_uint_t refcount;
+	// identifies the document, so it does not have to be kept and compared
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	oauth2_jose_jwt_verify_ctx_t *jwks_uri_verify;
+	oauth2_introspect_ctx_t *introspect;
+} oauth2_metadata_t;
+
 _OAUTH2_CFG_CTX_TYPE_START(oauth2_metadata_ctx)
 oauth2_introspect_ctx_t *introspect;
 oauth2_jose_jwt_verify_ctx_t *jwks_uri_verify;
 oauth2_uri_ctx_t *metadata_uri;
+oauth2_metadata_t *metadata;
+pthread_mutex_t mutex;
 _OAUTH2_CFG_CTX_TYPE_END(oauth2_metadata_ctx)
 
+static void _oauth2_metadata_free(oauth2_log_t *log, oauth2_metadata_t *md)
+{
+	if (md->jwks_uri_verify)
+		oauth2_jose_jwt_verify_ctx_free(log, md->jwks_uri_verify);
+	if (md->introspect)
+		oauth2_introspect_ctx_free(log, md->introspect);
+	oauth2_mem_free(md);
+}
+
+static void _oauth2_metadata_release(oauth2_log_t *log,
+				     oauth2_metadata_ctx_t *ctx,
+				     oauth2_metadata_t *md)
+{
+	oauth2_uint_t refcount = 0;
+
+	pthread_mutex_lock(&ctx->mutex);
+	refcount = --md->refcount;
+	pthread_mutex_unlock(&ctx->mutex);
+
+	if (refcount == 0)
+		_oauth2_metadata_free(log, md);
+}
+
+static oauth2_metadata_t *
+_oauth2_metadata_parse(oauth2_log_t *log, oauth2_metadata_ctx_t *ctx,
+		       const char *document, const unsigned char *digest)
+{
+	oauth2_metadata_t *md = NULL;
+	oauth2_uri_ctx_t *jwks_uri = NULL;
+	json_t *json_metadata = NULL, *json_value = NULL;
+
+	if (oauth2_json_decode_object(log, document, &json_metadata) == false)
+		goto end;
+
+	md = oauth2_mem_alloc(sizeof(oauth2_metadata_t));
+	if (md == NULL)
+		goto end;
+
+	md->refcount = 1;
+	memcpy(md->digest, digest, SHA256_DIGEST_LENGTH);
+
+	json_value = json_object_get(json_metadata, "jwks_uri");
+	if (json_is_string(json_value)) {
+		md->jwks_uri_verify =
+		    oauth2_jose_jwt_verify_ctx_clone(log, ctx->jwks_uri_verify);
+		jwks_uri = md->jwks_uri_verify->jwks_provider->jwks_uri;
+		if (jwks_uri->uri)
+			oauth2_mem_free(jwks_uri->uri);
+		jwks_uri->uri = oauth2_strdup(json_string_value(json_value));
+		// jwks_uri.refresh applies to the jwks_uri that was discovered
+		oauth2_jose_uri_refresh_register(log, jwks_uri,
+						 OAUTH2_JOSE_URI_REFRESH_JWKS);
+	} else if (json_value) {
+		oauth2_warn(log, "\"jwks_uri\" value is not a string");
+	}
+
+	json_value = json_object_get(json_metadata, "introspection_endpoint");
+	if (json_is_string(json_value)) {
+		md->introspect =
+		    oauth2_introspect_ctx_clone(log, ctx->introspect);
+		if (md->introspect->url)
+			oauth2_mem_free(md->introspect->url);
+		md->introspect->url =
+		    oauth2_strdup(json_string_value(json_value));
+	} else if (json_value) {
+		oauth2_warn(log,
+			    "\"introspection_endpoint\" value is not a string");
+	}
+
+end:
+
+	if (json_metadata)
+		json_decref(json_metadata);
+
+	return md;
+}
+
+// return a reference to the parsed form of the document, re-parsing and
+// swapping it in only when the document has changed
+static oauth2_metadata_t *_oauth2_metadata_get(oauth2_log_t *log,
+					       oauth2_metadata_ctx_t *ctx,
+					       const char *document)
+{
+	oauth2_metadata_t *md = NULL, *old = NULL;
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	bool suspended = false;
+
+	// hashed outside of the lock, which is then held for a fixed size
+	// comparison only
+	SHA256((const unsigned char *)document, strlen(document), digest);
+
+	pthread_mutex_lock(&ctx->mutex);
+	if ((ctx->metadata) &&
+	    (memcmp(ctx->metadata->digest, digest, sizeof(digest)) == 0)) {
+		md = ctx->metadata;
+		md->refcount++;
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+
+	if (md)
+		goto end;
+
+	// the snapshot is shared by subsequent requests
+	suspended = oauth2_mem_arena_suspend();
+	md = _oauth2_metadata_parse(log, ctx, document, digest);
+	oauth2_mem_arena_resume(suspended);
+	if (md == NULL)
+		goto end;
+
+	oauth2_debug(log, "publishing new metadata");
+
+	pthread_mutex_lock(&ctx->mutex);
+	old = ctx->metadata;
+	ctx->metadata = md;
+	md->refcount++;
+	pthread_mutex_unlock(&ctx->mutex);
+
+	if (old)
+		_oauth2_metadata_release(log, ctx, old);
+
+end:
+
+	return md;
+}
+
 _OAUTH2_CFG_CTX_INIT_START(oauth2_metadata_ctx)
 ctx->introspect = oauth2_introspect_ctx_init(log);
 ctx->jwks_uri_verify =
     (oauth2_jose_jwt_verify_ctx_t *)oauth2_jose_jwt_verify_ctx_init(log);
 ctx->metadata_uri = oauth2_uri_ctx_init(log);
+ctx->metadata = NULL;
+pthread_mutex_init(&ctx->mutex, NULL);
 _OAUTH2_CFG_CTX_INIT_END
 
 _OAUTH2_CFG_CTX_CLONE_START(oauth2_metadata_ctx)
@@ -542,6 +1122,9 @@ if (ctx->jwks_uri_verify)
 	oauth2_jose_jwt_verify_ctx_free(log, ctx->jwks_uri_verify);
 if (ctx->metadata_uri)
 	oauth2_uri_ctx_free(log, ctx->metadata_uri);
+if (ctx->metadata)
+	_oauth2_metadata_release(log, ctx, ctx->metadata);
+pthread_mutex_destroy(&ctx->mutex);
 _OAUTH2_CFG_CTX_FREE_END
 
 _OAUTH2_CFG_CTX_FUNCS(oauth2_metadata_ctx)
@@ -554,11 +1137,9 @@ static bool _oauth2_metadata_verify_callback(oauth2_log_t *log,
 {
 	bool rc = false;
 	oauth2_metadata_ctx_t *ptr = NULL;
-	bool refresh = false;
+	oauth2_metadata_t *md = NULL;
+	bool refresh = false, inactive = false;
 	char *response = NULL;
-	json_t *json_metadata = NULL, *json_jwks_uri = NULL,
-	       *json_introspection_endpoint;
-	const char *jwks_uri = NULL, *introspection_endpoint = NULL;
 	char *peek = NULL;
 
 	if ((verify == NULL) || (verify->ctx == NULL) ||
@@ -572,7 +1153,8 @@ static bool _oauth2_metadata_verify_callback(oauth2_log_t *log,
 	if (response == NULL)
 		goto end;
 
-	if (oauth2_json_decode_object(log, response, &json_metadata) == false)
+	md = _oauth2_metadata_get(log, ptr, response);
+	if (md == NULL)
 		goto end;
 
 	peek = oauth2_jose_jwt_header_peek(log, token, NULL);
@@ -586,23 +1168,8 @@ static bool _oauth2_metadata_verify_callback(oauth2_log_t *log,
 
 jwks_uri:
 
-	json_jwks_uri = json_object_get(json_metadata, "jwks_uri");
-	if (json_jwks_uri) {
-		if (json_is_string(json_jwks_uri)) {
-			jwks_uri = json_string_value(json_jwks_uri);
-		} else {
-			oauth2_warn(log, "\"jwks_uri\" value is not a string");
-		}
-	}
-
-	if (jwks_uri) {
-
-		if (ptr->jwks_uri_verify->jwks_provider->jwks_uri->uri)
-			oauth2_mem_free(
-			    ptr->jwks_uri_verify->jwks_provider->jwks_uri->uri);
-		ptr->jwks_uri_verify->jwks_provider->jwks_uri->uri =
-		    oauth2_strdup(jwks_uri);
-		rc = oauth2_jose_jwt_verify(log, ptr->jwks_uri_verify, token,
+	if (md->jwks_uri_verify) {
+		rc = oauth2_jose_jwt_verify(log, md->jwks_uri_verify, token,
 					    json_payload, s_payload);
 		if (rc == true)
 			goto end;
@@ -610,35 +1177,20 @@ jwks_uri:
 
 introspect:
 
-	json_introspection_endpoint =
-	    json_object_get(json_metadata, "introspection_endpoint");
-	if (json_introspection_endpoint) {
-		if (json_is_string(json_introspection_endpoint)) {
-			introspection_endpoint =
-			    json_string_value(json_introspection_endpoint);
-		} else {
-			oauth2_warn(
-			    log,
-			    "\"introspection_endpoint\" value is not a string");
-		}
-	}
-
-	if (introspection_endpoint) {
-		if (ptr->introspect->url)
-			oauth2_mem_free(ptr->introspect->url);
-		ptr->introspect->url = oauth2_strdup(introspection_endpoint);
-		rc = _oauth2_introspect_verify(log, ptr->introspect, token,
-					       json_payload, s_payload);
+	if (md->introspect) {
+		rc = _oauth2_introspect_verify(log, md->introspect, token,
+					       json_payload, s_payload,
+					       &inactive);
 		if (rc == true)
 			goto end;
 	}
 
 end:
 
+	if (md)
+		_oauth2_metadata_release(log, ptr, md);
 	if (peek)
 		oauth2_mem_free(peek);
-	if (json_metadata)
-		json_decref(json_metadata);
 	if (response)
 		oauth2_mem_free(response);
 
@@ -688,6 +1240,9 @@ _OAUTH_CFG_CTX_CALLBACK(oauth2_verify_options_set_metadata_url)
 		goto end;
 	}
 
+	oauth2_jose_uri_refresh_register(log, ptr->metadata_uri,
+					 OAUTH2_JOSE_URI_REFRESH_RAW);
+
 end:
 
 	oauth2_debug(log, "leave: %s", rv);
@@ -711,7 +1266,8 @@ bool oauth2_token_verify(oauth2_log_t *log, oauth2_cfg_token_verify_t *verify,
 	ptr = verify;
 	while (ptr && ptr->callback) {
 
-		oauth2_cache_get(log, ptr->cache, token, &s_payload);
+		if (ptr->cache_self == false)
+			oauth2_cache_get(log, ptr->cache, token, &s_payload);
 		if ((s_payload) &&
 		    (oauth2_json_decode_object(log, s_payload, json_payload))) {
 			rc = true;
@@ -719,8 +1275,9 @@ bool oauth2_token_verify(oauth2_log_t *log, oauth2_cfg_token_verify_t *verify,
 		}
 
 		if (ptr->callback(log, ptr, token, json_payload, &s_payload)) {
-			oauth2_cache_set(log, ptr->cache, token, s_payload,
-					 ptr->expiry_s);
+			if (ptr->cache_self == false)
+				oauth2_cache_set(log, ptr->cache, token,
+						 s_payload, ptr->expiry_s);
 			rc = true;
 			break;
 		}
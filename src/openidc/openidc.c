@@ -26,6 +26,9 @@
 
 #include "cfg_int.h"
 #include "openidc_int.h"
+#include "util_int.h"
+
+#include <pthread.h>
 
 static bool _oauth2_openidc_authenticate(oauth2_log_t *log,
 					 const oauth2_cfg_openidc_t *cfg,
@@ -200,16 +203,21 @@ end:
 	return rc;
 }
 
-static bool _oauth2_openidc_id_token_verify(oauth2_log_t *log,
-					    oauth2_openidc_provider_t *provider,
-					    const char *s_id_token,
-					    json_t **id_token)
-{
-	bool rc = false;
-	char *rv = NULL;
-	char *options = NULL;
+/*
+ * the id_token verifier is configured once per provider and kept on it, so
+ * it is shared through the in-process provider cache
+ */
 
+static pthread_mutex_t _oauth2_openidc_id_token_verify_mutex =
+    PTHREAD_MUTEX_INITIALIZER;
+
+static oauth2_cfg_token_verify_t *
+_oauth2_openidc_id_token_verify_create(oauth2_log_t *log,
+				       oauth2_openidc_provider_t *provider)
+{
 	oauth2_cfg_token_verify_t *verify = NULL;
+	char *rv = NULL, *options = NULL;
+
 	options = oauth2_stradd(NULL, "jwks_uri.ssl_verify", "=",
 				provider->ssl_verify ? "true" : "false");
 	rv = oauth2_cfg_token_verify_add_options(log, &verify, "jwks_uri",
@@ -217,8 +225,76 @@ static bool _oauth2_openidc_id_token_verify(oauth2_log_t *log,
 	if (rv != NULL) {
 		oauth2_error(
 		    log, "oauth2_cfg_token_verify_add_options failed: %s", rv);
+		if (verify) {
+			oauth2_cfg_token_verify_free(log, verify);
+			verify = NULL;
+		}
+	}
+
+	if (rv)
+		oauth2_mem_free(rv);
+	if (options)
+		oauth2_mem_free(options);
+
+	return verify;
+}
+
+// returns a verifier that is valid for as long as the provider is held
+static oauth2_cfg_token_verify_t *
+_oauth2_openidc_id_token_verify_get(oauth2_log_t *log,
+				    oauth2_openidc_provider_t *provider)
+{
+	oauth2_cfg_token_verify_t *verify = NULL, *created = NULL;
+	bool suspended = false;
+
+	pthread_mutex_lock(&_oauth2_openidc_id_token_verify_mutex);
+	verify = provider->id_token_verify;
+	pthread_mutex_unlock(&_oauth2_openidc_id_token_verify_mutex);
+
+	if (verify)
+		goto end;
+
+	// the verifier lives as long as the (shared) provider
+	suspended = oauth2_mem_arena_suspend();
+	created = _oauth2_openidc_id_token_verify_create(log, provider);
+	oauth2_mem_arena_resume(suspended);
+	if (created == NULL)
 		goto end;
+
+	// a concurrent request may have set one in the meantime
+	pthread_mutex_lock(&_oauth2_openidc_id_token_verify_mutex);
+	if (provider->id_token_verify == NULL) {
+		provider->id_token_verify = created;
+		created = NULL;
 	}
+	verify = provider->id_token_verify;
+	pthread_mutex_unlock(&_oauth2_openidc_id_token_verify_mutex);
+
+	if (created)
+		oauth2_cfg_token_verify_free(log, created);
+
+end:
+
+	return verify;
+}
+
+void _oauth2_openidc_shutdown(oauth2_log_t *log)
+{
+	_oauth2_openidc_provider_cache_flush(log);
+}
+
+static bool _oauth2_openidc_id_token_verify(oauth2_log_t *log,
+					    oauth2_openidc_provider_t *provider,
+					    const char *s_id_token,
+					    json_t **id_token)
+{
+	bool rc = false;
+	oauth2_cfg_token_verify_t *verify = NULL;
+
+	verify = _oauth2_openidc_id_token_verify_get(log, provider);
+	if (verify == NULL)
+		goto end;
+
 	if (oauth2_token_verify(log, verify, s_id_token, id_token) == false) {
 		oauth2_error(log, "id_token verification failed");
 		goto end;
@@ -228,13 +304,6 @@ static bool _oauth2_openidc_id_token_verify(oauth2_log_t *log,
 
 end:
 
-	if (rv)
-		oauth2_mem_free(rv);
-	if (options)
-		oauth2_mem_free(options);
-	if (verify)
-		oauth2_cfg_token_verify_free(log, verify);
-
 	return rc;
 }
 
@@ -24,6 +24,11 @@
 #include "openidc_int.h"
 #include "util_int.h"
 
+#include <pthread.h>
+
+static pthread_mutex_t _oauth2_openidc_provider_mutex =
+    PTHREAD_MUTEX_INITIALIZER;
+
 oauth2_openidc_provider_t *oauth2_openidc_provider_init(oauth2_log_t *log)
 {
 	oauth2_openidc_provider_t *p = NULL;
@@ -42,18 +47,39 @@ oauth2_openidc_provider_t *oauth2_openidc_provider_init(oauth2_log_t *log)
 	p->client_id = NULL;
 	p->client_secret = NULL;
 	p->ssl_verify = true;
+	p->id_token_verify = NULL;
+	p->refcount = 1;
 
 end:
 
 	return p;
 }
 
+oauth2_openidc_provider_t *
+_oauth2_openidc_provider_retain(oauth2_log_t *log,
+				oauth2_openidc_provider_t *p)
+{
+	pthread_mutex_lock(&_oauth2_openidc_provider_mutex);
+	p->refcount++;
+	pthread_mutex_unlock(&_oauth2_openidc_provider_mutex);
+	return p;
+}
+
 void oauth2_openidc_provider_free(oauth2_log_t *log,
 				  oauth2_openidc_provider_t *p)
 {
+	oauth2_uint_t refcount = 0;
+
 	if (p == NULL)
 		goto end;
 
+	pthread_mutex_lock(&_oauth2_openidc_provider_mutex);
+	refcount = --p->refcount;
+	pthread_mutex_unlock(&_oauth2_openidc_provider_mutex);
+
+	if (refcount > 0)
+		goto end;
+
 	if (p->issuer)
 		oauth2_mem_free(p->issuer);
 	if (p->authorization_endpoint)
@@ -72,6 +98,8 @@ void oauth2_openidc_provider_free(oauth2_log_t *log,
 		oauth2_mem_free(p->client_id);
 	if (p->client_secret)
 		oauth2_mem_free(p->client_secret);
+	if (p->id_token_verify)
+		oauth2_cfg_token_verify_free(log, p->id_token_verify);
 
 	oauth2_mem_free(p);
 
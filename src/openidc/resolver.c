@@ -25,6 +25,9 @@
 #include "cfg_int.h"
 #include "openidc_int.h"
 
+#include <pthread.h>
+#include <sys/stat.h>
+
 static bool
 _oauth2_openidc_provider_metadata_parse(oauth2_log_t *log, const char *s_json,
 					oauth2_openidc_provider_t **provider)
@@ -130,6 +133,112 @@ end:
 	return rc;
 }
 
+/*
+ * in-process cache of parsed providers keyed by issuer; an entry is handed
+ * out, read-only, for as long as the metadata document it was parsed from
+ * is returned unchanged
+ */
+
+#define OAUTH2_OPENIDC_PROVIDER_CACHE_MAX 16
+
+typedef struct oauth2_openidc_provider_cache_entry_t {
+	char *document;
+	oauth2_openidc_provider_t *provider;
+	oauth2_time_t accessed;
+} oauth2_openidc_provider_cache_entry_t;
+
+static oauth2_openidc_provider_cache_entry_t
+    _oauth2_openidc_provider_cache[OAUTH2_OPENIDC_PROVIDER_CACHE_MAX];
+static pthread_mutex_t _oauth2_openidc_provider_cache_mutex =
+    PTHREAD_MUTEX_INITIALIZER;
+
+static void _oauth2_openidc_provider_cache_entry_clear(
+    oauth2_log_t *log, oauth2_openidc_provider_cache_entry_t *e)
+{
+	if (e->document)
+		oauth2_mem_free(e->document);
+	if (e->provider)
+		oauth2_openidc_provider_free(log, e->provider);
+	e->document = NULL;
+	e->provider = NULL;
+	e->accessed = 0;
+}
+
+static oauth2_openidc_provider_t *
+_oauth2_openidc_provider_cache_get(oauth2_log_t *log, const char *issuer,
+				   const char *s_json)
+{
+	oauth2_openidc_provider_t *p = NULL;
+	oauth2_openidc_provider_cache_entry_t *e = NULL;
+	int i = 0;
+
+	pthread_mutex_lock(&_oauth2_openidc_provider_cache_mutex);
+
+	for (i = 0; i < OAUTH2_OPENIDC_PROVIDER_CACHE_MAX; i++) {
+		e = &_oauth2_openidc_provider_cache[i];
+		if (e->provider == NULL)
+			continue;
+		if ((issuer) && ((e->provider->issuer == NULL) ||
+				 (strcmp(e->provider->issuer, issuer) != 0)))
+			continue;
+		if (strcmp(e->document, s_json) != 0)
+			continue;
+		p = _oauth2_openidc_provider_retain(log, e->provider);
+		e->accessed = oauth2_time_now_sec();
+		break;
+	}
+
+	pthread_mutex_unlock(&_oauth2_openidc_provider_cache_mutex);
+
+	oauth2_debug(log, "in-process provider %s", p ? "found" : "not found");
+
+	return p;
+}
+
+static void _oauth2_openidc_provider_cache_set(oauth2_log_t *log,
+					       const char *s_json,
+					       oauth2_openidc_provider_t *p)
+{
+	oauth2_openidc_provider_cache_entry_t *e = NULL, *victim = NULL;
+	int i = 0;
+
+	pthread_mutex_lock(&_oauth2_openidc_provider_cache_mutex);
+
+	// replace the entry for this issuer, else take a free slot, else
+	// evict the least recently used one
+	for (i = 0; i < OAUTH2_OPENIDC_PROVIDER_CACHE_MAX; i++) {
+		e = &_oauth2_openidc_provider_cache[i];
+		if ((e->provider) && (e->provider->issuer) && (p->issuer) &&
+		    (strcmp(e->provider->issuer, p->issuer) == 0)) {
+			victim = e;
+			break;
+		}
+		if ((victim) && (victim->provider == NULL))
+			continue;
+		if ((victim == NULL) || (e->provider == NULL) ||
+		    (e->accessed < victim->accessed))
+			victim = e;
+	}
+
+	_oauth2_openidc_provider_cache_entry_clear(log, victim);
+	victim->document = oauth2_strdup(s_json);
+	victim->provider = _oauth2_openidc_provider_retain(log, p);
+	victim->accessed = oauth2_time_now_sec();
+
+	pthread_mutex_unlock(&_oauth2_openidc_provider_cache_mutex);
+}
+
+void _oauth2_openidc_provider_cache_flush(oauth2_log_t *log)
+{
+	int i = 0;
+
+	pthread_mutex_lock(&_oauth2_openidc_provider_cache_mutex);
+	for (i = 0; i < OAUTH2_OPENIDC_PROVIDER_CACHE_MAX; i++)
+		_oauth2_openidc_provider_cache_entry_clear(
+		    log, &_oauth2_openidc_provider_cache[i]);
+	pthread_mutex_unlock(&_oauth2_openidc_provider_cache_mutex);
+}
+
 #define OAUTH_OPENIDC_PROVIDER_CACHE_EXPIRY_DEFAULT 60 * 60 * 24
 
 bool _oauth2_openidc_provider_resolve(oauth2_log_t *log,
@@ -140,6 +249,7 @@ bool _oauth2_openidc_provider_resolve(oauth2_log_t *log,
 {
 	bool rc = false;
 	char *s_json = NULL;
+	bool suspended = false;
 
 	if ((cfg->provider_resolver == NULL) ||
 	    (cfg->provider_resolver->callback == NULL)) {
@@ -171,9 +281,21 @@ bool _oauth2_openidc_provider_resolve(oauth2_log_t *log,
 		}
 	}
 
+	*provider = _oauth2_openidc_provider_cache_get(log, issuer, s_json);
+	if (*provider) {
+		rc = true;
+		goto end;
+	}
+
+	// the parsed provider is shared with subsequent requests
+	suspended = oauth2_mem_arena_suspend();
 	if (_oauth2_openidc_provider_metadata_parse(log, s_json, provider) ==
-	    false)
+	    false) {
+		oauth2_mem_arena_resume(suspended);
 		goto end;
+	}
+	_oauth2_openidc_provider_cache_set(log, s_json, *provider);
+	oauth2_mem_arena_resume(suspended);
 
 	// TODO: cache expiry configuration option
 	if (cfg->provider_resolver->cache) {
@@ -193,8 +315,36 @@ end:
 	return rc;
 }
 
-_OAUTH2_CFG_CTX_TYPE_SINGLE_STRING(oauth2_openidc_provider_resolver_file_ctx,
-				   filename)
+_OAUTH2_CFG_CTX_TYPE_START(oauth2_openidc_provider_resolver_file_ctx)
+char *filename;
+// the last contents read and the file state they were read at
+char *s_json;
+time_t mtime;
+off_t size;
+pthread_mutex_t mutex;
+_OAUTH2_CFG_CTX_TYPE_END(oauth2_openidc_provider_resolver_file_ctx)
+
+_OAUTH2_CFG_CTX_INIT_START(oauth2_openidc_provider_resolver_file_ctx)
+ctx->filename = NULL;
+ctx->s_json = NULL;
+ctx->mtime = 0;
+ctx->size = 0;
+pthread_mutex_init(&ctx->mutex, NULL);
+_OAUTH2_CFG_CTX_INIT_END
+
+_OAUTH2_CFG_CTX_CLONE_START(oauth2_openidc_provider_resolver_file_ctx)
+dst->filename = oauth2_strdup(src->filename);
+_OAUTH2_CFG_CTX_CLONE_END
+
+_OAUTH2_CFG_CTX_FREE_START(oauth2_openidc_provider_resolver_file_ctx)
+if (ctx->filename)
+	oauth2_mem_free(ctx->filename);
+if (ctx->s_json)
+	oauth2_mem_free(ctx->s_json);
+pthread_mutex_destroy(&ctx->mutex);
+_OAUTH2_CFG_CTX_FREE_END
+
+_OAUTH2_CFG_CTX_FUNCS(oauth2_openidc_provider_resolver_file_ctx)
 
 #define OAUTH2_OPENIDC_PROVIDER_RESOLVE_FILENAME_DEFAULT "conf/provider.json"
 
@@ -205,6 +355,8 @@ static bool _oauth2_openidc_provider_resolve_file(
 	bool rc = false;
 	oauth2_openidc_provider_resolver_file_ctx_t *ctx = NULL;
 	char *filename = NULL;
+	struct stat st;
+	bool suspended = false;
 
 	oauth2_debug(log, "enter");
 
@@ -214,7 +366,30 @@ static bool _oauth2_openidc_provider_resolve_file(
 		       ? ctx->filename
 		       : OAUTH2_OPENIDC_PROVIDER_RESOLVE_FILENAME_DEFAULT;
 
-	*s_json = oauth_read_file(log, filename);
+	if (stat(filename, &st) != 0) {
+		oauth2_error(log, "could not stat file: %s", filename);
+		goto end;
+	}
+
+	pthread_mutex_lock(&ctx->mutex);
+
+	// only re-read the file when it has been modified
+	if ((ctx->s_json == NULL) || (ctx->mtime != st.st_mtime) ||
+	    (ctx->size != st.st_size)) {
+		oauth2_debug(log, "(re-)reading: %s", filename);
+		if (ctx->s_json)
+			oauth2_mem_free(ctx->s_json);
+		suspended = oauth2_mem_arena_suspend();
+		ctx->s_json = oauth_read_file(log, filename);
+		oauth2_mem_arena_resume(suspended);
+		ctx->mtime = st.st_mtime;
+		ctx->size = st.st_size;
+	}
+
+	*s_json = oauth2_strdup(ctx->s_json);
+
+	pthread_mutex_unlock(&ctx->mutex);
+
 	if (*s_json == NULL)
 		goto end;
 
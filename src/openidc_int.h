@@ -35,8 +35,17 @@ typedef struct oauth2_openidc_provider_t {
 	char *client_id;
 	char *client_secret;
 	bool ssl_verify;
+	// id_token verifier, created on first use
+	oauth2_cfg_token_verify_t *id_token_verify;
+	oauth2_uint_t refcount;
 } oauth2_openidc_provider_t;
 
+// providers returned by the resolver are shared and must be treated as
+// read-only; oauth2_openidc_provider_free releases a reference
+oauth2_openidc_provider_t *
+_oauth2_openidc_provider_retain(oauth2_log_t *log,
+				oauth2_openidc_provider_t *p);
+
 #define _OAUTH2_OPENIDC_PROTO_STATE_KEY_ISSUER "i"
 #define _OAUTH2_OPENIDC_PROTO_STATE_KEY_TARGET_LINK_URI "l"
 #define _OAUTH2_OPENIDC_PROTO_STATE_KEY_REQUEST_METHOD "m"
@@ -67,5 +76,6 @@ bool _oauth2_openidc_provider_resolve(oauth2_log_t *log,
 				      const oauth2_http_request_t *request,
 				      const char *issuer,
 				      oauth2_openidc_provider_t **provider);
+void _oauth2_openidc_provider_cache_flush(oauth2_log_t *log);
 
 #endif /* _OAUTH2_OPENIDC_INT_H_ */
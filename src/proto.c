@@ -359,6 +359,8 @@ bool oauth2_proto_request(oauth2_log_t *log,
 	    log, ctx, oauth2_cfg_endpoint_get_ssl_verify(token_endpoint));
 	oauth2_http_call_ctx_timeout_set(
 	    log, ctx, oauth2_cfg_endpoint_get_http_timeout(token_endpoint));
+	oauth2_http_call_ctx_http2_set(
+	    log, ctx, oauth2_cfg_endpoint_get_http2(token_endpoint));
 	// oauth2_http_call_ctx_outgoing_proxy_set(log, ctx, outgoing_proxy);
 
 	if (oauth2_http_post_form(log,
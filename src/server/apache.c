@@ -21,6 +21,7 @@
 
 #include <oauth2/apache.h>
 #include <oauth2/http.h>
+#include <oauth2/jose.h>
 #include <oauth2/mem.h>
 #include <oauth2/oauth2.h>
 
@@ -211,12 +212,26 @@ end:
 	return OK;
 }
 
+/*
+ * child init
+ */
+
+void oauth2_apache_child_init(apr_pool_t *p, server_rec *s, module *m)
+{
+	oauth2_apache_cfg_srv_t *cfg =
+	    (oauth2_apache_cfg_srv_t *)ap_get_module_config(s->module_config,
+							    m);
+	// the server log lives until the child cleanup calls oauth2_shutdown
+	oauth2_jose_uri_refresh_start(cfg->log);
+}
+
 static int oauth2_apache_http_request_hdr_add(void *rec, const char *key,
 					      const char *value)
 {
 	oauth2_apache_request_ctx_t *ctx = (oauth2_apache_request_ctx_t *)rec;
-	return (oauth2_http_request_header_add(ctx->log, ctx->request, key,
-					       value) == true);
+	// the table strings live in the request pool, which outlives the ctx
+	return (oauth2_http_request_header_add_ref(ctx->log, ctx->request, key,
+						   value) == true);
 }
 
 static const char *oauth2_apache_get_server_name(request_rec *r)
@@ -241,18 +256,32 @@ static const char *oauth2_apache_http_scheme(request_rec *r)
 	return rv;
 }
 
+static void *oauth2_apache_arena_chunk_alloc(void *ctx, size_t size)
+{
+	return apr_palloc((apr_pool_t *)ctx, size);
+}
+
 static oauth2_apache_request_ctx_t *
 oauth2_apache_request_context_init(request_rec *r,
 				   oauth2_log_function_t request_log_cb)
 {
 	oauth2_apache_request_ctx_t *ctx = NULL;
 	oauth2_log_sink_t *log_sink_apache = NULL;
+	bool suspended = false;
 
+	// the context itself is freed after its arena has been released
+	suspended = oauth2_mem_arena_suspend();
 	// TODO: memory allocation failure checks...?
 	ctx = oauth2_mem_alloc(sizeof(oauth2_apache_request_ctx_t));
+	oauth2_mem_arena_resume(suspended);
 
 	ctx->r = r;
 
+	// the chunks are returned with the request pool
+	ctx->arena = oauth2_mem_arena_create_ex(
+	    0, oauth2_apache_arena_chunk_alloc, NULL, r->pool);
+	oauth2_mem_arena_enter(ctx->arena);
+
 	// TODO: more elegant log-for-request handling
 	oauth2_log_level_t level = (r && r->log)
 				       ? log_level_apache2oauth2[r->log->level]
@@ -279,6 +308,8 @@ oauth2_apache_request_context_init(request_rec *r,
 
 	oauth2_debug(ctx->log, "created request context: %p", ctx);
 
+	oauth2_mem_arena_leave(ctx->arena);
+
 	return ctx;
 }
 
@@ -287,8 +318,12 @@ static apr_status_t oauth2_apache_request_context_free(void *rec)
 	oauth2_apache_request_ctx_t *ctx = (oauth2_apache_request_ctx_t *)rec;
 	if (ctx) {
 		oauth2_debug(ctx->log, "dispose request context: %p", ctx);
+		// so that the frees of arena memory are recognized as such
+		oauth2_mem_arena_enter(ctx->arena);
 		oauth2_http_request_free(ctx->log, ctx->request);
 		oauth2_log_free(ctx->log);
+		oauth2_mem_arena_leave(ctx->arena);
+		oauth2_mem_arena_free(ctx->arena);
 		oauth2_mem_free(ctx);
 	}
 	return APR_SUCCESS;
@@ -310,6 +345,20 @@ oauth2_apache_request_context(request_rec *r,
 	return ctx;
 }
 
+bool oauth2_apache_token_verify(oauth2_apache_request_ctx_t *ctx,
+				oauth2_cfg_token_verify_t *verify,
+				const char *token, json_t **json_payload)
+{
+	bool rc = false;
+
+	// the intermediate allocations of the verification are request-scoped
+	oauth2_mem_arena_enter(ctx->arena);
+	rc = oauth2_token_verify(ctx->log, verify, token, json_payload);
+	oauth2_mem_arena_leave(ctx->arena);
+
+	return rc;
+}
+
 int oauth2_apache_return_www_authenticate(oauth2_cfg_source_token_t *cfg,
 					  oauth2_apache_request_ctx_t *ctx,
 					  int status_code, const char *error,
@@ -539,7 +588,7 @@ static bool oauth2_apache_post_read(oauth2_log_t *log, request_rec *r,
 		goto end;
 	}
 
-	*rbuf = oauth2_mem_alloc(len + 1);
+	*rbuf = oauth2_mem_alloc_uninit(len + 1);
 	if (*rbuf == NULL) {
 		oauth2_error(
 		    log,
@@ -166,11 +166,22 @@ static void _oauth2_nginx_headers_copy(oauth2_nginx_request_context_t *ctx)
 			h = part->elts;
 			i = 0;
 		}
+		/*
+		 * parsed request header names and values are \0-terminated
+		 * and live in the request pool, which outlives the context;
+		 * anything else is copied
+		 */
+		if ((h[i].key.data[h[i].key.len] == '\0') &&
+		    (h[i].value.data[h[i].value.len] == '\0')) {
+			oauth2_http_request_header_add_ref(
+			    ctx->log, ctx->request, (const char *)h[i].key.data,
+			    (const char *)h[i].value.data);
+			continue;
+		}
 		name =
 		    oauth2_strndup((const char *)h[i].key.data, h[i].key.len);
 		value = oauth2_strndup((const char *)h[i].value.data,
 				       h[i].value.len);
-		// TODO: avoid duplicate copy
 		oauth2_http_request_header_add(ctx->log, ctx->request, name,
 					       value);
 		oauth2_mem_free(name);
@@ -201,6 +212,9 @@ oauth2_nginx_request_context_init(ngx_http_request_t *r)
 	// TODO: memory allocation failure checks...?
 	ctx = oauth2_mem_alloc(sizeof(oauth2_nginx_request_context_t));
 
+	ctx->arena = oauth2_mem_arena_create(0);
+	oauth2_mem_arena_enter(ctx->arena);
+
 	// TODO: get the log level from NGINX...
 	oauth2_log_level_t level = OAUTH2_LOG_TRACE1;
 	log_sink_nginx =
@@ -214,6 +228,8 @@ oauth2_nginx_request_context_init(ngx_http_request_t *r)
 
 	oauth2_debug(ctx->log, "created NGINX request context: %p", ctx);
 
+	oauth2_mem_arena_leave(ctx->arena);
+
 	return ctx;
 }
 
@@ -224,13 +240,31 @@ void oauth2_nginx_request_context_free(void *rec)
 	if (ctx) {
 		oauth2_debug(ctx->log, "dispose NGINX request context: %p",
 			     ctx);
+		// so that the frees of arena memory are recognized as such
+		oauth2_mem_arena_enter(ctx->arena);
 		if (ctx->request)
 			oauth2_http_request_free(ctx->log, ctx->request);
 		oauth2_log_free(ctx->log);
+		oauth2_mem_arena_leave(ctx->arena);
+		oauth2_mem_arena_free(ctx->arena);
 		oauth2_mem_free(ctx);
 	}
 }
 
+bool oauth2_nginx_token_verify(oauth2_nginx_request_context_t *ctx,
+			       oauth2_cfg_token_verify_t *verify,
+			       const char *token, json_t **json_payload)
+{
+	bool rc = false;
+
+	// the intermediate allocations of the verification are request-scoped
+	oauth2_mem_arena_enter(ctx->arena);
+	rc = oauth2_token_verify(ctx->log, verify, token, json_payload);
+	oauth2_mem_arena_leave(ctx->arena);
+
+	return rc;
+}
+
 ngx_int_t oauth2_nginx_http_response_set(oauth2_log_t *log,
 					 oauth2_http_response_t *response,
 					 ngx_http_request_t *r)
@@ -28,33 +28,52 @@
 #include "oauth2/mem.h"
 #include "oauth2/util.h"
 
+#include "jose_int.h"
+
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 #include <openssl/ssl.h>
 
-#include <cjose/base64.h>
 #include <curl/curl.h>
 
-static CURL *_s_curl = NULL;
-static oauth2_uint_t _curl_refcount = 0;
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+// the SSSE3 kernels are built for x86 with GCC or clang and selected at
+// runtime unless the compiler already targets SSSE3
+#if defined(__SSSE3__)
+#define OAUTH2_SSSE3
+#define OAUTH2_SSSE3_TARGET
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define OAUTH2_SSSE3
+#define OAUTH2_SSSE3_TARGET __attribute__((target("ssse3")))
+#endif
+#if defined(OAUTH2_SSSE3)
+#include <tmmintrin.h>
+#endif
 
 oauth2_log_t *oauth2_init(oauth2_log_level_t level, oauth2_log_sink_t *sink)
 {
+	oauth2_log_t *log = NULL;
+
 	ERR_load_crypto_strings();
 	OpenSSL_add_all_algorithms();
 	// TODO: align flags/call with memory initialization in mem.c
 	//       possibly providing alloc funcs as part of init?
 	curl_global_init(CURL_GLOBAL_ALL);
-	return oauth2_log_init(level, sink);
+	log = oauth2_log_init(level, sink);
+	// before a server forks its workers, so they share endpoint health
+	_oauth2_http_health_init(log);
+	return log;
 }
 
 void oauth2_shutdown(oauth2_log_t *log)
 {
-	if (_s_curl) {
-		curl_easy_cleanup(_s_curl);
-		_s_curl = NULL;
-	}
+	_oauth2_jose_shutdown(log);
+	_oauth2_http_shutdown(log);
+	_oauth2_openidc_shutdown(log);
+	_oauth2_jwt_pool_shutdown(log);
 	curl_global_cleanup();
 	EVP_cleanup();
 	ERR_free_strings();
@@ -71,37 +90,309 @@ void oauth2_shutdown(oauth2_log_t *log)
 	oauth2_log_free(log);
 }
 
-typedef bool(oauth2_cjose_base64_encode_callback_t)(const uint8_t *input,
-						    const size_t inlen,
-						    char **output,
-						    size_t *outlen,
-						    cjose_err *err);
+/*
+ * base64 and base64url codec
+ *
+ * base64url output is not padded, base64 output is; decoding accepts (and
+ * for base64 requires) up to two trailing padding characters
+ *
+ * the scalar kernels convert 3 bytes to 4 characters and back through
+ * lookup tables; when the CPU supports SSSE3 the bulk of the input is
+ * converted 12 bytes/16 characters at a time with byte shuffles, see
+ * http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html and
+ * http://0x80.pl/notesen/2016-01-17-sse-base64-decoding.html
+ */
 
-static size_t _oauth2_cjose_base64_encode(
-    oauth2_log_t *log, oauth2_cjose_base64_encode_callback_t encode,
-    const uint8_t *src, const size_t src_len, char **dst)
+static const char _oauth2_base64_alphabet_std[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char _oauth2_base64_alphabet_url[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// 7-bit character to sextet; 0xff marks characters outside the alphabet
+static const uint8_t _oauth2_base64_sextet_std[128] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+	0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12,
+	0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24,
+	0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+	0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint8_t _oauth2_base64_sextet_url[128] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+	0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12,
+	0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0x3f,
+	0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24,
+	0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+	0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+#if defined(OAUTH2_SSSE3)
+
+static bool _oauth2_base64_simd(void)
 {
-	bool rc = false;
-	size_t dst_len;
-	cjose_err err;
-	memset(&err, 0, sizeof(err));
+#if defined(__SSSE3__)
+	return true;
+#else
+	return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+OAUTH2_SSSE3_TARGET
+static size_t _oauth2_base64_encode_simd(const uint8_t *src, size_t src_len,
+					 char *dst, bool url)
+{
+	const __m128i shuf =
+	    _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+	const __m128i shift_lut =
+	    url ? _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+				'0' - 52, '0' - 52, '0' - 52, '0' - 52,
+				'0' - 52, '0' - 52, '0' - 52, '-' - 62,
+				'_' - 63, 'A', 0, 0)
+		: _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+				'0' - 52, '0' - 52, '0' - 52, '0' - 52,
+				'0' - 52, '0' - 52, '0' - 52, '+' - 62,
+				'/' - 63, 'A', 0, 0);
+	__m128i in, t0, t1, t2, t3, idx, res, less;
+	size_t i = 0;
+
+	// each round loads 16 bytes of which 12 are consumed
+	for (i = 0; src_len - i >= 16; i += 12) {
+		in = _mm_loadu_si128((const __m128i *)(src + i));
+		in = _mm_shuffle_epi8(in, shuf);
+		// spread the 4 sextets of every 3 input bytes over 4 bytes
+		t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+		t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+		t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+		t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+		idx = _mm_or_si128(t1, t3);
+		// map each sextet range to the offset of its alphabet segment
+		res = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+		less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+		res = _mm_or_si128(res, _mm_and_si128(less, _mm_set1_epi8(13)));
+		res = _mm_add_epi8(_mm_shuffle_epi8(shift_lut, res), idx);
+		_mm_storeu_si128((__m128i *)(dst + i / 3 * 4), res);
+	}
+
+	return i;
+}
+
+OAUTH2_SSSE3_TARGET
+static bool _oauth2_base64_decode_simd(const char *src, size_t src_len,
+				       uint8_t *dst, size_t *n, bool url)
+{
+	// per low nibble: the high nibble classes for which it is invalid
+	const __m128i lut_lo =
+	    url ? _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+				0x11, 0x11, 0x11, 0x13, 0x3b, 0x3b, 0x3a,
+				0x3b, 0x33)
+		: _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+				0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b,
+				0x1b, 0x1a);
+	const __m128i lut_hi =
+	    url ? _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04,
+				0x20, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+				0x10, 0x10)
+		: _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04,
+				0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+				0x10, 0x10);
+	// per high nibble the offset to the sextet value; the 63rd character
+	// has a high nibble it shares with others so it is moved to a spare
+	// slot first
+	const __m128i lut_roll =
+	    url ? _mm_setr_epi8(0, 0, 17, 4, -65, -65, -71, -71, 0, 0, 0, 0,
+				0, 0, 0, -32)
+		: _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0,
+				0, 0, 0, 0);
+	const __m128i c63 = _mm_set1_epi8(url ? '_' : '/');
+	const __m128i c63_slot = _mm_set1_epi8(url ? 0x0a : -1);
+	const __m128i mask_2f = _mm_set1_epi8(0x2f);
+	const __m128i shuf = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13,
+					   12, -1, -1, -1, -1);
+	__m128i in, hi, lo, roll, merged;
+	size_t i = 0;
+
+	*n = 0;
+
+	// each round stores 16 bytes of which 12 are valid; stop while the
+	// remaining input is guaranteed to overwrite the 4 trailing ones
+	for (i = 0; src_len - i >= 24; i += 16) {
+		in = _mm_loadu_si128((const __m128i *)(src + i));
+		hi = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+		lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(in, mask_2f));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_and_si128(lo, _mm_shuffle_epi8(lut_hi, hi)),
+			_mm_setzero_si128())) != 0xffff)
+			return false;
+		hi = _mm_add_epi8(
+		    hi, _mm_and_si128(_mm_cmpeq_epi8(in, c63), c63_slot));
+		roll = _mm_shuffle_epi8(lut_roll, hi);
+		in = _mm_add_epi8(in, roll);
+		// pack 4 sextets into 3 bytes
+		merged =
+		    _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+		merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+		merged = _mm_shuffle_epi8(merged, shuf);
+		_mm_storeu_si128((__m128i *)(dst + *n), merged);
+		*n += 12;
+	}
+
+	return true;
+}
+
+#endif
+
+size_t oauth2_base64_encode_len(size_t src_len, bool url)
+{
+	return url ? (src_len / 3) * 4 + ((src_len % 3) ? src_len % 3 + 1 : 0)
+		   : ((src_len + 2) / 3) * 4;
+}
+
+size_t oauth2_base64_decode_len(size_t src_len)
+{
+	return (src_len / 4) * 3 + ((src_len % 4) ? src_len % 4 - 1 : 0);
+}
+
+static size_t _oauth2_base64_encode_impl(const uint8_t *src, size_t src_len,
+					 char *dst, bool url)
+{
+	const char *alphabet =
+	    url ? _oauth2_base64_alphabet_url : _oauth2_base64_alphabet_std;
+	size_t i = 0, n = 0;
+	uint32_t v = 0;
+
+#if defined(OAUTH2_SSSE3)
+	if (_oauth2_base64_simd()) {
+		i = _oauth2_base64_encode_simd(src, src_len, dst, url);
+		n = i / 3 * 4;
+	}
+#endif
+
+	for (; src_len - i >= 3; i += 3) {
+		v = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) |
+		    src[i + 2];
+		dst[n++] = alphabet[(v >> 18) & 0x3f];
+		dst[n++] = alphabet[(v >> 12) & 0x3f];
+		dst[n++] = alphabet[(v >> 6) & 0x3f];
+		dst[n++] = alphabet[v & 0x3f];
+	}
+
+	if (src_len - i > 0) {
+		v = (uint32_t)src[i] << 16;
+		if (src_len - i > 1)
+			v |= (uint32_t)src[i + 1] << 8;
+		dst[n++] = alphabet[(v >> 18) & 0x3f];
+		dst[n++] = alphabet[(v >> 12) & 0x3f];
+		if (src_len - i > 1)
+			dst[n++] = alphabet[(v >> 6) & 0x3f];
+		else if (url == false)
+			dst[n++] = '=';
+		if (url == false)
+			dst[n++] = '=';
+	}
+
+	dst[n] = '\0';
+
+	return n;
+}
+
+static bool _oauth2_base64_decode_impl(const char *src, size_t src_len,
+				       uint8_t *dst, size_t *dst_len, bool url)
+{
+	const uint8_t *sextet =
+	    url ? _oauth2_base64_sextet_url : _oauth2_base64_sextet_std;
+	const unsigned char *s = (const unsigned char *)src;
+	size_t i = 0, n = 0;
+	uint32_t a = 0, b = 0, c = 0, d = 0, v = 0;
+
+	if ((url == false) && (src_len % 4 != 0))
+		return false;
+
+	if ((src_len > 0) && (src[src_len - 1] == '='))
+		src_len--;
+	if ((src_len > 0) && (src[src_len - 1] == '='))
+		src_len--;
+
+	if ((src_len % 4 == 1) ||
+	    (oauth2_base64_decode_len(src_len) > *dst_len))
+		return false;
+
+#if defined(OAUTH2_SSSE3)
+	if (_oauth2_base64_simd()) {
+		if (_oauth2_base64_decode_simd(src, src_len, dst, &n, url) ==
+		    false)
+			return false;
+		i = n / 3 * 4;
+	}
+#endif
+
+	for (; src_len - i >= 4; i += 4) {
+		if ((s[i] | s[i + 1] | s[i + 2] | s[i + 3]) & 0x80)
+			return false;
+		a = sextet[s[i]];
+		b = sextet[s[i + 1]];
+		c = sextet[s[i + 2]];
+		d = sextet[s[i + 3]];
+		if ((a | b | c | d) & 0x80)
+			return false;
+		v = (a << 18) | (b << 12) | (c << 6) | d;
+		dst[n++] = (v >> 16) & 0xff;
+		dst[n++] = (v >> 8) & 0xff;
+		dst[n++] = v & 0xff;
+	}
+
+	if (src_len - i > 0) {
+		c = (src_len - i > 2) ? s[i + 2] : 'A';
+		if ((s[i] | s[i + 1] | c) & 0x80)
+			return false;
+		a = sextet[s[i]];
+		b = sextet[s[i + 1]];
+		c = sextet[c];
+		if ((a | b | c) & 0x80)
+			return false;
+		v = (a << 18) | (b << 12) | (c << 6);
+		dst[n++] = (v >> 16) & 0xff;
+		if (src_len - i > 2)
+			dst[n++] = (v >> 8) & 0xff;
+	}
+
+	*dst_len = n;
+
+	return true;
+}
+
+static size_t _oauth2_base64_encode(oauth2_log_t *log, const uint8_t *src,
+				    const size_t src_len, char **dst, bool url)
+{
+	size_t dst_len = 0;
 
 	oauth2_debug(log, "enter: len=%d", (int)src_len);
 
-	if (dst)
-		*dst = NULL;
-	dst_len = 0;
+	if (dst == NULL)
+		goto end;
+	*dst = NULL;
 
 	if (src == NULL) {
 		oauth2_warn(log, "not encoding null input to empty string");
 		goto end;
 	}
 
-	rc = encode(src, src_len, dst, &dst_len, &err);
-	if (!rc) {
-		_OAUTH2_UTIL_JOSE_ERR_LOG(log, "encode", err);
+	*dst = oauth2_mem_alloc_uninit(oauth2_base64_encode_len(src_len, url) +
+				       1);
+	if (*dst == NULL)
 		goto end;
-	}
+
+	dst_len = _oauth2_base64_encode_impl(src, src_len, *dst, url);
 
 end:
 
@@ -113,33 +404,59 @@ end:
 size_t oauth2_base64url_encode(oauth2_log_t *log, const uint8_t *src,
 			       const size_t src_len, char **dst)
 {
-	return _oauth2_cjose_base64_encode(log, cjose_base64url_encode, src,
-					   src_len, dst);
+	return _oauth2_base64_encode(log, src, src_len, dst, true);
 }
 
 size_t oauth2_base64_encode(oauth2_log_t *log, const uint8_t *src,
 			    const size_t src_len, char **dst)
 {
-	return _oauth2_cjose_base64_encode(log, cjose_base64_encode, src,
-					   src_len, dst);
+	return _oauth2_base64_encode(log, src, src_len, dst, false);
+}
+
+static size_t _oauth2_base64_encode_buf(oauth2_log_t *log, const uint8_t *src,
+					size_t src_len, char *dst,
+					size_t dst_size, bool url)
+{
+	size_t dst_len = 0;
+
+	if ((src == NULL) || (dst == NULL)) {
+		oauth2_warn(log, "not encoding null input or into null output");
+		goto end;
+	}
+
+	if (oauth2_base64_encode_len(src_len, url) + 1 > dst_size) {
+		oauth2_error(log, "output buffer too small (%d) for %d bytes",
+			     (int)dst_size, (int)src_len);
+		goto end;
+	}
+
+	dst_len = _oauth2_base64_encode_impl(src, src_len, dst, url);
+
+end:
+
+	return dst_len;
+}
+
+size_t oauth2_base64url_encode_buf(oauth2_log_t *log, const uint8_t *src,
+				   size_t src_len, char *dst, size_t dst_size)
+{
+	return _oauth2_base64_encode_buf(log, src, src_len, dst, dst_size,
+					 true);
 }
 
-typedef bool(oauth2_cjose_base64_decode_callback_t)(const char *input,
-						    const size_t inlen,
-						    uint8_t **output,
-						    size_t *outlen,
-						    cjose_err *err);
+size_t oauth2_base64_encode_buf(oauth2_log_t *log, const uint8_t *src,
+				size_t src_len, char *dst, size_t dst_size)
+{
+	return _oauth2_base64_encode_buf(log, src, src_len, dst, dst_size,
+					 false);
+}
 
-static bool
-_oauth2_cjose_base64_decode(oauth2_log_t *log,
-			    oauth2_cjose_base64_decode_callback_t decode,
-			    const char *src, uint8_t **dst, size_t *dst_len)
+static bool _oauth2_base64_decode(oauth2_log_t *log, const char *src,
+				  uint8_t **dst, size_t *dst_len, bool url)
 {
 	bool rc = false;
-	cjose_err err;
 	size_t src_len = 0;
 
-	memset(&err, 0, sizeof(err));
 	src_len = src ? strlen(src) : 0;
 
 	oauth2_debug(log, "enter: len=%d", (int)src_len);
@@ -157,11 +474,24 @@ _oauth2_cjose_base64_decode(oauth2_log_t *log,
 		goto end;
 	}
 
-	if (decode(src, src_len, dst, dst_len, &err) == false) {
-		_OAUTH2_UTIL_JOSE_ERR_LOG(log, "decode", err);
+	// reserve room for a terminating \0 so callers can treat text as such
+	*dst_len = oauth2_base64_decode_len(src_len);
+	*dst = oauth2_mem_alloc_uninit(*dst_len + 1);
+	if (*dst == NULL)
+		goto end;
+
+	if (_oauth2_base64_decode_impl(src, src_len, *dst, dst_len, url) ==
+	    false) {
+		oauth2_error(log, "invalid base64%s input",
+			     url ? "url" : "");
+		oauth2_mem_free(*dst);
+		*dst = NULL;
+		*dst_len = 0;
 		goto end;
 	}
 
+	(*dst)[*dst_len] = '\0';
+
 	rc = true;
 
 end:
@@ -174,15 +504,49 @@ end:
 bool oauth2_base64url_decode(oauth2_log_t *log, const char *src, uint8_t **dst,
 			     size_t *dst_len)
 {
-	return _oauth2_cjose_base64_decode(log, cjose_base64url_decode, src,
-					   dst, dst_len);
+	return _oauth2_base64_decode(log, src, dst, dst_len, true);
 }
 
 bool oauth2_base64_decode(oauth2_log_t *log, const char *src, uint8_t **dst,
 			  size_t *dst_len)
 {
-	return _oauth2_cjose_base64_decode(log, cjose_base64_decode, src, dst,
-					   dst_len);
+	return _oauth2_base64_decode(log, src, dst, dst_len, false);
+}
+
+static bool _oauth2_base64_decode_buf(oauth2_log_t *log, const char *src,
+				      size_t src_len, uint8_t *dst,
+				      size_t *dst_len, bool url)
+{
+	bool rc = false;
+
+	if ((src == NULL) || (dst == NULL) || (dst_len == NULL)) {
+		oauth2_warn(log, "not decoding null input or into null output");
+		goto end;
+	}
+
+	rc = _oauth2_base64_decode_impl(src, src_len, dst, dst_len, url);
+	if (rc == false)
+		oauth2_error(log, "invalid base64%s input or output buffer "
+				  "too small (%d)",
+			     url ? "url" : "", (int)*dst_len);
+
+end:
+
+	return rc;
+}
+
+bool oauth2_base64url_decode_buf(oauth2_log_t *log, const char *src,
+				 size_t src_len, uint8_t *dst, size_t *dst_len)
+{
+	return _oauth2_base64_decode_buf(log, src, src_len, dst, dst_len,
+					 true);
+}
+
+bool oauth2_base64_decode_buf(oauth2_log_t *log, const char *src,
+			      size_t src_len, uint8_t *dst, size_t *dst_len)
+{
+	return _oauth2_base64_decode_buf(log, src, src_len, dst, dst_len,
+					 false);
 }
 
 static int oauth2_char_to_env(int c)
@@ -235,31 +599,149 @@ end:
 	return rv;
 }
 
-static CURL *oauth2_curl_init(oauth2_log_t *log)
+// RFC 3986 unreserved characters are passed as-is
+static const unsigned char _oauth2_url_unreserved[256] = {
+    ['-'] = 1, ['.'] = 1, ['_'] = 1, ['~'] = 1,
+    ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1,
+    ['5'] = 1, ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1,
+    ['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1,
+    ['G'] = 1, ['H'] = 1, ['I'] = 1, ['J'] = 1, ['K'] = 1, ['L'] = 1,
+    ['M'] = 1, ['N'] = 1, ['O'] = 1, ['P'] = 1, ['Q'] = 1, ['R'] = 1,
+    ['S'] = 1, ['T'] = 1, ['U'] = 1, ['V'] = 1, ['W'] = 1, ['X'] = 1,
+    ['Y'] = 1, ['Z'] = 1,
+    ['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1,
+    ['g'] = 1, ['h'] = 1, ['i'] = 1, ['j'] = 1, ['k'] = 1, ['l'] = 1,
+    ['m'] = 1, ['n'] = 1, ['o'] = 1, ['p'] = 1, ['q'] = 1, ['r'] = 1,
+    ['s'] = 1, ['t'] = 1, ['u'] = 1, ['v'] = 1, ['w'] = 1, ['x'] = 1,
+    ['y'] = 1, ['z'] = 1};
+
+static const char _oauth2_url_hex[] = "0123456789ABCDEF";
+
+// hexadecimal digit value plus one, 0 for anything else
+static const unsigned char _oauth2_url_hexval[256] = {
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,
+    ['5'] = 6,  ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16};
+
+size_t oauth2_url_encode_len(const char *src, size_t src_len)
+{
+	const unsigned char *p = (const unsigned char *)src;
+	size_t i = 0, n = src_len;
+
+	for (i = 0; i < src_len; i++)
+		if (_oauth2_url_unreserved[p[i]] == 0)
+			n += 2;
+
+	return n;
+}
+
+// dst must hold oauth2_url_encode_len + 1 bytes
+static size_t _oauth2_url_encode_impl(const char *src, size_t src_len,
+				      char *dst)
+{
+	const unsigned char *p = (const unsigned char *)src;
+	size_t i = 0, n = 0;
+
+	for (i = 0; i < src_len; i++) {
+		if (_oauth2_url_unreserved[p[i]]) {
+			dst[n++] = p[i];
+		} else {
+			dst[n++] = '%';
+			dst[n++] = _oauth2_url_hex[p[i] >> 4];
+			dst[n++] = _oauth2_url_hex[p[i] & 0x0f];
+		}
+	}
+	dst[n] = '\0';
+
+	return n;
+}
+
+/*
+ * decodes %XX escapes and, following form encoding, '+' into a space; a '%'
+ * that is not followed by two hex digits is passed as-is; the output is
+ * never longer than the input so dst may be equal to src
+ */
+static size_t _oauth2_url_decode_impl(const char *src, size_t src_len,
+				      char *dst)
 {
-	if (_s_curl == NULL) {
-		_s_curl = curl_easy_init();
-		if (_s_curl == NULL) {
-			oauth2_error(log, "curl_easy_init() error");
+	const unsigned char *p = (const unsigned char *)src;
+	size_t i = 0, n = 0;
+	unsigned char hi = 0, lo = 0;
+
+	for (i = 0; i < src_len; i++) {
+		if (p[i] == '+') {
+			// https://github.com/unshiftio/querystringify/issues/7#issuecomment-287627341
+			// NOTE: technically it would be more correct to make
+			// this a %20...
+			dst[n++] = ' ';
+		} else if ((p[i] == '%') && (src_len - i > 2) &&
+			   (hi = _oauth2_url_hexval[p[i + 1]]) &&
+			   (lo = _oauth2_url_hexval[p[i + 2]])) {
+			dst[n++] = (char)(((hi - 1) << 4) | (lo - 1));
+			i += 2;
+		} else {
+			dst[n++] = p[i];
 		}
 	}
-	_curl_refcount++;
-	return _s_curl;
+	dst[n] = '\0';
+
+	return n;
+}
+
+size_t oauth2_url_encode_buf(oauth2_log_t *log, const char *src,
+			     size_t src_len, char *dst, size_t dst_size)
+{
+	size_t dst_len = 0;
+
+	if ((src == NULL) || (dst == NULL)) {
+		oauth2_warn(log, "not encoding null input or into null output");
+		goto end;
+	}
+
+	if (oauth2_url_encode_len(src, src_len) + 1 > dst_size) {
+		oauth2_error(log, "output buffer too small (%d)",
+			     (int)dst_size);
+		goto end;
+	}
+
+	dst_len = _oauth2_url_encode_impl(src, src_len, dst);
+
+end:
+
+	return dst_len;
 }
 
-static void oauth2_curl_free(CURL *curl)
+bool oauth2_url_decode_buf(oauth2_log_t *log, const char *src,
+			   size_t src_len, char *dst, size_t *dst_len)
 {
-	_curl_refcount--;
-	if ((_curl_refcount == 0) && (_s_curl)) {
-		curl_easy_cleanup(_s_curl);
-		_s_curl = NULL;
+	bool rc = false;
+
+	if ((src == NULL) || (dst == NULL) || (dst_len == NULL)) {
+		oauth2_warn(log, "not decoding null input or into null output");
+		goto end;
 	}
+
+	// the decoded value is at most as long as the encoded one
+	if (src_len + 1 > *dst_len) {
+		oauth2_error(log, "output buffer too small (%d)",
+			     (int)*dst_len);
+		goto end;
+	}
+
+	*dst_len = _oauth2_url_decode_impl(src, src_len, dst);
+
+	rc = true;
+
+end:
+
+	return rc;
 }
 
 char *oauth2_url_encode(oauth2_log_t *log, const char *src)
 {
-	char *dst = NULL, *rc = NULL;
-	CURL *curl = NULL;
+	char *dst = NULL;
+	size_t src_len = 0;
 
 	oauth2_debug(log, "enter: %s", src);
 
@@ -268,23 +750,14 @@ char *oauth2_url_encode(oauth2_log_t *log, const char *src)
 		goto end;
 	}
 
-	curl = oauth2_curl_init(log);
-	if (curl == NULL)
+	src_len = strlen(src);
+	dst = oauth2_mem_alloc_uninit(oauth2_url_encode_len(src, src_len) + 1);
+	if (dst == NULL)
 		goto end;
 
-	rc = curl_easy_escape(curl, src, strlen(src));
-	if (rc == NULL) {
-		oauth2_error(log, "curl_easy_escape() error");
-		goto end;
-	}
-
-	dst = oauth2_strdup(rc);
+	_oauth2_url_encode_impl(src, src_len, dst);
 
 end:
-	if (rc)
-		curl_free(rc);
-	if (curl)
-		oauth2_curl_free(curl);
 
 	oauth2_debug(log, "leave: %s", dst);
 
@@ -293,10 +766,8 @@ end:
 
 char *oauth2_url_decode(oauth2_log_t *log, const char *src)
 {
-	char *dst = NULL, *rc = NULL;
-	char *replaced = NULL;
-	CURL *curl = NULL;
-	int i = 0;
+	char *dst = NULL;
+	size_t src_len = 0;
 
 	oauth2_debug(log, "enter: %s", src);
 
@@ -305,112 +776,127 @@ char *oauth2_url_decode(oauth2_log_t *log, const char *src)
 		goto end;
 	}
 
-	curl = oauth2_curl_init(log);
-	if (curl == NULL)
-		goto end;
-
-	replaced = oauth2_strdup(src);
-	if (replaced == NULL)
-		goto end;
-
-	// https://github.com/unshiftio/querystringify/issues/7#issuecomment-287627341
-	for (i = 0; replaced[i] != '\0'; i++)
-		if (replaced[i] == '+')
-			// NOTE: technically it would be more correct to make
-			// this a %20...
-			replaced[i] = ' ';
-
-	rc = curl_easy_unescape(curl, replaced, strlen(replaced), NULL);
-	if (rc == NULL) {
-		oauth2_error(log, "curl_easy_unescape() error");
+	src_len = strlen(src);
+	dst = oauth2_mem_alloc_uninit(src_len + 1);
+	if (dst == NULL)
 		goto end;
-	}
 
-	dst = oauth2_strdup(rc);
+	_oauth2_url_decode_impl(src, src_len, dst);
 
 end:
-	if (rc)
-		curl_free(rc);
-	if (replaced)
-		oauth2_mem_free(replaced);
-	if (curl)
-		oauth2_curl_free(curl);
 
 	oauth2_debug(log, "leave: %s", dst);
 
 	return dst;
 }
 
-// TODO: this has performance/memory issues for large chunks of HTML
-char *oauth2_html_escape(oauth2_log_t *log, const char *src)
+// bytes added by escaping a character, 0 for characters passed as-is
+static const unsigned char _oauth2_html_escape_extra[256] = {
+    ['&'] = 4, ['\''] = 5, ['"'] = 5, ['>'] = 3, ['<'] = 3};
+
+static const char *const _oauth2_html_escape_entity[256] = {
+    ['&'] = "&amp;", ['\''] = "&apos;", ['"'] = "&quot;", ['>'] = "&gt;",
+    ['<'] = "&lt;"};
+
+// counts the bytes that escaping adds, skipping 16 clean bytes at a time
+static size_t _oauth2_html_escape_extra_len(const char *src, size_t src_len)
 {
-	char *dst = NULL, *rc = NULL;
-	const char escape_chars[6] = {'&', '\'', '\"', '>', '<', '\0'};
-	const char *const replace_chars[] = {"&amp;", "&apos;", "&quot;",
-					     "&gt;", "&lt;"};
-	unsigned int i, j = 0, k, n = 0,
-			escape_chars_len = strlen(escape_chars);
-	size_t m = 0, src_len = src ? strlen(src) : 0;
+	const unsigned char *p = (const unsigned char *)src;
+	size_t i = 0, j = 0, n = 0;
+#if defined(__SSE2__)
+	__m128i in, m;
+
+	for (i = 0; src_len - i >= 16; i += 16) {
+		in = _mm_loadu_si128((const __m128i *)(p + i));
+		m = _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('&')),
+				 _mm_cmpeq_epi8(in, _mm_set1_epi8('\'')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(in, _mm_set1_epi8('"')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(in, _mm_set1_epi8('>')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(in, _mm_set1_epi8('<')));
+		if (_mm_movemask_epi8(m) == 0)
+			continue;
+		for (j = i; j < i + 16; j++)
+			n += _oauth2_html_escape_extra[p[j]];
+	}
+#endif
 
-	oauth2_debug(log, "enter: %s", src);
+	for (; i < src_len; i++)
+		n += _oauth2_html_escape_extra[p[i]];
+
+	return n;
+}
+
+/*
+ * returns src itself when there is nothing to escape; otherwise returns an
+ * escaped copy that is also stored in *alloc so the caller can free it
+ */
+const char *oauth2_html_escape_nocopy(oauth2_log_t *log, const char *src,
+				      char **alloc)
+{
+	const char *rv = NULL;
+	const unsigned char *p = (const unsigned char *)src;
+	const char *entity = NULL;
+	size_t src_len = 0, extra = 0, i = 0, j = 0, k = 0;
+	char *dst = NULL;
+
+	if (alloc == NULL)
+		goto end;
+	*alloc = NULL;
 
 	if (src == NULL)
 		goto end;
 
-	rc = oauth2_mem_alloc(src_len * 6 + 1);
+	src_len = strlen(src);
+	extra = _oauth2_html_escape_extra_len(src, src_len);
+	if (extra == 0) {
+		rv = src;
+		goto end;
+	}
+
+	dst = oauth2_mem_alloc_uninit(src_len + extra + 1);
+	if (dst == NULL)
+		goto end;
+
 	for (i = 0; i < src_len; i++) {
-		for (n = 0; n < escape_chars_len; n++) {
-			if (src[i] == escape_chars[n]) {
-				m = strlen(replace_chars[n]);
-				for (k = 0; k < m; k++)
-					rc[j + k] = replace_chars[n][k];
-				j += m;
-				break;
-			}
-		}
-		if (n == escape_chars_len) {
-			rc[j] = src[i];
-			j++;
+		entity = _oauth2_html_escape_entity[p[i]];
+		if (entity == NULL) {
+			dst[j++] = p[i];
+			continue;
 		}
+		for (k = 0; entity[k]; k++)
+			dst[j++] = entity[k];
 	}
-	rc[j] = '\0';
+	dst[j] = '\0';
 
-	dst = oauth2_strdup(rc);
+	*alloc = dst;
+	rv = dst;
 
 end:
-	if (rc)
-		oauth2_mem_free(rc);
 
-	oauth2_debug(log, "leave: %s", dst);
+	oauth2_trace1(log, "escaped %d bytes to %d", (int)src_len,
+		      (int)(src_len + extra));
 
-	return dst;
+	return rv;
 }
 
-static char *_oauth2_trim(char *src)
+char *oauth2_html_escape(oauth2_log_t *log, const char *src)
 {
-	char *rv = NULL;
-	char *start = NULL, *end = NULL;
-	char *buf = NULL;
+	char *dst = NULL;
+
+	oauth2_debug(log, "enter: %s", src);
 
 	if (src == NULL)
 		goto end;
 
-	buf = oauth2_strdup(src);
-	start = buf;
-
-	while (isspace(*start))
-		++start;
-	end = &start[strlen(start)];
-	while (--end >= start && isspace(*end))
-		*end = '\0';
-
-	rv = oauth2_strdup(start);
+	if ((oauth2_html_escape_nocopy(log, src, &dst) != NULL) &&
+	    (dst == NULL))
+		dst = oauth2_strdup(src);
 
 end:
-	if (buf)
-		oauth2_mem_free(buf);
 
-	return rv;
+	oauth2_debug(log, "leave: %s", dst);
+
+	return dst;
 }
 
 char *oauth2_getword(const char **line, char stop)
@@ -436,58 +922,101 @@ char *oauth2_getword(const char **line, char stop)
 	return res;
 }
 
+static void _oauth2_slice_trim(const char **str, size_t *len)
+{
+	while ((*len > 0) && isspace((unsigned char)**str)) {
+		(*str)++;
+		(*len)--;
+	}
+	while ((*len > 0) && isspace((unsigned char)(*str)[*len - 1]))
+		(*len)--;
+}
+
+/*
+ * returns the next name/value pair in input as slices of it, advancing input
+ * past the separator(s) that follow the pair; a pair without a sep_nv has an
+ * empty value
+ */
+bool _oauth2_nv_slice_next(const char **input, char sep_tuple, char sep_nv,
+			   bool trim, _oauth2_nv_slice_t *slice)
+{
+	const char *p = *input, *end = NULL, *sep = NULL;
+
+	if ((p == NULL) || (*p == '\0'))
+		return false;
+
+	end = strchr(p, sep_tuple);
+	if (end == NULL)
+		end = p + strlen(p);
+
+	slice->pair = p;
+	slice->pair_len = end - p;
+
+	sep = memchr(p, sep_nv, end - p);
+	slice->name = p;
+	slice->name_len = (sep ? sep : end) - p;
+	if (sep) {
+		while ((sep < end) && (*sep == sep_nv))
+			sep++;
+		slice->value = sep;
+	} else {
+		slice->value = end;
+	}
+	slice->value_len = end - slice->value;
+
+	if (trim) {
+		_oauth2_slice_trim(&slice->pair, &slice->pair_len);
+		_oauth2_slice_trim(&slice->name, &slice->name_len);
+		_oauth2_slice_trim(&slice->value, &slice->value_len);
+	}
+
+	while (*end == sep_tuple)
+		end++;
+	*input = end;
+
+	return true;
+}
+
 bool _oauth2_nv_list_parse(oauth2_log_t *log, const char *input,
 			   oauth2_nv_list_t *tuples, char sep_tuple,
 			   char sep_nv, bool trim, bool url_decode)
 {
 	bool rc = false;
-	const char *p = NULL;
-	char *save_input = NULL, *save_val = NULL;
-	char *key = NULL, *val = NULL;
-	char *dec_key = NULL, *dec_val = NULL;
-	char *trm_key = NULL, *trm_val = NULL;
+	_oauth2_nv_slice_t slice;
+	char *buf = NULL, *name = NULL, *value = NULL;
 
 	if ((input == NULL) || (tuples == NULL))
 		goto end;
 
-	save_input = oauth2_strdup(input);
-	p = save_input;
-
-	while (p && *p && (val = oauth2_getword(&p, sep_tuple))) {
-
-		save_val = val;
-		key = oauth2_getword((const char **)&val, sep_nv);
+	// a single scratch buffer holds the \0-terminated name and value of
+	// the current pair; decoding never lengthens them so it is in place
+	buf = oauth2_mem_alloc_uninit(strlen(input) + 2);
+	if (buf == NULL)
+		goto end;
 
-		if (key == NULL)
-			continue;
+	while (_oauth2_nv_slice_next(&input, sep_tuple, sep_nv, trim, &slice)) {
 
-		trm_key = trim ? _oauth2_trim(key) : oauth2_strdup(key);
-		trm_val = trim ? _oauth2_trim(val) : oauth2_strdup(val);
+		name = buf;
+		memcpy(name, slice.name, slice.name_len);
+		name[slice.name_len] = '\0';
+		value = name + slice.name_len + 1;
+		memcpy(value, slice.value, slice.value_len);
+		value[slice.value_len] = '\0';
 
 		if (url_decode) {
-			dec_key = oauth2_url_decode(log, trm_key);
-			dec_val = oauth2_url_decode(log, trm_val);
-			oauth2_nv_list_add(log, tuples, dec_key, dec_val);
-			oauth2_mem_free(dec_key);
-			oauth2_mem_free(dec_val);
-		} else {
-			oauth2_nv_list_add(log, tuples, trm_key, trm_val);
+			_oauth2_url_decode_impl(name, slice.name_len, name);
+			_oauth2_url_decode_impl(value, slice.value_len, value);
 		}
 
-		oauth2_mem_free(trm_key);
-		if (trm_val)
-			oauth2_mem_free(trm_val);
-		oauth2_mem_free(key);
-		if (save_val)
-			oauth2_mem_free(save_val);
+		oauth2_nv_list_add(log, tuples, name, value);
 	}
 
 	rc = true;
 
 end:
 
-	if (save_input)
-		oauth2_mem_free(save_input);
+	if (buf)
+		oauth2_mem_free(buf);
 
 	return rc;
 }
@@ -528,7 +1057,7 @@ char *oauth2_strndup(const char *src, size_t len)
 	if (src == NULL)
 		goto end;
 
-	dst = oauth2_mem_alloc(len + 1);
+	dst = oauth2_mem_alloc_uninit(len + 1);
 	if (dst == NULL)
 		goto end;
 
@@ -568,7 +1097,7 @@ char *_oauth2_stradd4(char *src, const char *add1, const char *add2,
 	len = strlen(src) + strlen(add1) + strlen(add2) + strlen(add3) +
 	      strlen(add4) + 1;
 
-	ptr = oauth2_mem_alloc(len);
+	ptr = oauth2_mem_alloc_uninit(len);
 	if (ptr == NULL)
 		goto end;
 
@@ -588,16 +1117,176 @@ char *oauth2_stradd(char *src, const char *add1, const char *add2,
 	return _oauth2_stradd4(src, add1, add2, add3, NULL);
 }
 
+/*
+ * string builder
+ */
+
+#define OAUTH2_STRBUF_SIZE_MIN 64
+
+void oauth2_strbuf_init(oauth2_strbuf_t *sb, size_t hint)
+{
+	sb->buf = NULL;
+	sb->len = 0;
+	sb->size = hint;
+	sb->failed = false;
+}
+
+// make room for len more bytes plus a terminating NUL
+static bool _oauth2_strbuf_reserve(oauth2_strbuf_t *sb, size_t len)
+{
+	bool rc = false;
+	size_t size = 0;
+	char *ptr = NULL;
+
+	if (sb->failed)
+		goto end;
+
+	if ((sb->buf) && (sb->len + len + 1 <= sb->size)) {
+		rc = true;
+		goto end;
+	}
+
+	size = (sb->size < OAUTH2_STRBUF_SIZE_MIN) ? OAUTH2_STRBUF_SIZE_MIN
+						   : sb->size;
+	while (size < sb->len + len + 1)
+		size *= 2;
+
+	// no realloc: the buffer may live in a request arena
+	ptr = oauth2_mem_alloc_uninit(size);
+	if (ptr == NULL) {
+		sb->failed = true;
+		goto end;
+	}
+	if (sb->buf) {
+		memcpy(ptr, sb->buf, sb->len);
+		oauth2_mem_free(sb->buf);
+	}
+	ptr[sb->len] = '\0';
+	sb->buf = ptr;
+	sb->size = size;
+
+	rc = true;
+
+end:
+
+	return rc;
+}
+
+bool oauth2_strbuf_appendn(oauth2_strbuf_t *sb, const char *str, size_t len)
+{
+	bool rc = false;
+
+	if ((sb == NULL) || (_oauth2_strbuf_reserve(sb, len) == false))
+		goto end;
+
+	if (len > 0)
+		memcpy(sb->buf + sb->len, str, len);
+	sb->len += len;
+	sb->buf[sb->len] = '\0';
+
+	rc = true;
+
+end:
+
+	return rc;
+}
+
+bool oauth2_strbuf_append(oauth2_strbuf_t *sb, const char *str)
+{
+	return oauth2_strbuf_appendn(sb, str ? str : "", str ? strlen(str) : 0);
+}
+
+bool oauth2_strbuf_appendf(oauth2_strbuf_t *sb, const char *fmt, ...)
+{
+	bool rc = false;
+	va_list ap;
+	int n = 0;
+
+	if (sb == NULL)
+		goto end;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		goto end;
+
+	if (_oauth2_strbuf_reserve(sb, n) == false)
+		goto end;
+
+	va_start(ap, fmt);
+	vsnprintf(sb->buf + sb->len, n + 1, fmt, ap);
+	va_end(ap);
+	sb->len += n;
+
+	rc = true;
+
+end:
+
+	return rc;
+}
+
+// appends the URL (percent) encoded form of str
+bool oauth2_strbuf_append_escaped(oauth2_strbuf_t *sb, const char *str)
+{
+	size_t len = 0, n = 0;
+
+	if (str == NULL)
+		return oauth2_strbuf_appendn(sb, "", 0);
+
+	len = strlen(str);
+	n = oauth2_url_encode_len(str, len);
+
+	if ((sb == NULL) || (_oauth2_strbuf_reserve(sb, n) == false))
+		return false;
+
+	sb->len += _oauth2_url_encode_impl(str, len, sb->buf + sb->len);
+
+	return true;
+}
+
+// hands over the buffer, NULL if nothing was appended or on failure
+char *oauth2_strbuf_take(oauth2_strbuf_t *sb)
+{
+	char *rv = NULL;
+
+	if (sb == NULL)
+		goto end;
+
+	if (sb->failed == false)
+		rv = sb->buf;
+	else if (sb->buf)
+		oauth2_mem_free(sb->buf);
+
+	oauth2_strbuf_init(sb, 0);
+
+end:
+
+	return rv;
+}
+
+void oauth2_strbuf_free(oauth2_strbuf_t *sb)
+{
+	if (sb == NULL)
+		return;
+	if (sb->buf)
+		oauth2_mem_free(sb->buf);
+	oauth2_strbuf_init(sb, 0);
+}
+
 static bool _oauth2_nv2s(oauth2_log_t *log, void *rec, const char *key,
 			 const char *value)
 {
 	bool rc = false;
-	char **str = (char **)rec;
+	oauth2_strbuf_t *sb = (oauth2_strbuf_t *)rec;
 
-	if (str == NULL)
+	if (sb == NULL)
 		goto end;
 
-	*str = _oauth2_stradd4(*str, " ", key, _OAUTH2_STR_EQUAL, value);
+	oauth2_strbuf_append(sb, " ");
+	oauth2_strbuf_append(sb, key);
+	oauth2_strbuf_append(sb, _OAUTH2_STR_EQUAL);
+	oauth2_strbuf_append(sb, value);
 
 	rc = true;
 
@@ -608,10 +1297,14 @@ end:
 
 char *oauth2_nv_list2s(oauth2_log_t *log, const oauth2_nv_list_t *list)
 {
-	char *str = oauth2_strdup("[");
-	oauth2_nv_list_loop(log, list, _oauth2_nv2s, &str);
-	str = oauth2_stradd(str, " ]", NULL, NULL);
-	return str;
+	oauth2_strbuf_t sb;
+
+	oauth2_strbuf_init(&sb, 0);
+	oauth2_strbuf_append(&sb, "[");
+	oauth2_nv_list_loop(log, list, _oauth2_nv2s, &sb);
+	oauth2_strbuf_append(&sb, " ]");
+
+	return oauth2_strbuf_take(&sb);
 }
 
 bool _oauth2_struct_slot_str_set(void *struct_ptr, size_t offset,
@@ -713,6 +1406,9 @@ end:
 typedef struct _oauth2_nv_t {
 	char *name;
 	char *value;
+	unsigned int hash;
+	// name and value point into storage owned by the caller
+	bool borrowed;
 	struct _oauth2_nv_t *next;
 } _oauth2_nv_t;
 
@@ -724,6 +1420,7 @@ static _oauth2_nv_t *_oauth2_nv_new(oauth2_log_t *log, const char *name,
 	if (ptr != NULL) {
 		ptr->name = name ? oauth2_strdup(name) : NULL;
 		ptr->value = value ? oauth2_strdup(value) : NULL;
+		ptr->borrowed = false;
 		ptr->next = NULL;
 	}
 	return ptr;
@@ -731,15 +1428,23 @@ static _oauth2_nv_t *_oauth2_nv_new(oauth2_log_t *log, const char *name,
 
 static void _oauth2_nv_free(oauth2_log_t *log, _oauth2_nv_t *ptr)
 {
-	if (ptr->name)
+	if ((ptr->name) && (ptr->borrowed == false))
 		oauth2_mem_free(ptr->name);
-	if (ptr->value)
+	if ((ptr->value) && (ptr->borrowed == false))
 		oauth2_mem_free(ptr->value);
 	oauth2_mem_free(ptr);
 }
 
+// lists longer than this get an open-addressing hash index on the name
+#define OAUTH2_NV_LIST_INDEX_THRESHOLD 8
+
 typedef struct oauth2_nv_list_t {
 	_oauth2_nv_t *first;
+	_oauth2_nv_t *last;
+	size_t count;
+	// the first entry for each name, NULL for empty slots
+	_oauth2_nv_t **index;
+	size_t index_size;
 	bool case_sensitive;
 } oauth2_nv_list_t;
 
@@ -748,11 +1453,24 @@ oauth2_nv_list_t *oauth2_nv_list_init(oauth2_log_t *log)
 	oauth2_nv_list_t *ptr = NULL;
 	ptr = oauth2_mem_alloc(sizeof(oauth2_nv_list_t));
 	if (ptr != NULL) {
+		ptr->first = NULL;
+		ptr->last = NULL;
+		ptr->count = 0;
+		ptr->index = NULL;
+		ptr->index_size = 0;
 		ptr->case_sensitive = true;
 	}
 	return ptr;
 }
 
+static void _oauth2_nv_list_index_free(oauth2_nv_list_t *list)
+{
+	if (list->index)
+		oauth2_mem_free(list->index);
+	list->index = NULL;
+	list->index_size = 0;
+}
+
 void oauth2_nv_list_free(oauth2_log_t *log, oauth2_nv_list_t *list)
 {
 	_oauth2_nv_t *ptr = NULL;
@@ -765,6 +1483,7 @@ void oauth2_nv_list_free(oauth2_log_t *log, oauth2_nv_list_t *list)
 		_oauth2_nv_free(log, ptr);
 	}
 
+	_oauth2_nv_list_index_free(list);
 	oauth2_mem_free(list);
 
 end:
@@ -772,55 +1491,166 @@ end:
 	return;
 }
 
-_OAUTH2_TYPE_IMPLEMENT_MEMBER_SET_GET(nv, list, case_sensitive, bool, bln)
+// FNV-1a, folding ASCII case for case-insensitive (header) lists
+static unsigned int _oauth2_nv_list_hash(const oauth2_nv_list_t *list,
+					 const char *name)
+{
+	unsigned int hash = 2166136261u;
+	const unsigned char *p = (const unsigned char *)name;
+
+	if (list->case_sensitive) {
+		for (; *p; p++)
+			hash = (hash ^ *p) * 16777619u;
+	} else {
+		for (; *p; p++)
+			hash = (hash ^ (unsigned char)tolower(*p)) * 16777619u;
+	}
+
+	return hash;
+}
+
+static bool _oauth2_nv_list_name_eq(const oauth2_nv_list_t *list,
+				    const char *n1, const char *n2)
+{
+	return list->case_sensitive ? (strcmp(n1, n2) == 0)
+				    : (strcasecmp(n1, n2) == 0);
+}
+
+// returns the slot that holds the first entry for the name, or the empty
+// slot where it would go
+static _oauth2_nv_t **_oauth2_nv_list_index_slot(const oauth2_nv_list_t *list,
+						 const char *name,
+						 unsigned int hash)
+{
+	size_t mask = list->index_size - 1;
+	size_t i = hash & mask;
+	_oauth2_nv_t *e = NULL;
+
+	while ((e = list->index[i])) {
+		if ((e->hash == hash) &&
+		    (_oauth2_nv_list_name_eq(list, e->name, name)))
+			break;
+		i = (i + 1) & mask;
+	}
+
+	return &list->index[i];
+}
 
-static bool _oauth2_nv_list_find(oauth2_log_t *log,
-				 const oauth2_nv_list_t *list, const char *name,
-				 _oauth2_nv_t **ptr, _oauth2_nv_t **prev)
+static bool _oauth2_nv_list_index_build(oauth2_nv_list_t *list)
 {
 	bool rc = false;
+	_oauth2_nv_t *ptr = NULL, **slot = NULL;
+	size_t size = 16;
 
-	if ((list == NULL) || (name == NULL))
+	_oauth2_nv_list_index_free(list);
+
+	if (list->count <= OAUTH2_NV_LIST_INDEX_THRESHOLD) {
+		rc = true;
 		goto end;
+	}
 
-	for (*ptr = list->first; *ptr; *ptr = (*ptr)->next) {
-		if (list->case_sensitive) {
-			if (strcmp((*ptr)->name, name) == 0) {
-				rc = true;
-				break;
-			}
-		} else {
-			if (strcasecmp((*ptr)->name, name) == 0) {
-				rc = true;
-				break;
-			}
-		}
-		*prev = *ptr;
+	// keep the load factor below one half
+	while (size < list->count * 2)
+		size <<= 1;
+
+	list->index = oauth2_mem_alloc(size * sizeof(_oauth2_nv_t *));
+	if (list->index == NULL)
+		goto end;
+	list->index_size = size;
+
+	for (ptr = list->first; ptr; ptr = ptr->next) {
+		slot = _oauth2_nv_list_index_slot(list, ptr->name, ptr->hash);
+		if (*slot == NULL)
+			*slot = ptr;
 	}
 
+	rc = true;
+
+end:
+
+	return rc;
+}
+
+// recompute the hashes after the case sensitivity has changed
+static void _oauth2_nv_list_rehash(oauth2_nv_list_t *list)
+{
+	_oauth2_nv_t *ptr = NULL;
+
+	for (ptr = list->first; ptr; ptr = ptr->next)
+		ptr->hash = _oauth2_nv_list_hash(list, ptr->name);
+	_oauth2_nv_list_index_build(list);
+}
+
+bool oauth2_nv_list_case_sensitive_set(oauth2_log_t *log,
+				       oauth2_nv_list_t *list, const bool v)
+{
+	bool rc = false;
+
+	if (list == NULL)
+		goto end;
+
+	if (list->case_sensitive != v) {
+		list->case_sensitive = v;
+		_oauth2_nv_list_rehash(list);
+	}
+
+	rc = true;
+
 end:
 
 	return rc;
 }
 
+_OAUTH2_TYPE_IMPLEMENT_MEMBER_GET(nv, list, case_sensitive, bool)
+
+static _oauth2_nv_t *_oauth2_nv_list_find(oauth2_log_t *log,
+					  const oauth2_nv_list_t *list,
+					  const char *name)
+{
+	_oauth2_nv_t *ptr = NULL;
+	unsigned int hash = 0;
+
+	if ((list == NULL) || (name == NULL))
+		goto end;
+
+	if (list->index) {
+		hash = _oauth2_nv_list_hash(list, name);
+		ptr = *_oauth2_nv_list_index_slot(list, name, hash);
+		goto end;
+	}
+
+	for (ptr = list->first; ptr; ptr = ptr->next)
+		if (_oauth2_nv_list_name_eq(list, ptr->name, name))
+			break;
+
+end:
+
+	return ptr;
+}
+
 bool oauth2_nv_list_set(oauth2_log_t *log, oauth2_nv_list_t *list,
 			const char *name, const char *value)
 {
 	bool rc = false;
-	_oauth2_nv_t *ptr = NULL, *prev = NULL;
+	_oauth2_nv_t *ptr = NULL;
 
 	if ((list == NULL) || (name == NULL))
 		goto end;
 
-	_oauth2_nv_list_find(log, list, name, &ptr, &prev);
+	ptr = _oauth2_nv_list_find(log, list, name);
 
 	if (ptr == NULL) {
 		rc = oauth2_nv_list_add(log, list, name, value);
 		goto end;
 	}
 
-	if (ptr->value)
+	if (ptr->borrowed) {
+		// copy on write: from here on the entry owns its strings
+		ptr->name = oauth2_strdup(ptr->name);
+		ptr->borrowed = false;
+	} else if (ptr->value) {
 		oauth2_mem_free(ptr->value);
+	}
 
 	ptr->value = value ? oauth2_strdup(value) : NULL;
 
@@ -840,14 +1670,22 @@ bool oauth2_nv_list_unset(oauth2_log_t *log, oauth2_nv_list_t *list,
 	if ((list == NULL) || (name == NULL))
 		goto end;
 
-	_oauth2_nv_list_find(log, list, name, &ptr, &prev);
+	for (ptr = list->first; ptr; prev = ptr, ptr = ptr->next)
+		if (_oauth2_nv_list_name_eq(list, ptr->name, name))
+			break;
 
 	if (ptr) {
 		if (prev)
 			prev->next = ptr->next;
 		else
 			list->first = ptr->next;
+		if (list->last == ptr)
+			list->last = prev;
+		list->count--;
 		_oauth2_nv_free(log, ptr);
+		// a later entry with the same name may now be the first one
+		if (list->index)
+			_oauth2_nv_list_index_build(list);
 	}
 
 	rc = true;
@@ -857,11 +1695,34 @@ end:
 	return rc;
 }
 
+static void _oauth2_nv_list_append(oauth2_nv_list_t *list, _oauth2_nv_t *ptr)
+{
+	_oauth2_nv_t **slot = NULL;
+
+	ptr->hash = _oauth2_nv_list_hash(list, ptr->name);
+
+	if (list->last == NULL)
+		list->first = ptr;
+	else
+		list->last->next = ptr;
+	list->last = ptr;
+	list->count++;
+
+	if ((list->index) && (list->count * 2 <= list->index_size)) {
+		slot = _oauth2_nv_list_index_slot(list, ptr->name, ptr->hash);
+		if (*slot == NULL)
+			*slot = ptr;
+	} else if (list->count > OAUTH2_NV_LIST_INDEX_THRESHOLD) {
+		// a failure leaves the list without an index, i.e. scanned
+		_oauth2_nv_list_index_build(list);
+	}
+}
+
 bool oauth2_nv_list_add(oauth2_log_t *log, oauth2_nv_list_t *list,
 			const char *name, const char *value)
 {
 	bool rc = false;
-	_oauth2_nv_t *ptr = NULL, *prev = NULL;
+	_oauth2_nv_t *ptr = NULL;
 
 	if ((list == NULL) || (name == NULL))
 		goto end;
@@ -870,13 +1731,7 @@ bool oauth2_nv_list_add(oauth2_log_t *log, oauth2_nv_list_t *list,
 	if (ptr == NULL)
 		goto end;
 
-	if (list->first == NULL) {
-		list->first = ptr;
-	} else {
-		for (prev = list->first; prev->next; prev = prev->next)
-			;
-		prev->next = ptr;
-	}
+	_oauth2_nv_list_append(list, ptr);
 
 	rc = true;
 
@@ -885,24 +1740,50 @@ end:
 	return rc;
 }
 
-const char *oauth2_nv_list_get(oauth2_log_t *log, const oauth2_nv_list_t *list,
-			       const char *name)
+/*
+ * adds an entry that refers to name and value instead of copying them; they
+ * must remain valid and unchanged until the list is freed, the entry is
+ * removed, or its value is set which makes the entry take copies
+ */
+bool oauth2_nv_list_add_ref(oauth2_log_t *log, oauth2_nv_list_t *list,
+			    const char *name, const char *value)
 {
-	const char *value = NULL;
-	_oauth2_nv_t *ptr = NULL, *prev = NULL;
+	bool rc = false;
+	_oauth2_nv_t *ptr = NULL;
 
 	if ((list == NULL) || (name == NULL))
 		goto end;
 
-	_oauth2_nv_list_find(log, list, name, &ptr, &prev);
+	ptr = oauth2_mem_alloc(sizeof(_oauth2_nv_t));
+	if (ptr == NULL)
+		goto end;
 
-	if (ptr)
-		value = ptr->value;
+	ptr->name = (char *)name;
+	ptr->value = (char *)value;
+	ptr->borrowed = true;
+	ptr->next = NULL;
+
+	_oauth2_nv_list_append(list, ptr);
+
+	rc = true;
 
 end:
 
+	return rc;
+}
+
+const char *oauth2_nv_list_get(oauth2_log_t *log, const oauth2_nv_list_t *list,
+			       const char *name)
+{
+	const char *value = NULL;
+	_oauth2_nv_t *ptr = NULL;
+
+	ptr = _oauth2_nv_list_find(log, list, name);
+	if (ptr)
+		value = ptr->value;
+
 	if (name != NULL)
-		oauth2_debug(log, "%s=%s", name, value ? value : "(null)");
+		oauth2_trace1(log, "%s=%s", name, value ? value : "(null)");
 
 	return value;
 }
@@ -1199,7 +2080,7 @@ char *_oauth2_bytes2str(oauth2_log_t *log, uint8_t *buf, size_t len)
 	char *rv = NULL, *ptr = NULL;
 	int i = 0, n = 0;
 
-	rv = oauth2_mem_alloc(len * 2 + 1);
+	rv = oauth2_mem_alloc_uninit(len * 2 + 1);
 	if (rv == NULL)
 		goto end;
 
@@ -1232,7 +2113,7 @@ char *oauth2_rand_str(oauth2_log_t *log, size_t len)
 		goto end;
 
 	half_len = len / 2 + 1;
-	buf = oauth2_mem_alloc(half_len);
+	buf = oauth2_mem_alloc_uninit(half_len);
 	if (buf == NULL)
 		goto end;
 
@@ -1323,7 +2204,7 @@ int gettimeofday(struct timeval *tp, struct timezone *tzp)
 }
 #endif
 
-static oauth2_time_t _oauth2_time_now_ms()
+oauth2_time_t _oauth2_time_now_ms()
 {
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
@@ -1404,7 +2285,7 @@ char *oauth_read_file(oauth2_log_t *log, const char *filename)
 	fsize = ftell(fp);
 	fseek(fp, 0, SEEK_SET);
 
-	rv = oauth2_mem_alloc(fsize + 1);
+	rv = oauth2_mem_alloc_uninit(fsize + 1);
 	n = fread(rv, 1, fsize, fp);
 	if (n != fsize) {
 		oauth2_error(log, "read only %ld bytes from file of %ld length",
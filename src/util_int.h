@@ -124,7 +124,33 @@ bool _oauth2_nv_list_parse(oauth2_log_t *log, const char *input,
 			   oauth2_nv_list_t *tuples, char sep_tuple,
 			   char sep_nv, bool trim, bool url_decode);
 
+// a name/value pair as slices of the (not modified) input
+typedef struct _oauth2_nv_slice_t {
+	const char *pair;
+	size_t pair_len;
+	const char *name;
+	size_t name_len;
+	const char *value;
+	size_t value_len;
+} _oauth2_nv_slice_t;
+
+bool _oauth2_nv_slice_next(const char **input, char sep_tuple, char sep_nv,
+			   bool trim, _oauth2_nv_slice_t *slice);
+
 char *_oauth2_bytes2str(oauth2_log_t *log, uint8_t *buf, size_t len);
+oauth2_time_t _oauth2_time_now_ms();
+bool _oauth2_rand_bytes(oauth2_log_t *log, uint8_t *buf, size_t len);
+
+void _oauth2_http_shutdown(oauth2_log_t *log);
+bool _oauth2_http_health_init(oauth2_log_t *log);
+bool _oauth2_http_health_admit(oauth2_log_t *log, const char *key,
+			       oauth2_time_t now, oauth2_time_t timeout_s,
+			       oauth2_time_t *hedge_delay_ms);
+void _oauth2_http_health_update(oauth2_log_t *log, const char *key,
+				oauth2_time_t now, bool ok,
+				oauth2_time_t latency_ms);
+void _oauth2_openidc_shutdown(oauth2_log_t *log);
+void _oauth2_jwt_pool_shutdown(oauth2_log_t *log);
 
 /*
  * struct list member management macros
@@ -0,0 +1,131 @@
+/***************************************************************************
+ *
+ * Copyright (C) 2018-2020 - ZmartZone Holding BV - www.zmartzone.eu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @Author: Hans Zandbelt - hans.zandbelt@zmartzone.eu
+ *
+ **************************************************************************/
+
+
+/*
+ * measures the JWT verification path with and without a request-scoped
+ * arena, e.g.: make bench_verify && ./bench_verify 200000
+ */
+
+#include "oauth2/jose.h"
+#include "oauth2/mem.h"
+#include "oauth2/oauth2.h"
+#include "oauth2_int.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const char *bench_jwt =
+    "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9."
+    "eyJzdWIiOiIxMjM0NTY3ODkwIiwibmFtZSI6IkpvaG4gRG9lIn0."
+    "sQOVoEtkQlgy8UwlPOi5YWSdGAkRn80JqT53RdktIms";
+
+static double bench_now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static bool bench_verify_once(oauth2_log_t *log,
+			      oauth2_cfg_token_verify_t *verify)
+{
+	bool rc = false;
+	json_t *json_payload = NULL;
+	char *s_payload = NULL;
+
+	// bypass the token cache so that every round verifies the signature
+	rc = oauth2_jose_jwt_verify(log, verify->ctx->ptr, bench_jwt,
+				    &json_payload, &s_payload);
+	if (s_payload)
+		oauth2_mem_free(s_payload);
+	if (json_payload)
+		json_decref(json_payload);
+
+	return rc;
+}
+
+static double bench_run(oauth2_log_t *log, oauth2_cfg_token_verify_t *verify,
+			long rounds, bool arena)
+{
+	oauth2_mem_arena_t *a = NULL;
+	double start = 0;
+	long i = 0;
+
+	start = bench_now_ns();
+
+	for (i = 0; i < rounds; i++) {
+		// one arena per request, as the server adapters do
+		if (arena) {
+			a = oauth2_mem_arena_create(0);
+			oauth2_mem_arena_enter(a);
+		}
+		if (bench_verify_once(log, verify) == false) {
+			fprintf(stderr, "verification failed\n");
+			exit(1);
+		}
+		if (arena) {
+			oauth2_mem_arena_leave(a);
+			oauth2_mem_arena_free(a);
+		}
+	}
+
+	return (bench_now_ns() - start) / rounds;
+}
+
+int main(int argc, char **argv)
+{
+	oauth2_log_t *log = NULL;
+	oauth2_cfg_token_verify_t *verify = NULL;
+	long rounds = (argc > 1) ? atol(argv[1]) : 100000;
+	double heap = 0, arena = 0;
+	char *rv = NULL;
+
+	if (rounds <= 0)
+		rounds = 100000;
+
+	log = oauth2_init(OAUTH2_LOG_ERROR, 0);
+
+	rv = oauth2_cfg_token_verify_add_options(log, &verify, "plain",
+						 "mysecret", "kid=mykid");
+	if (rv != NULL) {
+		fprintf(stderr, "oauth2_cfg_token_verify_add_options: %s\n",
+			rv);
+		return 1;
+	}
+
+	// warm up caches and lazily initialized state
+	bench_run(log, verify, rounds / 10 + 1, false);
+
+	heap = bench_run(log, verify, rounds, false);
+	arena = bench_run(log, verify, rounds, true);
+
+	printf("rounds: %ld\n", rounds);
+	printf("heap:   %10.0f ns/verify\n", heap);
+	printf("arena:  %10.0f ns/verify (%+.1f%%)\n", arena,
+	       (arena - heap) * 100.0 / heap);
+
+	oauth2_cfg_token_verify_free(log, verify);
+	oauth2_shutdown(log);
+
+	return 0;
+}
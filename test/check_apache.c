@@ -163,6 +163,37 @@ START_TEST(test_apache_request_state)
 }
 END_TEST
 
+START_TEST(test_apache_token_verify)
+{
+	oauth2_apache_request_ctx_t *ctx = NULL;
+	oauth2_cfg_token_verify_t *verify = NULL;
+	const char *jwt = "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9."
+			  "eyJzdWIiOiIxMjM0NTY3ODkwIiwibmFtZSI6IkpvaG4gRG9lIn0."
+			  "sQOVoEtkQlgy8UwlPOi5YWSdGAkRn80JqT53RdktIms";
+	json_t *json_payload = NULL;
+	const char *rv = NULL;
+	size_t used = 0;
+
+	rv = oauth2_cfg_token_verify_add_options(_log, &verify, "plain",
+						 "mysecret", "kid=mykid");
+	ck_assert_ptr_eq(rv, NULL);
+
+	ctx = oauth2_apache_request_context(request, check_apache_log_request,
+					    "check_apache");
+	used = oauth2_mem_arena_used(ctx->arena);
+
+	ck_assert_int_eq(
+	    oauth2_apache_token_verify(ctx, verify, jwt, &json_payload), true);
+	ck_assert_ptr_ne(json_payload, NULL);
+
+	// the verification allocated from the request's arena
+	ck_assert_uint_gt(oauth2_mem_arena_used(ctx->arena), used);
+
+	json_decref(json_payload);
+	oauth2_cfg_token_verify_free(_log, verify);
+}
+END_TEST
+
 START_TEST(test_apache_authz_match_claim)
 {
 	json_error_t err;
@@ -237,6 +268,7 @@ Suite *oauth2_check_apache_suite()
 
 	tcase_add_test(c, test_apache_request_state);
 	tcase_add_test(c, test_apache_authz_match_claim);
+	tcase_add_test(c, test_apache_token_verify);
 	tcase_add_test(c, test_apache_authorize);
 	tcase_add_test(c, test_apache_http_response_set);
 
@@ -23,7 +23,11 @@
 #include "oauth2/http.h"
 #include "oauth2/mem.h"
 #include "oauth2/util.h"
+#include "util_int.h"
 #include <check.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 static oauth2_log_t *_log = NULL;
 
@@ -584,17 +588,27 @@ END_TEST
 
 static char *get_json = "{ \"my\": \"json\" }";
 static char *get_json_path = "/my_json";
+static char *get_large_path = "/large";
+
+#define TEST_HTTP_LARGE_SIZE 100000
 
 static char *oauth2_check_http_serve_get(const char *request)
 {
+	char *rv = NULL;
 	if (strncmp(request, get_json_path, strlen(get_json_path)) == 0) {
 		return oauth2_strdup(get_json);
 	}
+	if (strncmp(request, get_large_path, strlen(get_large_path)) == 0) {
+		rv = oauth2_mem_alloc(TEST_HTTP_LARGE_SIZE + 1);
+		memset(rv, 'x', TEST_HTTP_LARGE_SIZE);
+		return rv;
+	}
 	return oauth2_strdup("problem");
 }
 
 static char *post_json = "{ \"form\": \"post\" }";
 static char *post_form_json_path = "/post_json";
+static char *post_cookie_path = "/post_cookie";
 
 static char *oauth2_check_http_serve_post(const char *request)
 {
@@ -602,6 +616,13 @@ static char *oauth2_check_http_serve_post(const char *request)
 		    strlen(post_form_json_path)) == 0) {
 		return oauth2_strdup(post_json);
 	}
+	// the request includes the headers
+	if (strncmp(request, post_cookie_path, strlen(post_cookie_path)) ==
+	    0) {
+		return oauth2_strdup(strstr(request, "mycookie=mycvalue")
+					 ? "cookie"
+					 : "none");
+	}
 	return oauth2_strdup("problem");
 }
 
@@ -642,6 +663,369 @@ START_TEST(test_http_get)
 }
 END_TEST
 
+static int test_http_reused = 0;
+
+static void test_http_reuse_sink_callback(oauth2_log_sink_t *sink,
+					  const char *filename,
+					  unsigned long line,
+					  const char *function,
+					  oauth2_log_level_t level,
+					  const char *msg)
+{
+	if (strstr(msg, "reusing curl handle for:"))
+		test_http_reused++;
+}
+
+START_TEST(test_http_get_reuse)
+{
+	bool rc;
+	char *response = NULL, *url = NULL;
+	oauth2_nv_list_t *params = oauth2_nv_list_init(_log);
+	oauth2_http_call_ctx_t *ctx = oauth2_http_call_ctx_init(_log);
+
+	oauth2_log_sink_add(_log, oauth2_log_sink_create(
+				      OAUTH2_LOG_DEBUG,
+				      test_http_reuse_sink_callback, NULL));
+
+	url = oauth2_stradd(NULL, oauth2_check_http_base_url(),
+			    post_cookie_path, NULL);
+	oauth2_nv_list_add(_log, params, "name", "value");
+	oauth2_http_call_ctx_cookie_add(_log, ctx, "mycookie", "mycvalue");
+
+	rc = oauth2_http_post_form(_log, url, params, ctx, &response, NULL);
+	ck_assert_int_eq(rc, true);
+	ck_assert_str_eq(response, "cookie");
+	oauth2_mem_free(response);
+	// no assumption about earlier calls in this process
+	test_http_reused = 0;
+
+	// the pooled handle must not carry over the cookie of the previous call
+	rc = oauth2_http_post_form(_log, url, params, NULL, &response, NULL);
+	ck_assert_int_eq(rc, true);
+	ck_assert_str_eq(response, "none");
+	oauth2_mem_free(response);
+	ck_assert_int_eq(test_http_reused, 1);
+
+	oauth2_mem_free(url);
+	url = oauth2_stradd(NULL, oauth2_check_http_base_url(), get_json_path,
+			    NULL);
+
+	// nor the POST body and method
+	rc = oauth2_http_get(_log, url, NULL, NULL, &response, NULL);
+	ck_assert_int_eq(rc, true);
+	ck_assert_str_eq(response, get_json);
+	oauth2_mem_free(response);
+	ck_assert_int_eq(test_http_reused, 2);
+
+	oauth2_http_call_ctx_free(_log, ctx);
+	oauth2_nv_list_free(_log, params);
+	oauth2_mem_free(url);
+}
+END_TEST
+
+#define TEST_ASYNC_FDS_MAX 8
+
+typedef struct test_async_loop_t {
+	struct pollfd fds[TEST_ASYNC_FDS_MAX];
+	int n;
+	long timeout_ms;
+	int done;
+	bool rc;
+	char *response;
+	oauth2_http_status_code_t status_code;
+} test_async_loop_t;
+
+static bool test_async_socket_cb(oauth2_log_t *log, int fd, int events,
+				 void *arg)
+{
+	test_async_loop_t *loop = (test_async_loop_t *)arg;
+	int i = 0;
+
+	for (i = 0; i < loop->n; i++)
+		if (loop->fds[i].fd == fd)
+			break;
+
+	if (events & OAUTH2_HTTP_ASYNC_POLL_REMOVE) {
+		if (i < loop->n)
+			loop->fds[i] = loop->fds[--loop->n];
+		return true;
+	}
+
+	if (i == loop->n) {
+		if (loop->n == TEST_ASYNC_FDS_MAX)
+			return false;
+		loop->n++;
+	}
+
+	loop->fds[i].fd = fd;
+	loop->fds[i].events = 0;
+	if (events & OAUTH2_HTTP_ASYNC_POLL_IN)
+		loop->fds[i].events |= POLLIN;
+	if (events & OAUTH2_HTTP_ASYNC_POLL_OUT)
+		loop->fds[i].events |= POLLOUT;
+
+	return true;
+}
+
+static bool test_async_timer_cb(oauth2_log_t *log, long timeout_ms, void *arg)
+{
+	test_async_loop_t *loop = (test_async_loop_t *)arg;
+	loop->timeout_ms = timeout_ms;
+	return true;
+}
+
+static void test_async_done_cb(oauth2_log_t *log, bool rc, char *response,
+			       oauth2_http_status_code_t status_code, void *arg)
+{
+	test_async_loop_t *loop = (test_async_loop_t *)arg;
+	loop->done++;
+	loop->rc = rc;
+	loop->response = response;
+	loop->status_code = status_code;
+}
+
+static void test_async_run(oauth2_http_async_t *async, test_async_loop_t *loop)
+{
+	int i = 0, n = 0, rv = 0, events = 0;
+	struct pollfd fds[TEST_ASYNC_FDS_MAX];
+
+	while ((loop->done == 0) && (n++ < 1000)) {
+		memcpy(fds, loop->fds, sizeof(fds));
+		rv = poll(fds, loop->n,
+			  (loop->timeout_ms < 0) ? 100 : loop->timeout_ms);
+		if (rv == 0) {
+			oauth2_http_async_action(
+			    _log, async, OAUTH2_HTTP_ASYNC_TIMEOUT, 0);
+			continue;
+		}
+		for (i = 0; (rv > 0) && (i < loop->n); i++) {
+			if (fds[i].revents == 0)
+				continue;
+			events = 0;
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+				events |= OAUTH2_HTTP_ASYNC_POLL_IN;
+			if (fds[i].revents & POLLOUT)
+				events |= OAUTH2_HTTP_ASYNC_POLL_OUT;
+			oauth2_http_async_action(_log, async, fds[i].fd,
+						 events);
+		}
+	}
+}
+
+START_TEST(test_http_call_async)
+{
+	bool rc;
+	char *url = NULL;
+	oauth2_http_async_t *async = NULL;
+	test_async_loop_t loop;
+
+	memset(&loop, 0, sizeof(loop));
+	loop.timeout_ms = -1;
+
+	async = oauth2_http_async_init(_log, NULL, NULL, NULL);
+	ck_assert_ptr_eq(async, NULL);
+
+	async = oauth2_http_async_init(_log, test_async_socket_cb,
+				       test_async_timer_cb, &loop);
+	ck_assert_ptr_ne(async, NULL);
+
+	url = oauth2_stradd(NULL, oauth2_check_http_base_url(), get_json_path,
+			    NULL);
+	rc = oauth2_http_call_async(_log, async, url, NULL, NULL,
+				    test_async_done_cb, &loop);
+	ck_assert_int_eq(rc, true);
+
+	test_async_run(async, &loop);
+
+	ck_assert_int_eq(loop.done, 1);
+	ck_assert_int_eq(loop.rc, true);
+	ck_assert_uint_eq(loop.status_code, 200);
+	ck_assert_str_eq(loop.response, get_json);
+	oauth2_mem_free(loop.response);
+
+	// pending calls complete with an error when the engine goes away
+	memset(&loop, 0, sizeof(loop));
+	rc = oauth2_http_call_async(_log, async, url, NULL, NULL,
+				    test_async_done_cb, &loop);
+	ck_assert_int_eq(rc, true);
+	oauth2_http_async_free(_log, async);
+	ck_assert_int_eq(loop.done, 1);
+	ck_assert_int_eq(loop.rc, false);
+	ck_assert_ptr_eq(loop.response, NULL);
+
+	oauth2_mem_free(url);
+}
+END_TEST
+
+START_TEST(test_http_get_http2)
+{
+	bool rc;
+	char *response = NULL, *url = NULL;
+	oauth2_http_call_ctx_t *ctx = oauth2_http_call_ctx_init(_log);
+
+	url = oauth2_stradd(NULL, oauth2_check_http_base_url(), get_json_path,
+			    NULL);
+
+	// h2 is negotiated over TLS only so plain http falls back to 1.1
+	rc = oauth2_http_call_ctx_http2_set(_log, ctx, true);
+	ck_assert_int_eq(rc, true);
+	rc = oauth2_http_get(_log, url, NULL, ctx, &response, NULL);
+	ck_assert_int_eq(rc, true);
+	ck_assert_str_eq(response, get_json);
+	oauth2_mem_free(response);
+
+	oauth2_http_call_ctx_free(_log, ctx);
+	oauth2_mem_free(url);
+}
+END_TEST
+
+START_TEST(test_http_get_large)
+{
+	bool rc;
+	char *response = NULL, *url = NULL;
+
+	url = oauth2_stradd(NULL, oauth2_check_http_base_url(), get_large_path,
+			    NULL);
+
+	// received in several chunks into a single growing buffer
+	rc = oauth2_http_get(_log, url, NULL, NULL, &response, NULL);
+	ck_assert_int_eq(rc, true);
+	ck_assert_int_eq(strlen(response), TEST_HTTP_LARGE_SIZE);
+	ck_assert_int_eq(response[TEST_HTTP_LARGE_SIZE - 1], 'x');
+	oauth2_mem_free(response);
+
+	oauth2_mem_free(url);
+}
+END_TEST
+
+START_TEST(test_http_circuit_breaker)
+{
+	bool rc;
+	int i = 0;
+	char *response = NULL;
+	oauth2_http_status_code_t status_code = 0;
+	const char *url = "http://127.0.0.1:1/unreachable";
+
+	for (i = 0; i < 10; i++) {
+		status_code = 0;
+		rc = oauth2_http_get(_log, url, NULL, NULL, &response,
+				     &status_code);
+		ck_assert_int_eq(rc, false);
+		ck_assert_uint_ne(status_code, 503);
+	}
+
+	// the endpoint is now considered down so calls fail fast
+	rc = oauth2_http_get(_log, url, NULL, NULL, &response, &status_code);
+	ck_assert_int_eq(rc, false);
+	ck_assert_uint_eq(status_code, 503);
+}
+END_TEST
+
+START_TEST(test_http_circuit_breaker_transitions)
+{
+	const char *key = "http://127.0.0.1/breaker";
+	oauth2_time_t now = oauth2_time_now_sec(), hedge_delay_ms = 0;
+	int i = 0;
+
+	for (i = 0; i < 10; i++) {
+		ck_assert_int_eq(_oauth2_http_health_admit(_log, key, now, 15,
+							   &hedge_delay_ms),
+				 true);
+		_oauth2_http_health_update(_log, key, now, false, 5);
+	}
+
+	// open
+	ck_assert_int_eq(_oauth2_http_health_admit(_log, key, now + 29, 15,
+						   &hedge_delay_ms),
+			 false);
+
+	// half-open: a single probe is let through
+	ck_assert_int_eq(
+	    _oauth2_http_health_admit(_log, key, now + 30, 15, &hedge_delay_ms),
+	    true);
+	ck_assert_int_eq(
+	    _oauth2_http_health_admit(_log, key, now + 30, 15, &hedge_delay_ms),
+	    false);
+
+	// a failed probe opens the breaker again
+	_oauth2_http_health_update(_log, key, now + 31, false, 5);
+	ck_assert_int_eq(
+	    _oauth2_http_health_admit(_log, key, now + 45, 15, &hedge_delay_ms),
+	    false);
+
+	// a probe that does not complete in time is replaced by another one
+	ck_assert_int_eq(
+	    _oauth2_http_health_admit(_log, key, now + 61, 15, &hedge_delay_ms),
+	    true);
+	ck_assert_int_eq(
+	    _oauth2_http_health_admit(_log, key, now + 70, 15, &hedge_delay_ms),
+	    false);
+	ck_assert_int_eq(
+	    _oauth2_http_health_admit(_log, key, now + 76, 15, &hedge_delay_ms),
+	    true);
+
+	// a successful probe closes it
+	_oauth2_http_health_update(_log, key, now + 77, true, 5);
+	for (i = 0; i < 9; i++) {
+		ck_assert_int_eq(_oauth2_http_health_admit(_log, key, now + 77,
+							   15, &hedge_delay_ms),
+				 true);
+		_oauth2_http_health_update(_log, key, now + 77, false, 5);
+	}
+	ck_assert_int_eq(
+	    _oauth2_http_health_admit(_log, key, now + 77, 15, &hedge_delay_ms),
+	    true);
+}
+END_TEST
+
+START_TEST(test_http_circuit_breaker_shared)
+{
+	const char *key = "http://127.0.0.1/shared";
+	oauth2_time_t now = oauth2_time_now_sec(), hedge_delay_ms = 0;
+	int i = 0, status = 0;
+	pid_t pid;
+
+	// a worker that sees the endpoint fail opens the breaker for all
+	pid = fork();
+	ck_assert_int_ne(pid, -1);
+	if (pid == 0) {
+		for (i = 0; i < 10; i++)
+			_oauth2_http_health_update(_log, key, now, false, 5);
+		_exit(0);
+	}
+	ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+	ck_assert_int_eq(WEXITSTATUS(status), 0);
+
+	ck_assert_int_eq(
+	    _oauth2_http_health_admit(_log, key, now + 1, 15, &hedge_delay_ms),
+	    false);
+}
+END_TEST
+
+START_TEST(test_http_get_json)
+{
+	bool rc;
+	char *url = NULL;
+	json_t *json = NULL;
+	oauth2_uint_t status_code = 0;
+
+	url = oauth2_stradd(NULL, oauth2_check_http_base_url(), get_json_path,
+			    NULL);
+	rc = oauth2_http_get_json(_log, url, NULL, NULL, NULL, NULL);
+	ck_assert_int_eq(rc, false);
+
+	rc = oauth2_http_get_json(_log, url, NULL, NULL, &json, &status_code);
+	ck_assert_int_eq(rc, true);
+	ck_assert_uint_eq(status_code, 200);
+	ck_assert_ptr_ne(json, NULL);
+	ck_assert_str_eq(json_string_value(json_object_get(json, "my")),
+			 "json");
+	json_decref(json);
+
+	oauth2_mem_free(url);
+}
+END_TEST
+
 START_TEST(test_http_post_form)
 {
 	bool rc;
@@ -702,6 +1086,53 @@ START_TEST(test_cookies)
 }
 END_TEST
 
+START_TEST(test_cookies_ref)
+{
+	oauth2_http_request_t *r = NULL;
+	char *rv = NULL;
+	const char *cookie = " a=x%20y ; b==c;; d ";
+
+	// a borrowed header is scanned in place and left alone on reads
+	r = oauth2_http_request_init(_log);
+	oauth2_http_request_header_add_ref(_log, r, "Cookie", cookie);
+	ck_assert_ptr_eq(oauth2_http_request_header_cookie_get(_log, r),
+			 cookie);
+
+	rv = oauth2_http_request_cookie_get(_log, r, "b", false);
+	ck_assert_str_eq(rv, "c");
+	oauth2_mem_free(rv);
+	rv = oauth2_http_request_cookie_get(_log, r, "d", false);
+	ck_assert_str_eq(rv, "");
+	oauth2_mem_free(rv);
+	rv = oauth2_http_request_cookie_get(_log, r, "c", false);
+	ck_assert_ptr_eq(rv, NULL);
+
+	// stripping copies the header and keeps the other cookies verbatim
+	rv = oauth2_http_request_cookie_get(_log, r, "b", true);
+	ck_assert_str_eq(rv, "c");
+	oauth2_mem_free(rv);
+	ck_assert_str_eq(oauth2_http_request_header_cookie_get(_log, r),
+			 "a=x%20y; d");
+	ck_assert_str_eq(cookie, " a=x%20y ; b==c;; d ");
+
+	rv = oauth2_http_request_cookie_get(_log, r, "a", true);
+	ck_assert_str_eq(rv, "x%20y");
+	oauth2_mem_free(rv);
+	rv = oauth2_http_request_cookie_get(_log, r, "d", true);
+	oauth2_mem_free(rv);
+
+	// no cookies left: no Cookie header
+	ck_assert_ptr_eq(oauth2_http_request_header_cookie_get(_log, r), NULL);
+
+	// values that need sanitizing are copied
+	oauth2_http_request_header_add_ref(_log, r, "X-Test", "a\nb");
+	ck_assert_str_eq(oauth2_http_request_header_get(_log, r, "X-Test"),
+			 "a b");
+
+	oauth2_http_request_free(_log, r);
+}
+END_TEST
+
 START_TEST(test_auth)
 {
 	bool rc = false;
@@ -775,8 +1206,17 @@ Suite *oauth2_check_http_suite()
 	tcase_add_test(c, test_query_encode);
 	tcase_add_test(c, test_form_encode);
 	tcase_add_test(c, test_http_get);
+	tcase_add_test(c, test_http_get_reuse);
+	tcase_add_test(c, test_http_get_http2);
+	tcase_add_test(c, test_http_get_large);
+	tcase_add_test(c, test_http_circuit_breaker);
+	tcase_add_test(c, test_http_circuit_breaker_transitions);
+	tcase_add_test(c, test_http_circuit_breaker_shared);
+	tcase_add_test(c, test_http_get_json);
+	tcase_add_test(c, test_http_call_async);
 	tcase_add_test(c, test_http_post_form);
 	tcase_add_test(c, test_cookies);
+	tcase_add_test(c, test_cookies_ref);
 	tcase_add_test(c, test_auth);
 	tcase_add_test(c, test_xml_http_request);
 
@@ -19,11 +19,13 @@
  *
  **************************************************************************/
 
+#include "oauth2/cache.h"
 #include "oauth2/jose.h"
 #include "oauth2/mem.h"
 #include "oauth2/util.h"
 #include <check.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "check_liboauth2.h"
 #include "jose_int.h"
@@ -372,6 +374,51 @@ START_TEST(test_jwks_resolve_uri)
 }
 END_TEST
 
+START_TEST(test_jwks_uri_refresh)
+{
+	oauth2_cfg_token_verify_t *verify = NULL;
+	oauth2_uri_ctx_t *uri_ctx = NULL;
+	const char *rv = NULL;
+	char *url = NULL, *value = NULL;
+	int i = 0;
+
+	url = oauth2_stradd(NULL, oauth2_check_http_base_url(), jwks_uri_path,
+			    NULL);
+	rv = oauth2_cfg_token_verify_add_options(
+	    _log, &verify, "jwks_uri", url,
+	    "ssl_verify=false&jwks_uri.refresh=true");
+	ck_assert_ptr_eq(rv, NULL);
+
+	uri_ctx = ((oauth2_jose_jwt_verify_ctx_t *)verify->ctx->ptr)
+		      ->jwks_provider->jwks_uri;
+	ck_assert_int_eq(uri_ctx->refresh, true);
+	ck_assert_int_eq(
+	    oauth2_cache_set(_log, uri_ctx->cache, url, "stale", 60), true);
+
+	ck_assert_int_eq(oauth2_jose_uri_refresh_start(_log), true);
+
+	// the refresher publishes the reduced JWKS into the cache
+	for (i = 0; i < 50; i++) {
+		oauth2_cache_get(_log, uri_ctx->cache, url, &value);
+		if ((value) && (strcmp(value, "stale") != 0))
+			break;
+		if (value)
+			oauth2_mem_free(value);
+		value = NULL;
+		usleep(100 * 1000);
+	}
+
+	oauth2_jose_uri_refresh_stop(_log);
+
+	ck_assert_ptr_ne(value, NULL);
+	ck_assert_ptr_ne(strstr(value, "\"kid\":\"k1\""), NULL);
+
+	oauth2_mem_free(value);
+	oauth2_mem_free(url);
+	oauth2_cfg_token_verify_free(_log, verify);
+}
+END_TEST
+
 START_TEST(test_jwk_resolve_plain)
 {
 	oauth2_cfg_token_verify_t *verify = NULL;
@@ -408,6 +455,7 @@ Suite *oauth2_check_jose_suite()
 	tcase_add_test(c, test_jwt_encrypt);
 	tcase_add_test(c, test_jwt_decrypt);
 	tcase_add_test(c, test_jwks_resolve_uri);
+	tcase_add_test(c, test_jwks_uri_refresh);
 	tcase_add_test(c, test_jwk_resolve_plain);
 
 	suite_add_tcase(s, c);
@@ -61,6 +61,107 @@ check_log_test_sink_callback(oauth2_log_sink_t *sink, const char *filename,
 	check_log_test_sink_callback_dummy = 1;
 }
 
+static int check_log_test_sink_callback_count = 0;
+
+static void check_log_test_sink_callback_count_inc(
+    oauth2_log_sink_t *sink, const char *filename, unsigned long line,
+    const char *function, oauth2_log_level_t level, const char *msg)
+{
+	check_log_test_sink_callback_count++;
+}
+
+static int check_log_test_evaluated = 0;
+
+static const char *check_log_test_evaluate()
+{
+	check_log_test_evaluated++;
+	return "evaluated";
+}
+
+START_TEST(test_level_enabled)
+{
+	oauth2_log_sink_t *sink = oauth2_log_sink_create(
+	    OAUTH2_LOG_WARN, check_log_test_sink_callback_count_inc, NULL);
+	oauth2_log_t *log = oauth2_log_init(OAUTH2_LOG_ERROR, sink);
+
+	ck_assert_int_eq(oauth2_log_level_enabled(NULL, OAUTH2_LOG_ERROR),
+			 false);
+	ck_assert_int_eq(oauth2_log_level_enabled(log, OAUTH2_LOG_ERROR), true);
+	ck_assert_int_eq(oauth2_log_level_enabled(log, OAUTH2_LOG_DEBUG),
+			 false);
+
+	// disabled levels do not evaluate their arguments
+	check_log_test_evaluated = 0;
+	check_log_test_sink_callback_count = 0;
+	oauth2_debug(log, "%s", check_log_test_evaluate());
+	ck_assert_int_eq(check_log_test_evaluated, 0);
+	ck_assert_int_eq(check_log_test_sink_callback_count, 0);
+
+	// a level change on the sink is picked up by the log
+	oauth2_log_sink_level_set(sink, OAUTH2_LOG_DEBUG);
+	ck_assert_int_eq(oauth2_log_level_enabled(log, OAUTH2_LOG_DEBUG), true);
+	oauth2_debug(log, "%s", check_log_test_evaluate());
+	ck_assert_int_eq(check_log_test_evaluated, 1);
+	ck_assert_int_eq(check_log_test_sink_callback_count, 1);
+
+	oauth2_log_free(log);
+}
+END_TEST
+
+static int check_log_test_async_gate = 0;
+
+static void check_log_test_sink_callback_gated(
+    oauth2_log_sink_t *sink, const char *filename, unsigned long line,
+    const char *function, oauth2_log_level_t level, const char *msg)
+{
+	while (__atomic_load_n(&check_log_test_async_gate, __ATOMIC_ACQUIRE))
+		;
+	__atomic_add_fetch(&check_log_test_sink_callback_count, 1,
+			   __ATOMIC_RELAXED);
+}
+
+START_TEST(test_sink_async)
+{
+	oauth2_log_sink_t *target = NULL, *sink = NULL;
+	oauth2_log_t *log = NULL;
+	unsigned long dropped = 0;
+	int i = 0;
+
+	// blocking: every record arrives, also when the ring is tiny
+	check_log_test_sink_callback_count = 0;
+	target = oauth2_log_sink_create(
+	    OAUTH2_LOG_DEBUG, check_log_test_sink_callback_gated, NULL);
+	sink = oauth2_log_sink_async_create(target, 4,
+					    OAUTH2_LOG_ASYNC_OVERFLOW_BLOCK);
+	ck_assert_ptr_ne(sink, NULL);
+	log = oauth2_log_init(OAUTH2_LOG_DEBUG, sink);
+	for (i = 0; i < 100; i++)
+		oauth2_debug(log, "record %d", i);
+	// freeing the log drains the ring before returning
+	oauth2_log_free(log);
+	ck_assert_int_eq(check_log_test_sink_callback_count, 100);
+
+	// dropping: with the writer stalled only the ring fits
+	check_log_test_sink_callback_count = 0;
+	check_log_test_async_gate = 1;
+	target = oauth2_log_sink_create(
+	    OAUTH2_LOG_DEBUG, check_log_test_sink_callback_gated, NULL);
+	sink = oauth2_log_sink_async_create(target, 2,
+					    OAUTH2_LOG_ASYNC_OVERFLOW_DROP);
+	ck_assert_ptr_ne(sink, NULL);
+	log = oauth2_log_init(OAUTH2_LOG_DEBUG, sink);
+	for (i = 0; i < 10; i++)
+		oauth2_debug(log, "record %d", i);
+	dropped = oauth2_log_sink_async_dropped_get(sink);
+	ck_assert_uint_ge(dropped, 7);
+	__atomic_store_n(&check_log_test_async_gate, 0, __ATOMIC_RELEASE);
+	oauth2_log_free(log);
+	ck_assert_uint_eq(check_log_test_sink_callback_count + dropped, 10);
+
+	ck_assert_uint_eq(oauth2_log_sink_async_dropped_get(NULL), 0);
+}
+END_TEST
+
 START_TEST(test_sink)
 {
 	char *dummy = "dummy";
@@ -88,6 +189,8 @@ Suite *oauth2_check_log_suite()
 
 	tcase_add_test(c, test_log);
 	tcase_add_test(c, test_sink);
+	tcase_add_test(c, test_level_enabled);
+	tcase_add_test(c, test_sink_async);
 
 	suite_add_tcase(s, c);
 
@@ -20,8 +20,10 @@
  **************************************************************************/
 
 #include "oauth2/mem.h"
+#include "oauth2/util.h"
 #include <check.h>
 #include <curl/curl.h>
+#include <pthread.h>
 #include <stdlib.h>
 
 static oauth2_mem_alloc_fn_t _save_alloc = NULL;
@@ -146,6 +148,10 @@ START_TEST(test_mem)
 	ptr = oauth2_mem_get_realloc()(ptr, 8);
 	oauth2_mem_free(ptr);
 
+	ptr = oauth2_mem_alloc_uninit(8);
+	ck_assert_ptr_ne(ptr, NULL);
+	oauth2_mem_free(ptr);
+
 	test_mem_functions_reset();
 
 	ck_assert(NULL != oauth2_mem_get_alloc());
@@ -170,6 +176,154 @@ START_TEST(test_mem)
 }
 END_TEST
 
+START_TEST(test_mem_arena)
+{
+	oauth2_mem_arena_t *arena = NULL;
+	char *small = NULL, *large = NULL, *heap = NULL, *after = NULL;
+	size_t used = 0;
+	bool suspended = false;
+
+	arena = oauth2_mem_arena_create(256);
+	ck_assert_ptr_ne(arena, NULL);
+	ck_assert_uint_eq(oauth2_mem_arena_used(arena), 0);
+
+	oauth2_mem_arena_enter(arena);
+
+	small = oauth2_mem_alloc(10);
+	ck_assert_ptr_ne(small, NULL);
+	ck_assert_int_eq(small[9], 0);
+	used = oauth2_mem_arena_used(arena);
+	ck_assert_uint_ge(used, 10);
+
+	// larger than a quarter chunk: a chunk of its own
+	large = oauth2_mem_alloc(1000);
+	ck_assert_ptr_ne(large, NULL);
+	ck_assert_int_eq(large[999], 0);
+	ck_assert_uint_ge(oauth2_mem_arena_used(arena), used + 1000);
+
+	used = oauth2_mem_arena_used(arena);
+	ck_assert_ptr_ne(oauth2_mem_alloc_uninit(16), NULL);
+	ck_assert_uint_eq(oauth2_mem_arena_used(arena), used + 16);
+
+	// freeing arena memory is a no-op
+	oauth2_mem_free(small);
+	oauth2_mem_free(large);
+
+	// allocations that outlive the request bypass the arena
+	suspended = oauth2_mem_arena_suspend();
+	used = oauth2_mem_arena_used(arena);
+	heap = oauth2_strdup("persistent");
+	ck_assert_uint_eq(oauth2_mem_arena_used(arena), used);
+	oauth2_mem_arena_resume(suspended);
+
+	oauth2_mem_arena_leave(arena);
+
+	after = oauth2_mem_alloc(8);
+	ck_assert_uint_eq(oauth2_mem_arena_used(arena), used);
+	// arena memory is recognized again when the arena is re-entered
+	oauth2_mem_arena_enter(arena);
+	oauth2_mem_free(small);
+	oauth2_mem_free(after);
+	after = NULL;
+	oauth2_mem_arena_leave(arena);
+
+	oauth2_mem_arena_free(arena);
+
+	ck_assert_str_eq(heap, "persistent");
+	oauth2_mem_free(heap);
+}
+END_TEST
+
+typedef struct test_mem_arena_thread_ctx_t {
+	oauth2_mem_arena_t *arena;
+	char *ptr;
+	char *heap;
+} test_mem_arena_thread_ctx_t;
+
+static void *test_mem_arena_thread(void *arg)
+{
+	test_mem_arena_thread_ctx_t *ctx = (test_mem_arena_thread_ctx_t *)arg;
+
+	// the arena is not bound to the thread that created it
+	oauth2_mem_arena_enter(ctx->arena);
+	oauth2_mem_free(ctx->ptr);
+	ctx->ptr = oauth2_mem_alloc(32);
+	oauth2_mem_free(ctx->ptr);
+	oauth2_mem_arena_leave(ctx->arena);
+	oauth2_mem_arena_free(ctx->arena);
+
+	// and allocates from the heap
+	ctx->heap = oauth2_mem_alloc(8);
+
+	return NULL;
+}
+
+START_TEST(test_mem_arena_thread_free)
+{
+	test_mem_arena_thread_ctx_t ctx;
+	pthread_t thread;
+	char *heap = NULL;
+
+	ctx.arena = oauth2_mem_arena_create(0);
+	ctx.heap = NULL;
+
+	oauth2_mem_arena_enter(ctx.arena);
+	ctx.ptr = oauth2_mem_alloc(32);
+	ck_assert_uint_ge(oauth2_mem_arena_used(ctx.arena), 32);
+	oauth2_mem_arena_leave(ctx.arena);
+
+	// e.g. a request pool that is destroyed on another worker thread
+	ck_assert_int_eq(
+	    pthread_create(&thread, NULL, test_mem_arena_thread, &ctx), 0);
+	ck_assert_int_eq(pthread_join(thread, NULL), 0);
+
+	ck_assert_ptr_ne(ctx.heap, NULL);
+	oauth2_mem_free(ctx.heap);
+
+	// nothing is left behind on the thread that entered the arena
+	heap = oauth2_mem_alloc(8);
+	ck_assert_ptr_ne(heap, NULL);
+	oauth2_mem_free(heap);
+}
+END_TEST
+
+START_TEST(test_mem_arena_nested)
+{
+	oauth2_mem_arena_t *main = NULL, *sub = NULL;
+	char *ptr = NULL;
+	size_t used = 0;
+
+	main = oauth2_mem_arena_create(0);
+	sub = oauth2_mem_arena_create(0);
+
+	oauth2_mem_arena_enter(main);
+	oauth2_mem_arena_enter(main);
+	oauth2_mem_arena_enter(sub);
+	used = oauth2_mem_arena_used(main);
+	ptr = oauth2_mem_alloc(8);
+	ck_assert_uint_eq(oauth2_mem_arena_used(main), used);
+	ck_assert_uint_ge(oauth2_mem_arena_used(sub), 8);
+	oauth2_mem_arena_leave(sub);
+
+	// back to the main request
+	ptr = oauth2_mem_alloc(8);
+	ck_assert_uint_ge(oauth2_mem_arena_used(main), used + 8);
+	oauth2_mem_arena_leave(main);
+	used = oauth2_mem_arena_used(main);
+	ptr = oauth2_mem_alloc(8);
+	ck_assert_uint_ge(oauth2_mem_arena_used(main), used + 8);
+	oauth2_mem_arena_leave(main);
+
+	used = oauth2_mem_arena_used(main);
+	ptr = oauth2_mem_alloc(8);
+	ck_assert_uint_eq(oauth2_mem_arena_used(main), used);
+	oauth2_mem_free(ptr);
+
+	oauth2_mem_arena_free(sub);
+	oauth2_mem_arena_free(main);
+}
+END_TEST
+
 Suite *oauth2_check_mem_suite()
 {
 	Suite *s = suite_create("mem");
@@ -178,6 +332,9 @@ Suite *oauth2_check_mem_suite()
 	tcase_add_checked_fixture(c, setup, teardown);
 
 	tcase_add_test(c, test_mem);
+	tcase_add_test(c, test_mem_arena);
+	tcase_add_test(c, test_mem_arena_thread_free);
+	tcase_add_test(c, test_mem_arena_nested);
 
 	suite_add_tcase(s, c);
 
@@ -20,11 +20,16 @@
  **************************************************************************/
 
 #include "check_liboauth2.h"
+#include "jose_int.h"
+#include "oauth2/cache.h"
+#include "oauth2/jose.h"
 #include "oauth2/mem.h"
 #include "oauth2/oauth2.h"
 #include "oauth2_int.h"
 #include <check.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 static oauth2_log_t *_log = 0;
 
@@ -338,6 +343,85 @@ START_TEST(test_oauth2_auth_private_key_jwt)
 }
 END_TEST
 
+START_TEST(test_oauth2_auth_jwt_pool)
+{
+	bool rc = false;
+	oauth2_http_call_ctx_t *ctx = NULL;
+	oauth2_cfg_endpoint_auth_t *auth = NULL;
+	oauth2_nv_list_t *params = NULL;
+	oauth2_nv_list_t *post = NULL;
+	char *rv = NULL;
+	char *jwt = NULL;
+	const char *str = NULL;
+	oauth2_cfg_endpoint_auth_jwt_pool_t *pool = NULL;
+	int i = 0;
+
+	ctx = oauth2_http_call_ctx_init(_log);
+	params = oauth2_nv_list_init(_log);
+	oauth2_nv_list_add(_log, params, "client_id", "myclient");
+	oauth2_nv_list_add(_log, params, "client_secret", "mysecret");
+	oauth2_nv_list_add(_log, params, "aud", "myaud");
+	oauth2_nv_list_add(_log, params, "assertion_pool_size", "2");
+
+	auth = oauth2_cfg_endpoint_auth_init(_log);
+	rv = oauth2_cfg_endpoint_auth_add_options(_log, auth,
+						  "client_secret_jwt", params);
+	ck_assert_ptr_eq(rv, NULL);
+	pool = auth->client_secret_jwt.pool;
+
+	// an empty pool signs inline and is topped up in the background
+	post = oauth2_nv_list_init(_log);
+	rc = oauth2_http_ctx_auth_add(_log, ctx, auth, post);
+	ck_assert_int_eq(rc, true);
+	ck_assert_ptr_ne(oauth2_nv_list_get(_log, post, "client_assertion"),
+			 NULL);
+	oauth2_nv_list_free(_log, post);
+	for (i = 0; i < 500; i++) {
+		if (__atomic_load_n(&pool->len, __ATOMIC_ACQUIRE) == 2)
+			break;
+		usleep(10000);
+	}
+	ck_assert_uint_eq(__atomic_load_n(&pool->len, __ATOMIC_ACQUIRE), 2);
+
+	// every assertion must be unique, also across pool refills
+	for (i = 0; i < 5; i++) {
+		post = oauth2_nv_list_init(_log);
+		rc = oauth2_http_ctx_auth_add(_log, ctx, auth, post);
+		ck_assert_int_eq(rc, true);
+		str = oauth2_nv_list_get(_log, post, "client_assertion");
+		ck_assert_ptr_ne(str, NULL);
+		if (jwt) {
+			ck_assert_str_ne(str, jwt);
+			oauth2_mem_free(jwt);
+		}
+		jwt = oauth2_strdup(str);
+		oauth2_nv_list_free(_log, post);
+	}
+	oauth2_mem_free(jwt);
+
+	test_oauth_auth_clone(auth);
+
+	oauth2_cfg_endpoint_auth_free(_log, auth);
+
+	// a pool size of 0 signs an assertion on every call
+	oauth2_nv_list_set(_log, params, "assertion_pool_size", "0");
+	auth = oauth2_cfg_endpoint_auth_init(_log);
+	rv = oauth2_cfg_endpoint_auth_add_options(_log, auth,
+						  "client_secret_jwt", params);
+	ck_assert_ptr_eq(rv, NULL);
+	post = oauth2_nv_list_init(_log);
+	rc = oauth2_http_ctx_auth_add(_log, ctx, auth, post);
+	ck_assert_int_eq(rc, true);
+	str = oauth2_nv_list_get(_log, post, "client_assertion");
+	ck_assert_ptr_ne(str, NULL);
+	oauth2_nv_list_free(_log, post);
+
+	oauth2_cfg_endpoint_auth_free(_log, auth);
+	oauth2_nv_list_free(_log, params);
+	oauth2_http_call_ctx_free(_log, ctx);
+}
+END_TEST
+
 START_TEST(test_oauth2_auth_client_cert)
 {
 	bool rc = false;
@@ -481,6 +565,8 @@ static char *get_jwks_uri_json =
     "NaasTSX4JpNf+xakm7yePtuWyAY/"
     "fQ7ETSPMJdVEaL\"],\"x5t\":\"31YdH_bv2Hlg89wmwBphxJZaK64\"}]}";
 static char *get_jwks_uri_path = "/jwks_uri";
+// number of JWKS documents served, shared with the forked HTTP server
+static int *get_jwks_uri_count = NULL;
 
 static char *get_eckey_pem =
     "-----BEGIN PUBLIC "
@@ -489,15 +575,23 @@ static char *get_eckey_pem =
     "Qdj1Ev2363\n47i7PxTx8Tr87RYHXIIXLRmH1aIz0OVLt4eM9iXDlDGB6ldBFsM8P61nqQ=="
     "\n-----END PUBLIC KEY-----";
 static char *get_eckey_url_path = "/ec_key";
+// number of EC key PEMs served, shared with the forked HTTP server
+static int *get_eckey_url_count = NULL;
 
 static char *introspection_result_json = "{ \"active\": true }";
 
 static char *post_introspection_path = "/introspection";
+// number of introspection calls served, shared with the forked HTTP server
+static int *post_introspection_count = NULL;
 const char *valid_access_token = "my_valid_token";
+const char *expiring_access_token = "my_expiring_token";
 
 static char *metadata_path = "/.well-known/oauth2-configuration";
 
 static char metadata[512];
+// the version of the metadata document served, shared with the forked HTTP
+// server; version 2 no longer lists the introspection endpoint
+static int *metadata_version = NULL;
 
 static char *get_metadata_json()
 {
@@ -505,9 +599,19 @@ static char *get_metadata_json()
 			      "\"jwks_uri\": \"%s%s\","
 			      "\"introspection_endpoint\": \"%s%s\""
 			      "}";
-	oauth2_snprintf(metadata, sizeof(metadata), format,
-			oauth2_check_http_base_url(), get_jwks_uri_path,
-			oauth2_check_http_base_url(), post_introspection_path);
+	static char *format_v2 = "{"
+				 "\"jwks_uri\": \"%s%s\""
+				 "}";
+	if ((metadata_version) &&
+	    (__atomic_load_n(metadata_version, __ATOMIC_SEQ_CST) == 2))
+		oauth2_snprintf(metadata, sizeof(metadata), format_v2,
+				oauth2_check_http_base_url(),
+				get_jwks_uri_path);
+	else
+		oauth2_snprintf(metadata, sizeof(metadata), format,
+				oauth2_check_http_base_url(), get_jwks_uri_path,
+				oauth2_check_http_base_url(),
+				post_introspection_path);
 	return metadata;
 }
 
@@ -517,11 +621,17 @@ static char *oauth2_check_oauth2_serve_get(const char *request)
 
 	if (strncmp(request, get_jwks_uri_path, strlen(get_jwks_uri_path)) ==
 	    0) {
+		if (get_jwks_uri_count)
+			__atomic_add_fetch(get_jwks_uri_count, 1,
+					   __ATOMIC_SEQ_CST);
 		rv = oauth2_strdup(get_jwks_uri_json);
 		goto end;
 	}
 	if (strncmp(request, get_eckey_url_path, strlen(get_eckey_url_path)) ==
 	    0) {
+		if (get_eckey_url_count)
+			__atomic_add_fetch(get_eckey_url_count, 1,
+					   __ATOMIC_SEQ_CST);
 		rv = oauth2_strdup(get_eckey_pem);
 		goto end;
 	}
@@ -547,6 +657,9 @@ static char *oauth2_check_oauth2_serve_post(const char *request)
 
 	if (strncmp(request, post_introspection_path,
 		    strlen(post_introspection_path)) == 0) {
+		if (post_introspection_count)
+			__atomic_add_fetch(post_introspection_count, 1,
+					   __ATOMIC_SEQ_CST);
 		request += strlen(post_introspection_path) + 5;
 		data = strstr(request, sep);
 		if (data == NULL)
@@ -560,6 +673,8 @@ static char *oauth2_check_oauth2_serve_post(const char *request)
 			goto error;
 		if ((token) && (strcmp(token, valid_access_token) == 0))
 			rv = oauth2_strdup(introspection_result_json);
+		else if ((token) && (strcmp(token, expiring_access_token) == 0))
+			rv = oauth2_strdup("{ \"active\": true, \"exp\": 1 }");
 		else
 			rv = oauth2_strdup("{ \"active\": false }");
 		oauth2_nv_list_free(_log, params);
@@ -632,8 +747,14 @@ START_TEST(test_oauth2_verify_eckey_uri)
 	    "AlH8PGya9avWoGVkWOFWbMNiLdpSDQZqP-"
 	    "OuGfIXHw1CZWjxfJInXYiRsKRZlvlXJA5fguaeNKZ1Q_RyDjNqRg==";
 	json_t *json_payload = NULL;
+	char *s_payload = NULL;
 	const char *rv = NULL;
 	char *url = NULL;
+	oauth2_uri_ctx_t *uri_ctx = NULL;
+	int count = 0;
+
+	ck_assert_ptr_ne(get_eckey_url_count, NULL);
+	count = __atomic_load_n(get_eckey_url_count, __ATOMIC_SEQ_CST);
 
 	url = oauth2_stradd(NULL, oauth2_check_http_base_url(),
 			    get_eckey_url_path, NULL);
@@ -643,6 +764,24 @@ START_TEST(test_oauth2_verify_eckey_uri)
 
 	rc = oauth2_token_verify(_log, verify, jwt, &json_payload);
 	ck_assert_int_eq(rc, true);
+	json_decref(json_payload);
+	json_payload = NULL;
+	ck_assert_int_eq(
+	    __atomic_load_n(get_eckey_url_count, __ATOMIC_SEQ_CST), count + 1);
+
+	// spoil the cached PEM: only the in-process EC key cache can answer
+	uri_ctx = ((oauth2_jose_jwt_verify_ctx_t *)verify->ctx->ptr)
+		      ->jwks_provider->jwks_uri;
+	ck_assert_int_eq(
+	    oauth2_cache_set(_log, uri_ctx->cache, url, "problem", 60), true);
+
+	// bypass the token cache so the EC key comes from the in-process cache
+	rc = oauth2_jose_jwt_verify(_log, verify->ctx->ptr, jwt, &json_payload,
+				    &s_payload);
+	ck_assert_int_eq(rc, true);
+	oauth2_mem_free(s_payload);
+	ck_assert_int_eq(
+	    __atomic_load_n(get_eckey_url_count, __ATOMIC_SEQ_CST), count + 1);
 
 	oauth2_cfg_token_verify_free(_log, verify);
 	oauth2_mem_free(url);
@@ -657,6 +796,10 @@ START_TEST(test_oauth2_verify_token_introspection)
 	json_t *json_payload = NULL;
 	const char *rv = NULL;
 	char *url = NULL;
+	int count = 0;
+
+	ck_assert_ptr_ne(post_introspection_count, NULL);
+	count = __atomic_load_n(post_introspection_count, __ATOMIC_SEQ_CST);
 
 	url = oauth2_stradd(NULL, oauth2_check_http_base_url(),
 			    post_introspection_path, NULL);
@@ -668,6 +811,18 @@ START_TEST(test_oauth2_verify_token_introspection)
 	rc = oauth2_token_verify(_log, verify, "bogus", &json_payload);
 	ck_assert_int_eq(rc, false);
 	json_decref(json_payload);
+	ck_assert_int_eq(
+	    __atomic_load_n(post_introspection_count, __ATOMIC_SEQ_CST),
+	    count + 1);
+
+	// get the inactive result from the cache
+	json_payload = NULL;
+	rc = oauth2_token_verify(_log, verify, "bogus", &json_payload);
+	ck_assert_int_eq(rc, false);
+	ck_assert_ptr_eq(json_payload, NULL);
+	ck_assert_int_eq(
+	    __atomic_load_n(post_introspection_count, __ATOMIC_SEQ_CST),
+	    count + 1);
 
 	rc = oauth2_token_verify(_log, verify, valid_access_token,
 				 &json_payload);
@@ -679,6 +834,23 @@ START_TEST(test_oauth2_verify_token_introspection)
 				 &json_payload);
 	ck_assert_int_eq(rc, true);
 	json_decref(json_payload);
+	ck_assert_int_eq(
+	    __atomic_load_n(post_introspection_count, __ATOMIC_SEQ_CST),
+	    count + 2);
+
+	// an "exp" in the past is not cached but does not fail introspection
+	rc = oauth2_token_verify(_log, verify, expiring_access_token,
+				 &json_payload);
+	ck_assert_int_eq(rc, true);
+	json_decref(json_payload);
+
+	rc = oauth2_token_verify(_log, verify, expiring_access_token,
+				 &json_payload);
+	ck_assert_int_eq(rc, true);
+	json_decref(json_payload);
+	ck_assert_int_eq(
+	    __atomic_load_n(post_introspection_count, __ATOMIC_SEQ_CST),
+	    count + 4);
 
 	oauth2_cfg_token_verify_free(_log, verify);
 	oauth2_mem_free(url);
@@ -707,6 +879,257 @@ START_TEST(test_oauth2_verify_token_plain)
 }
 END_TEST
 
+static bool _test_oauth2_verify_claims(const char *options)
+{
+	bool rc = false;
+	oauth2_cfg_token_verify_t *verify = NULL;
+	char *jwt =
+	    "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9."
+	    "eyJzdWIiOiJqb2UiLCJpc3MiOiJodHRwczovL29wLmV4YW1wbGUub3JnIiwiYXVkIj"
+	    "pbImFwaTEiLCJhcGkyIl0sIm5iZiI6MTU4MDAwMDAwMCwiZXhwIjo0MTAyNDQ0ODAw"
+	    "fQ.3ZjQqOPA0xLW60tSlFrD-yDDxjkQ9AHBNoBkf-11fkc";
+	json_t *json_payload = NULL;
+	const char *rv = NULL;
+
+	rv = oauth2_cfg_token_verify_add_options(_log, &verify, "plain",
+						 "mysecret", options);
+	ck_assert_ptr_eq(rv, NULL);
+
+	rc = oauth2_token_verify(_log, verify, jwt, &json_payload);
+
+	oauth2_cfg_token_verify_free(_log, verify);
+	if (json_payload)
+		json_decref(json_payload);
+
+	return rc;
+}
+
+START_TEST(test_oauth2_verify_token_claims)
+{
+	// negative results are not cached so test those first
+	ck_assert_int_eq(_test_oauth2_verify_claims("verify.aud.value=api3"),
+			 false);
+	ck_assert_int_eq(
+	    _test_oauth2_verify_claims("verify.iss.value=https%3A%2F%2Fother"),
+	    false);
+	ck_assert_int_eq(_test_oauth2_verify_claims("verify.iat=required"),
+			 false);
+	ck_assert_int_eq(
+	    _test_oauth2_verify_claims("verify.claims.required=sub,email"),
+	    false);
+
+	ck_assert_int_eq(
+	    _test_oauth2_verify_claims(
+		"verify.aud.value=api2&verify.iss.value=https%3A%2F%2Fop."
+		"example.org&verify.nbf=required&verify.exp=required&verify."
+		"claims.required=sub,iss"),
+	    true);
+}
+END_TEST
+
+// RS256 tokens for the "k1" key served on get_jwks_uri_path
+#define TEST_JWKS_JWT_HDR_K1 "eyJhbGciOiJSUzI1NiIsImtpZCI6ImsxIn0."
+#define TEST_JWKS_JWT_HDR_K2 "eyJhbGciOiJSUzI1NiIsImtpZCI6ImsyIn0."
+#define TEST_JWKS_JWT_PAYLOAD                                                  \
+	"eyJzY29wZSI6W10sImNsaWVudF9pZF9uYW1lIjoicm9fY2xpZW50IiwiYWdpZCI6Im"   \
+	"4zak1UazdXSDVVSU9FTWNEZEZPSVR5eFZ2VW1XRHVyIiwiT3JnTmFtZSI6IlBpbmcg"   \
+	"SWRlbnRpdHkgQ29ycG9yYXRpb24iLCJjbmYiOnsieDV0I1MyNTYiOiJsNnU5S1VDZ0"   \
+	"I2UHpHdklpTS0tWEYwTHF3N1ZYejdvQWtoUkhhbEZqOGkwIn0sIlVzZXJuYW1lIjoi"   \
+	"am9lIiwiZXhwIjoxNTQyMTI5NzgzfQ."
+// the signature minus its first 12 characters
+#define TEST_JWKS_JWT_SIG_TAIL                                                 \
+	"3HODBl6spAA-h6W7D-"                                                   \
+	"PoKyhDfR5DnODQqwb5zaqba2pWyJ0d6-4AQfQ6dIe0jfwQeUrPTu2DZLtk3H-"        \
+	"noCSjtXrFV_RFNfz9kqdEXwkVZAX8H_ySrYFcAx3Ac9C8bZzjRUM6c4emql-"         \
+	"I6T1fVGqO_"                                                           \
+	"bVUsWbPmPtNanq3UyqTrlDwQ6weO0ZbLH9tcDpZD4ojNCJjkHa3lvjwYzPNwlAI6a_"   \
+	"DGng-7rgrobhOiaAgBAwLhq9fvTtM2MWNmWXmUCymq3nGqG_d_t5i_"               \
+	"x7Zf28T3ejzEX-ETefpTENX7BJ57-vQbAeECRTIo_LhzKTaDkiZWpf6JgraQg"
+#define TEST_JWKS_JWT_SIG "MUghlaVxy5ij" TEST_JWKS_JWT_SIG_TAIL
+
+static oauth2_cfg_token_verify_t *_test_oauth2_verify_jwks(const char *query)
+{
+	oauth2_cfg_token_verify_t *verify = NULL;
+	char *url = NULL;
+	const char *rv = NULL;
+
+	ck_assert_ptr_ne(get_jwks_uri_count, NULL);
+
+	// a separate URL per test so that cached documents are not shared
+	url = oauth2_stradd(NULL, oauth2_check_http_base_url(),
+			    get_jwks_uri_path, query);
+	rv = oauth2_cfg_token_verify_add_options(_log, &verify, "jwks_uri", url,
+						 "verify.exp=skip");
+	ck_assert_ptr_eq(rv, NULL);
+	oauth2_mem_free(url);
+
+	return verify;
+}
+
+static int _test_oauth2_verify_jwks_count(oauth2_cfg_token_verify_t *verify,
+					  const char *token, bool expected)
+{
+	json_t *json_payload = NULL;
+
+	ck_assert_int_eq(
+	    oauth2_token_verify(_log, verify, token, &json_payload), expected);
+	if (json_payload)
+		json_decref(json_payload);
+
+	return __atomic_load_n(get_jwks_uri_count, __ATOMIC_SEQ_CST);
+}
+
+START_TEST(test_oauth2_verify_token_invalid_cached)
+{
+	bool rc = false;
+	oauth2_cfg_token_verify_t *verify = NULL;
+	const char *jwt =
+	    TEST_JWKS_JWT_HDR_K1 TEST_JWKS_JWT_PAYLOAD TEST_JWKS_JWT_SIG;
+	// signatures that differ from the real one in whole bytes
+	const char *invalid1 = TEST_JWKS_JWT_HDR_K1 TEST_JWKS_JWT_PAYLOAD
+	    "NUghlaVxy5ij" TEST_JWKS_JWT_SIG_TAIL;
+	const char *invalid2 = TEST_JWKS_JWT_HDR_K1 TEST_JWKS_JWT_PAYLOAD
+	    "MUghlaVxy5ik" TEST_JWKS_JWT_SIG_TAIL;
+	json_t *json_payload = NULL;
+	int count = 0;
+
+	verify = _test_oauth2_verify_jwks("?invalid_cached");
+	count = __atomic_load_n(get_jwks_uri_count, __ATOMIC_SEQ_CST);
+
+	// fresh keys: the signature is definitely bad
+	ck_assert_int_eq(
+	    _test_oauth2_verify_jwks_count(verify, invalid1, false), count + 1);
+
+	// rejected from the negative cache: re-verification against the now
+	// cached keys would have forced a refresh of the JWKS
+	ck_assert_int_eq(
+	    _test_oauth2_verify_jwks_count(verify, invalid1, false), count + 1);
+
+	// which is what happens for another invalid token
+	ck_assert_int_eq(
+	    _test_oauth2_verify_jwks_count(verify, invalid2, false), count + 2);
+	ck_assert_int_eq(
+	    _test_oauth2_verify_jwks_count(verify, invalid2, false), count + 2);
+
+	rc = oauth2_token_verify(_log, verify, "garbage", &json_payload);
+	ck_assert_int_eq(rc, false);
+	rc = oauth2_token_verify(_log, verify, "garbage", &json_payload);
+	ck_assert_int_eq(rc, false);
+
+	ck_assert_int_eq(_test_oauth2_verify_jwks_count(verify, jwt, true),
+			 count + 2);
+
+	oauth2_cfg_token_verify_free(_log, verify);
+}
+END_TEST
+
+START_TEST(test_oauth2_verify_jwks_refresh_rate_limit)
+{
+	oauth2_cfg_token_verify_t *verify = NULL;
+	const char *jwt =
+	    TEST_JWKS_JWT_HDR_K1 TEST_JWKS_JWT_PAYLOAD TEST_JWKS_JWT_SIG;
+	const char *unknown1 =
+	    TEST_JWKS_JWT_HDR_K2 TEST_JWKS_JWT_PAYLOAD TEST_JWKS_JWT_SIG;
+	const char *unknown2 = TEST_JWKS_JWT_HDR_K2 TEST_JWKS_JWT_PAYLOAD
+	    "NUghlaVxy5ij" TEST_JWKS_JWT_SIG_TAIL;
+	const char *unknown3 = TEST_JWKS_JWT_HDR_K2 TEST_JWKS_JWT_PAYLOAD
+	    "MUghlaVxy5ik" TEST_JWKS_JWT_SIG_TAIL;
+	const char *invalid = TEST_JWKS_JWT_HDR_K1 TEST_JWKS_JWT_PAYLOAD
+	    "NUghlaVxy5ij" TEST_JWKS_JWT_SIG_TAIL;
+	int count = 0;
+
+	verify = _test_oauth2_verify_jwks("?rate_limit");
+	count = __atomic_load_n(get_jwks_uri_count, __ATOMIC_SEQ_CST);
+
+	ck_assert_int_eq(
+	    _test_oauth2_verify_jwks_count(verify, unknown1, false), count + 1);
+
+	// the cached keys may be stale: refresh them once
+	ck_assert_int_eq(
+	    _test_oauth2_verify_jwks_count(verify, unknown2, false), count + 2);
+
+	// the refreshed set did not contain the kid either
+	ck_assert_int_eq(
+	    _test_oauth2_verify_jwks_count(verify, unknown3, false), count + 2);
+
+	// a known kid is not refreshed again within the minimum interval
+	ck_assert_int_eq(
+	    _test_oauth2_verify_jwks_count(verify, invalid, false), count + 2);
+
+	ck_assert_int_eq(_test_oauth2_verify_jwks_count(verify, jwt, true),
+			 count + 2);
+
+	oauth2_cfg_token_verify_free(_log, verify);
+}
+END_TEST
+
+#define TEST_JWKS_FLOOD_SIZE 2000
+
+static void _test_oauth2_log_discard(oauth2_log_sink_t *sink,
+				     const char *filename, unsigned long line,
+				     const char *function,
+				     oauth2_log_level_t level, const char *msg)
+{
+}
+
+START_TEST(test_oauth2_verify_jwks_refresh_flood)
+{
+	oauth2_cfg_token_verify_t *verify = NULL;
+	const char *jwt =
+	    TEST_JWKS_JWT_HDR_K1 TEST_JWKS_JWT_PAYLOAD TEST_JWKS_JWT_SIG;
+	const char *unknown1 =
+	    TEST_JWKS_JWT_HDR_K2 TEST_JWKS_JWT_PAYLOAD TEST_JWKS_JWT_SIG;
+	const char *unknown2 = TEST_JWKS_JWT_HDR_K2 TEST_JWKS_JWT_PAYLOAD
+	    "NUghlaVxy5ij" TEST_JWKS_JWT_SIG_TAIL;
+	char hdr[64], garbage[32], *s_hdr = NULL, *token = NULL;
+	json_t *json_payload = NULL;
+	int count = 0, i = 0;
+	// keep the flood out of the test output
+	oauth2_log_t *log = oauth2_log_init(
+	    OAUTH2_LOG_ERROR,
+	    oauth2_log_sink_create(OAUTH2_LOG_ERROR, _test_oauth2_log_discard,
+				   NULL));
+
+	verify = _test_oauth2_verify_jwks("?flood");
+	count = __atomic_load_n(get_jwks_uri_count, __ATOMIC_SEQ_CST);
+
+	ck_assert_int_eq(
+	    _test_oauth2_verify_jwks_count(verify, unknown1, false), count + 1);
+	ck_assert_int_eq(
+	    _test_oauth2_verify_jwks_count(verify, unknown2, false), count + 2);
+
+	// distinct invalid tokens fill the negative cache and tokens with
+	// random kids ask for a refresh, none of which may reach the JWKS
+	for (i = 0; i < TEST_JWKS_FLOOD_SIZE; i++) {
+		oauth2_snprintf(garbage, sizeof(garbage), "garbage%d", i);
+		ck_assert_int_eq(
+		    oauth2_token_verify(log, verify, garbage, &json_payload),
+		    false);
+
+		oauth2_snprintf(hdr, sizeof(hdr),
+				"{\"alg\":\"RS256\",\"kid\":\"flood%d\"}", i);
+		oauth2_base64url_encode(_log, (const uint8_t *)hdr,
+					strlen(hdr), &s_hdr);
+		token = oauth2_stradd(NULL, s_hdr, ".",
+				      TEST_JWKS_JWT_PAYLOAD TEST_JWKS_JWT_SIG);
+		ck_assert_int_eq(
+		    oauth2_token_verify(log, verify, token, &json_payload),
+		    false);
+		oauth2_mem_free(token);
+		oauth2_mem_free(s_hdr);
+	}
+
+	ck_assert_int_eq(__atomic_load_n(get_jwks_uri_count, __ATOMIC_SEQ_CST),
+			 count + 2);
+
+	ck_assert_int_eq(_test_oauth2_verify_jwks_count(verify, jwt, true),
+			 count + 2);
+
+	oauth2_cfg_token_verify_free(_log, verify);
+	oauth2_log_free(log);
+}
+END_TEST
+
 START_TEST(test_oauth2_verify_token_base64)
 {
 	bool rc = false;
@@ -925,11 +1348,142 @@ START_TEST(test_oauth2_verify_token_metadata)
 }
 END_TEST
 
+START_TEST(test_oauth2_verify_metadata_swap)
+{
+	bool rc = false;
+	oauth2_cfg_token_verify_t *verify = NULL;
+	json_t *json_payload = NULL;
+	char *s_payload = NULL;
+	const char *rv = NULL;
+	char *url = NULL;
+
+	char *jwt =
+	    "eyJhbGciOiJSUzI1NiIsImtpZCI6ImsxIn0."
+	    "eyJzY29wZSI6W10sImNsaWVudF9pZF9uYW1lIjoicm9fY2xpZW50IiwiYWdpZCI6Im"
+	    "4zak1UazdXSDVVSU9FTWNEZEZPSVR5eFZ2VW1XRHVyIiwiT3JnTmFtZSI6IlBpbmcg"
+	    "SWRlbnRpdHkgQ29ycG9yYXRpb24iLCJjbmYiOnsieDV0I1MyNTYiOiJsNnU5S1VDZ0"
+	    "I2UHpHdklpTS0tWEYwTHF3N1ZYejdvQWtoUkhhbEZqOGkwIn0sIlVzZXJuYW1lIjoi"
+	    "am9lIiwiZXhwIjoxNTQyMTI5NzgzfQ.MUghlaVxy5ij3HODBl6spAA-h6W7D-"
+	    "PoKyhDfR5DnODQqwb5zaqba2pWyJ0d6-4AQfQ6dIe0jfwQeUrPTu2DZLtk3H-"
+	    "noCSjtXrFV_RFNfz9kqdEXwkVZAX8H_ySrYFcAx3Ac9C8bZzjRUM6c4emql-"
+	    "I6T1fVGqO_"
+	    "bVUsWbPmPtNanq3UyqTrlDwQ6weO0ZbLH9tcDpZD4ojNCJjkHa3lvjwYzPNwlAI6a_"
+	    "DGng-7rgrobhOiaAgBAwLhq9fvTtM2MWNmWXmUCymq3nGqG_d_t5i_"
+	    "x7Zf28T3ejzEX-ETefpTENX7BJ57-vQbAeECRTIo_LhzKTaDkiZWpf6JgraQg";
+
+	ck_assert_ptr_ne(metadata_version, NULL);
+	__atomic_store_n(metadata_version, 1, __ATOMIC_SEQ_CST);
+
+	url = oauth2_stradd(NULL, oauth2_check_http_base_url(), metadata_path,
+			    NULL);
+	rv = oauth2_cfg_token_verify_add_options(
+	    _log, &verify, "metadata", url,
+	    "verify.exp=skip&metadata.expiry=1");
+	ck_assert_ptr_eq(rv, NULL);
+
+	// call the callback directly to bypass the token cache
+	rc = verify->callback(_log, verify, valid_access_token, &json_payload,
+			      &s_payload);
+	ck_assert_int_eq(rc, true);
+	json_decref(json_payload);
+	json_payload = NULL;
+	oauth2_mem_free(s_payload);
+	s_payload = NULL;
+
+	// serve a new document and let the cached one expire
+	__atomic_store_n(metadata_version, 2, __ATOMIC_SEQ_CST);
+	sleep(2);
+
+	// the new snapshot has no introspection endpoint
+	rc = verify->callback(_log, verify, valid_access_token, &json_payload,
+			      &s_payload);
+	ck_assert_int_eq(rc, false);
+	json_decref(json_payload);
+	json_payload = NULL;
+	if (s_payload)
+		oauth2_mem_free(s_payload);
+	s_payload = NULL;
+
+	// but it does have the jwks_uri
+	rc = verify->callback(_log, verify, jwt, &json_payload, &s_payload);
+	ck_assert_int_eq(rc, true);
+	json_decref(json_payload);
+	oauth2_mem_free(s_payload);
+
+	__atomic_store_n(metadata_version, 1, __ATOMIC_SEQ_CST);
+
+	oauth2_cfg_token_verify_free(_log, verify);
+	oauth2_mem_free(url);
+}
+END_TEST
+
+START_TEST(test_oauth2_verify_metadata_jwks_uri_refresh)
+{
+	bool rc = false;
+	oauth2_cfg_token_verify_t *verify = NULL;
+	json_t *json_payload = NULL;
+	const char *rv = NULL;
+	char *url = NULL;
+	int count = 0, i = 0;
+
+	ck_assert_ptr_ne(get_jwks_uri_count, NULL);
+
+	url = oauth2_stradd(NULL, oauth2_check_http_base_url(), metadata_path,
+			    NULL);
+	rv = oauth2_cfg_token_verify_add_options(
+	    _log, &verify, "metadata", url,
+	    "verify.exp=skip&jwks_uri.refresh=true");
+	ck_assert_ptr_eq(rv, NULL);
+
+	// nothing to refresh yet: the jwks_uri is only known after discovery
+	ck_assert_int_eq(oauth2_jose_uri_refresh_start(_log), true);
+
+	// a reference token resolves the metadata without fetching the JWKS
+	count = __atomic_load_n(get_jwks_uri_count, __ATOMIC_SEQ_CST);
+	rc = oauth2_token_verify(_log, verify, "bogus", &json_payload);
+	ck_assert_int_eq(rc, false);
+
+	// so any JWKS fetch comes from the refresher
+	for (i = 0; i < 50; i++) {
+		if (__atomic_load_n(get_jwks_uri_count, __ATOMIC_SEQ_CST) >
+		    count)
+			break;
+		usleep(100 * 1000);
+	}
+
+	oauth2_jose_uri_refresh_stop(_log);
+
+	ck_assert_int_gt(__atomic_load_n(get_jwks_uri_count, __ATOMIC_SEQ_CST),
+			 count);
+
+	oauth2_cfg_token_verify_free(_log, verify);
+	oauth2_mem_free(url);
+}
+END_TEST
+
 Suite *oauth2_check_oauth2_suite()
 {
 	Suite *s = suite_create("oauth2");
 	TCase *c = tcase_create("core");
 
+	get_jwks_uri_count = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (get_jwks_uri_count == MAP_FAILED)
+		get_jwks_uri_count = NULL;
+	metadata_version = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (metadata_version == MAP_FAILED)
+		metadata_version = NULL;
+	post_introspection_count =
+	    mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (post_introspection_count == MAP_FAILED)
+		post_introspection_count = NULL;
+	get_eckey_url_count = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (get_eckey_url_count == MAP_FAILED)
+		get_eckey_url_count = NULL;
+
 	liboauth2_check_register_http_callbacks(oauth2_check_http_base_path(),
 						oauth2_check_oauth2_serve_get,
 						oauth2_check_oauth2_serve_post);
@@ -940,6 +1494,7 @@ Suite *oauth2_check_oauth2_suite()
 	tcase_add_test(c, test_oauth2_auth_client_secret_post);
 	tcase_add_test(c, test_oauth2_auth_client_secret_jwt);
 	tcase_add_test(c, test_oauth2_auth_private_key_jwt);
+	tcase_add_test(c, test_oauth2_auth_jwt_pool);
 	tcase_add_test(c, test_oauth2_auth_client_cert);
 	tcase_add_test(c, test_oauth2_auth_http_basic);
 	tcase_add_test(c, test_oauth2_auth_none);
@@ -948,12 +1503,18 @@ Suite *oauth2_check_oauth2_suite()
 	tcase_add_test(c, test_oauth2_verify_eckey_uri);
 	tcase_add_test(c, test_oauth2_verify_token_introspection);
 	tcase_add_test(c, test_oauth2_verify_token_plain);
+	tcase_add_test(c, test_oauth2_verify_token_claims);
+	tcase_add_test(c, test_oauth2_verify_token_invalid_cached);
+	tcase_add_test(c, test_oauth2_verify_jwks_refresh_rate_limit);
+	tcase_add_test(c, test_oauth2_verify_jwks_refresh_flood);
 	tcase_add_test(c, test_oauth2_verify_token_base64);
 	tcase_add_test(c, test_oauth2_verify_token_base64url);
 	tcase_add_test(c, test_oauth2_verify_token_hex);
 	tcase_add_test(c, test_oauth2_verify_token_pem);
 	tcase_add_test(c, test_oauth2_verify_token_pubkey);
 	tcase_add_test(c, test_oauth2_verify_token_metadata);
+	tcase_add_test(c, test_oauth2_verify_metadata_swap);
+	tcase_add_test(c, test_oauth2_verify_metadata_jwks_uri_refresh);
 
 	suite_add_tcase(s, c);
 
@@ -33,6 +33,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
+#include <utime.h>
 
 static oauth2_log_t *_log = 0;
 
@@ -596,7 +597,88 @@ START_TEST(test_openidc_resolver)
 }
 END_TEST
 
-static void _test_openidc_handle(oauth2_cfg_openidc_t *c)
+static void _test_openidc_write_provider(const char *filename,
+					 const char *issuer)
+{
+	FILE *fp = fopen(filename, "w");
+	ck_assert_ptr_ne(fp, NULL);
+	fprintf(fp,
+		"{ \"issuer\": \"%s\", "
+		"\"authorization_endpoint\": \"%s/authorize\", "
+		"\"token_endpoint\": \"%s/token\", "
+		"\"jwks_uri\": \"%s/jwks\", "
+		"\"client_id\": \"client\", "
+		"\"client_secret\": \"secret\" }",
+		issuer, issuer, issuer, issuer);
+	fclose(fp);
+}
+
+START_TEST(test_openidc_resolver_cache)
+{
+	bool rc = false;
+	char *rv = NULL;
+	oauth2_cfg_openidc_t *c = NULL;
+	oauth2_http_request_t *r = NULL;
+	oauth2_openidc_provider_t *p1 = NULL, *p2 = NULL;
+	char filename[] = "/tmp/check_openidc_provider_XXXXXX";
+	struct utimbuf times;
+	int fd = -1;
+
+	c = oauth2_cfg_openidc_init(_log);
+	r = oauth2_http_request_init(_log);
+
+	// the same document yields the same parsed provider
+	rv = oauth2_cfg_openidc_provider_resolver_set_options(
+	    _log, c, "string", test_openidc_metadata_get(), NULL);
+	ck_assert_ptr_eq(rv, NULL);
+
+	rc = _oauth2_openidc_provider_resolve(_log, c, r, NULL, &p1);
+	ck_assert_int_eq(rc, true);
+	rc = _oauth2_openidc_provider_resolve(_log, c, r, NULL, &p2);
+	ck_assert_int_eq(rc, true);
+	ck_assert_ptr_eq(p1, p2);
+	oauth2_openidc_provider_free(_log, p1);
+	oauth2_openidc_provider_free(_log, p2);
+
+	// a modified file is picked up
+	fd = mkstemp(filename);
+	ck_assert_int_ne(fd, -1);
+	close(fd);
+	_test_openidc_write_provider(filename, "https://one.example.org");
+
+	rv = oauth2_cfg_openidc_provider_resolver_set_options(
+	    _log, c, "file", filename, NULL);
+	ck_assert_ptr_eq(rv, NULL);
+
+	rc = _oauth2_openidc_provider_resolve(_log, c, r, NULL, &p1);
+	ck_assert_int_eq(rc, true);
+	ck_assert_str_eq("https://one.example.org",
+			 oauth2_openidc_provider_issuer_get(_log, p1));
+
+	_test_openidc_write_provider(filename, "https://two.example.org");
+	times.actime = times.modtime = time(NULL) + 10;
+	ck_assert_int_eq(utime(filename, &times), 0);
+
+	rc = _oauth2_openidc_provider_resolve(_log, c, r, NULL, &p2);
+	ck_assert_int_eq(rc, true);
+	ck_assert_str_eq("https://two.example.org",
+			 oauth2_openidc_provider_issuer_get(_log, p2));
+
+	// the provider handed out earlier remains valid
+	ck_assert_str_eq("https://one.example.org",
+			 oauth2_openidc_provider_issuer_get(_log, p1));
+
+	oauth2_openidc_provider_free(_log, p1);
+	oauth2_openidc_provider_free(_log, p2);
+
+	unlink(filename);
+	oauth2_http_request_free(_log, r);
+	oauth2_cfg_openidc_free(_log, c);
+}
+END_TEST
+
+// log in through the redirect URI and return the session cookie
+static char *_test_openidc_login(oauth2_cfg_openidc_t *c)
 {
 	bool rc = false;
 	oauth2_http_request_t *r = NULL;
@@ -691,6 +773,24 @@ static void _test_openidc_handle(oauth2_cfg_openidc_t *c)
 	oauth2_http_response_free(_log, response);
 	oauth2_http_request_free(_log, r);
 
+	oauth2_mem_free(state);
+	oauth2_mem_free(query_str);
+	oauth2_mem_free(state_cookie_name);
+	oauth2_mem_free(state_cookie);
+
+	return session_cookie;
+}
+
+static void _test_openidc_handle(oauth2_cfg_openidc_t *c)
+{
+	bool rc = false;
+	oauth2_http_request_t *r = NULL;
+	oauth2_http_response_t *response = NULL;
+	char *session_cookie = NULL;
+	json_t *claims = NULL;
+
+	session_cookie = _test_openidc_login(c);
+
 	r = oauth2_http_request_init(_log);
 	rc = oauth2_http_request_path_set(_log, r, "/secure");
 	ck_assert_int_eq(rc, true);
@@ -741,10 +841,6 @@ static void _test_openidc_handle(oauth2_cfg_openidc_t *c)
 	oauth2_http_request_free(_log, r);
 	oauth2_http_response_free(_log, response);
 
-	oauth2_mem_free(state);
-	oauth2_mem_free(query_str);
-	oauth2_mem_free(state_cookie_name);
-	oauth2_mem_free(state_cookie);
 	oauth2_mem_free(session_cookie);
 }
 
@@ -809,6 +905,73 @@ START_TEST(test_openidc_handle_cache)
 }
 END_TEST
 
+static oauth2_openidc_provider_t *
+_test_openidc_provider_get(oauth2_cfg_openidc_t *c)
+{
+	bool rc = false;
+	oauth2_http_request_t *r = NULL;
+	oauth2_openidc_provider_t *provider = NULL;
+
+	r = oauth2_http_request_init(_log);
+	rc = _oauth2_openidc_provider_resolve(_log, c, r, NULL, &provider);
+	ck_assert_int_eq(rc, true);
+	oauth2_http_request_free(_log, r);
+
+	return provider;
+}
+
+START_TEST(test_openidc_id_token_verify_cached)
+{
+	oauth2_cfg_openidc_t *c = NULL;
+	oauth2_cfg_session_t *session_cfg = NULL;
+	oauth2_openidc_provider_t *p1 = NULL, *p2 = NULL;
+	char *session_cookie = NULL, *metadata = NULL;
+
+	c = oauth2_cfg_openidc_init(_log);
+	session_cfg = oauth2_cfg_session_init(_log);
+	oauth2_cfg_session_set_options(_log, session_cfg, "cookie",
+				       "name=verify_cookie");
+	oauth2_cfg_openidc_provider_resolver_set_options(
+	    _log, c, "string", test_openidc_metadata_get(),
+	    "session=verify_cookie");
+
+	// the first login configures the verifier on the cached provider
+	session_cookie = _test_openidc_login(c);
+	oauth2_mem_free(session_cookie);
+	p1 = _test_openidc_provider_get(c);
+	ck_assert_ptr_ne(p1->id_token_verify, NULL);
+
+	// the next one uses it as is
+	session_cookie = _test_openidc_login(c);
+	oauth2_mem_free(session_cookie);
+	p2 = _test_openidc_provider_get(c);
+	ck_assert_ptr_eq(p1, p2);
+	ck_assert_ptr_eq(p1->id_token_verify, p2->id_token_verify);
+	oauth2_openidc_provider_free(_log, p2);
+
+	// a changed provider document yields a new provider and verifier;
+	// p1 is still held so its verifier cannot be freed and reused
+	metadata = oauth2_stradd(NULL, "{ \"service_documentation\": "
+				       "\"https://op.example.org/docs\",",
+				 test_openidc_metadata_get() + 1, NULL);
+	oauth2_cfg_openidc_provider_resolver_set_options(
+	    _log, c, "string", metadata, "session=verify_cookie");
+
+	session_cookie = _test_openidc_login(c);
+	oauth2_mem_free(session_cookie);
+	p2 = _test_openidc_provider_get(c);
+	ck_assert_ptr_ne(p1, p2);
+	ck_assert_ptr_ne(p2->id_token_verify, NULL);
+	ck_assert_ptr_ne(p1->id_token_verify, p2->id_token_verify);
+
+	oauth2_openidc_provider_free(_log, p2);
+	oauth2_openidc_provider_free(_log, p1);
+	oauth2_mem_free(metadata);
+	oauth2_cfg_session_release(_log, session_cfg);
+	oauth2_cfg_openidc_free(_log, c);
+}
+END_TEST
+
 Suite *oauth2_check_openidc_suite()
 {
 	Suite *s = suite_create("openidc");
@@ -823,8 +986,10 @@ Suite *oauth2_check_openidc_suite()
 	tcase_add_test(c, test_openidc_cfg);
 	tcase_add_test(c, test_openidc_proto_state);
 	tcase_add_test(c, test_openidc_resolver);
+	tcase_add_test(c, test_openidc_resolver_cache);
 	tcase_add_test(c, test_openidc_handle_cookie);
 	tcase_add_test(c, test_openidc_handle_cache);
+	tcase_add_test(c, test_openidc_id_token_verify_cached);
 
 	suite_add_tcase(s, c);
 
@@ -281,6 +281,86 @@ START_TEST(test_base64url_decode)
 }
 END_TEST
 
+START_TEST(test_base64)
+{
+	uint8_t src[100], *dst = NULL;
+	char enc[160], *str = NULL;
+	size_t i = 0, n = 0, len = 0;
+	bool rc = false;
+
+	len = oauth2_base64_encode(_log, (const uint8_t *)"ab", 2, &str);
+	ck_assert_uint_eq(len, 4);
+	ck_assert_str_eq(str, "YWI=");
+	rc = oauth2_base64_decode(_log, str, &dst, &len);
+	ck_assert_int_eq(rc, true);
+	ck_assert_uint_eq(len, 2);
+	ck_assert_str_eq((char *)dst, "ab");
+	oauth2_mem_free(dst);
+	oauth2_mem_free(str);
+
+	// padding is mandatory for base64 and optional for base64url
+	rc = oauth2_base64_decode(_log, "YWI", &dst, &len);
+	ck_assert_int_eq(rc, false);
+	ck_assert_ptr_eq(dst, NULL);
+	rc = oauth2_base64url_decode(_log, "YWI=", &dst, &len);
+	ck_assert_int_eq(rc, true);
+	ck_assert_uint_eq(len, 2);
+	oauth2_mem_free(dst);
+
+	// characters of the other alphabet are rejected
+	rc = oauth2_base64url_decode(_log, "ab+c", &dst, &len);
+	ck_assert_int_eq(rc, false);
+	rc = oauth2_base64_decode(_log, "ab_c", &dst, &len);
+	ck_assert_int_eq(rc, false);
+	rc = oauth2_base64url_decode(_log, "a", &dst, &len);
+	ck_assert_int_eq(rc, false);
+
+	// round trip through the caller buffer variants at lengths that
+	// exercise both the bulk and the tail conversion
+	for (i = 0; i < sizeof(src); i++)
+		src[i] = (uint8_t)(i * 37 + 11);
+	for (n = 0; n <= sizeof(src); n++) {
+		len = oauth2_base64url_encode_buf(_log, src, n, enc,
+						  sizeof(enc));
+		ck_assert_uint_eq(len, oauth2_base64_encode_len(n, true));
+		ck_assert_uint_eq(strlen(enc), len);
+
+		rc = oauth2_base64url_decode(_log, enc, &dst, &len);
+		ck_assert_int_eq(rc, true);
+		ck_assert_uint_eq(len, n);
+		ck_assert_int_eq(memcmp(dst, src, n), 0);
+		oauth2_mem_free(dst);
+
+		len = oauth2_base64_encode_buf(_log, src, n, enc, sizeof(enc));
+		ck_assert_uint_eq(len % 4, 0);
+		dst = oauth2_mem_alloc(sizeof(src));
+		len = sizeof(src);
+		rc = oauth2_base64_decode_buf(_log, enc, strlen(enc), dst,
+					      &len);
+		ck_assert_int_eq(rc, true);
+		ck_assert_uint_eq(len, n);
+		ck_assert_int_eq(memcmp(dst, src, n), 0);
+
+		// an invalid character anywhere fails the decode
+		if (n > 0) {
+			enc[n % (strlen(enc) - 2)] = '*';
+			len = sizeof(src);
+			rc = oauth2_base64_decode_buf(_log, enc, strlen(enc),
+						      dst, &len);
+			ck_assert_int_eq(rc, false);
+		}
+		oauth2_mem_free(dst);
+	}
+
+	// output buffers that are too small are not written to
+	len = oauth2_base64url_encode_buf(_log, src, 3, enc, 4);
+	ck_assert_uint_eq(len, 0);
+	len = 2;
+	rc = oauth2_base64url_decode_buf(_log, "YWJj", 4, src, &len);
+	ck_assert_int_eq(rc, false);
+}
+END_TEST
+
 START_TEST(test_url_encode)
 {
 	char *src = NULL, *dst = NULL, *enc = NULL;
@@ -327,6 +407,13 @@ START_TEST(test_url_decode)
 	ck_assert_str_eq(dst, dec);
 	oauth2_mem_free(dst);
 
+	// malformed escapes are passed as-is, an escaped '+' is kept
+	src = "a+b%2Bc%zz%4%";
+	dec = "a b+c%zz%4%";
+	dst = oauth2_url_decode(_log, src);
+	ck_assert_str_eq(dst, dec);
+	oauth2_mem_free(dst);
+
 	dst = NULL;
 	src = NULL;
 	dst = oauth2_url_decode(_log, src);
@@ -334,6 +421,35 @@ START_TEST(test_url_decode)
 }
 END_TEST
 
+START_TEST(test_url_buf)
+{
+	char buf[32];
+	size_t len = 0;
+	bool rc = false;
+
+	len = oauth2_url_encode_buf(_log, "a b&c", 5, buf, sizeof(buf));
+	ck_assert_uint_eq(len, 9);
+	ck_assert_uint_eq(oauth2_url_encode_len("a b&c", 5), 9);
+	ck_assert_str_eq(buf, "a%20b%26c");
+
+	// too small: nothing is written
+	len = oauth2_url_encode_buf(_log, "a b&c", 5, buf, 9);
+	ck_assert_uint_eq(len, 0);
+
+	// decode in place, a slice of the input only
+	strcpy(buf, "a%20b%26c&d");
+	len = sizeof(buf);
+	rc = oauth2_url_decode_buf(_log, buf, 9, buf, &len);
+	ck_assert_int_eq(rc, true);
+	ck_assert_uint_eq(len, 5);
+	ck_assert_str_eq(buf, "a b&c");
+
+	len = 4;
+	rc = oauth2_url_decode_buf(_log, "a%20b", 5, buf, &len);
+	ck_assert_int_eq(rc, false);
+}
+END_TEST
+
 START_TEST(test_html_encode)
 {
 	char *src = NULL, *dst = NULL, *enc = NULL;
@@ -354,12 +470,46 @@ START_TEST(test_html_encode)
 	oauth2_mem_free(dst);
 	dst = NULL;
 
+	// clean input still returns a copy the caller owns
+	src = "nothing to escape in this string of more than 16 bytes";
+	dst = oauth2_html_escape(_log, src);
+	ck_assert_str_eq(dst, src);
+	ck_assert_ptr_ne(dst, src);
+	oauth2_mem_free(dst);
+	dst = NULL;
+
 	src = NULL;
 	dst = oauth2_html_escape(_log, src);
 	ck_assert_ptr_eq(dst, NULL);
 }
 END_TEST
 
+START_TEST(test_html_escape_nocopy)
+{
+	const char *src = NULL, *rv = NULL;
+	char *alloc = NULL;
+
+	// clean input is handed back as-is
+	src = "nothing to escape in this string of more than 16 bytes";
+	rv = oauth2_html_escape_nocopy(_log, src, &alloc);
+	ck_assert_ptr_eq(rv, src);
+	ck_assert_ptr_eq(alloc, NULL);
+
+	// escapes beyond the first 16 bytes and in the tail are found
+	src = "nothing to escape in this string but \"this\" & <that>'";
+	rv = oauth2_html_escape_nocopy(_log, src, &alloc);
+	ck_assert_ptr_ne(alloc, NULL);
+	ck_assert_ptr_eq(rv, alloc);
+	ck_assert_str_eq(rv, "nothing to escape in this string but "
+			     "&quot;this&quot; &amp; &lt;that&gt;&apos;");
+	oauth2_mem_free(alloc);
+
+	rv = oauth2_html_escape_nocopy(_log, NULL, &alloc);
+	ck_assert_ptr_eq(rv, NULL);
+	ck_assert_ptr_eq(alloc, NULL);
+}
+END_TEST
+
 START_TEST(test_random)
 {
 	char *rv = NULL;
@@ -384,6 +534,127 @@ START_TEST(test_random)
 }
 END_TEST
 
+START_TEST(test_strbuf)
+{
+	oauth2_strbuf_t sb;
+	char *rv = NULL;
+	int i = 0;
+
+	// nothing appended: nothing to hand over
+	oauth2_strbuf_init(&sb, 0);
+	ck_assert_ptr_eq(oauth2_strbuf_take(&sb), NULL);
+
+	oauth2_strbuf_init(&sb, 0);
+	oauth2_strbuf_append(&sb, "a");
+	oauth2_strbuf_appendn(&sb, "bcd", 2);
+	oauth2_strbuf_appendf(&sb, "-%d-%s", 42, "x");
+	oauth2_strbuf_append_escaped(&sb, " a+b/c~d");
+	rv = oauth2_strbuf_take(&sb);
+	ck_assert_str_eq(rv, "abc-42-x%20a%2Bb%2Fc~d");
+	ck_assert_ptr_eq(sb.buf, NULL);
+	oauth2_mem_free(rv);
+
+	// grow well beyond the initial size
+	oauth2_strbuf_init(&sb, 0);
+	for (i = 0; i < 1000; i++)
+		oauth2_strbuf_append(&sb, "0123456789");
+	ck_assert_uint_eq(sb.len, 10000);
+	ck_assert_uint_eq(strlen(sb.buf), 10000);
+	oauth2_strbuf_free(&sb);
+	ck_assert_ptr_eq(sb.buf, NULL);
+}
+END_TEST
+
+static bool check_util_nv_list_order_cb(oauth2_log_t *log, void *rec,
+					const char *key, const char *value)
+{
+	int *n = (int *)rec;
+	char name[16];
+
+	oauth2_snprintf(name, sizeof(name), "Name%d", *n);
+	ck_assert_str_eq(key, name);
+	(*n)++;
+
+	return true;
+}
+
+START_TEST(test_nv_list_add_ref)
+{
+	oauth2_nv_list_t *list = NULL;
+	char name[] = "Name", value[] = "value", other[] = "other";
+
+	list = oauth2_nv_list_init(_log);
+	oauth2_nv_list_case_sensitive_set(_log, list, false);
+
+	// borrowed entries refer to the caller's strings
+	ck_assert_int_eq(oauth2_nv_list_add_ref(_log, list, name, value), true);
+	ck_assert_int_eq(oauth2_nv_list_add_ref(_log, list, other, other),
+			 true);
+	ck_assert_ptr_eq(oauth2_nv_list_get(_log, list, "name"), value);
+
+	// setting a value makes the entry take copies
+	ck_assert_int_eq(oauth2_nv_list_set(_log, list, "name", "new"), true);
+	name[0] = 'X';
+	ck_assert_str_eq(oauth2_nv_list_get(_log, list, "name"), "new");
+
+	// removing a borrowed entry does not free the caller's strings
+	ck_assert_int_eq(oauth2_nv_list_unset(_log, list, "other"), true);
+	ck_assert_ptr_eq(oauth2_nv_list_get(_log, list, "other"), NULL);
+	ck_assert_str_eq(other, "other");
+
+	oauth2_nv_list_free(_log, list);
+}
+END_TEST
+
+START_TEST(test_nv_list)
+{
+	oauth2_nv_list_t *list = NULL;
+	char name[16], value[16];
+	int i = 0, n = 0;
+
+	list = oauth2_nv_list_init(_log);
+	oauth2_nv_list_case_sensitive_set(_log, list, false);
+
+	// enough entries for the list to be indexed
+	for (i = 0; i < 40; i++) {
+		oauth2_snprintf(name, sizeof(name), "Name%d", i);
+		oauth2_snprintf(value, sizeof(value), "value%d", i);
+		ck_assert_int_eq(oauth2_nv_list_add(_log, list, name, value),
+				 true);
+	}
+
+	ck_assert_str_eq(oauth2_nv_list_get(_log, list, "Name0"), "value0");
+	ck_assert_str_eq(oauth2_nv_list_get(_log, list, "name39"), "value39");
+	ck_assert_str_eq(oauth2_nv_list_get(_log, list, "NAME17"), "value17");
+	ck_assert_ptr_eq(oauth2_nv_list_get(_log, list, "Name40"), NULL);
+
+	// iteration keeps the insertion order
+	oauth2_nv_list_loop(_log, list, check_util_nv_list_order_cb, &n);
+	ck_assert_int_eq(n, 40);
+
+	// the first of duplicate names wins until it is removed
+	oauth2_nv_list_add(_log, list, "name5", "duplicate");
+	ck_assert_str_eq(oauth2_nv_list_get(_log, list, "Name5"), "value5");
+	oauth2_nv_list_unset(_log, list, "Name5");
+	ck_assert_str_eq(oauth2_nv_list_get(_log, list, "Name5"), "duplicate");
+
+	oauth2_nv_list_set(_log, list, "name20", "replaced");
+	ck_assert_str_eq(oauth2_nv_list_get(_log, list, "Name20"), "replaced");
+
+	// switching to case sensitive re-indexes the entries
+	oauth2_nv_list_case_sensitive_set(_log, list, true);
+	ck_assert_ptr_eq(oauth2_nv_list_get(_log, list, "name21"), NULL);
+	ck_assert_str_eq(oauth2_nv_list_get(_log, list, "Name21"), "value21");
+
+	// appending still works after the last entry has been removed
+	oauth2_nv_list_unset(_log, list, "name5");
+	oauth2_nv_list_add(_log, list, "last", "entry");
+	ck_assert_str_eq(oauth2_nv_list_get(_log, list, "last"), "entry");
+
+	oauth2_nv_list_free(_log, list);
+}
+END_TEST
+
 Suite *oauth2_check_util_suite()
 {
 	Suite *s = suite_create("util");
@@ -396,10 +667,16 @@ Suite *oauth2_check_util_suite()
 	tcase_add_test(c, test_strdup);
 	tcase_add_test(c, test_base64url_encode);
 	tcase_add_test(c, test_base64url_decode);
+	tcase_add_test(c, test_base64);
 	tcase_add_test(c, test_url_encode);
 	tcase_add_test(c, test_url_decode);
+	tcase_add_test(c, test_url_buf);
 	tcase_add_test(c, test_html_encode);
+	tcase_add_test(c, test_html_escape_nocopy);
 	tcase_add_test(c, test_random);
+	tcase_add_test(c, test_strbuf);
+	tcase_add_test(c, test_nv_list);
+	tcase_add_test(c, test_nv_list_add_ref);
 
 	suite_add_tcase(s, c);
 